@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include "buffer-pool.h"
+
+/* A pool of at most @max buffers of @size bytes, allocated on
+ * demand. When it is exhausted, the waiters are called in order as
+ * buffers come back. */
+
+typedef struct _BufferPoolWaiter
+{
+  BufferPoolFunc func;
+  gpointer       user_data;
+} BufferPoolWaiter;
+
+struct _BufferPool
+{
+  gsize   size;
+  guint   max;
+  guint   allocated;
+  GQueue  free;
+  GQueue  waiters;
+};
+
+BufferPool* buffer_pool_new (gsize size, guint max)
+{
+  BufferPool *pool = g_new0 (BufferPool, 1);
+
+  pool->size = size;
+  pool->max = max;
+  g_queue_init (&pool->free);
+  g_queue_init (&pool->waiters);
+
+  return pool;
+}
+
+/* buffers still in use are not freed, and waiters are dropped */
+void buffer_pool_free (BufferPool *pool)
+{
+  if (!pool)
+    return;
+
+  g_queue_clear_full (&pool->free, g_free);
+  g_queue_clear_full (&pool->waiters, g_free);
+  g_free (pool);
+}
+
+gsize buffer_pool_get_size (BufferPool *pool)
+{
+  return pool->size;
+}
+
+/* returns NULL when the pool is exhausted */
+guint8* buffer_pool_get (BufferPool *pool)
+{
+  if (!g_queue_is_empty (&pool->free))
+    return g_queue_pop_head (&pool->free);
+
+  if (pool->allocated == pool->max)
+    return NULL;
+
+  pool->allocated++;
+  return g_malloc (pool->size);
+}
+
+void buffer_pool_put (BufferPool *pool, guint8 *buf)
+{
+  BufferPoolWaiter *w;
+
+  g_queue_push_head (&pool->free, buf);
+
+  /* a waiter may not want the buffer anymore */
+  while (!g_queue_is_empty (&pool->free) &&
+         (w = g_queue_pop_head (&pool->waiters)))
+    {
+      w->func (w->user_data);
+      g_free (w);
+    }
+}
+
+/* @func is called once, when a buffer is available again */
+void buffer_pool_wait (BufferPool *pool, BufferPoolFunc func, gpointer user_data)
+{
+  BufferPoolWaiter *w = g_new (BufferPoolWaiter, 1);
+
+  w->func = func;
+  w->user_data = user_data;
+  g_queue_push_tail (&pool->waiters, w);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BUFFER_POOL_H
+#define __BUFFER_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _BufferPool BufferPool;
+
+typedef void (*BufferPoolFunc) (gpointer user_data);
+
+BufferPool* buffer_pool_new (gsize size, guint max);
+void buffer_pool_free (BufferPool *pool);
+
+gsize buffer_pool_get_size (BufferPool *pool);
+guint8* buffer_pool_get (BufferPool *pool);
+void buffer_pool_put (BufferPool *pool, guint8 *buf);
+void buffer_pool_wait (BufferPool *pool, BufferPoolFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif
@@ -17,12 +17,15 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <locale.h>
 #include <glib/gi18n.h>
 #include <glib.h>
 #include <glib/gprintf.h>
 #ifdef G_OS_UNIX
 #include <glib-unix.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #endif
 
 #ifdef WITH_AVAHI
@@ -30,6 +33,7 @@
 #endif
 
 #include "libphodav/phodav.h"
+#include "htdigest.h"
 
 static PhodavServer *dav;
 static gint verbose;
@@ -37,6 +41,11 @@ static gint readonly;
 static gint port = 8080;
 static gint local = 0;
 static gint public = 0;
+static gint threads = 1;
+static gint metrics = 0;
+static gint search_index = 0;
+static gint infinity_limit = 0;
+static gint durability = PHODAV_PUT_DURABILITY_ATOMIC;
 
 #ifdef WITH_AVAHI
 static gint nomdns = 0;
@@ -77,33 +86,371 @@ get_realm (void)
 
 gchar *htdigest = NULL;
 
+/* username -> digest, swapped as a whole on reload, and looked up
+ * from the threads of all the servers */
+static GHashTable *htdigest_users;
+G_LOCK_DEFINE_STATIC (htdigest_users);
+static const gchar *htdigest_realm;
+
+static gboolean
+htdigest_load (GError **error)
+{
+  GHashTable *users, *old;
+  gchar *contents;
+
+  if (!g_file_get_contents (htdigest, &contents, NULL, error))
+    return FALSE;
+
+  users = htdigest_parse (contents, htdigest_realm);
+  g_free (contents);
+
+  G_LOCK (htdigest_users);
+  old = htdigest_users;
+  htdigest_users = users;
+  G_UNLOCK (htdigest_users);
+
+  g_clear_pointer (&old, g_hash_table_unref);
+  return TRUE;
+}
+
+/* the previous users are kept if the file can't be read */
+static void
+htdigest_reload (void)
+{
+  GError *error = NULL;
+
+  if (!htdigest_load (&error))
+    {
+      g_warning ("Failed to reload htdigest: %s", error->message);
+      g_clear_error (&error);
+      return;
+    }
+
+  g_message ("htdigest reloaded");
+}
+
+static void
+htdigest_changed (GFileMonitor *monitor, GFile *file, GFile *other,
+                  GFileMonitorEvent event, gpointer user_data)
+{
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event == G_FILE_MONITOR_EVENT_CREATED)
+    htdigest_reload ();
+}
+
+#ifdef G_OS_UNIX
 static gboolean
+sighup_reload (gpointer user_data)
+{
+  htdigest_reload ();
+
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+/* the stored digest, that libsoup checks the response against */
+static gchar *
 digest_auth_callback (SoupAuthDomain *auth_domain, SoupServerMessage *msg,
                       const char *username, gpointer data)
 {
-  gchar *digest = NULL;
-  gchar *line = NULL;
-  gchar *eol = NULL;
+  gchar *digest;
+
+  G_LOCK (htdigest_users);
+  digest = g_strdup (g_hash_table_lookup (htdigest_users, username));
+  G_UNLOCK (htdigest_users);
+
+  return digest;
+}
+
+#define METRICS_PATH "/.well-known/phodav-metrics"
+
+/* with @labels of the form "a=\"x\"," */
+static void
+append_histogram (GString *out, const gchar *name, const gchar *labels,
+                  GVariant *histogram, gdouble scale)
+{
+  GVariant *buckets;
+  const guint64 *b;
+  guint64 count, sum, total = 0;
+  gsize i, n;
 
-  for (line = htdigest; line && *line; line = eol ? eol + 1 : NULL)
+  g_variant_get (histogram, "(tt@at)", &count, &sum, &buckets);
+  b = g_variant_get_fixed_array (buckets, &n, sizeof (guint64));
+
+  /* bucket i holds the values below 2^i, the last one those above
+   * all, only counted in +Inf */
+  for (i = 0; i + 1 < n; i++)
     {
-      gchar **strv = g_strsplit (line, ":", -1);
-      eol = strchr (line, '\n');
-      if (eol)
-        *eol = '\0';
+      total += b[i];
+      g_string_append_printf (out, "%s_bucket{%sle=\"%g\"} %" G_GUINT64_FORMAT "\n",
+                              name, labels, (gdouble) (G_GUINT64_CONSTANT (1) << i) * scale,
+                              total);
+    }
+  g_string_append_printf (out, "%s_bucket{%sle=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+                          name, labels, count);
+  g_string_append_printf (out, "%s_sum{%s} %g\n", name, labels, sum * scale);
+  g_string_append_printf (out, "%s_count{%s} %" G_GUINT64_FORMAT "\n", name, labels, count);
+
+  g_variant_unref (buckets);
+}
+
+/* the Prometheus text format */
+static gchar *
+metrics_to_text (GVariant *metrics)
+{
+  GString *out = g_string_new (NULL);
+  GVariant *methods, *enumerations, *m, *v;
+  GVariantIter iter, siter;
+  const gchar *method;
+  guint64 hits = 0, misses = 0, in, sent, count;
+  guint32 locks = 0, status;
+  gchar *labels;
+
+  methods = g_variant_lookup_value (metrics, "methods", G_VARIANT_TYPE ("a{sa{sv}}"));
+  enumerations = g_variant_lookup_value (metrics, "enumerations", NULL);
+  g_variant_lookup (metrics, "locks", "u", &locks);
+  g_variant_lookup (metrics, "info-cache-hits", "t", &hits);
+  g_variant_lookup (metrics, "info-cache-misses", "t", &misses);
+
+  g_string_append (out, "# TYPE phodav_responses_total counter\n");
+  g_variant_iter_init (&iter, methods);
+  while (g_variant_iter_next (&iter, "{&s@a{sv}}", &method, &m))
+    {
+      v = g_variant_lookup_value (m, "statuses", G_VARIANT_TYPE ("a{ut}"));
+      g_variant_iter_init (&siter, v);
+      while (g_variant_iter_next (&siter, "{ut}", &status, &count))
+        g_string_append_printf (out, "phodav_responses_total{method=\"%s\",code=\"%u\"} %"
+                                G_GUINT64_FORMAT "\n", method, status, count);
+      g_variant_unref (v);
+      g_variant_unref (m);
+    }
+
+  g_string_append (out, "# TYPE phodav_request_bytes_total counter\n");
+  g_string_append (out, "# TYPE phodav_response_bytes_total counter\n");
+  g_variant_iter_init (&iter, methods);
+  while (g_variant_iter_next (&iter, "{&s@a{sv}}", &method, &m))
+    {
+      in = sent = 0;
+      g_variant_lookup (m, "bytes-in", "t", &in);
+      g_variant_lookup (m, "bytes-out", "t", &sent);
+      g_string_append_printf (out, "phodav_request_bytes_total{method=\"%s\"} %"
+                              G_GUINT64_FORMAT "\n", method, in);
+      g_string_append_printf (out, "phodav_response_bytes_total{method=\"%s\"} %"
+                              G_GUINT64_FORMAT "\n", method, sent);
+      g_variant_unref (m);
+    }
+
+  g_string_append (out, "# TYPE phodav_request_duration_seconds histogram\n");
+  g_variant_iter_init (&iter, methods);
+  while (g_variant_iter_next (&iter, "{&s@a{sv}}", &method, &m))
+    {
+      v = g_variant_lookup_value (m, "latency", NULL);
+      labels = g_strdup_printf ("method=\"%s\",", method);
+      append_histogram (out, "phodav_request_duration_seconds", labels, v, 1e-6);
+      g_free (labels);
+      g_variant_unref (v);
+      g_variant_unref (m);
+    }
+
+  g_string_append (out, "# TYPE phodav_enumeration_entries histogram\n");
+  append_histogram (out, "phodav_enumeration_entries", "", enumerations, 1);
+
+  g_string_append_printf (out, "# TYPE phodav_locks gauge\n"
+                          "phodav_locks %u\n", locks);
+  g_string_append_printf (out, "# TYPE phodav_info_cache_hits_total counter\n"
+                          "phodav_info_cache_hits_total %" G_GUINT64_FORMAT "\n", hits);
+  g_string_append_printf (out, "# TYPE phodav_info_cache_misses_total counter\n"
+                          "phodav_info_cache_misses_total %" G_GUINT64_FORMAT "\n", misses);
 
-      if (!(strv[0] && strv[1] && strv[2])) {
-        g_warn_if_reached ();
-      } else if (g_strcmp0 (strv[0], username) == 0)
-        digest = g_strdup (strv[2]);
+  g_variant_unref (methods);
+  g_variant_unref (enumerations);
 
-      g_strfreev (strv);
+  return g_string_free (out, FALSE);
+}
+
+static void
+metrics_callback (SoupServer *server, SoupServerMessage *msg,
+                  const char *path, GHashTable *query,
+                  gpointer user_data)
+{
+  PhodavServer *dav = user_data;
+  GVariant *variant;
+  gchar *text;
 
-      if (digest)
-        break;
+  if (soup_server_message_get_method (msg) != SOUP_METHOD_GET)
+    {
+      soup_server_message_set_status (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+      return;
     }
 
-  return !!digest;
+  variant = phodav_server_get_metrics (dav);
+  text = metrics_to_text (variant);
+  g_variant_unref (variant);
+
+  soup_server_message_set_response (msg, "text/plain; version=0.0.4",
+                                    SOUP_MEMORY_TAKE, text, strlen (text));
+  soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+}
+
+static PhodavServer *
+server_new (const gchar *path, const gchar *realm,
+            const gchar *store, PhodavServer *peer)
+{
+  PhodavServer *server;
+
+  server = g_object_new (PHODAV_TYPE_SERVER,
+                         "root", path,
+                         "peer", peer,
+                         "read-only", readonly,
+                         "put-durability", durability,
+                         "search-index", search_index,
+                         "depth-infinity-limit", infinity_limit,
+                         NULL);
+
+  /* the peer already has it */
+  if (store && !peer)
+    {
+      GFile *file = g_file_new_for_commandline_arg (store);
+
+      g_object_set (server, "store-file", file, NULL);
+      g_object_unref (file);
+    }
+
+  if (htdigest)
+    {
+      SoupAuthDomain *auth;
+
+      auth = soup_auth_domain_digest_new ("realm", realm, NULL);
+      soup_auth_domain_add_path (auth, "/");
+      soup_auth_domain_digest_set_auth_callback (auth, digest_auth_callback, NULL, NULL);
+
+      soup_server_add_auth_domain (phodav_server_get_soup_server (server), auth);
+      g_object_unref (auth);
+    }
+
+  /* takes precedence over the "/" handler of the server */
+  if (metrics)
+    soup_server_add_handler (phodav_server_get_soup_server (server), METRICS_PATH,
+                             metrics_callback, server, NULL);
+
+  return server;
+}
+
+#ifdef SO_REUSEPORT
+static gboolean
+listen_reuseport_address (SoupServer *server, GSocketFamily family,
+                          gboolean any, GError **error)
+{
+  GInetAddress *iaddr = NULL;
+  GSocketAddress *saddr = NULL;
+  GSocket *socket;
+  gboolean success = FALSE;
+
+  socket = g_socket_new (family, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
+  if (!socket)
+    return FALSE;
+
+  if (!g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, TRUE, error))
+    goto end;
+  if (family == G_SOCKET_FAMILY_IPV6 &&
+      !g_socket_set_option (socket, IPPROTO_IPV6, IPV6_V6ONLY, TRUE, error))
+    goto end;
+
+  iaddr = any ? g_inet_address_new_any (family) : g_inet_address_new_loopback (family);
+  saddr = g_inet_socket_address_new (iaddr, port);
+  if (!g_socket_bind (socket, saddr, TRUE, error) ||
+      !g_socket_listen (socket, error))
+    goto end;
+
+  success = soup_server_listen_socket (server, socket, 0, error);
+
+end:
+  g_clear_object (&saddr);
+  g_clear_object (&iaddr);
+  g_object_unref (socket);
+  return success;
+}
+#endif
+
+/* with several threads, every server listens on the same port, and
+ * the kernel spreads the connections between them */
+static gboolean
+server_listen (PhodavServer *dav, GError **error)
+{
+  SoupServer *server = phodav_server_get_soup_server (dav);
+
+  if (threads == 1)
+    {
+      if (local)
+        return soup_server_listen_local (server, port, 0, error);
+      else
+        return soup_server_listen_all (server, port, 0, error);
+    }
+
+#ifdef SO_REUSEPORT
+  {
+    GError *err4 = NULL, *err6 = NULL;
+    gboolean ok4, ok6;
+
+    /* like soup_server_listen_all(), one of the families is enough */
+    ok4 = listen_reuseport_address (server, G_SOCKET_FAMILY_IPV4, public, &err4);
+    ok6 = listen_reuseport_address (server, G_SOCKET_FAMILY_IPV6, public, &err6);
+    if (!ok4 && !ok6)
+      {
+        g_propagate_error (error, err4);
+        g_clear_error (&err6);
+        return FALSE;
+      }
+
+    g_clear_error (&err4);
+    g_clear_error (&err6);
+    return TRUE;
+  }
+#else
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       _ ("Listening from several threads is not supported on this platform"));
+  return FALSE;
+#endif
+}
+
+typedef struct _Shard
+{
+  GThread      *thread;
+  GMainContext *context;
+  GMainLoop    *loop;
+  PhodavServer *peer;
+  const gchar  *path;
+  const gchar  *realm;
+} Shard;
+
+static gpointer
+shard_run (gpointer data)
+{
+  Shard *shard = data;
+  GError *error = NULL;
+  PhodavServer *dav;
+
+  g_main_context_push_thread_default (shard->context);
+
+  dav = server_new (shard->path, shard->realm, NULL, shard->peer);
+  if (!server_listen (dav, &error))
+    my_error (_ ("Listen failed: %s\n"), error->message);
+
+  g_main_loop_run (shard->loop);
+
+  g_object_unref (dav);
+  g_main_context_pop_thread_default (shard->context);
+
+  return NULL;
+}
+
+static gboolean
+shard_quit (gpointer data)
+{
+  Shard *shard = data;
+
+  g_main_loop_quit (shard->loop);
+  return G_SOURCE_REMOVE;
 }
 
 int
@@ -113,7 +460,12 @@ main (int argc, char *argv[])
   GOptionContext *context;
   const gchar *path = NULL;
   const gchar *realm = NULL;
+  const gchar *store = NULL;
+  const gchar *put = NULL;
   GMainLoop *mainloop = NULL;
+  GFileMonitor *monitor = NULL;
+  Shard *shards;
+  gint i;
 
   int version = 0;
   GOptionEntry entries[] = {
@@ -122,10 +474,16 @@ main (int argc, char *argv[])
     { "port", 'p', 0, G_OPTION_ARG_INT, &port, N_ ("Port to listen to"), NULL },
     { "local", 0, 0, G_OPTION_ARG_NONE, &local, N_ ("Listen on loopback only"), NULL },
     { "public", 0, 0, G_OPTION_ARG_NONE, &public, N_ ("Listen on all interfaces"), NULL },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &threads, N_ ("Number of threads serving requests"), NULL },
     { "path", 'P', 0, G_OPTION_ARG_FILENAME, &path, N_ ("Path to export"), NULL },
     { "htdigest", 'd', 0, G_OPTION_ARG_FILENAME, &htdigest, N_ ("Path to htdigest file"), NULL },
     { "realm", 0, 0, G_OPTION_ARG_STRING, &realm, N_ ("DIGEST realm"), NULL },
     { "readonly", 'r', 0, G_OPTION_ARG_NONE, &readonly, N_ ("Read-only access"), NULL },
+    { "store", 0, 0, G_OPTION_ARG_FILENAME, &store, N_ ("File to keep properties and locks in"), NULL },
+    { "durability", 0, 0, G_OPTION_ARG_STRING, &put, N_ ("How PUT commits files: direct, atomic or sync"), NULL },
+    { "metrics", 0, 0, G_OPTION_ARG_NONE, &metrics, N_ ("Serve metrics at " METRICS_PATH), NULL },
+    { "search-index", 0, 0, G_OPTION_ARG_NONE, &search_index, N_ ("Index the files for SEARCH"), NULL },
+    { "depth-infinity-limit", 0, 0, G_OPTION_ARG_INT, &infinity_limit, N_ ("Number of members listed by a Depth: infinity PROPFIND"), NULL },
 #ifdef WITH_AVAHI
     { "no-mdns", 0, 0, G_OPTION_ARG_NONE, &nomdns, N_ ("Skip mDNS service announcement"), NULL },
 #endif
@@ -171,32 +529,59 @@ main (int argc, char *argv[])
   if (!realm)
       realm = get_realm ();
 
+  if (threads < 1)
+    my_error (_ ("--threads must be at least 1\n"));
+
+  if (infinity_limit < 0)
+    my_error (_ ("--depth-infinity-limit must not be negative\n"));
+
+  if (put)
+    {
+      GEnumClass *klass = g_type_class_ref (PHODAV_TYPE_PUT_DURABILITY);
+      GEnumValue *value = g_enum_get_value_by_nick (klass, put);
+
+      if (!value)
+        my_error (_ ("Unknown --durability: %s\n"), put);
+      durability = value->value;
+      g_type_class_unref (klass);
+    }
+
+  htdigest_realm = realm;
+  if (htdigest && !htdigest_load (&error))
+    my_error (_ ("Failed to open htdigest: %s\n"), error->message);
+
   mainloop = g_main_loop_new (NULL, FALSE);
 
 #ifdef G_OS_UNIX
   g_unix_signal_add (SIGINT, sighup_received, mainloop);
+  if (htdigest)
+    g_unix_signal_add (SIGHUP, sighup_reload, NULL);
 #endif
 
-  dav = phodav_server_new (path);
-  g_object_set (dav, "read-only", readonly, NULL);
-
   if (htdigest)
     {
-      SoupAuthDomain *auth;
-      SoupServer *server;
+      GFile *file = g_file_new_for_commandline_arg (htdigest);
 
-      if (!g_file_get_contents (htdigest, &htdigest, NULL, &error))
-        my_error (_ ("Failed to open htdigest: %s\n"), error->message);
-
-      auth = soup_auth_domain_digest_new ("realm", realm, NULL);
-      soup_auth_domain_add_path (auth, "/");
-      soup_auth_domain_set_generic_auth_callback (auth, digest_auth_callback, NULL, NULL);
+      monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+      if (monitor)
+        g_signal_connect (monitor, "changed", G_CALLBACK (htdigest_changed), NULL);
+      g_object_unref (file);
+    }
 
-      server = phodav_server_get_soup_server (dav);
-      soup_server_add_auth_domain (server, auth);
-      g_object_unref (auth);
-  }
+  dav = server_new (path, realm, store, NULL);
 
+  shards = g_new0 (Shard, threads - 1);
+  for (i = 0; i < threads - 1; i++)
+    {
+      Shard *shard = &shards[i];
+
+      shard->context = g_main_context_new ();
+      shard->loop = g_main_loop_new (shard->context, FALSE);
+      shard->peer = dav;
+      shard->path = path;
+      shard->realm = realm;
+      shard->thread = g_thread_new ("chezdav", shard_run, shard);
+    }
 
 #ifdef WITH_AVAHI
   gchar *name = get_realm ();
@@ -204,28 +589,36 @@ main (int argc, char *argv[])
     my_error (_ ("mDNS failed: %s\n"), error->message);
 #endif
 
-  SoupServer *server = phodav_server_get_soup_server (dav);
-
-  int res;
-  if (local)
-    res = soup_server_listen_local (server, port, 0, &error);
-  else if (public)
-    res = soup_server_listen_all (server, port, 0, &error);
-  else
-    my_error (_ ("Internal error, should not happen\n"));
-
-  if (!res) {
+  if (!server_listen (dav, &error))
     my_error (_ ("Listen failed: %s\n"), error->message);
-  }
 
   g_main_loop_run (mainloop);
 
+  /* queued, in case a shard isn't running its loop yet */
+  for (i = 0; i < threads - 1; i++)
+    {
+      GSource *source = g_idle_source_new ();
+
+      g_source_set_callback (source, shard_quit, &shards[i], NULL);
+      g_source_attach (source, shards[i].context);
+      g_source_unref (source);
+    }
+  for (i = 0; i < threads - 1; i++)
+    {
+      g_thread_join (shards[i].thread);
+      g_main_loop_unref (shards[i].loop);
+      g_main_context_unref (shards[i].context);
+    }
+  g_free (shards);
+
   g_main_loop_unref (mainloop);
 #ifdef WITH_AVAHI
   avahi_client_stop ();
   g_free (name);
 #endif
   g_object_unref (dav);
+  g_clear_object (&monitor);
+  g_clear_pointer (&htdigest_users, g_hash_table_unref);
 
   g_message ("Bye");
 
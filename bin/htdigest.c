@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include "htdigest.h"
+
+/* The lines of an htdigest file are user:realm:digest, where the
+ * digest is the MD5 of user:realm:password. Returns a table of
+ * username -> digest for @realm, the first line of a user winning. */
+GHashTable *
+htdigest_parse (const gchar *contents, const gchar *realm)
+{
+  GHashTable *users = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  gchar **lines = g_strsplit (contents, "\n", -1);
+  gchar **line;
+
+  for (line = lines; *line; line++)
+    {
+      gchar **strv;
+
+      g_strchomp (*line);
+      if (!**line)
+        continue;
+
+      strv = g_strsplit (*line, ":", 3);
+      if (!(strv[0] && strv[1] && strv[2]))
+        g_warning ("invalid htdigest line: %s", *line);
+      else if (!g_strcmp0 (strv[1], realm) && !g_hash_table_contains (users, strv[0]))
+        g_hash_table_insert (users, g_strdup (strv[0]), g_strdup (strv[2]));
+      g_strfreev (strv);
+    }
+
+  g_strfreev (lines);
+  return users;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "mux-header.h"
+
+/* writes the header of a frame of @version, returns its size */
+gsize mux_header_write (guint8 *header, guint version, gint64 id,
+                        MuxFrameType type, guint32 size)
+{
+  if (version == 1)
+    {
+      guint16 size16 = size;
+
+      g_warn_if_fail (type == MUX_FRAME_DATA || type == MUX_FRAME_CLOSE);
+      memcpy (header, &id, sizeof (gint64));
+      memcpy (header + sizeof (gint64), &size16, sizeof (guint16));
+      return MUX_V1_HEADER_SIZE;
+    }
+  else
+    {
+      MuxHeader h = {
+        .client = GINT64_TO_LE (id),
+        .size = GUINT32_TO_LE (size),
+        .type = type,
+      };
+
+      memcpy (header, &h, sizeof (h));
+      return MUX_V2_HEADER_SIZE;
+    }
+}
+
+/* reads a version 2 header, the type is not checked */
+void mux_header_read (const guint8 *header, gint64 *id, guint8 *type, guint32 *size)
+{
+  MuxHeader h;
+
+  memcpy (&h, header, sizeof (h));
+  *id = GINT64_FROM_LE (h.client);
+  *size = GUINT32_FROM_LE (h.size);
+  *type = h.type;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MUX_HEADER_H
+#define __MUX_HEADER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum _MuxFrameType
+{
+  MUX_FRAME_DATA,
+  MUX_FRAME_OPEN,
+  MUX_FRAME_CLOSE,
+  MUX_FRAME_CREDIT,
+} MuxFrameType;
+
+typedef struct _MuxHeader
+{
+  gint64  client;
+  guint32 size;
+  guint8  type;
+  guint8  reserved[3];
+} MuxHeader;
+
+G_STATIC_ASSERT (sizeof (MuxHeader) == 16);
+
+#define MUX_V1_HEADER_SIZE (sizeof (gint64) + sizeof (guint16))
+#define MUX_V2_HEADER_SIZE (sizeof (MuxHeader))
+
+gsize mux_header_write (guint8 *header, guint version, gint64 id,
+                        MuxFrameType type, guint32 size);
+void mux_header_read (const guint8 *header, gint64 *id, guint8 *type, guint32 *size);
+
+G_END_DECLS
+
+#endif
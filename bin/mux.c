@@ -0,0 +1,693 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "buffer-pool.h"
+#include "mux.h"
+#include "mux-header.h"
+#include "output-queue.h"
+
+static guint mux_version = 1;
+
+/* The data read from the clients is held in buffers of a bounded
+ * pool, only while a frame is in flight. Frames from the mux are read
+ * ahead and queued to their client, in buffers of a share of
+ * DEMUX_POOL_SIZE, kept apart so that the clients reading and the mux
+ * reader can't starve each other.
+ *
+ * A client may hold DEMUX_CLIENT_MAX frames, and the mux reader waits
+ * when the next frame is for a client already at its limit, or when
+ * the share is exhausted. In version 1, that is the only flow control.
+ * In version 2, the host doesn't send a client more than its window,
+ * which DEMUX_CLIENT_MAX full frames fill, so the reader only waits
+ * for a host sending small frames to a slow client. A frame past the
+ * window closes its client. */
+#define MUX_POOL_SIZE 32
+#define DEMUX_POOL_SIZE 16
+
+static BufferPool *buffer_pool;
+static BufferPool *demux_pool;
+
+typedef struct _Client Client;
+
+typedef struct _DemuxData
+{
+  gint64  client;
+  guint16 size16;
+  guint8  header[MUX_V2_HEADER_SIZE];
+  guint32 size;
+  guint8  type;
+  guint8 *buf;
+  guint   version;
+  Client *target;
+} DemuxData;
+
+static DemuxData *demux_blocked;
+
+struct _Client
+{
+  guint              ref_count;
+  gint64             id;
+  guint8             header[MUX_V2_HEADER_SIZE];
+  guint8            *buf;
+  gsize              size;
+  guint32            credit;
+  gboolean           busy;
+  gboolean           closed;
+  gboolean           removed;
+  GSource           *source;
+  GSocketConnection *client_connection;
+  OutputQueue       *queue;
+  guint              pending;
+  guint32            queued;
+};
+
+static GCancellable *cancel;
+static MuxQuitFunc quit;
+static GInputStream *mux_istream;
+static OutputQueue *mux_queue;
+static GHashTable *clients;
+
+static void start_mux_read (GInputStream *istream);
+
+static void
+mux_control_pushed_cb (OutputQueue *q, gpointer user_data, GError *error)
+{
+  g_free (user_data);
+}
+
+static void
+mux_push_control (gint64 id, MuxFrameType type,
+                  gconstpointer payload, guint32 size)
+{
+  guint8 *frame = g_malloc (MUX_V2_HEADER_SIZE + size);
+  gsize len = mux_header_write (frame, mux_version, id, type, size);
+
+  if (size)
+    memcpy (frame + len, payload, size);
+  output_queue_push (mux_queue, frame, len + size, mux_control_pushed_cb, frame);
+}
+
+static Client *
+add_client (GSocketConnection *client_connection)
+{
+  Client *client;
+  client = g_new0 (Client, 1);
+  client->ref_count = 1;
+  client->client_connection = g_object_ref (client_connection);
+  client->queue = output_queue_new (
+    g_io_stream_get_output_stream (G_IO_STREAM (client_connection)), cancel);
+  client->credit = MUX_V2_WINDOW;
+  // TODO: check if usage of this idiom is portable, or if we need to check collisions
+  client->id = GPOINTER_TO_INT (client_connection);
+  g_hash_table_insert (clients, &client->id, client);
+  g_warn_if_fail (g_hash_table_lookup (clients, &client->id));
+
+  if (mux_version == 2)
+    mux_push_control (client->id, MUX_FRAME_OPEN, NULL, 0);
+
+  return client;
+}
+
+static Client *
+client_ref (Client *c)
+{
+  c->ref_count++;
+  return c;
+}
+
+static void
+client_unref (gpointer user_data)
+{
+  Client *c = user_data;
+  if (--c->ref_count > 0)
+    return;
+
+  g_debug ("Free client %" G_GINT64_FORMAT, c->id);
+
+  g_object_unref (c->queue);
+  g_io_stream_close (G_IO_STREAM (c->client_connection), NULL, NULL);
+  g_object_unref (c->client_connection);
+  g_free (c);
+}
+
+static void
+remove_client (Client *client)
+{
+  g_debug ("remove client %" G_GINT64_FORMAT, client->id);
+
+  if (client->removed)
+    return;
+
+  client->removed = TRUE;
+  if (client->source)
+    {
+      g_source_destroy (client->source);
+      g_clear_pointer (&client->source, g_source_unref);
+    }
+
+  if (mux_version == 2 && !client->closed)
+    {
+      client->closed = TRUE;
+      mux_push_control (client->id, MUX_FRAME_CLOSE, NULL, 0);
+    }
+
+  g_hash_table_remove (clients, &client->id);
+}
+
+static void
+mux_switch_version (void)
+{
+  GHashTableIter iter;
+  Client *c;
+
+  g_debug ("switching the mux to version 2");
+
+  /* sent back as the last version 1 frame */
+  mux_push_control (MUX_CONTROL_ID, MUX_FRAME_DATA,
+                    MUX_V2_HELLO, strlen (MUX_V2_HELLO));
+  mux_version = 2;
+
+  g_hash_table_iter_init (&iter, clients);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &c))
+    c->credit = MUX_V2_WINDOW;
+}
+
+static void
+demux_free (DemuxData *d)
+{
+  if (d->buf)
+    buffer_pool_put (demux_pool, d->buf);
+  g_free (d);
+}
+
+static void client_start_read (Client *client);
+static void demux_dispatch (DemuxData *d);
+
+static void
+mux_pushed_client_cb (OutputQueue *q, gpointer user_data, GError *error)
+{
+  DemuxData *d = user_data;
+  Client *client = g_steal_pointer (&d->target);
+
+  if (error)
+    {
+      g_warning ("error pushing to client %" G_GINT64_FORMAT ": %s",
+        client->id, error->message);
+      remove_client (client);
+    }
+  else if (d->version == 2 && !client->removed)
+    {
+      guint32 credit = GUINT32_TO_LE (d->size);
+
+      mux_push_control (client->id, MUX_FRAME_CREDIT, &credit, sizeof (credit));
+    }
+
+  /* frames read before the switch to version 2 count as version 1 */
+  client->pending--;
+  if (d->version == 2)
+    client->queued -= d->size;
+  demux_free (d);
+
+  if (demux_blocked && demux_blocked->client == client->id)
+    demux_dispatch (g_steal_pointer (&demux_blocked));
+
+  client_unref (client);
+}
+
+static void
+demux_dispatch (DemuxData *d)
+{
+  Client *c = g_hash_table_lookup (clients, &d->client);
+  g_debug ("looked up client %" G_GINT64_FORMAT ": %p", d->client, c);
+
+  if (!c)
+    {
+      demux_free (d);
+      start_mux_read (mux_istream);
+      return;
+    }
+
+  if (d->version == 2 && d->size > MUX_V2_WINDOW - c->queued)
+    {
+      g_warning ("client %" G_GINT64_FORMAT " got more than its window",
+                 d->client);
+      demux_free (d);
+      remove_client (c);
+      start_mux_read (mux_istream);
+      return;
+    }
+
+  if (c->pending == DEMUX_CLIENT_MAX)
+    {
+      g_debug ("client %" G_GINT64_FORMAT " is behind, waiting", d->client);
+      demux_blocked = d;
+      return;
+    }
+
+  c->pending++;
+  if (d->version == 2)
+    c->queued += d->size;
+
+  d->target = client_ref (c);
+  output_queue_push (c->queue, d->buf, d->size,
+                     mux_pushed_client_cb, d);
+
+  start_mux_read (mux_istream);
+}
+
+/* handles a complete frame from the mux */
+static void
+demux_frame (DemuxData *d)
+{
+  Client *c;
+  guint32 credit;
+
+  if (mux_version == 1)
+    {
+      if (d->client != MUX_CONTROL_ID)
+        {
+          demux_dispatch (d);
+          return;
+        }
+
+      if (d->size == strlen (MUX_V2_HELLO) &&
+          !memcmp (d->buf, MUX_V2_HELLO, d->size))
+        mux_switch_version ();
+      goto end;
+    }
+
+  switch (d->type)
+    {
+    case MUX_FRAME_DATA:
+      demux_dispatch (d);
+      return;
+    case MUX_FRAME_CLOSE:
+      c = g_hash_table_lookup (clients, &d->client);
+      if (c)
+        {
+          c->closed = TRUE;
+          remove_client (c);
+        }
+      break;
+    case MUX_FRAME_CREDIT:
+      c = g_hash_table_lookup (clients, &d->client);
+      if (!c || d->size != sizeof (credit))
+        break;
+
+      memcpy (&credit, d->buf, sizeof (credit));
+      c->credit += GUINT32_FROM_LE (credit);
+      if (!c->busy)
+        client_start_read (c);
+      break;
+    default:
+      g_debug ("ignoring frame type %u for client %" G_GINT64_FORMAT,
+               d->type, d->client);
+      break;
+    }
+
+end:
+  demux_free (d);
+  start_mux_read (mux_istream);
+}
+
+static void
+mux_data_read_cb (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  DemuxData *d = user_data;
+  GError *error = NULL;
+  gsize size;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
+  g_debug ("read %" G_GSIZE_FORMAT " bytes from mux", size);
+  if (error)
+    {
+      g_warning ("%s: error: %s", __FUNCTION__, error->message);
+      g_clear_error (&error);
+    }
+  if (size != d->size)
+    {
+      demux_free (d);
+      quit (-1);
+      return;
+    }
+
+  demux_frame (d);
+}
+
+static void demux_read_data (DemuxData *d);
+
+static void
+demux_pool_cb (gpointer user_data)
+{
+  demux_read_data (user_data);
+}
+
+static void
+demux_read_data (DemuxData *d)
+{
+  if (d->size == 0)
+    {
+      demux_frame (d);
+      return;
+    }
+
+  d->buf = buffer_pool_get (demux_pool);
+  if (!d->buf)
+    {
+      g_debug ("mux buffers exhausted, waiting");
+      buffer_pool_wait (demux_pool, demux_pool_cb, d);
+      return;
+    }
+
+  g_input_stream_read_all_async (mux_istream,
+                                 d->buf, d->size, G_PRIORITY_DEFAULT,
+                                 cancel, mux_data_read_cb, d);
+}
+
+static void
+mux_header_read_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  DemuxData *d = user_data;
+  GError *error = NULL;
+  gsize size;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
+  if (error || size != sizeof (d->header))
+    goto end;
+
+  mux_header_read (d->header, &d->client, &d->type, &d->size);
+  if (d->size > MUX_BUFFER_SIZE)
+    {
+      g_warning ("%s: frame of %u bytes is too large", __FUNCTION__, d->size);
+      goto end;
+    }
+
+  demux_read_data (d);
+  return;
+
+end:
+  if (error)
+    {
+      g_warning ("%s: error: %s", __FUNCTION__, error->message);
+      g_clear_error (&error);
+    }
+
+  demux_free (d);
+  quit (-4);
+}
+
+static void
+mux_size_read_cb (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  DemuxData *d = user_data;
+  GError *error = NULL;
+  gsize size;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
+  if (error || size != sizeof (guint16))
+    goto end;
+
+  d->size = d->size16;
+  d->type = MUX_FRAME_DATA;
+  demux_read_data (d);
+  return;
+
+end:
+  if (error)
+    {
+      g_warning ("%s: error: %s", __FUNCTION__, error->message);
+      g_clear_error (&error);
+    }
+
+  demux_free (d);
+  quit (-2);
+}
+
+static void
+mux_client_read_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  GInputStream *istream = G_INPUT_STREAM (source_object);
+  DemuxData *d = user_data;
+  GError *error = NULL;
+  gsize size;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
+  if (error || size != sizeof (gint64))
+    goto end;
+  g_input_stream_read_all_async (istream,
+                                 &d->size16, sizeof (guint16), G_PRIORITY_DEFAULT,
+                                 cancel, mux_size_read_cb, d);
+  return;
+
+end:
+  if (error)
+    {
+      g_warning ("%s: error: %s", __FUNCTION__, error->message);
+      g_clear_error (&error);
+    }
+
+  demux_free (d);
+  quit (-3);
+}
+
+static void
+start_mux_read (GInputStream *istream)
+{
+  DemuxData *d = g_new0 (DemuxData, 1);
+
+  g_debug ("start reading mux");
+  d->version = mux_version;
+  if (mux_version == 1)
+    g_input_stream_read_all_async (istream,
+                                   &d->client, sizeof (gint64), G_PRIORITY_DEFAULT,
+                                   cancel, mux_client_read_cb, d);
+  else
+    g_input_stream_read_all_async (istream,
+                                   d->header, sizeof (d->header), G_PRIORITY_DEFAULT,
+                                   cancel, mux_header_read_cb, d);
+}
+
+static void
+mux_pushed_cb (OutputQueue *q, gpointer user_data, GError *error)
+{
+  Client *client = user_data;
+
+  if (client->buf)
+    buffer_pool_put (buffer_pool, g_steal_pointer (&client->buf));
+
+  if (error)
+    {
+      g_warning ("error pushing to mux from client %" G_GINT64_FORMAT ": %s",
+        client->id, error->message);
+      remove_client (client);
+      goto end;
+    }
+
+  if (client->size == 0)
+    {
+      remove_client (client);
+      goto end;
+    }
+
+  client->busy = FALSE;
+  client_start_read (client);
+end:
+  client_unref (client);
+}
+
+/* sends what was read from the client, the end of it when size is 0 */
+static void
+client_push (Client *client, gsize size)
+{
+  gsize len;
+
+  client->size = size;
+  if (size == 0 && mux_version == 2)
+    {
+      client->closed = TRUE;
+      len = mux_header_write (client->header, mux_version, client->id,
+                              MUX_FRAME_CLOSE, 0);
+    }
+  else
+    len = mux_header_write (client->header, mux_version, client->id,
+                            MUX_FRAME_DATA, size);
+
+  if (mux_version == 2)
+    client->credit -= size;
+
+  output_queue_push (mux_queue, client->header, len, NULL, NULL);
+  output_queue_push (mux_queue, client->buf, size, mux_pushed_cb, client_ref (client));
+}
+
+static gboolean client_readable_cb (GObject *stream, gpointer user_data);
+
+static void
+client_pool_cb (gpointer user_data)
+{
+  Client *client = user_data;
+
+  if (!client->removed)
+    client_readable_cb (NULL, client);
+  client_unref (client);
+}
+
+/* called when the client has data, reads it into a buffer of the
+ * pool, so idle clients don't hold any */
+static gboolean
+client_readable_cb (GObject *stream, gpointer user_data)
+{
+  Client *client = user_data;
+  GIOStream *iostream = G_IO_STREAM (client->client_connection);
+  GInputStream *istream = g_io_stream_get_input_stream (iostream);
+  GError *error = NULL;
+  gssize size;
+  gsize max;
+
+  client->buf = buffer_pool_get (buffer_pool);
+  if (!client->buf)
+    {
+      g_debug ("buffers exhausted, client %" G_GINT64_FORMAT " waiting", client->id);
+      buffer_pool_wait (buffer_pool, client_pool_cb, client_ref (client));
+      goto remove;
+    }
+
+  max = mux_version == 1 ? G_MAXUINT16 : MIN (MUX_BUFFER_SIZE, client->credit);
+  size = g_pollable_input_stream_read_nonblocking (G_POLLABLE_INPUT_STREAM (istream),
+                                                   client->buf, max, NULL, &error);
+  g_debug ("read %" G_GSSIZE_FORMAT " bytes from client %" G_GINT64_FORMAT, size, client->id);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    {
+      g_clear_error (&error);
+      buffer_pool_put (buffer_pool, g_steal_pointer (&client->buf));
+      if (client->source)
+        return G_SOURCE_CONTINUE;
+
+      client_start_read (client);
+      return G_SOURCE_REMOVE;
+    }
+  if (error)
+    {
+      g_warning ("%s: error for client %" G_GINT64_FORMAT ": %s",
+        __FUNCTION__, client->id, error->message);
+      g_clear_error (&error);
+      buffer_pool_put (buffer_pool, g_steal_pointer (&client->buf));
+      remove_client (client);
+      return G_SOURCE_REMOVE;
+    }
+
+  client_push (client, size);
+
+remove:
+  g_clear_pointer (&client->source, g_source_unref);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+client_start_read (Client *client)
+{
+  GIOStream *iostream = G_IO_STREAM (client->client_connection);
+  GInputStream *istream = g_io_stream_get_input_stream (iostream);
+
+  if (mux_version == 2 && client->credit == 0)
+    {
+      g_debug ("client %" G_GINT64_FORMAT " is out of credit", client->id);
+      return;
+    }
+
+  g_debug ("start read client %" G_GINT64_FORMAT, client->id);
+  client->busy = TRUE;
+  client->source = g_pollable_input_stream_create_source (G_POLLABLE_INPUT_STREAM (istream),
+                                                          cancel);
+  g_source_set_callback (client->source, (GSourceFunc) client_readable_cb,
+                         client_ref (client), client_unref);
+  g_source_attach (client->source, NULL);
+}
+
+/* the buffer pools outlive the runs of the mux, for the frames still
+ * in flight when it stops */
+void
+mux_init (void)
+{
+  buffer_pool = buffer_pool_new (MUX_BUFFER_SIZE, MUX_POOL_SIZE - DEMUX_POOL_SIZE);
+  demux_pool = buffer_pool_new (MUX_BUFFER_SIZE, DEMUX_POOL_SIZE);
+}
+
+void
+mux_clear (void)
+{
+  g_clear_pointer (&buffer_pool, buffer_pool_free);
+  g_clear_pointer (&demux_pool, buffer_pool_free);
+}
+
+/* starts reading the frames of the mux from @istream, in version 1,
+ * @quit is called when it fails or ends */
+void
+mux_start (GInputStream *istream, GOutputStream *ostream, gsize write_budget,
+           GCancellable *cancellable, MuxQuitFunc quit_func)
+{
+  g_return_if_fail (!mux_istream);
+
+  cancel = g_object_ref (cancellable);
+  quit = quit_func;
+  clients = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                   NULL, client_unref);
+  mux_istream = g_object_ref (istream);
+  mux_queue = output_queue_new (ostream, cancel);
+  output_queue_set_budget (mux_queue, write_budget);
+
+  start_mux_read (mux_istream);
+}
+
+void
+mux_stop (void)
+{
+  g_cancellable_cancel (cancel);
+
+  g_clear_object (&mux_istream);
+  g_clear_object (&mux_queue);
+  g_clear_pointer (&clients, g_hash_table_unref);
+  g_clear_pointer (&demux_blocked, demux_free);
+  mux_version = 1;
+
+  g_clear_object (&cancel);
+}
+
+void
+mux_add_client (GSocketConnection *connection)
+{
+  Client *client = add_client (connection);
+
+  g_debug ("new client %" G_GINT64_FORMAT, client->id);
+  client_start_read (client);
+}
+
+guint
+mux_get_version (void)
+{
+  return mux_version;
+}
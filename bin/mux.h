@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MUX_H
+#define __MUX_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* The mux carries the data of all the clients over the port, in
+ * frames tagged with the client id.
+ *
+ * Version 1 frames are a native gint64 client id, a native guint16
+ * size and the data. A zero size frame tells that the client went
+ * away.
+ *
+ * The host may ask for version 2 by sending, as its first frame, a
+ * version 1 frame for MUX_CONTROL_ID carrying MUX_V2_HELLO. The same
+ * frame is sent back, and every frame following it, in both
+ * directions, is a version 2 frame: a MuxHeader, in little endian,
+ * followed by size bytes. Clients are announced with MUX_FRAME_OPEN
+ * and end with MUX_FRAME_CLOSE, from either side. The data sent on a
+ * channel is bounded by a window of MUX_V2_WINDOW bytes, that the
+ * receiver reopens with MUX_FRAME_CREDIT frames, carrying a guint32
+ * count of bytes, as it delivers the data. Clients that exist at the
+ * switch are considered open. A hello from a version 1 guest is
+ * simply dropped, as an unknown client. */
+#define MUX_CONTROL_ID (-1)
+#define MUX_V2_HELLO "phodav-mux-2"
+#define MUX_BUFFER_SIZE (256 * 1024)
+#define DEMUX_CLIENT_MAX 4
+#define MUX_V2_WINDOW (DEMUX_CLIENT_MAX * MUX_BUFFER_SIZE)
+
+/* called when the mux fails or ends, with a negative code */
+typedef void (*MuxQuitFunc) (gint code);
+
+void mux_init (void);
+void mux_clear (void);
+
+void mux_start (GInputStream *istream, GOutputStream *ostream, gsize write_budget,
+                GCancellable *cancel, MuxQuitFunc quit);
+void mux_stop (void);
+
+void mux_add_client (GSocketConnection *connection);
+guint mux_get_version (void);
+
+G_END_DECLS
+
+#endif
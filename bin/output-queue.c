@@ -33,6 +33,9 @@ struct _OutputQueue
   gboolean       writing;
   GQueue        *queue;
   GCancellable  *cancel;
+  gsize          budget;
+  GArray        *vectors;
+  guint          in_flight;
 };
 
 G_DEFINE_TYPE (OutputQueue, output_queue, G_TYPE_OBJECT);
@@ -42,6 +45,8 @@ static void output_queue_kick (OutputQueue *q);
 static void output_queue_init (OutputQueue *self)
 {
   self->queue = g_queue_new ();
+  self->budget = OUTPUT_QUEUE_DEFAULT_BUDGET;
+  self->vectors = g_array_new (FALSE, FALSE, sizeof (GOutputVector));
 }
 
 static void output_queue_finalize (GObject *obj)
@@ -49,6 +54,7 @@ static void output_queue_finalize (GObject *obj)
   OutputQueue *self = OUTPUT_QUEUE (obj);
 
   g_queue_free_full (self->queue, g_free);
+  g_array_unref (self->vectors);
   g_object_unref (self->output);
   g_object_unref (self->cancel);
 
@@ -69,22 +75,44 @@ OutputQueue* output_queue_new (GOutputStream *output, GCancellable *cancel)
   return self;
 }
 
+/* queued buffers are coalesced into a single vectored write of up to
+ * @budget bytes, 0 writes them one by one */
+void
+output_queue_set_budget (OutputQueue *q, gsize budget)
+{
+  g_return_if_fail (q != NULL);
+
+  q->budget = budget;
+}
+
 static void
 write_cb (GObject *source_object,
           GAsyncResult *res,
           gpointer user_data)
 {
   OutputQueue *q = user_data;
+  GQueue written = G_QUEUE_INIT;
   OutputQueueElem *e;
   GError *err = NULL;
 
-  e = g_queue_pop_head (q->queue);
-  g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object), res, NULL, &err);
+  g_output_stream_writev_all_finish (G_OUTPUT_STREAM (source_object), res, NULL, &err);
 
-  if (e->cb)
-    e->cb (q, e->user_data, err);
+  /* the callbacks may push again, so take the batch off the queue
+   * first. After an error, nothing queued will be written either */
+  while (q->in_flight > 0)
+    {
+      g_queue_push_tail (&written, g_queue_pop_head (q->queue));
+      q->in_flight--;
+    }
+
+  while ((e = g_queue_pop_head (&written)) ||
+         (err && (e = g_queue_pop_head (q->queue))))
+    {
+      if (e->cb)
+        e->cb (q, e->user_data, err);
+      g_free (e);
+    }
 
-  g_free (e);
   q->writing = FALSE;
   if (!err)
     output_queue_kick (q);
@@ -95,14 +123,29 @@ write_cb (GObject *source_object,
 static void
 output_queue_kick (OutputQueue *q)
 {
-  OutputQueueElem *e;
+  GList *l;
+  gsize total = 0;
 
   if (!q || q->writing || g_queue_is_empty (q->queue))
     return;
 
-  e = g_queue_peek_head (q->queue);
+  g_array_set_size (q->vectors, 0);
+  for (l = q->queue->head; l != NULL; l = l->next)
+    {
+      OutputQueueElem *e = l->data;
+      GOutputVector v = { e->buf, e->size };
+
+      if (q->vectors->len > 0 && total + e->size > q->budget)
+        break;
+
+      g_array_append_val (q->vectors, v);
+      total += e->size;
+    }
+
   q->writing = TRUE;
-  g_output_stream_write_all_async (q->output, e->buf, e->size,
+  q->in_flight = q->vectors->len;
+  g_output_stream_writev_all_async (q->output,
+    (GOutputVector *) q->vectors->data, q->vectors->len,
     G_PRIORITY_DEFAULT, q->cancel, write_cb, g_object_ref (q));
 }
 
@@ -28,6 +28,10 @@ G_DECLARE_FINAL_TYPE (OutputQueue, output_queue, OUTPUT, QUEUE, GObject);
 
 OutputQueue* output_queue_new (GOutputStream *output, GCancellable *cancel);
 
+#define OUTPUT_QUEUE_DEFAULT_BUDGET (256 * 1024)
+
+void output_queue_set_budget (OutputQueue *q, gsize budget);
+
 typedef void (*PushedCb) (OutputQueue *q, gpointer user_data, GError *error);
 
 void output_queue_push (OutputQueue *q, const guint8 *buf, gsize size,
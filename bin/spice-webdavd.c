@@ -17,6 +17,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <gio/gio.h>
 
 #ifdef G_OS_UNIX
@@ -39,6 +40,7 @@
 #include "avahi-common.h"
 #endif
 
+#include "mux.h"
 #include "output-queue.h"
 
 typedef struct _ServiceData
@@ -51,31 +53,10 @@ typedef struct _ServiceData
 
 static GCancellable *cancel;
 
-static struct _DemuxData
-{
-  gint64  client;
-  guint16 size;
-  gchar   buf[G_MAXUINT16];
-} demux;
-
-typedef struct _Client
-{
-  guint              ref_count;
-  struct
-  {
-    gint64             id;
-    guint16            size;
-    guint8             buf[G_MAXUINT16];
-  } mux;
-  GSocketConnection *client_connection;
-} Client;
-
 static volatile gboolean quit_service;
 static GMainLoop *loop;
 static GInputStream *mux_istream;
 static GOutputStream *mux_ostream;
-static OutputQueue *mux_queue;
-static GHashTable *clients;
 static GSocketService *socket_service;
 #ifdef G_OS_UNIX
 static gint port_fd;
@@ -83,8 +64,6 @@ static gint port_fd;
 static HANDLE port_handle;
 #endif
 
-static void start_mux_read (GInputStream *istream);
-
 static void
 quit (int sig)
 {
@@ -106,253 +85,19 @@ signal_handler (gpointer user_data)
 }
 #endif
 
-static Client *
-add_client (GSocketConnection *client_connection)
-{
-  Client *client;
-  client = g_new0 (Client, 1);
-  client->ref_count = 1;
-  client->client_connection = g_object_ref (client_connection);
-  // TODO: check if usage of this idiom is portable, or if we need to check collisions
-  client->mux.id = GPOINTER_TO_INT (client_connection);
-  g_hash_table_insert (clients, &client->mux.id, client);
-  g_warn_if_fail (g_hash_table_lookup (clients, &client->mux.id));
-
-  return client;
-}
-
-static Client *
-client_ref (Client *c)
-{
-  c->ref_count++;
-  return c;
-}
-
-static void
-client_unref (gpointer user_data)
-{
-  Client *c = user_data;
-  if (--c->ref_count > 0)
-    return;
-
-  g_debug ("Free client %" G_GINT64_FORMAT, c->mux.id);
-
-  g_io_stream_close (G_IO_STREAM (c->client_connection), NULL, NULL);
-  g_object_unref (c->client_connection);
-  g_free (c);
-}
-
-static void
-remove_client (Client *client)
-{
-  g_debug ("remove client %" G_GINT64_FORMAT, client->mux.id);
-
-  g_hash_table_remove (clients, &client->mux.id);
-}
-
-static void
-mux_pushed_client_cb (GObject *source_object,
-                      GAsyncResult *res,
-                      gpointer user_data)
-{
-  Client *client = user_data;
-  GError *error = NULL;
-  g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object), res, NULL, &error);
-
-  if (error)
-    {
-      g_warning ("error pushing to client %" G_GINT64_FORMAT ": %s",
-        client->mux.id, error->message);
-      g_error_free (error);
-      remove_client (client);
-    }
-  client_unref (client);
-
-  start_mux_read (mux_istream);
-}
-
-static void
-mux_data_read_cb (GObject      *source_object,
-                  GAsyncResult *res,
-                  gpointer      user_data)
-{
-  GError *error = NULL;
-  gsize size;
-
-  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
-  g_debug ("read %" G_GSIZE_FORMAT " bytes from mux", size);
-  if (error)
-    {
-      g_warning ("%s: error: %s", __FUNCTION__, error->message);
-      g_clear_error (&error);
-    }
-  if (size != demux.size)
-    {
-      quit (-1);
-      return;
-    }
-
-  Client *c = g_hash_table_lookup (clients, &demux.client);
-  g_debug ("looked up client %" G_GINT64_FORMAT ": %p", demux.client, c);
-
-  if (c)
-    {
-      GOutputStream *out;
-      out = g_io_stream_get_output_stream (G_IO_STREAM (c->client_connection));
-      g_output_stream_write_all_async (out, demux.buf, demux.size,
-        G_PRIORITY_DEFAULT, cancel, mux_pushed_client_cb, client_ref (c));
-    }
-  else
-    start_mux_read (mux_istream);
-}
-
-static void
-mux_size_read_cb (GObject      *source_object,
-                  GAsyncResult *res,
-                  gpointer      user_data)
-{
-  GInputStream *istream = G_INPUT_STREAM (source_object);
-  GError *error = NULL;
-  gsize size;
-
-  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
-  if (error || size != sizeof (guint16))
-    goto end;
-
-  g_input_stream_read_all_async (istream,
-                                 &demux.buf, demux.size, G_PRIORITY_DEFAULT,
-                                 cancel, mux_data_read_cb, NULL);
-  return;
-
-end:
-  if (error)
-    {
-      g_warning ("%s: error: %s", __FUNCTION__, error->message);
-      g_clear_error (&error);
-    }
-
-  quit (-2);
-}
-
-static void
-mux_client_read_cb (GObject      *source_object,
-                    GAsyncResult *res,
-                    gpointer      user_data)
-{
-  GInputStream *istream = G_INPUT_STREAM (source_object);
-  GError *error = NULL;
-  gsize size;
-
-  g_input_stream_read_all_finish (G_INPUT_STREAM (source_object), res, &size, &error);
-  if (error || size != sizeof (gint64))
-    goto end;
-  g_input_stream_read_all_async (istream,
-                                 &demux.size, sizeof (guint16), G_PRIORITY_DEFAULT,
-                                 cancel, mux_size_read_cb, NULL);
-  return;
-
-end:
-  if (error)
-    {
-      g_warning ("%s: error: %s", __FUNCTION__, error->message);
-      g_clear_error (&error);
-    }
-
-  quit (-3);
-}
-
-static void
-start_mux_read (GInputStream *istream)
-{
-  g_debug ("start reading mux");
-  g_input_stream_read_all_async (istream,
-                                 &demux.client, sizeof (gint64), G_PRIORITY_DEFAULT,
-                                 cancel, mux_client_read_cb, NULL);
-}
-
-static void client_start_read (Client *client);
-
-static void
-mux_pushed_cb (OutputQueue *q, gpointer user_data, GError *error)
-{
-  Client *client = user_data;
-
-  if (error)
-    {
-      g_warning ("error pushing to mux from client %" G_GINT64_FORMAT ": %s",
-        client->mux.id, error->message);
-      remove_client (client);
-      goto end;
-    }
-
-  if (client->mux.size == 0)
-    {
-      remove_client (client);
-      goto end;
-    }
-
-  client_start_read (client);
-end:
-  client_unref (client);
-}
-
-static void
-client_read_cb (GObject      *source_object,
-                GAsyncResult *res,
-                gpointer      user_data)
-{
-  Client *client = user_data;
-  GError *error = NULL;
-  gssize size;
-
-  size = g_input_stream_read_finish (G_INPUT_STREAM (source_object), res, &error);
-  g_debug ("read %" G_GSSIZE_FORMAT " bytes from client %" G_GINT64_FORMAT, size, client->mux.id);
-  if (error)
-    {
-      g_warning ("%s: error for client %" G_GINT64_FORMAT ": %s",
-        __FUNCTION__, client->mux.id, error->message);
-      g_clear_error (&error);
-      remove_client (client);
-      client_unref (client);
-      return;
-    }
-
-  g_return_if_fail (size <= G_MAXUINT16);
-  g_return_if_fail (size >= 0);
-  client->mux.size = size;
-
-  output_queue_push (mux_queue, (guint8 *) &client->mux,
-    sizeof (gint64) + sizeof (guint16) + size, mux_pushed_cb, client);
-}
-
-static void
-client_start_read (Client *client)
-{
-  GIOStream *iostream = G_IO_STREAM (client->client_connection);
-  GInputStream *istream = g_io_stream_get_input_stream (iostream);
-
-  g_debug ("start read client %" G_GINT64_FORMAT, client->mux.id);
-  g_input_stream_read_async (istream,
-                             client->mux.buf, G_MAXUINT16, G_PRIORITY_DEFAULT,
-                             cancel, client_read_cb, client_ref (client));
-}
-
 static gboolean
 incoming_callback (GSocketService    *service,
                    GSocketConnection *client_connection,
                    GObject           *source_object,
                    gpointer           user_data)
 {
-  Client *client;
-
-  client = add_client (client_connection);
-  g_debug ("new client %" G_GINT64_FORMAT, client->mux.id);
-  client_start_read (client);
+  mux_add_client (client_connection);
 
   return FALSE;
 }
 
 static int port;
+static int write_budget = OUTPUT_QUEUE_DEFAULT_BUDGET;
 
 #ifdef G_OS_WIN32
 static gboolean no_service;
@@ -389,7 +134,6 @@ open_mux_path (const char *path)
   g_return_if_fail (path);
   g_return_if_fail (!mux_istream);
   g_return_if_fail (!mux_ostream);
-  g_return_if_fail (!mux_queue);
 
   g_debug ("Open %s", path);
 #ifdef G_OS_UNIX
@@ -420,8 +164,6 @@ open_mux_path (const char *path)
   mux_ostream = G_OUTPUT_STREAM (g_win32_output_stream_new (port_handle, TRUE));
   mux_istream = G_INPUT_STREAM (g_win32_input_stream_new (port_handle, TRUE));
 #endif
-
-  mux_queue = output_queue_new (G_OUTPUT_STREAM (mux_ostream), cancel);
 }
 
 #ifdef G_OS_WIN32
@@ -650,8 +392,6 @@ run_service (ServiceData *service_data)
   g_socket_service_start (socket_service);
 
   cancel = g_cancellable_new ();
-  clients = g_hash_table_new_full (g_int64_hash, g_int64_equal,
-                                   NULL, client_unref);
 
   loop = g_main_loop_new (NULL, TRUE);
 #ifdef G_OS_UNIX
@@ -677,7 +417,7 @@ run_service (ServiceData *service_data)
     }
 #endif
 
-  start_mux_read (mux_istream);
+  mux_start (mux_istream, mux_ostream, MAX (write_budget, 0), cancel, quit);
   g_main_loop_run (loop);
   g_clear_pointer (&loop, g_main_loop_unref);
 
@@ -686,14 +426,11 @@ run_service (ServiceData *service_data)
   g_object_unref (map_drive_data.cancel_map);
 #endif
 
-  g_cancellable_cancel (cancel);
+  mux_stop ();
 
   g_clear_object (&mux_istream);
   g_clear_object (&mux_ostream);
 
-  g_clear_object (&mux_queue);
-  g_hash_table_unref (clients);
-
 #ifdef WITH_AVAHI
   avahi_client_stop ();
 #endif
@@ -781,6 +518,9 @@ static GOptionEntry entries[] = {
   { "port", 'p', 0,
     G_OPTION_ARG_INT, &port,
     "Port to listen on", NULL },
+  { "write-budget", 0, 0,
+    G_OPTION_ARG_INT, &write_budget,
+    "Bytes of client data coalesced per write to the port, 0 for one write per read", "BYTES" },
 #ifdef G_OS_WIN32
   { "no-service", 0, 0,
     G_OPTION_ARG_NONE, &no_service,
@@ -819,6 +559,8 @@ main (int argc, char *argv[])
   signal (SIGINT, quit);
 #endif
 
+  mux_init ();
+
   /* run socket service once at beginning, there seems to be a bug on
      windows, and it can't accept new connections if cleanup and
      restart a new service */
@@ -875,6 +617,7 @@ main (int argc, char *argv[])
 #endif
 
   g_clear_object (&socket_service);
+  mux_clear ();
 
   return 0;
 }
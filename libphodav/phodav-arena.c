@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "phodav-arena.h"
+
+/* A bump allocator for the small, short-lived objects of a request.
+ * Nothing is freed individually: arena_reset() rewinds to the first
+ * block, which is kept for reuse, and arena_free() releases it all. */
+
+#define ARENA_ALIGN(Size) (((Size) + 15) & ~(gsize) 15)
+
+typedef struct _ArenaBlock ArenaBlock;
+
+struct _ArenaBlock
+{
+  ArenaBlock *next;
+  gsize       size;
+  gsize       used;
+  guint8      data[];
+};
+
+struct _Arena
+{
+  ArenaBlock *blocks; /* the current block first */
+  gsize       block_size;
+};
+
+static ArenaBlock *
+arena_block_new (gsize size, ArenaBlock *next)
+{
+  ArenaBlock *block = g_malloc (sizeof (ArenaBlock) + size);
+
+  block->next = next;
+  block->size = size;
+  block->used = 0;
+
+  return block;
+}
+
+Arena *
+arena_new (gsize block_size)
+{
+  Arena *arena = g_slice_new0 (Arena);
+
+  arena->block_size = ARENA_ALIGN (block_size);
+  arena->blocks = arena_block_new (arena->block_size, NULL);
+
+  return arena;
+}
+
+static void
+arena_free_blocks (ArenaBlock *block, ArenaBlock *last)
+{
+  while (block != last)
+    {
+      ArenaBlock *next = block->next;
+      g_free (block);
+      block = next;
+    }
+}
+
+void
+arena_free (Arena *arena)
+{
+  arena_free_blocks (arena->blocks, NULL);
+  g_slice_free (Arena, arena);
+}
+
+void
+arena_reset (Arena *arena)
+{
+  ArenaBlock *first = arena->blocks;
+
+  while (first->next)
+    first = first->next;
+
+  arena_free_blocks (arena->blocks, first);
+  first->used = 0;
+  arena->blocks = first;
+}
+
+gpointer
+arena_alloc (Arena *arena, gsize size)
+{
+  ArenaBlock *block = arena->blocks;
+  gpointer mem;
+
+  size = ARENA_ALIGN (size);
+  if (block->size - block->used < size)
+    {
+      block = arena_block_new (MAX (size, arena->block_size), block);
+      arena->blocks = block;
+    }
+
+  mem = block->data + block->used;
+  block->used += size;
+
+  return memset (mem, 0, size);
+}
+
+gchar *
+arena_strconcat (Arena *arena, const gchar *first, ...)
+{
+  const gchar *s;
+  gsize len = 1;
+  gchar *str, *p;
+  va_list args;
+
+  va_start (args, first);
+  for (s = first; s; s = va_arg (args, const gchar *))
+    len += strlen (s);
+  va_end (args);
+
+  str = p = arena_alloc (arena, len);
+
+  va_start (args, first);
+  for (s = first; s; s = va_arg (args, const gchar *))
+    p = g_stpcpy (p, s);
+  va_end (args);
+
+  return str;
+}
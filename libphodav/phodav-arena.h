@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_ARENA_H__
+#define __PHODAV_ARENA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Arena Arena;
+
+Arena *          arena_new                       (gsize block_size);
+void             arena_free                      (Arena *arena);
+void             arena_reset                     (Arena *arena);
+gpointer         arena_alloc                     (Arena *arena, gsize size);
+gchar *          arena_strconcat                 (Arena *arena, const gchar *first,
+                                                  ...) G_GNUC_NULL_TERMINATED;
+
+G_END_DECLS
+
+#endif /* __PHODAV_ARENA_H__ */
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "phodav-copy.h"
+#include "phodav-utils.h"
+#include "phodav-multistatus.h"
+
+#if defined (HAVE_COPY_FILE_RANGE) || defined (HAVE_FICLONE)
+#define HAVE_NATIVE_COPY 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef HAVE_FICLONE
+#include <linux/fs.h>
+#endif
+#endif
+
+#ifdef HAVE_NATIVE_COPY
+static void
+set_error_from_errno (GError **err, int errsv, const gchar *path)
+{
+  g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errsv),
+               "%s: %s", path, g_strerror (errsv));
+}
+
+/* copy the data within the kernel, reflinking when the filesystem
+ * can: G_IO_ERROR_NOT_SUPPORTED asks the caller to fall back. The
+ * destination is always a new file: an existing one is unlinked
+ * first, so a symbolic link is replaced and not written through, as
+ * g_file_copy() does. Symbolic links as sources are left to it too. */
+static gboolean
+copy_file_native (GFile *src, GFile *dest, GFileCopyFlags flags,
+                  GCancellable *cancellable, GError **err)
+{
+  gchar *src_path = g_file_get_path (src);
+  gchar *dest_path = g_file_get_path (dest);
+  gboolean overwrite = flags & G_FILE_COPY_OVERWRITE;
+  gboolean success = FALSE, created = FALSE;
+  int in = -1, out = -1;
+  struct stat st;
+
+  if (!src_path || !dest_path)
+    {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "not a local file");
+      goto end;
+    }
+
+  in = open (src_path, O_RDONLY | O_CLOEXEC |
+             (flags & G_FILE_COPY_NOFOLLOW_SYMLINKS ? O_NOFOLLOW : 0));
+  if (in < 0 && errno == ELOOP)
+    {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "a symbolic link");
+      goto end;
+    }
+  if (in < 0 || fstat (in, &st) < 0)
+    {
+      set_error_from_errno (err, errno, src_path);
+      goto end;
+    }
+
+  if (!S_ISREG (st.st_mode))
+    {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "not a regular file");
+      goto end;
+    }
+
+  /* a directory, or anything else in the way, is left to GIO */
+  if (overwrite && unlink (dest_path) < 0 && errno != ENOENT)
+    {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "can't replace the destination");
+      goto end;
+    }
+
+  out = open (dest_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+              st.st_mode & 0777);
+  if (out < 0 && overwrite && errno == EEXIST)
+    {
+      /* created again meanwhile */
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "can't replace the destination");
+      goto end;
+    }
+  if (out < 0)
+    {
+      set_error_from_errno (err, errno, dest_path);
+      goto end;
+    }
+  created = TRUE;
+
+#ifdef HAVE_FICLONE
+  if (ioctl (out, FICLONE, in) == 0)
+    {
+      success = TRUE;
+      goto end;
+    }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+  {
+    off_t remaining = st.st_size;
+
+    while (remaining > 0)
+      {
+        ssize_t n;
+
+        if (g_cancellable_set_error_if_cancelled (cancellable, err))
+          goto end;
+
+        n = copy_file_range (in, NULL, out, NULL, MIN (remaining, 16 * 1024 * 1024), 0);
+        if (n < 0 && errno == EINTR)
+          continue;
+
+        if (n < 0 && remaining == st.st_size &&
+            (errno == EXDEV || errno == ENOSYS ||
+             errno == EOPNOTSUPP || errno == EINVAL))
+          break;
+
+        if (n < 0)
+          {
+            set_error_from_errno (err, errno, dest_path);
+            goto end;
+          }
+
+        if (n == 0)
+          break;
+
+        remaining -= n;
+      }
+
+    if (remaining < st.st_size || st.st_size == 0)
+      {
+        success = TRUE;
+        goto end;
+      }
+  }
+#endif
+
+  g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "no in-kernel copy");
+
+end:
+  /* any copy will be redone by the fallback, or not at all */
+  if (created && !success)
+    unlink (dest_path);
+  if (in >= 0)
+    close (in);
+  if (out >= 0 && close (out) < 0 && success)
+    {
+      set_error_from_errno (err, errno, dest_path);
+      success = FALSE;
+    }
+  g_free (src_path);
+  g_free (dest_path);
+
+  return success;
+}
+#endif
+
+gboolean
+phodav_copy_file (GFile *src, GFile *dest, GFileCopyFlags flags,
+                  GCancellable *cancellable, GError **err)
+{
+#ifdef HAVE_NATIVE_COPY
+  GError *error = NULL;
+
+  if (copy_file_native (src, dest, flags, cancellable, &error))
+    {
+      if (flags & G_FILE_COPY_ALL_METADATA)
+        g_file_copy_attributes (src, dest, flags, cancellable, NULL);
+      return TRUE;
+    }
+
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+    {
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  g_clear_error (&error);
+#endif
+
+  return g_file_copy (src, dest, flags, cancellable, NULL, NULL, err);
+}
+
+typedef struct _CopyTree
+{
+  GFileCopyFlags  flags;
+  guint           batch_size;
+  GCancellable   *cancellable;
+  GThreadPool    *pool;
+  GQueue          queue; /* without a pool */
+
+  GMutex          mutex;
+  GCond           cond;
+  guint           pending;
+  GHashTable     *mstatus;
+} CopyTree;
+
+typedef struct _CopyTask
+{
+  CopyTree *tree;
+  GFile    *src;
+  GFile    *dest;
+  gchar    *path; /* the destination href */
+  gboolean  directory;
+  gboolean  make_directory;
+} CopyTask;
+
+typedef struct _CopyChildren
+{
+  CopyTree *tree;
+  CopyTask *task;
+} CopyChildren;
+
+static gint
+error_to_status (GError *err)
+{
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+    return SOUP_STATUS_INSUFFICIENT_STORAGE;
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED))
+    return SOUP_STATUS_FORBIDDEN;
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_EXISTS))
+    return SOUP_STATUS_PRECONDITION_FAILED;
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    return SOUP_STATUS_NOT_FOUND;
+
+  return SOUP_STATUS_INTERNAL_SERVER_ERROR;
+}
+
+static void
+copy_tree_add_error (CopyTree *tree, const gchar *path, GError *err)
+{
+  g_debug ("COPY %s: %s", path, err->message);
+
+  g_mutex_lock (&tree->mutex);
+  if (tree->mstatus)
+    g_hash_table_insert (tree->mstatus, g_strdup (path),
+                         response_new (NULL, error_to_status (err)));
+  g_mutex_unlock (&tree->mutex);
+}
+
+static void
+copy_tree_push (CopyTree *tree, GFile *src, GFile *dest, gchar *path,
+                gboolean directory, gboolean make_directory)
+{
+  CopyTask *task = g_slice_new (CopyTask);
+
+  task->tree = tree;
+  task->src = src;
+  task->dest = dest;
+  task->path = path;
+  task->directory = directory;
+  task->make_directory = make_directory;
+
+  g_mutex_lock (&tree->mutex);
+  tree->pending++;
+  g_mutex_unlock (&tree->mutex);
+
+  if (tree->pool)
+    g_thread_pool_push (tree->pool, task, NULL);
+  else
+    g_queue_push_tail (&tree->queue, task);
+}
+
+static gboolean
+copy_tree_add_child (GFileInfo *info, gpointer data)
+{
+  CopyChildren *c = data;
+  const gchar *name = g_file_info_get_name (info);
+  gchar *escape = g_markup_escape_text (name, -1);
+
+  copy_tree_push (c->tree,
+                  g_file_get_child (c->task->src, name),
+                  g_file_get_child (c->task->dest, name),
+                  g_build_path ("/", c->task->path, escape, NULL),
+                  /* a link to a collection is copied as a link */
+                  g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY,
+                  TRUE);
+  g_free (escape);
+
+  return !g_cancellable_is_cancelled (c->tree->cancellable);
+}
+
+/* the members of a collection that failed to copy are not copied */
+static void
+copy_directory (CopyTree *tree, CopyTask *task)
+{
+  CopyChildren c = { tree, task };
+  GError *err = NULL;
+
+  if (task->make_directory &&
+      !g_file_make_directory (task->dest, tree->cancellable, &err))
+    goto end;
+
+  phodav_enumerate_children (task->src, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                             G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                             G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, tree->batch_size,
+                             copy_tree_add_child, &c, tree->cancellable, &err);
+
+end:
+  if (err)
+    copy_tree_add_error (tree, task->path, err);
+  g_clear_error (&err);
+}
+
+static void
+copy_task_run (gpointer data, gpointer user_data)
+{
+  CopyTask *task = data;
+  CopyTree *tree = task->tree;
+  GError *err = NULL;
+
+  if (task->directory)
+    copy_directory (tree, task);
+  else if (!phodav_copy_file (task->src, task->dest,
+                              tree->flags | G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                              tree->cancellable, &err))
+    {
+      copy_tree_add_error (tree, task->path, err);
+      g_clear_error (&err);
+    }
+
+  g_object_unref (task->src);
+  g_object_unref (task->dest);
+  g_free (task->path);
+  g_slice_free (CopyTask, task);
+
+  g_mutex_lock (&tree->mutex);
+  if (--tree->pending == 0)
+    g_cond_signal (&tree->cond);
+  g_mutex_unlock (&tree->mutex);
+}
+
+/* the tasks of all the trees copied at once: they never wait for
+ * each other, so one pool can be shared by the requests */
+GThreadPool *
+phodav_copy_pool_new (guint threads, GError **err)
+{
+  return g_thread_pool_new (copy_task_run, NULL, threads, FALSE, err);
+}
+
+/* copy the collection @src to @dest, members are copied in parallel
+ * on @pool, or in the calling thread when NULL, and their failures
+ * added to @mstatus. Symbolic links below @src are copied as links. */
+gboolean
+phodav_copy_tree (GFile *src, GFile *dest, const gchar *dest_path,
+                  GFileCopyFlags flags, guint batch_size, GThreadPool *pool,
+                  GHashTable *mstatus, GCancellable *cancellable,
+                  GError **err)
+{
+  CopyTree tree = { flags, batch_size, cancellable, pool, };
+  CopyTask *task;
+
+  if (!g_file_make_directory_with_parents (dest, cancellable, err))
+    return FALSE;
+
+  tree.mstatus = mstatus;
+  g_mutex_init (&tree.mutex);
+  g_cond_init (&tree.cond);
+
+  copy_tree_push (&tree, g_object_ref (src), g_object_ref (dest),
+                  g_strdup (dest_path), TRUE, FALSE);
+
+  if (tree.pool)
+    {
+      g_mutex_lock (&tree.mutex);
+      while (tree.pending > 0)
+        g_cond_wait (&tree.cond, &tree.mutex);
+      g_mutex_unlock (&tree.mutex);
+    }
+  else
+    while ((task = g_queue_pop_head (&tree.queue)))
+      copy_task_run (task, NULL);
+
+  g_mutex_clear (&tree.mutex);
+  g_cond_clear (&tree.cond);
+
+  return TRUE;
+}
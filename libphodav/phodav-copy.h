@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_COPY_H__
+#define __PHODAV_COPY_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+gboolean         phodav_copy_file                (GFile *src, GFile *dest,
+                                                  GFileCopyFlags flags,
+                                                  GCancellable *cancellable,
+                                                  GError **err);
+GThreadPool *    phodav_copy_pool_new            (guint threads, GError **err);
+gboolean         phodav_copy_tree                (GFile *src, GFile *dest,
+                                                  const gchar *dest_path,
+                                                  GFileCopyFlags flags,
+                                                  guint batch_size, GThreadPool *pool,
+                                                  GHashTable *mstatus,
+                                                  GCancellable *cancellable,
+                                                  GError **err);
+
+G_END_DECLS
+
+#endif /* __PHODAV_COPY_H__ */
@@ -18,14 +18,48 @@
 #include "phodav-priv.h"
 #include "phodav-lock.h"
 
+/* The If header is parsed once into lists of conditions, the
+ * condition holds when one of the lists does. The etags are then
+ * queried once per resource, before taking the paths lock, and the
+ * lists are evaluated under it along with the other locks. */
+
+typedef struct _IfCondition
+{
+  gboolean     not;
+  const gchar *token; /* in the header copy, NULL for an etag */
+  gchar       *etag;
+} IfCondition;
+
+typedef struct _IfList
+{
+  gchar *path;
+  GList *conditions; /* all of them hold */
+} IfList;
+
 typedef struct _IfState
 {
-  gchar   *cur;
-  gchar   *path;
-  GList   *locks;
-  gboolean error;
+  gchar      *cur;
+  gchar      *path;
+  GList      *locks;
+  GList      *lists;
+  GHashTable *etags; /* path -> etag, NULL when not found */
 } IfState;
 
+static void
+if_condition_free (IfCondition *cond)
+{
+  g_free (cond->etag);
+  g_slice_free (IfCondition, cond);
+}
+
+static void
+if_list_free (IfList *list)
+{
+  g_list_free_full (list->conditions, (GDestroyNotify) if_condition_free);
+  g_free (list->path);
+  g_slice_free (IfList, list);
+}
+
 static gboolean
 eat_whitespaces (IfState *state)
 {
@@ -125,147 +159,194 @@ check_token (PathHandler *handler, const gchar *path, const gchar *token)
 }
 
 static gboolean
-check_etag (PathHandler *handler, const gchar *path, const gchar *etag)
+parse_condition (IfState *state, IfList *list)
 {
-  GCancellable *cancellable = handler_get_cancellable (handler);
-  GFile *file = NULL;
-  GFileInfo *info = NULL;
-  GError *error = NULL;
-  const gchar *fetag;
-  gboolean success = FALSE;
-
-  g_debug ("check etag %s for %s", etag, path);
+  gboolean not = accept_token (state, "Not");
+  const gchar *token = NULL;
+  gchar *etag = NULL;
+  IfCondition *cond;
 
-  file = g_file_get_child (handler_get_file (handler), path + 1);
-  info = g_file_query_info (file, "etag::*",
-                            G_FILE_QUERY_INFO_NONE, cancellable, &error);
-  if (!info)
-    goto end;
-
-  fetag = g_file_info_get_etag (info);
-  g_warn_if_fail (fetag != NULL);
-
-  success = !g_strcmp0 (etag, fetag);
+  if (next_token (state, "<"))
+    {
+      token = accept_ref (state);
+      if (!token)
+        return FALSE;
 
-end:
-  if (error)
+      state->locks = g_list_append (state->locks, lock_submitted_new (list->path, token));
+    }
+  else if (next_token (state, "["))
     {
-      g_warning ("check_etag error: %s", error->message);
-      g_clear_error (&error);
+      etag = accept_etag (state);
+      if (!etag)
+        return FALSE;
     }
+  else
+    return FALSE;
 
-  g_clear_object (&info);
-  g_clear_object (&file);
+  cond = g_slice_new (IfCondition);
+  cond->not = not;
+  cond->token = token;
+  cond->etag = etag;
+  list->conditions = g_list_prepend (list->conditions, cond);
 
-  return success;
+  return TRUE;
 }
 
 static gboolean
-eval_if_condition (PathHandler *handler, IfState *state)
+parse_list (IfState *state)
 {
-  gboolean success = FALSE;
-
-  if (next_token (state, "<"))
-    {
-      const gchar *token = accept_ref (state);
-      LockSubmitted *l = lock_submitted_new (state->path, token);
+  IfList *list = g_slice_new0 (IfList);
 
-      state->locks = g_list_append (state->locks, l);
+  list->path = g_strdup (state->path);
+  state->lists = g_list_prepend (state->lists, list);
 
-      success = check_token (handler, state->path, token);
-    }
-  else if (next_token (state, "["))
-    {
-      gchar *etag = accept_etag (state);
+  if (!accept_token (state, "("))
+    return FALSE;
 
-      success = check_etag (handler, state->path, etag);
-      g_free (etag);
-    }
-  else
-    g_warn_if_reached ();
+  do
+    if (!parse_condition (state, list))
+      return FALSE;
+  while (!accept_token (state, ")"));
 
-  return success;
+  return TRUE;
 }
 
 static gboolean
-eval_if_not_condition (PathHandler *handler, IfState *state)
+parse_lists (IfState *state)
 {
-  gboolean not = FALSE;
-  gboolean res;
-
-  if (accept_token (state, "Not"))
-    not = TRUE;
+  if (!next_token (state, "("))
+    return FALSE;
 
-  res = eval_if_condition (handler, state);
+  while (next_token (state, "("))
+    if (!parse_list (state))
+      return FALSE;
 
-  return not ? !res : res;
+  return TRUE;
 }
 
 static gboolean
-eval_if_list (PathHandler *handler, IfState *state)
+parse_tag (IfState *state)
 {
-  gboolean success;
+  GUri *uri;
+  const gchar *ref = accept_ref (state);
 
-  g_return_val_if_fail (accept_token (state, "("), FALSE);
+  if (!ref)
+    return FALSE;
 
-  success = eval_if_not_condition (handler, state);
+  /* an absolute URI, or else an absolute path */
+  uri = g_uri_parse (ref, G_URI_FLAGS_ENCODED_PATH, NULL);
+  if (!uri && *ref != '/')
+    return FALSE;
 
-  while (!accept_token (state, ")"))
-    success &= eval_if_not_condition (handler, state);
+  g_free (state->path);
+  state->path = g_strdup (uri ? g_uri_get_path (uri) : ref);
+  g_clear_pointer (&uri, g_uri_unref);
 
-  return success;
+  return parse_lists (state);
 }
 
 static gboolean
-eval_if_lists (PathHandler *handler, IfState *state)
+parse_if (IfState *state)
 {
-  gboolean success = FALSE;
+  gboolean tagged = next_token (state, "<");
 
-  g_return_val_if_fail (next_token (state, "("), FALSE);
+  while (!eat_whitespaces (state))
+    if (!(tagged ? parse_tag (state) : parse_lists (state)))
+      return FALSE;
 
-  while (next_token (state, "("))
-    success |= eval_if_list (handler, state);
+  return TRUE;
+}
 
-  return success;
+static gchar *
+query_etag (PathHandler *handler, const gchar *path)
+{
+  GCancellable *cancellable = handler_get_cancellable (handler);
+  GFile *file = NULL;
+  GFileInfo *info = NULL;
+  GError *error = NULL;
+  gchar *etag = NULL;
+
+  file = g_file_get_child (handler_get_file (handler), path + 1);
+  info = g_file_query_info (file, "etag::*",
+                            G_FILE_QUERY_INFO_NONE, cancellable, &error);
+  if (!info)
+    goto end;
+
+  etag = g_strdup (g_file_info_get_etag (info));
+  g_warn_if_fail (etag != NULL);
+
+end:
+  if (error)
+    {
+      g_warning ("check_etag error: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_clear_object (&info);
+  g_clear_object (&file);
+
+  return etag;
 }
 
-static gboolean
-eval_if_tag (PathHandler *handler, IfState *state)
+static void
+query_etags (PathHandler *handler, IfState *state)
 {
-  GUri *uri;
-  const gchar *path;
-  const gchar *ref = accept_ref (state);
+  GList *l, *c;
 
-  g_return_val_if_fail (ref != NULL, FALSE);
+  for (l = state->lists; l != NULL; l = l->next)
+    {
+      IfList *list = l->data;
 
-  uri = g_uri_parse (ref, G_URI_FLAGS_ENCODED_PATH, NULL);
-  path = g_uri_get_path (uri);
-  g_free (state->path);
-  state->path = g_strdup (path);
-  g_uri_unref (uri);
+      for (c = list->conditions; c != NULL; c = c->next)
+        {
+          IfCondition *cond = c->data;
 
-  return eval_if_lists (handler, state);
+          if (cond->etag && !g_hash_table_contains (state->etags, list->path))
+            g_hash_table_insert (state->etags, g_strdup (list->path),
+                                 query_etag (handler, list->path));
+        }
+    }
 }
 
+static gboolean
+eval_condition (PathHandler *handler, IfState *state, IfList *list, IfCondition *cond)
+{
+  gboolean success;
+
+  if (cond->token)
+    success = check_token (handler, list->path, cond->token);
+  else
+    {
+      g_debug ("check etag %s for %s", cond->etag, list->path);
+      success = !g_strcmp0 (cond->etag, g_hash_table_lookup (state->etags, list->path));
+    }
+
+  return cond->not ? !success : success;
+}
 
 static gboolean
 eval_if (PathHandler *handler, IfState *state)
 {
-  gboolean success = FALSE;
+  GList *l, *c;
+
+  for (l = state->lists; l != NULL; l = l->next)
+    {
+      IfList *list = l->data;
 
-  if (next_token (state, "<")) {
-    while (!eat_whitespaces (state))
-      success |= eval_if_tag (handler, state);
-  } else {
-    while (!eat_whitespaces (state))
-      success |= eval_if_lists (handler, state);
-  }
+      for (c = list->conditions; c != NULL; c = c->next)
+        if (!eval_condition (handler, state, list, c->data))
+          break;
 
-  return success;
+      if (!c)
+        return TRUE;
+    }
+
+  return FALSE;
 }
 
-gint
-phodav_check_if (PathHandler *handler, SoupServerMessage *msg, const gchar *path, GList **locks)
+static gint
+check_if (PathHandler *handler, SoupServerMessage *msg, const gchar *path,
+          gboolean have_info, GFileInfo *info, GList **locks)
 {
   PhodavServer *server = handler_get_server (handler);
   gboolean success = TRUE;
@@ -273,29 +354,64 @@ phodav_check_if (PathHandler *handler, SoupServerMessage *msg, const gchar *path
   SoupMessageHeaders *request_headers = soup_server_message_get_request_headers (msg);
   gchar *str = g_strdup (soup_message_headers_get_one (request_headers, "If"));
   IfState state = { .cur = str, .path = g_strdup (path) };
-  gboolean copy = soup_server_message_get_method (msg) == SOUP_METHOD_COPY;
+  const gchar *method = soup_server_message_get_method (msg);
 
-  if (!str)
-    goto end;
-
-  if (eval_if (handler, &state))
-    {
-      *locks = state.locks;
-    }
-  else
+  if (str)
     {
-      g_list_free_full (state.locks, (GDestroyNotify) lock_submitted_free);
-      success = FALSE;
+      if (!parse_if (&state))
+        {
+          status = SOUP_STATUS_BAD_REQUEST;
+          goto end;
+        }
+
+      state.etags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      if (have_info)
+        g_hash_table_insert (state.etags, g_strdup (path),
+                             info ? g_strdup (g_file_info_get_etag (info)) : NULL);
+      query_etags (handler, &state);
     }
 
-end:
+  server_lock_paths (server);
+
+  if (str)
+    success = eval_if (handler, &state);
+  if (success)
+    *locks = g_steal_pointer (&state.locks);
+
   status = success ? SOUP_STATUS_OK
            : str ? SOUP_STATUS_PRECONDITION_FAILED : SOUP_STATUS_LOCKED;
 
-  if (success && !copy && server_path_has_other_locks (server, path, *locks))
+  /* a collection is deleted or moved with all its members */
+  if (success && method != SOUP_METHOD_COPY &&
+      server_path_has_other_locks (server, path, *locks,
+                                   method == SOUP_METHOD_DELETE ||
+                                   method == SOUP_METHOD_MOVE))
     status = SOUP_STATUS_LOCKED;
 
+  server_unlock_paths (server);
+
+end:
+  g_list_free_full (state.locks, (GDestroyNotify) lock_submitted_free);
+  g_list_free_full (state.lists, (GDestroyNotify) if_list_free);
+  g_clear_pointer (&state.etags, g_hash_table_unref);
   g_free (str);
   g_free (state.path);
   return status;
 }
+
+gint
+phodav_check_if (PathHandler *handler, SoupServerMessage *msg, const gchar *path, GList **locks)
+{
+  return check_if (handler, msg, path, FALSE, NULL, locks);
+}
+
+/* the same, with @info the etag::value of @path already queried, or
+ * NULL when it doesn't exist: for the methods querying @path anyway,
+ * PUT and PROPPATCH with a store. DELETE, MKCOL, MOVE and COPY don't
+ * query the source, the check of an etag is then its only query. */
+gint
+phodav_check_if_info (PathHandler *handler, SoupServerMessage *msg, const gchar *path,
+                      GFileInfo *info, GList **locks)
+{
+  return check_if (handler, msg, path, TRUE, info, locks);
+}
@@ -0,0 +1,765 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "phodav-info-cache.h"
+
+/* A cache of GFileInfo and of directory listings, keyed by file.
+ *
+ * Entries are kept in LRU order, their size is counted in infos (a
+ * listing weighs one per member) and bounded by max_size. An entry is
+ * dropped when phodav modifies its file.
+ *
+ * The changes made behind phodav are reported by monitors, kept on up
+ * to CACHE_MAX_WATCHES directories below the root: the ones listed,
+ * and their ancestors. An event drops the entries of the file and of
+ * its directory, and the watches below a file moved or removed. An
+ * entry is served without touching the file system while the watches
+ * of its directory and of all the ancestors up to the root are active,
+ * since the move of an ancestor is only seen by the watch of its
+ * parent. It is only stored that way when no event came since it was
+ * queried, and the watches were active before: the caller takes the
+ * serial of the cache before querying.
+ *
+ * Otherwise, an info is checked against a stat of the file on every
+ * hit, an info queried for the cache also has the attributes of a
+ * CacheStamp, and the files changed in the last CACHE_RACY_NS are not
+ * stored, their next change could leave the same times. A listing is
+ * not stored, checking every member costs about as much as listing
+ * it again.
+ *
+ * The monitors are only created, destroyed and report in the server
+ * context, the rest may be used from any thread. A watch keeps a
+ * reference on the cache, the ones of the servers drop the watches
+ * when they are all gone. A max_size of 0 disables the cache. */
+
+#define CACHE_STAMP_ATTRIBUTES                  \
+  G_FILE_ATTRIBUTE_STANDARD_NAME ","            \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE ","            \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED ","            \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC ","       \
+  G_FILE_ATTRIBUTE_TIME_CHANGED ","             \
+  G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC ","        \
+  G_FILE_ATTRIBUTE_UNIX_INODE
+
+#define CACHE_RACY_NS G_GUINT64_CONSTANT (1000000000)
+#define CACHE_MAX_WATCHES 256
+
+typedef struct _CacheEntry
+{
+  gchar      *key;
+  gchar      *info_attributes;
+  GFileInfo  *info;
+  CacheStamp  stamp;
+  guint64     info_watch; /* of the directory, if the info needs no stat */
+  gchar      *children_attributes;
+  GPtrArray  *children;
+  guint64     children_watch;
+  guint       weight;
+  GList       link;
+} CacheEntry;
+
+typedef struct _CacheWatch
+{
+  InfoCache    *cache;
+  gchar        *key;
+  GFile        *file;
+  GFileMonitor *monitor; /* context only */
+  guint64       id;      /* a watch added again has another one */
+  gboolean      active;  /* reporting, and still in the watches */
+  gboolean      removed;
+} CacheWatch;
+
+struct _InfoCache
+{
+  gint          users;
+  GMutex        lock;
+  GMainContext *context;
+  gchar        *root;    /* the key of the root, NULL if not local */
+  GHashTable   *entries; /* key -> CacheEntry */
+  GHashTable   *watches; /* key -> CacheWatch */
+  GQueue        lru;
+  guint         size;
+  guint         max_size;
+  guint64       serial;  /* of the events and invalidations */
+  guint64       watch_id;
+  guint64       hits;
+  guint64       misses;
+};
+
+static gchar *
+cache_key (GFile *file)
+{
+  return g_file_get_path (file) ? : g_file_get_uri (file);
+}
+
+/* turns @key into the one of its directory, FALSE at the top */
+static gboolean
+key_parent (gchar *key)
+{
+  gchar *sep = strrchr (key, G_DIR_SEPARATOR);
+
+  if (!sep || sep[1] == '\0')
+    return FALSE;
+
+  if (sep == key)
+    sep++;
+  *sep = '\0';
+
+  return TRUE;
+}
+
+/* whether @key is @dir or below it */
+static gboolean
+key_has_prefix (const gchar *key, const gchar *dir)
+{
+  gsize len = strlen (dir);
+
+  return !strncmp (key, dir, len) &&
+    (key[len] == '\0' || key[len] == G_DIR_SEPARATOR ||
+     (len && dir[len - 1] == G_DIR_SEPARATOR));
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_free (entry->info_attributes);
+  g_clear_object (&entry->info);
+  g_free (entry->children_attributes);
+  g_clear_pointer (&entry->children, g_ptr_array_unref);
+  g_slice_free (CacheEntry, entry);
+}
+
+/* FALSE when @info tells nothing to check a later change against */
+static gboolean
+cache_stamp_from_info (GFileInfo *info, CacheStamp *stamp)
+{
+  if (!g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    return FALSE;
+
+  stamp->inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+  stamp->size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+  stamp->mtime =
+    g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * CACHE_RACY_NS +
+    g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC);
+  stamp->ctime =
+    g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED) * CACHE_RACY_NS +
+    g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC);
+
+  /* too recent, a change could come within the same tick */
+  return MAX (stamp->mtime, stamp->ctime) + CACHE_RACY_NS <=
+    (guint64) g_get_real_time () * 1000;
+}
+
+static gboolean
+cache_stamp_equal (const CacheStamp *a, const CacheStamp *b)
+{
+  return a->inode == b->inode && a->size == b->size &&
+    a->mtime == b->mtime && a->ctime == b->ctime;
+}
+
+/* whether @file is as it was at @stamp */
+static gboolean
+cache_stamp_check (GFile *file, const CacheStamp *stamp)
+{
+  GFileInfo *info;
+  CacheStamp now;
+  gboolean same;
+
+  info = g_file_query_info (file, CACHE_STAMP_ATTRIBUTES, G_FILE_QUERY_INFO_NONE,
+                            NULL, NULL);
+  if (!info)
+    return FALSE;
+
+  same = cache_stamp_from_info (info, &now) && cache_stamp_equal (stamp, &now);
+  g_object_unref (info);
+
+  return same;
+}
+
+/* called with the lock held */
+static void
+cache_remove (InfoCache *cache, CacheEntry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->weight;
+  g_hash_table_remove (cache->entries, entry->key);
+}
+
+static void
+cache_remove_key (InfoCache *cache, const gchar *key)
+{
+  CacheEntry *entry = g_hash_table_lookup (cache->entries, key);
+
+  if (entry)
+    cache_remove (cache, entry);
+}
+
+static void
+cache_evict (InfoCache *cache)
+{
+  while (cache->size > cache->max_size && cache->lru.tail)
+    cache_remove (cache, cache->lru.tail->data);
+}
+
+static CacheEntry *
+cache_lookup (InfoCache *cache, const gchar *key)
+{
+  CacheEntry *entry = g_hash_table_lookup (cache->entries, key);
+
+  if (entry)
+    {
+      g_queue_unlink (&cache->lru, &entry->link);
+      g_queue_push_head_link (&cache->lru, &entry->link);
+    }
+
+  return entry;
+}
+
+static CacheEntry *
+cache_get_entry (InfoCache *cache, const gchar *key)
+{
+  CacheEntry *entry = cache_lookup (cache, key);
+
+  if (!entry)
+    {
+      entry = g_slice_new0 (CacheEntry);
+      entry->key = g_strdup (key);
+      entry->link.data = entry;
+      g_hash_table_insert (cache->entries, entry->key, entry);
+      g_queue_push_head_link (&cache->lru, &entry->link);
+    }
+
+  return entry;
+}
+
+static void
+cache_entry_set_weight (InfoCache *cache, CacheEntry *entry)
+{
+  cache->size -= entry->weight;
+  entry->weight = (entry->info ? 1 : 0) + (entry->children ? entry->children->len : 0);
+  cache->size += entry->weight;
+}
+
+static void info_cache_clear (InfoCache *cache);
+
+static void watch_changed (GFileMonitor      *monitor,
+                           GFile             *file,
+                           GFile             *other_file,
+                           GFileMonitorEvent  event_type,
+                           gpointer           user_data);
+
+/* in the context, after the watch is taken out of the watches */
+static gboolean
+watch_free (gpointer user_data)
+{
+  CacheWatch *watch = user_data;
+
+  if (watch->monitor)
+    {
+      g_signal_handlers_disconnect_by_func (watch->monitor, watch_changed, watch);
+      g_file_monitor_cancel (watch->monitor);
+      g_object_unref (watch->monitor);
+    }
+  g_object_unref (watch->file);
+  g_free (watch->key);
+  g_atomic_rc_box_release_full (watch->cache, (GDestroyNotify) info_cache_clear);
+  g_slice_free (CacheWatch, watch);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* in the context */
+static gboolean
+watch_start (gpointer user_data)
+{
+  CacheWatch *watch = user_data;
+  InfoCache *cache = watch->cache;
+  GFileMonitor *monitor;
+  gboolean removed;
+
+  g_mutex_lock (&cache->lock);
+  removed = watch->removed;
+  g_mutex_unlock (&cache->lock);
+  if (removed)
+    return G_SOURCE_REMOVE;
+
+  monitor = g_file_monitor_directory (watch->file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+  if (!monitor)
+    return G_SOURCE_REMOVE;
+
+  g_signal_connect (monitor, "changed", G_CALLBACK (watch_changed), watch);
+  watch->monitor = monitor;
+
+  g_mutex_lock (&cache->lock);
+  /* what was queried before can't be trusted */
+  cache->serial++;
+  watch->active = !watch->removed;
+  g_mutex_unlock (&cache->lock);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+cache_invoke (InfoCache *cache, GSourceFunc func, gpointer data)
+{
+  GSource *source = g_idle_source_new ();
+
+  /* always deferred, the lock is held here */
+  g_source_set_callback (source, func, data, NULL);
+  g_source_attach (source, cache->context);
+  g_source_unref (source);
+}
+
+/* called with the lock held, the watch is freed in the context */
+static void
+cache_remove_watch (InfoCache *cache, CacheWatch *watch)
+{
+  g_hash_table_steal (cache->watches, watch->key);
+  watch->removed = TRUE;
+  watch->active = FALSE;
+  cache_invoke (cache, watch_free, watch);
+}
+
+/* drops the watches of @key and below, when it was moved or removed */
+static void
+cache_remove_watches (InfoCache *cache, const gchar *key)
+{
+  GHashTableIter iter;
+  CacheWatch *watch;
+  GPtrArray *removed = g_ptr_array_new ();
+  guint i;
+
+  g_hash_table_iter_init (&iter, cache->watches);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &watch))
+    if (key_has_prefix (watch->key, key))
+      g_ptr_array_add (removed, watch);
+
+  for (i = 0; i < removed->len; i++)
+    cache_remove_watch (cache, removed->pdata[i]);
+  g_ptr_array_free (removed, TRUE);
+}
+
+/* asks for watches on @key and its ancestors up to the root */
+static void
+cache_add_watches (InfoCache *cache, const gchar *key)
+{
+  CacheWatch *watch;
+  gchar *dir;
+
+  if (!cache->root || !key_has_prefix (key, cache->root))
+    return;
+
+  dir = g_strdup (key);
+  do
+    {
+      if (g_hash_table_contains (cache->watches, dir))
+        continue;
+      if (g_hash_table_size (cache->watches) >= CACHE_MAX_WATCHES)
+        break;
+
+      watch = g_slice_new0 (CacheWatch);
+      watch->cache = g_atomic_rc_box_acquire (cache);
+      watch->key = g_strdup (dir);
+      watch->id = ++cache->watch_id;
+      watch->file = g_file_new_for_path (dir);
+      g_hash_table_insert (cache->watches, watch->key, watch);
+      cache_invoke (cache, watch_start, watch);
+    }
+  while (strcmp (dir, cache->root) && key_parent (dir));
+
+  g_free (dir);
+}
+
+/* The id of the watch of the directory @key, if the changes of its
+ * members and the moves of its ancestors are all reported, or 0. The
+ * watches below one that is removed are removed too, so the id
+ * changes when an event may have been missed. */
+static guint64
+cache_get_watch (InfoCache *cache, const gchar *key)
+{
+  CacheWatch *watch;
+  guint64 id = 0;
+  gboolean root = FALSE;
+  gchar *dir;
+
+  if (!cache->root || !key_has_prefix (key, cache->root))
+    return 0;
+
+  dir = g_strdup (key);
+  do
+    {
+      watch = g_hash_table_lookup (cache->watches, dir);
+      if (!watch || !watch->active)
+        break;
+
+      if (!id)
+        id = watch->id;
+      root = !strcmp (dir, cache->root);
+    }
+  while (!root && key_parent (dir));
+
+  g_free (dir);
+  return root ? id : 0;
+}
+
+static guint64
+cache_get_parent_watch (InfoCache *cache, const gchar *key)
+{
+  gchar *dir = g_strdup (key);
+  guint64 id;
+
+  id = key_parent (dir) ? cache_get_watch (cache, dir) : 0;
+  g_free (dir);
+
+  return id;
+}
+
+/* called with the lock held, for a change of the file @key */
+static void
+cache_file_changed (InfoCache *cache, const gchar *key, gboolean moved)
+{
+  gchar *dir = g_strdup (key);
+
+  cache->serial++;
+  cache_remove_key (cache, key);
+  if (moved)
+    cache_remove_watches (cache, key);
+
+  /* the listing, and the times of the directory */
+  if (key_parent (dir))
+    cache_remove_key (cache, dir);
+  g_free (dir);
+}
+
+static void
+watch_changed (GFileMonitor      *monitor,
+               GFile             *file,
+               GFile             *other_file,
+               GFileMonitorEvent  event_type,
+               gpointer           user_data)
+{
+  CacheWatch *watch = user_data;
+  InfoCache *cache = watch->cache;
+  gboolean moved = FALSE;
+  gchar *key;
+
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+    case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+      moved = TRUE;
+      break;
+
+    default:
+      break;
+    }
+
+  g_mutex_lock (&cache->lock);
+  if (watch->removed)
+    goto end;
+
+  key = cache_key (file);
+  cache_file_changed (cache, key, moved);
+  g_free (key);
+
+  if (other_file)
+    {
+      key = cache_key (other_file);
+      cache_file_changed (cache, key, moved);
+      g_free (key);
+    }
+
+  /* the events of the directory itself */
+  cache_remove_key (cache, watch->key);
+
+end:
+  g_mutex_unlock (&cache->lock);
+}
+
+InfoCache *
+info_cache_new (GMainContext *context, guint max_size)
+{
+  InfoCache *cache = g_atomic_rc_box_new0 (InfoCache);
+
+  cache->users = 1;
+  g_mutex_init (&cache->lock);
+  cache->context = g_main_context_ref (context);
+  cache->max_size = max_size;
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) cache_entry_free);
+  cache->watches = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return cache;
+}
+
+InfoCache *
+info_cache_ref (InfoCache *cache)
+{
+  g_atomic_int_inc (&cache->users);
+
+  return g_atomic_rc_box_acquire (cache);
+}
+
+static void
+info_cache_clear (InfoCache *cache)
+{
+  g_clear_pointer (&cache->entries, g_hash_table_unref);
+  g_clear_pointer (&cache->watches, g_hash_table_unref);
+  g_main_context_unref (cache->context);
+  g_free (cache->root);
+  g_mutex_clear (&cache->lock);
+}
+
+void
+info_cache_unref (InfoCache *cache)
+{
+  /* the watches keep a reference until they are freed */
+  if (g_atomic_int_dec_and_test (&cache->users))
+    {
+      g_mutex_lock (&cache->lock);
+      cache_remove_watches (cache, "");
+      g_mutex_unlock (&cache->lock);
+    }
+
+  g_atomic_rc_box_release_full (cache, (GDestroyNotify) info_cache_clear);
+}
+
+/* the directory the watches are kept below */
+void
+info_cache_set_root (InfoCache *cache, GFile *root)
+{
+  g_mutex_lock (&cache->lock);
+  cache_remove_watches (cache, "");
+  g_clear_pointer (&cache->root, g_free);
+  if (root && g_file_is_native (root))
+    cache->root = g_file_get_path (root);
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+info_cache_set_max_size (InfoCache *cache, guint max_size)
+{
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  cache_evict (cache);
+  if (!max_size)
+    cache_remove_watches (cache, "");
+  g_mutex_unlock (&cache->lock);
+}
+
+/* The attributes to query for @attributes, to then store the info,
+ * or NULL when the cache is disabled. */
+gchar *
+info_cache_get_query (InfoCache *cache, const gchar *attributes)
+{
+  if (!cache->max_size)
+    return NULL;
+
+  return g_strconcat (attributes, ",", CACHE_STAMP_ATTRIBUTES, NULL);
+}
+
+/* to be taken before querying what is stored */
+guint64
+info_cache_get_serial (InfoCache *cache)
+{
+  guint64 serial;
+
+  g_mutex_lock (&cache->lock);
+  serial = cache->serial;
+  g_mutex_unlock (&cache->lock);
+
+  return serial;
+}
+
+/* returns a new reference on the cached info, which must not be modified */
+GFileInfo *
+info_cache_lookup_info (InfoCache *cache, GFile *file, const gchar *attributes)
+{
+  gchar *key;
+  GFileInfo *info = NULL;
+  gboolean watched = FALSE;
+  CacheEntry *entry;
+  CacheStamp stamp;
+
+  if (!cache->max_size)
+    return NULL;
+
+  key = cache_key (file);
+  g_mutex_lock (&cache->lock);
+  entry = cache_lookup (cache, key);
+  if (entry && entry->info && !g_strcmp0 (entry->info_attributes, attributes))
+    {
+      info = g_object_ref (entry->info);
+      stamp = entry->stamp;
+      watched = entry->info_watch &&
+        entry->info_watch == cache_get_parent_watch (cache, key);
+    }
+  g_mutex_unlock (&cache->lock);
+
+  /* a stale entry is replaced by the caller */
+  if (info && !watched && !cache_stamp_check (file, &stamp))
+    g_clear_object (&info);
+
+  g_mutex_lock (&cache->lock);
+  if (info)
+    cache->hits++;
+  else
+    cache->misses++;
+  g_mutex_unlock (&cache->lock);
+
+  g_free (key);
+  return info;
+}
+
+void
+info_cache_store_info (InfoCache *cache, GFile *file, const gchar *attributes,
+                       guint64 serial, GFileInfo *info)
+{
+  gchar *key, *dir;
+  CacheEntry *entry;
+  CacheStamp stamp = { 0, };
+  guint64 watch = 0;
+  gboolean stamped;
+
+  if (!cache->max_size)
+    return;
+
+  key = cache_key (file);
+  stamped = cache_stamp_from_info (info, &stamp);
+
+  g_mutex_lock (&cache->lock);
+  if (serial == cache->serial)
+    watch = cache_get_parent_watch (cache, key);
+  if (watch || stamped)
+    {
+      entry = cache_get_entry (cache, key);
+      g_set_object (&entry->info, info);
+      entry->stamp = stamp;
+      entry->info_watch = watch;
+      g_free (entry->info_attributes);
+      entry->info_attributes = g_strdup (attributes);
+      cache_entry_set_weight (cache, entry);
+      cache_evict (cache);
+    }
+
+  if (!watch)
+    {
+      dir = g_strdup (key);
+      if (key_parent (dir))
+        cache_add_watches (cache, dir);
+      g_free (dir);
+    }
+  g_mutex_unlock (&cache->lock);
+
+  g_free (key);
+}
+
+/* returns a new reference on the cached infos of the members of
+ * @file, which must not be modified */
+GPtrArray *
+info_cache_lookup_children (InfoCache *cache, GFile *file, const gchar *attributes)
+{
+  GPtrArray *children = NULL;
+  CacheEntry *entry;
+  gchar *key;
+
+  if (!cache->max_size)
+    return NULL;
+
+  key = cache_key (file);
+  g_mutex_lock (&cache->lock);
+  entry = cache_lookup (cache, key);
+  if (entry && entry->children &&
+      !g_strcmp0 (entry->children_attributes, attributes) &&
+      entry->children_watch == cache_get_watch (cache, key))
+    children = g_ptr_array_ref (entry->children);
+
+  if (children)
+    cache->hits++;
+  else
+    cache->misses++;
+  g_mutex_unlock (&cache->lock);
+
+  g_free (key);
+  return children;
+}
+
+/* @children were listed after taking @serial */
+void
+info_cache_store_children (InfoCache *cache, GFile *file, const gchar *attributes,
+                           guint64 serial, GPtrArray *children)
+{
+  CacheEntry *entry;
+  guint64 watch = 0;
+  gchar *key;
+
+  if (!cache->max_size)
+    return;
+
+  key = cache_key (file);
+  g_mutex_lock (&cache->lock);
+  if (serial == cache->serial)
+    watch = cache_get_watch (cache, key);
+  if (watch)
+    {
+      entry = cache_get_entry (cache, key);
+      g_clear_pointer (&entry->children, g_ptr_array_unref);
+      entry->children = g_ptr_array_ref (children);
+      g_free (entry->children_attributes);
+      entry->children_attributes = g_strdup (attributes);
+      entry->children_watch = watch;
+      cache_entry_set_weight (cache, entry);
+      cache_evict (cache);
+    }
+  else
+    cache_add_watches (cache, key);
+  g_mutex_unlock (&cache->lock);
+
+  g_free (key);
+}
+
+/* @file was modified, created, moved or removed by phodav */
+void
+info_cache_invalidate (InfoCache *cache, GFile *file)
+{
+  gchar *key = cache_key (file);
+
+  g_mutex_lock (&cache->lock);
+  cache_file_changed (cache, key, TRUE);
+  g_mutex_unlock (&cache->lock);
+
+  g_free (key);
+}
+
+void
+info_cache_get_stats (InfoCache *cache, guint64 *hits, guint64 *misses)
+{
+  g_mutex_lock (&cache->lock);
+  if (hits)
+    *hits = cache->hits;
+  if (misses)
+    *misses = cache->misses;
+  g_mutex_unlock (&cache->lock);
+}
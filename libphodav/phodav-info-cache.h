@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_INFO_CACHE_H__
+#define __PHODAV_INFO_CACHE_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+typedef struct _InfoCache InfoCache;
+
+/* what tells a file changed */
+typedef struct _CacheStamp
+{
+  guint64 inode;
+  guint64 size;
+  guint64 mtime; /* in ns */
+  guint64 ctime;
+} CacheStamp;
+
+InfoCache *      info_cache_new                  (GMainContext *context, guint max_size);
+InfoCache *      info_cache_ref                  (InfoCache *cache);
+void             info_cache_unref                (InfoCache *cache);
+void             info_cache_set_root             (InfoCache *cache, GFile *root);
+void             info_cache_set_max_size         (InfoCache *cache, guint max_size);
+gchar *          info_cache_get_query            (InfoCache *cache, const gchar *attributes);
+guint64          info_cache_get_serial           (InfoCache *cache);
+
+GFileInfo *      info_cache_lookup_info          (InfoCache *cache, GFile *file,
+                                                  const gchar *attributes);
+void             info_cache_store_info           (InfoCache *cache, GFile *file,
+                                                  const gchar *attributes,
+                                                  guint64 serial,
+                                                  GFileInfo *info);
+GPtrArray *      info_cache_lookup_children      (InfoCache *cache, GFile *file,
+                                                  const gchar *attributes);
+void             info_cache_store_children       (InfoCache *cache, GFile *file,
+                                                  const gchar *attributes,
+                                                  guint64 serial,
+                                                  GPtrArray *children);
+void             info_cache_invalidate           (InfoCache *cache, GFile *file);
+void             info_cache_get_stats            (InfoCache *cache,
+                                                  guint64 *hits, guint64 *misses);
+
+G_END_DECLS
+
+#endif /* __PHODAV_INFO_CACHE_H__ */
@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "phodav-journal.h"
+
+/* The paths changed under the root, numbered in order, for the
+ * RFC 6578 sync-collection report. A sync token is the epoch of the
+ * journal, different at every start, and the last number the client
+ * has seen. Only the JOURNAL_MAX_ENTRIES last changes are kept: older
+ * tokens are no longer valid, and the client has to sync again from
+ * scratch.
+ *
+ * Changes are recorded by phodav itself, and by monitors installed on
+ * the first JOURNAL_MAX_MONITORS synced collections, before their first
+ * token is given. A collection synced at infinite level gets all its
+ * subcollections watched, symlinks aside, and so do the collections
+ * created or moved in below. A tree copied or moved in has all its
+ * members recorded. A change only names a path, whether it still
+ * exists is found out when reporting.
+ *
+ * A tree is walked in the thread asking for its sync, the monitors
+ * alone are made in the journal context. A collection created behind
+ * phodav is walked there too, but asynchronously, so that the
+ * requests of the context are not held. Past JOURNAL_MAX_WALK
+ * members, a tree is left unwatched, and synced from scratch every
+ * time. */
+
+#define JOURNAL_MAX_ENTRIES 65536
+#define JOURNAL_MAX_MONITORS 256
+#define JOURNAL_MAX_WALK 16384
+#define JOURNAL_TOKEN_PREFIX "urn:phodav:sync:"
+
+typedef struct _JournalEntry
+{
+  guint64  seq;
+  gchar   *path;
+} JournalEntry;
+
+typedef struct _JournalWatch
+{
+  GFileMonitor *monitor;
+  guint64       since;      /* the changes after it are seen */
+  gboolean      tree;       /* and those below, after tree_since */
+  guint64       tree_since;
+  gboolean      walking;    /* part of a tree being walked */
+} JournalWatch;
+
+struct _Journal
+{
+  GFile        *root;
+  GMainContext *context;
+  GMutex        mutex;
+  gint64        epoch;
+  guint64       seq;
+  guint64       floor; /* the changes after it are all known */
+  GQueue        entries;
+  GHashTable   *watches; /* path -> JournalWatch, in the journal context */
+  GCond         cond;
+  GCancellable *cancellable; /* of the walks in the journal context */
+};
+
+static void
+journal_entry_free (JournalEntry *entry)
+{
+  g_free (entry->path);
+  g_slice_free (JournalEntry, entry);
+}
+
+static void journal_monitor_changed (GFileMonitor      *monitor,
+                                     GFile             *file,
+                                     GFile             *other_file,
+                                     GFileMonitorEvent  event_type,
+                                     gpointer           user_data);
+
+static void
+journal_watch_free (JournalWatch *watch)
+{
+  g_signal_handlers_disconnect_matched (watch->monitor, G_SIGNAL_MATCH_FUNC, 0, 0,
+                                        NULL, journal_monitor_changed, NULL);
+  g_file_monitor_cancel (watch->monitor);
+  g_object_unref (watch->monitor);
+  g_slice_free (JournalWatch, watch);
+}
+
+Journal *
+journal_new (GFile *root, GMainContext *context)
+{
+  Journal *journal = g_slice_new0 (Journal);
+
+  journal->root = g_object_ref (root);
+  journal->context = g_main_context_ref (context);
+  journal->epoch = g_get_real_time ();
+  journal->watches = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify) journal_watch_free);
+  g_mutex_init (&journal->mutex);
+  g_cond_init (&journal->cond);
+  journal->cancellable = g_cancellable_new ();
+
+  return journal;
+}
+
+void
+journal_free (Journal *journal)
+{
+  /* the monitors may outlive the table */
+  g_hash_table_unref (journal->watches);
+  g_cancellable_cancel (journal->cancellable);
+  g_object_unref (journal->cancellable);
+
+  g_queue_clear_full (&journal->entries, (GDestroyNotify) journal_entry_free);
+  g_cond_clear (&journal->cond);
+  g_mutex_clear (&journal->mutex);
+  g_main_context_unref (journal->context);
+  g_object_unref (journal->root);
+  g_slice_free (Journal, journal);
+}
+
+/* the request path of @file, NULL if not under the root */
+static gchar *
+journal_path (Journal *journal, GFile *file)
+{
+  gchar *rel, *path;
+
+  if (g_file_equal (journal->root, file))
+    return g_strdup ("/");
+
+  rel = g_file_get_relative_path (journal->root, file);
+  if (!rel)
+    return NULL;
+
+  path = g_strconcat ("/", rel, NULL);
+  g_free (rel);
+
+  return path;
+}
+
+static GFile *
+journal_file (Journal *journal, const gchar *path)
+{
+  return path[1] ? g_file_resolve_relative_path (journal->root, path + 1) :
+    g_object_ref (journal->root);
+}
+
+/* @file was created, modified or removed */
+void
+journal_record (Journal *journal, GFile *file)
+{
+  JournalEntry *entry;
+  gchar *path = journal_path (journal, file);
+
+  if (!path)
+    return;
+
+  g_mutex_lock (&journal->mutex);
+  entry = g_queue_peek_tail (&journal->entries);
+  if (entry && !g_strcmp0 (entry->path, path))
+    {
+      /* the same file written again, a common case */
+      g_queue_pop_tail (&journal->entries);
+      journal_entry_free (entry);
+    }
+
+  entry = g_slice_new (JournalEntry);
+  entry->seq = ++journal->seq;
+  entry->path = path;
+  g_queue_push_tail (&journal->entries, entry);
+
+  while (journal->entries.length > JOURNAL_MAX_ENTRIES)
+    {
+      entry = g_queue_pop_head (&journal->entries);
+      journal->floor = entry->seq;
+      journal_entry_free (entry);
+    }
+  g_mutex_unlock (&journal->mutex);
+}
+
+/* the members of @dir, copied or moved in, were all created: when
+ * there are more than the journal can hold, no older token is valid */
+void
+journal_record_tree (Journal *journal, GFile *dir)
+{
+  GQueue dirs = G_QUEUE_INIT;
+  GFileEnumerator *e;
+  GFileInfo *info;
+  GFile *file;
+  guint n = 0;
+
+  g_queue_push_tail (&dirs, g_object_ref (dir));
+  while (n <= JOURNAL_MAX_ENTRIES && (dir = g_queue_pop_head (&dirs)))
+    {
+      e = g_file_enumerate_children (dir, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                     G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+      while (e && n <= JOURNAL_MAX_ENTRIES &&
+             (info = g_file_enumerator_next_file (e, NULL, NULL)))
+        {
+          file = g_file_get_child (dir, g_file_info_get_name (info));
+          journal_record (journal, file);
+          if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+            g_queue_push_tail (&dirs, g_object_ref (file));
+          g_object_unref (file);
+          g_object_unref (info);
+          n++;
+        }
+      g_clear_object (&e);
+      g_object_unref (dir);
+    }
+  g_queue_clear_full (&dirs, g_object_unref);
+
+  if (n > JOURNAL_MAX_ENTRIES)
+    {
+      g_mutex_lock (&journal->mutex);
+      journal->floor = journal->seq;
+      g_mutex_unlock (&journal->mutex);
+    }
+}
+
+static gchar *
+journal_make_token (Journal *journal, guint64 seq)
+{
+  return g_strdup_printf (JOURNAL_TOKEN_PREFIX "%" G_GINT64_MODIFIER "x-%" G_GUINT64_FORMAT,
+                          journal->epoch, seq);
+}
+
+/* the token of the current state */
+gchar *
+journal_get_token (Journal *journal)
+{
+  guint64 seq;
+
+  g_mutex_lock (&journal->mutex);
+  seq = journal->seq;
+  g_mutex_unlock (&journal->mutex);
+
+  return journal_make_token (journal, seq);
+}
+
+/* FALSE if @token is not one of this journal */
+static gboolean
+journal_parse_token (Journal *journal, const gchar *token, guint64 *seq)
+{
+  gchar *end;
+  gint64 epoch;
+
+  if (!g_str_has_prefix (token, JOURNAL_TOKEN_PREFIX))
+    return FALSE;
+
+  token += strlen (JOURNAL_TOKEN_PREFIX);
+  epoch = g_ascii_strtoll (token, &end, 16);
+  if (end == token || *end != '-' || epoch != journal->epoch)
+    return FALSE;
+
+  token = end + 1;
+  *seq = g_ascii_strtoull (token, &end, 10);
+
+  return end != token && *end == '\0';
+}
+
+static gboolean
+journal_path_is_member (const gchar *path, const gchar *collection,
+                        gsize len, gboolean infinite)
+{
+  const gchar *rest;
+
+  if (len == 1)
+    rest = path + 1;
+  else if (strncmp (path, collection, len) || path[len] != '/')
+    return FALSE;
+  else
+    rest = path + len + 1;
+
+  return *rest && (infinite || !strchr (rest, '/'));
+}
+
+/* The members of @collection changed since @token, in the order of
+ * their last change and up to @limit of them when not 0, and in @next
+ * the token to give the remaining ones. FALSE when @token is invalid
+ * or too old, or when some change may be missing: @collection, or at
+ * infinite level its tree, was not watched by then. */
+gboolean
+journal_get_changes (Journal *journal, const gchar *token,
+                     const gchar *collection, gboolean infinite,
+                     guint limit, GPtrArray *paths, gchar **next,
+                     gboolean *truncated)
+{
+  GHashTable *seen;
+  GPtrArray *changes;
+  JournalEntry *entry;
+  JournalWatch *watch;
+  gsize len = strlen (collection);
+  guint64 seq, end;
+  GList *l;
+  guint i;
+
+  if (!journal_parse_token (journal, token, &seq))
+    return FALSE;
+
+  g_mutex_lock (&journal->mutex);
+  watch = g_hash_table_lookup (journal->watches, collection);
+  if (seq < journal->floor || seq > journal->seq ||
+      !watch || watch->since > seq ||
+      (infinite && (!watch->tree || watch->tree_since > seq)))
+    {
+      g_mutex_unlock (&journal->mutex);
+      return FALSE;
+    }
+
+  /* from the most recent, to keep the last change of every path */
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  changes = g_ptr_array_new ();
+  for (l = journal->entries.tail; l; l = l->prev)
+    {
+      entry = l->data;
+      if (entry->seq <= seq)
+        break;
+
+      if (journal_path_is_member (entry->path, collection, len, infinite) &&
+          g_hash_table_add (seen, entry->path))
+        g_ptr_array_add (changes, entry);
+    }
+
+  *truncated = limit && changes->len > limit;
+  end = journal->seq;
+  for (i = changes->len; i > 0; i--)
+    {
+      entry = changes->pdata[i - 1];
+      if (*truncated && paths->len == limit)
+        break;
+
+      g_ptr_array_add (paths, g_strdup (entry->path));
+      if (*truncated)
+        end = entry->seq;
+    }
+  g_mutex_unlock (&journal->mutex);
+
+  g_ptr_array_unref (changes);
+  g_hash_table_unref (seen);
+  *next = journal_make_token (journal, end);
+  return TRUE;
+}
+
+/* in the journal context, with the mutex held: NULL when @path
+ * cannot be watched */
+static JournalWatch *
+journal_add_watch (Journal *journal, const gchar *path)
+{
+  JournalWatch *watch = g_hash_table_lookup (journal->watches, path);
+  GFileMonitor *monitor;
+  GFile *dir;
+
+  if (watch)
+    return watch;
+  if (g_hash_table_size (journal->watches) >= JOURNAL_MAX_MONITORS)
+    return NULL;
+
+  /* the monitors report in the thread-default context */
+  dir = journal_file (journal, path);
+  g_main_context_push_thread_default (journal->context);
+  monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_main_context_pop_thread_default (journal->context);
+  g_object_unref (dir);
+  if (!monitor)
+    return NULL;
+
+  g_signal_connect (monitor, "changed", G_CALLBACK (journal_monitor_changed), journal);
+  watch = g_slice_new0 (JournalWatch);
+  watch->monitor = monitor;
+  watch->since = journal->seq;
+  g_hash_table_insert (journal->watches, g_strdup (path), watch);
+
+  return watch;
+}
+
+typedef struct _JournalWatchCall
+{
+  Journal     *journal;
+  const gchar *path;
+  gboolean     watched;
+  gboolean     done;
+} JournalWatchCall;
+
+static gboolean
+journal_watch_cb (gpointer user_data)
+{
+  JournalWatchCall *call = user_data;
+  Journal *journal = call->journal;
+
+  g_mutex_lock (&journal->mutex);
+  call->watched = journal_add_watch (journal, call->path) != NULL;
+  call->done = TRUE;
+  g_cond_broadcast (&journal->cond);
+  g_mutex_unlock (&journal->mutex);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* in any thread: FALSE when @path cannot be watched */
+static gboolean
+journal_watch_dir (Journal *journal, const gchar *path)
+{
+  JournalWatchCall call = { journal, path, FALSE, FALSE };
+
+  if (g_main_context_is_owner (journal->context))
+    {
+      journal_watch_cb (&call);
+      return call.watched;
+    }
+
+  g_main_context_invoke (journal->context, journal_watch_cb, &call);
+  g_mutex_lock (&journal->mutex);
+  while (!call.done)
+    g_cond_wait (&journal->cond, &journal->mutex);
+  g_mutex_unlock (&journal->mutex);
+
+  return call.watched;
+}
+
+/* the trees of the @watched paths are complete from now on */
+static void
+journal_mark_trees (Journal *journal, GPtrArray *watched)
+{
+  JournalWatch *watch;
+  guint i;
+
+  g_mutex_lock (&journal->mutex);
+  for (i = 0; i < watched->len; i++)
+    {
+      watch = g_hash_table_lookup (journal->watches, watched->pdata[i]);
+      if (watch && !watch->tree)
+        {
+          watch->tree = TRUE;
+          watch->tree_since = journal->seq;
+        }
+    }
+  g_mutex_unlock (&journal->mutex);
+}
+
+/* @path could not be watched whole: the trees above no longer are */
+static void
+journal_unmark_trees (Journal *journal, const gchar *path)
+{
+  JournalWatch *watch;
+  GHashTableIter iter;
+  const gchar *p;
+
+  g_mutex_lock (&journal->mutex);
+  g_hash_table_iter_init (&iter, journal->watches);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &p, (gpointer *) &watch))
+    if (journal_path_is_member (path, p, strlen (p), TRUE))
+      watch->tree = FALSE;
+  g_mutex_unlock (&journal->mutex);
+}
+
+/* In any thread: watches @path and all the collections below, and
+ * records their members when @record. Each collection is watched
+ * before it is listed, so a collection created meanwhile is found
+ * either way. FALSE if some could not be watched, or when there are
+ * more than JOURNAL_MAX_WALK members. */
+static gboolean
+journal_watch_tree (Journal *journal, const gchar *path, gboolean record)
+{
+  GPtrArray *watched = g_ptr_array_new_with_free_func (g_free);
+  GQueue dirs = G_QUEUE_INIT;
+  gboolean complete = TRUE;
+  GFileEnumerator *e;
+  GFileInfo *info;
+  GFile *dir, *file;
+  guint n = 0;
+  gchar *p;
+
+  g_queue_push_tail (&dirs, g_strdup (path));
+  while (complete && (p = g_queue_pop_head (&dirs)))
+    {
+      complete = journal_watch_dir (journal, p);
+      if (!complete)
+        {
+          g_free (p);
+          break;
+        }
+      g_ptr_array_add (watched, p);
+
+      dir = journal_file (journal, p);
+      e = g_file_enumerate_children (dir, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                     G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+      while (e && (info = g_file_enumerator_next_file (e, NULL, NULL)))
+        {
+          if (++n > JOURNAL_MAX_WALK)
+            {
+              complete = FALSE;
+              g_object_unref (info);
+              break;
+            }
+
+          file = g_file_get_child (dir, g_file_info_get_name (info));
+          if (record)
+            journal_record (journal, file);
+          if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+            g_queue_push_tail (&dirs, journal_path (journal, file));
+          g_object_unref (file);
+          g_object_unref (info);
+        }
+      g_clear_object (&e);
+      g_object_unref (dir);
+    }
+  g_queue_clear_full (&dirs, g_free);
+
+  if (complete)
+    journal_mark_trees (journal, watched);
+
+  g_ptr_array_unref (watched);
+  return complete;
+}
+
+/* The walk of a collection created behind phodav, like
+ * journal_watch_tree() recording the members, but made of async calls
+ * returning in the journal context. It stops there once the journal is
+ * freed: only the cancellable is checked before. */
+typedef struct _JournalWalk
+{
+  Journal      *journal;
+  GCancellable *cancellable;
+  gchar        *path;
+  GQueue        dirs;    /* the paths not listed yet */
+  GPtrArray    *watched;
+  GFile        *dir;     /* being listed */
+  guint         n;
+} JournalWalk;
+
+#define JOURNAL_WALK_BATCH 64
+
+static void journal_walk_next (JournalWalk *walk);
+
+static void
+journal_walk_free (JournalWalk *walk)
+{
+  g_queue_clear_full (&walk->dirs, g_free);
+  g_ptr_array_unref (walk->watched);
+  g_clear_object (&walk->dir);
+  g_object_unref (walk->cancellable);
+  g_free (walk->path);
+  g_slice_free (JournalWalk, walk);
+}
+
+static void
+journal_walk_end (JournalWalk *walk, gboolean complete)
+{
+  Journal *journal = walk->journal;
+  JournalWatch *watch;
+  guint i;
+
+  g_mutex_lock (&journal->mutex);
+  for (i = 0; i < walk->watched->len; i++)
+    {
+      watch = g_hash_table_lookup (journal->watches, walk->watched->pdata[i]);
+      if (watch)
+        watch->walking = FALSE;
+    }
+  g_mutex_unlock (&journal->mutex);
+
+  if (complete)
+    journal_mark_trees (journal, walk->watched);
+  else
+    journal_unmark_trees (journal, walk->path);
+
+  journal_walk_free (walk);
+}
+
+static void
+journal_walk_listed (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GFileEnumerator *e = G_FILE_ENUMERATOR (source);
+  JournalWalk *walk = user_data;
+  GList *infos, *l;
+  GFile *file;
+
+  infos = g_file_enumerator_next_files_finish (e, result, NULL);
+  if (g_cancellable_is_cancelled (walk->cancellable))
+    {
+      g_list_free_full (infos, g_object_unref);
+      journal_walk_free (walk);
+      return;
+    }
+
+  for (l = infos; l != NULL; l = l->next)
+    {
+      if (++walk->n > JOURNAL_MAX_WALK)
+        {
+          g_list_free_full (infos, g_object_unref);
+          journal_walk_end (walk, FALSE);
+          return;
+        }
+
+      file = g_file_get_child (walk->dir, g_file_info_get_name (l->data));
+      journal_record (walk->journal, file);
+      if (g_file_info_get_file_type (l->data) == G_FILE_TYPE_DIRECTORY)
+        g_queue_push_tail (&walk->dirs, journal_path (walk->journal, file));
+      g_object_unref (file);
+    }
+
+  if (!infos)
+    {
+      journal_walk_next (walk);
+      return;
+    }
+
+  g_list_free_full (infos, g_object_unref);
+  g_file_enumerator_next_files_async (e, JOURNAL_WALK_BATCH, G_PRIORITY_LOW,
+                                      walk->cancellable, journal_walk_listed, walk);
+}
+
+static void
+journal_walk_enumerated (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  JournalWalk *walk = user_data;
+  GFileEnumerator *e;
+
+  e = g_file_enumerate_children_finish (G_FILE (source), result, NULL);
+  if (g_cancellable_is_cancelled (walk->cancellable))
+    {
+      g_clear_object (&e);
+      journal_walk_free (walk);
+      return;
+    }
+
+  if (!e)
+    {
+      journal_walk_next (walk);
+      return;
+    }
+
+  g_file_enumerator_next_files_async (e, JOURNAL_WALK_BATCH, G_PRIORITY_LOW,
+                                      walk->cancellable, journal_walk_listed, walk);
+  g_object_unref (e);
+}
+
+/* watches the next collection, before listing it */
+static void
+journal_walk_next (JournalWalk *walk)
+{
+  Journal *journal = walk->journal;
+  JournalWatch *watch;
+  gchar *p;
+
+  g_clear_object (&walk->dir);
+  p = g_queue_pop_head (&walk->dirs);
+  if (!p)
+    {
+      journal_walk_end (walk, TRUE);
+      return;
+    }
+
+  g_mutex_lock (&journal->mutex);
+  watch = journal_add_watch (journal, p);
+  if (watch)
+    watch->walking = TRUE;
+  g_mutex_unlock (&journal->mutex);
+  if (!watch)
+    {
+      g_free (p);
+      journal_walk_end (walk, FALSE);
+      return;
+    }
+  g_ptr_array_add (walk->watched, p);
+
+  walk->dir = journal_file (journal, p);
+  g_main_context_push_thread_default (journal->context);
+  g_file_enumerate_children_async (walk->dir, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                   G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                   G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, G_PRIORITY_LOW,
+                                   walk->cancellable, journal_walk_enumerated, walk);
+  g_main_context_pop_thread_default (journal->context);
+}
+
+/* @file was created in a watched collection: it is watched too, with
+ * its members, when the collection tree is, or is being walked */
+static void
+journal_watch_created (Journal *journal, GFile *file)
+{
+  GFile *parent = g_file_get_parent (file);
+  gchar *parent_path = parent ? journal_path (journal, parent) : NULL;
+  JournalWatch *watch;
+  JournalWalk *walk;
+  gboolean tree;
+
+  if (!parent_path)
+    goto end;
+
+  g_mutex_lock (&journal->mutex);
+  watch = g_hash_table_lookup (journal->watches, parent_path);
+  tree = watch && (watch->tree || watch->walking);
+  g_mutex_unlock (&journal->mutex);
+
+  if (!tree ||
+      g_file_query_file_type (file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                              NULL) != G_FILE_TYPE_DIRECTORY)
+    goto end;
+
+  walk = g_slice_new0 (JournalWalk);
+  walk->journal = journal;
+  walk->cancellable = g_object_ref (journal->cancellable);
+  walk->path = journal_path (journal, file);
+  walk->watched = g_ptr_array_new_with_free_func (g_free);
+  g_queue_push_tail (&walk->dirs, g_strdup (walk->path));
+  journal_walk_next (walk);
+
+end:
+  g_clear_object (&parent);
+  g_free (parent_path);
+}
+
+/* @file was removed, or moved away: its watches go with it */
+static void
+journal_unwatch (Journal *journal, GFile *file)
+{
+  gchar *path = journal_path (journal, file);
+  GHashTableIter iter;
+  const gchar *p;
+
+  if (!path)
+    return;
+
+  g_mutex_lock (&journal->mutex);
+  g_hash_table_iter_init (&iter, journal->watches);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &p, NULL))
+    if (!strcmp (p, path) ||
+        journal_path_is_member (p, path, strlen (path), TRUE))
+      g_hash_table_iter_remove (&iter);
+  g_mutex_unlock (&journal->mutex);
+
+  g_free (path);
+}
+
+static void
+journal_monitor_changed (GFileMonitor      *monitor,
+                         GFile             *file,
+                         GFile             *other_file,
+                         GFileMonitorEvent  event_type,
+                         gpointer           user_data)
+{
+  Journal *journal = user_data;
+
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+      journal_record (journal, file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_CREATED:
+      journal_record (journal, file);
+      journal_watch_created (journal, file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_DELETED:
+      journal_record (journal, file);
+      journal_unwatch (journal, file);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* To also catch the changes of the members of @collection made behind
+ * phodav, and at @infinite level, of all its tree. To call before
+ * taking a token: it returns once watching. */
+void
+journal_watch (Journal *journal, const gchar *collection, gboolean infinite)
+{
+  JournalWatch *watch;
+  gboolean tree;
+
+  if (!journal_watch_dir (journal, collection) || !infinite)
+    return;
+
+  g_mutex_lock (&journal->mutex);
+  watch = g_hash_table_lookup (journal->watches, collection);
+  tree = watch && watch->tree;
+  g_mutex_unlock (&journal->mutex);
+
+  if (!tree)
+    journal_watch_tree (journal, collection, FALSE);
+}
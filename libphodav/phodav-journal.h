@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_JOURNAL_H__
+#define __PHODAV_JOURNAL_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+Journal *        journal_new                     (GFile *root, GMainContext *context);
+void             journal_free                    (Journal *journal);
+
+void             journal_record                  (Journal *journal, GFile *file);
+void             journal_record_tree             (Journal *journal, GFile *dir);
+void             journal_watch                   (Journal *journal, const gchar *collection,
+                                                  gboolean infinite);
+gchar *          journal_get_token               (Journal *journal);
+gboolean         journal_get_changes             (Journal *journal, const gchar *token,
+                                                  const gchar *collection,
+                                                  gboolean infinite, guint limit,
+                                                  GPtrArray *paths, gchar **next,
+                                                  gboolean *truncated);
+
+G_END_DECLS
+
+#endif /* __PHODAV_JOURNAL_H__ */
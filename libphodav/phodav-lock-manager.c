@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phodav-lock-manager.h"
+#include "phodav-store.h"
+
+/* Every lock is indexed by its token, and the locks with a timeout
+ * are also kept in a binary min-heap of expiration times. A single
+ * source is ready when the earliest of them expires. With a store,
+ * the changes are also saved there. The manager is not locked itself:
+ * callers hold the server paths lock. */
+
+struct _LockManager
+{
+  GHashTable *tokens;
+  GPtrArray  *heap;
+  GSource    *source;
+  PropStore  *store;
+};
+
+static gboolean
+lock_source_dispatch (GSource     *source,
+                      GSourceFunc  callback,
+                      gpointer     user_data)
+{
+  return callback (user_data);
+}
+
+static GSourceFuncs lock_source_funcs = {
+  .dispatch = lock_source_dispatch,
+};
+
+LockManager *
+lock_manager_new (GMainContext *context, GSourceFunc expired, gpointer data)
+{
+  LockManager *manager = g_slice_new0 (LockManager);
+
+  manager->tokens = g_hash_table_new (g_str_hash, g_str_equal);
+  manager->heap = g_ptr_array_new ();
+
+  manager->source = g_source_new (&lock_source_funcs, sizeof (GSource));
+  g_source_set_callback (manager->source, expired, data, NULL);
+  g_source_set_name (manager->source, "phodav lock expiry");
+  g_source_attach (manager->source, context);
+
+  return manager;
+}
+
+void
+lock_manager_free (LockManager *manager)
+{
+  GHashTableIter iter;
+  DAVLock *lock;
+
+  g_hash_table_iter_init (&iter, manager->tokens);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lock))
+    {
+      lock->manager = NULL;
+      lock->heap_index = 0;
+    }
+
+  g_source_destroy (manager->source);
+  g_source_unref (manager->source);
+  g_hash_table_unref (manager->tokens);
+  g_ptr_array_unref (manager->heap);
+  g_slice_free (LockManager, manager);
+}
+
+/* the store is not owned */
+void
+lock_manager_set_store (LockManager *manager, PropStore *store)
+{
+  manager->store = store;
+}
+
+/* heap_index is the position in the heap + 1, 0 when not in it */
+#define HEAP(Manager, I) ((DAVLock *) g_ptr_array_index ((Manager)->heap, (I)))
+
+static void
+heap_set (LockManager *manager, guint i, DAVLock *lock)
+{
+  g_ptr_array_index (manager->heap, i) = lock;
+  lock->heap_index = i + 1;
+}
+
+static void
+heap_sift_up (LockManager *manager, guint i)
+{
+  DAVLock *lock = HEAP (manager, i);
+
+  while (i > 0)
+    {
+      guint parent = (i - 1) / 2;
+
+      if (HEAP (manager, parent)->timeout <= lock->timeout)
+        break;
+
+      heap_set (manager, i, HEAP (manager, parent));
+      i = parent;
+    }
+
+  heap_set (manager, i, lock);
+}
+
+static void
+heap_sift_down (LockManager *manager, guint i)
+{
+  DAVLock *lock = HEAP (manager, i);
+  guint len = manager->heap->len;
+
+  for (;;)
+    {
+      guint child = 2 * i + 1;
+
+      if (child >= len)
+        break;
+      if (child + 1 < len &&
+          HEAP (manager, child + 1)->timeout < HEAP (manager, child)->timeout)
+        child++;
+      if (lock->timeout <= HEAP (manager, child)->timeout)
+        break;
+
+      heap_set (manager, i, HEAP (manager, child));
+      i = child;
+    }
+
+  heap_set (manager, i, lock);
+}
+
+static void
+heap_remove (LockManager *manager, DAVLock *lock)
+{
+  guint i = lock->heap_index - 1;
+  DAVLock *last = g_ptr_array_steal_index (manager->heap, manager->heap->len - 1);
+
+  lock->heap_index = 0;
+  if (last == lock)
+    return;
+
+  heap_set (manager, i, last);
+  heap_sift_up (manager, i);
+  heap_sift_down (manager, last->heap_index - 1);
+}
+
+static void
+heap_insert (LockManager *manager, DAVLock *lock)
+{
+  g_ptr_array_add (manager->heap, lock);
+  heap_sift_up (manager, manager->heap->len - 1);
+}
+
+static void
+update_ready_time (LockManager *manager)
+{
+  gint64 ready = -1;
+
+  if (manager->heap->len > 0)
+    ready = HEAP (manager, 0)->timeout * G_USEC_PER_SEC;
+
+  if (g_source_get_ready_time (manager->source) != ready)
+    g_source_set_ready_time (manager->source, ready);
+}
+
+void
+lock_manager_add (LockManager *manager, DAVLock *lock)
+{
+  g_return_if_fail (lock->manager == NULL);
+
+  lock->manager = manager;
+  g_hash_table_insert (manager->tokens, lock->token, lock);
+  if (lock->timeout)
+    {
+      heap_insert (manager, lock);
+      update_ready_time (manager);
+    }
+
+  if (manager->store)
+    prop_store_save_lock (manager->store, lock);
+}
+
+void
+lock_manager_remove (LockManager *manager, DAVLock *lock)
+{
+  g_return_if_fail (lock->manager == manager);
+
+  g_hash_table_remove (manager->tokens, lock->token);
+  if (lock->heap_index)
+    {
+      heap_remove (manager, lock);
+      update_ready_time (manager);
+    }
+  lock->manager = NULL;
+
+  if (manager->store)
+    prop_store_remove_lock (manager->store, lock);
+}
+
+/* to be called when the timeout of @lock changed */
+void
+lock_manager_update (LockManager *manager, DAVLock *lock)
+{
+  g_return_if_fail (lock->manager == manager);
+
+  if (lock->heap_index)
+    heap_remove (manager, lock);
+  if (lock->timeout)
+    heap_insert (manager, lock);
+
+  update_ready_time (manager);
+  if (manager->store)
+    prop_store_save_lock (manager->store, lock);
+}
+
+DAVLock *
+lock_manager_lookup (LockManager *manager, const gchar *token)
+{
+  return g_hash_table_lookup (manager->tokens, token);
+}
+
+/* removes and returns a lock that expired, to be freed by the caller */
+DAVLock *
+lock_manager_pop_expired (LockManager *manager)
+{
+  guint64 now = g_get_monotonic_time () / G_USEC_PER_SEC;
+  DAVLock *lock;
+
+  if (manager->heap->len == 0 || HEAP (manager, 0)->timeout > now)
+    {
+      update_ready_time (manager);
+      return NULL;
+    }
+
+  lock = HEAP (manager, 0);
+  lock_manager_remove (manager, lock);
+
+  return lock;
+}
+
+guint
+lock_manager_get_size (LockManager *manager)
+{
+  return g_hash_table_size (manager->tokens);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_LOCK_MANAGER_H__
+#define __PHODAV_LOCK_MANAGER_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+LockManager *    lock_manager_new                (GMainContext *context,
+                                                  GSourceFunc expired,
+                                                  gpointer data);
+void             lock_manager_free               (LockManager *manager);
+void             lock_manager_set_store          (LockManager *manager, PropStore *store);
+
+void             lock_manager_add                (LockManager *manager, DAVLock *lock);
+void             lock_manager_remove             (LockManager *manager, DAVLock *lock);
+void             lock_manager_update             (LockManager *manager, DAVLock *lock);
+DAVLock *        lock_manager_lookup             (LockManager *manager, const gchar *token);
+DAVLock *        lock_manager_pop_expired        (LockManager *manager);
+guint            lock_manager_get_size           (LockManager *manager);
+
+G_END_DECLS
+
+#endif /* __PHODAV_LOCK_MANAGER_H__ */
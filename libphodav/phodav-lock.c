@@ -18,6 +18,7 @@
 #include "phodav-lock.h"
 #include "phodav-utils.h"
 #include "phodav-path.h"
+#include "phodav-lock-manager.h"
 
 void
 dav_lock_refresh_timeout (DAVLock *lock, guint timeout)
@@ -26,6 +27,9 @@ dav_lock_refresh_timeout (DAVLock *lock, guint timeout)
     lock->timeout = g_get_monotonic_time () / G_USEC_PER_SEC + timeout;
   else
     lock->timeout = 0;
+
+  if (lock->manager)
+    lock_manager_update (lock->manager, lock);
 }
 
 DAVLock *
@@ -58,6 +62,8 @@ dav_lock_free (DAVLock *lock)
 {
   g_return_if_fail (lock);
 
+  if (lock->manager)
+    lock_manager_remove (lock->manager, lock);
   path_remove_lock (lock->path, lock);
   path_unref (lock->path);
 
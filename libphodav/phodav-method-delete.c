@@ -16,7 +16,17 @@
  */
 
 #include "phodav-priv.h"
+#include "phodav-utils.h"
 #include "phodav-multistatus.h"
+#include "phodav-virtual-dir.h"
+
+#ifdef HAVE_UNLINKAT
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 static gint
 error_to_status (GError *err)
@@ -29,41 +39,51 @@ error_to_status (GError *err)
   return SOUP_STATUS_FORBIDDEN;
 }
 
-gint
-phodav_delete_file (const gchar *path, GFile *file,
-                    GHashTable *mstatus,
-                    GCancellable *cancellable)
+typedef struct _DeleteChildren
 {
-  GError *error = NULL;
-  GFileEnumerator *e;
-  gint status = SOUP_STATUS_NO_CONTENT;
+  const gchar  *path;
+  GFile        *file;
+  GHashTable   *mstatus;
+  guint         batch_size;
+  GCancellable *cancellable;
+} DeleteChildren;
 
-  e = g_file_enumerate_children (file, "standard::*", G_FILE_QUERY_INFO_NONE,
-                                 cancellable, NULL);
-  if (e)
-    {
-      while (1)
-        {
-          GFileInfo *info = g_file_enumerator_next_file (e, cancellable, &error);
-          if (!info)
-            break;
-          GFile *del = g_file_get_child (file, g_file_info_get_name (info));
-          gchar *escape = g_markup_escape_text (g_file_info_get_name (info), -1);
-          gchar *del_path = g_build_path ("/", path, escape, NULL);
-          phodav_delete_file (del_path, del, mstatus, cancellable);
-          g_object_unref (del);
-          g_object_unref (info);
-          g_free (escape);
-          g_free (del_path);
-        }
+static gint delete_file_gio (const gchar *path, GFile *file,
+                             GHashTable *mstatus, guint batch_size,
+                             GCancellable *cancellable);
 
-      g_file_enumerator_close (e, cancellable, NULL);
-      g_clear_object (&e);
-    }
+static gboolean
+delete_child (GFileInfo *info, gpointer data)
+{
+  DeleteChildren *d = data;
+  GFile *del = g_file_get_child (d->file, g_file_info_get_name (info));
+  gchar *escape = g_markup_escape_text (g_file_info_get_name (info), -1);
+  gchar *del_path = g_build_path ("/", d->path, escape, NULL);
 
-  if (error)
+  delete_file_gio (del_path, del, d->mstatus, d->batch_size, d->cancellable);
+  g_object_unref (del);
+  g_free (escape);
+  g_free (del_path);
+
+  return TRUE;
+}
+
+static gint
+delete_file_gio (const gchar *path, GFile *file,
+                 GHashTable *mstatus, guint batch_size,
+                 GCancellable *cancellable)
+{
+  DeleteChildren d = { path, file, mstatus, batch_size, cancellable };
+  GError *error = NULL;
+  gint status = SOUP_STATUS_NO_CONTENT;
+
+  if (!phodav_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                  G_FILE_QUERY_INFO_NONE, batch_size,
+                                  delete_child, &d, cancellable, &error))
     {
-      g_warning ("DELETE: enumeration error: %s", error->message);
+      if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY) &&
+          !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_warning ("DELETE: enumeration error: %s", error->message);
       g_clear_error (&error);
     }
 
@@ -84,6 +104,306 @@ phodav_delete_file (const gchar *path, GFile *file,
   return status;
 }
 
+#ifdef HAVE_UNLINKAT
+/* Local trees are removed with fd-relative calls: every directory is
+ * opened, and its entries removed, relative to the fd of its parent
+ * only, never through a path of several components, so that a
+ * directory replaced by a link meanwhile does not lead out of the
+ * tree. Each directory is a task, on a thread pool with several
+ * threads, or else run in the request thread. A directory is removed
+ * by the last of its tasks to finish, unless one of its members could
+ * not be, and keeps its fd open until then. The deepest ones are run
+ * first, which bounds the open fds. Hrefs are only built for the
+ * entries that failed. */
+
+typedef struct _DeleteDir DeleteDir;
+
+struct _DeleteDir
+{
+  DeleteDir *parent;
+  gchar     *name;
+  gchar     *relpath; /* from the root, for the errors */
+  guint      depth;
+  int        fd;
+  gint       pending;
+  gint       failed;
+};
+
+typedef struct _DeleteTree
+{
+  const gchar  *path;
+  GCancellable *cancellable;
+  GThreadPool  *pool;
+  GQueue        queue; /* without a pool */
+
+  GMutex        mutex;
+  GCond         cond;
+  gboolean      done;
+  GHashTable   *mstatus;
+} DeleteTree;
+
+static DeleteDir *
+delete_dir_new (DeleteDir *parent, const gchar *name)
+{
+  DeleteDir *dir = g_slice_new (DeleteDir);
+
+  dir->parent = parent;
+  dir->name = g_strdup (name);
+  dir->relpath = !parent ? g_strdup ("") : !parent->parent ? g_strdup (name) :
+    g_strconcat (parent->relpath, "/", name, NULL);
+  dir->depth = parent ? parent->depth + 1 : 0;
+  dir->fd = -1;
+  dir->pending = 1;
+  dir->failed = FALSE;
+  if (parent)
+    g_atomic_int_inc (&parent->pending);
+
+  return dir;
+}
+
+static void
+delete_dir_free (DeleteDir *dir)
+{
+  if (dir->fd >= 0)
+    close (dir->fd);
+  g_free (dir->name);
+  g_free (dir->relpath);
+  g_slice_free (DeleteDir, dir);
+}
+
+static gint
+delete_dir_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const DeleteDir *da = a, *db = b;
+
+  return (da->depth < db->depth) - (da->depth > db->depth);
+}
+
+static void
+delete_tree_push (DeleteTree *tree, DeleteDir *dir)
+{
+  if (tree->pool)
+    g_thread_pool_push (tree->pool, dir, NULL);
+  else
+    g_queue_push_head (&tree->queue, dir);
+}
+
+static void
+delete_tree_add_error (DeleteTree *tree, const gchar *relpath, int errsv)
+{
+  gchar *escape;
+
+  if (!tree->mstatus)
+    return;
+
+  escape = g_markup_escape_text (relpath, -1);
+  g_mutex_lock (&tree->mutex);
+  g_hash_table_insert (tree->mstatus,
+                       g_build_path ("/", tree->path, escape, NULL),
+                       response_new (NULL, errsv == ENOENT ?
+                                     SOUP_STATUS_NOT_FOUND : SOUP_STATUS_FORBIDDEN));
+  g_mutex_unlock (&tree->mutex);
+  g_free (escape);
+}
+
+static void
+delete_dir_release (DeleteTree *tree, DeleteDir *dir)
+{
+  while (g_atomic_int_dec_and_test (&dir->pending))
+    {
+      DeleteDir *parent = dir->parent;
+
+      if (!parent)
+        {
+          g_mutex_lock (&tree->mutex);
+          tree->done = TRUE;
+          g_cond_signal (&tree->cond);
+          g_mutex_unlock (&tree->mutex);
+          return;
+        }
+
+      /* the parent is still open, it waits for this one */
+      if (dir->fd >= 0)
+        {
+          close (dir->fd);
+          dir->fd = -1;
+        }
+      if (g_atomic_int_get (&dir->failed))
+        g_atomic_int_set (&parent->failed, TRUE);
+      else if (unlinkat (parent->fd, dir->name, AT_REMOVEDIR) < 0 &&
+               errno != ENOENT)
+        {
+          delete_tree_add_error (tree, dir->relpath, errno);
+          g_atomic_int_set (&parent->failed, TRUE);
+        }
+
+      delete_dir_free (dir);
+      dir = parent;
+    }
+}
+
+static void
+delete_dir_run (gpointer data, gpointer user_data)
+{
+  DeleteDir *dir = data;
+  DeleteTree *tree = user_data;
+  struct dirent *entry;
+  DIR *d = NULL;
+  int fd;
+
+  if (dir->parent)
+    dir->fd = openat (dir->parent->fd, dir->name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+  /* readdir() gets its own fd, this one is kept for the children */
+  fd = dir->fd >= 0 ? fcntl (dir->fd, F_DUPFD_CLOEXEC, 0) : -1;
+  if (fd < 0 || !(d = fdopendir (fd)))
+    {
+      delete_tree_add_error (tree, dir->relpath, errno);
+      g_atomic_int_set (&dir->failed, TRUE);
+      if (fd >= 0)
+        close (fd);
+      goto end;
+    }
+
+  while ((entry = readdir (d)))
+    {
+      const gchar *name = entry->d_name;
+      gboolean is_dir = entry->d_type == DT_DIR;
+
+      if (!strcmp (name, ".") || !strcmp (name, ".."))
+        continue;
+
+      if (g_cancellable_is_cancelled (tree->cancellable))
+        {
+          g_atomic_int_set (&dir->failed, TRUE);
+          break;
+        }
+
+      if (entry->d_type == DT_UNKNOWN)
+        {
+          struct stat st;
+
+          is_dir = fstatat (dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            S_ISDIR (st.st_mode);
+        }
+
+      if (is_dir)
+        delete_tree_push (tree, delete_dir_new (dir, name));
+      else if (unlinkat (dir->fd, name, 0) < 0 && errno != ENOENT)
+        {
+          gchar *relpath = dir->parent ? g_strconcat (dir->relpath, "/", name, NULL) :
+            g_strdup (name);
+
+          delete_tree_add_error (tree, relpath, errno);
+          g_atomic_int_set (&dir->failed, TRUE);
+          g_free (relpath);
+        }
+    }
+
+  closedir (d);
+
+end:
+  delete_dir_release (tree, dir);
+}
+
+static gint
+delete_file_native (const gchar *path, const gchar *local,
+                    GHashTable *mstatus, guint threads,
+                    GCancellable *cancellable)
+{
+  DeleteTree tree = { path, cancellable, };
+  DeleteDir *root, *dir;
+  gint status = SOUP_STATUS_NO_CONTENT;
+  int errsv = 0;
+
+  if (unlink (local) == 0)
+    goto end;
+
+  if (errno != EISDIR && errno != EPERM)
+    {
+      errsv = errno;
+      goto end;
+    }
+
+  root = delete_dir_new (NULL, "");
+  root->fd = open (local, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (root->fd < 0)
+    {
+      errsv = errno;
+      delete_dir_free (root);
+      goto end;
+    }
+
+  tree.mstatus = mstatus;
+  if (threads > 1)
+    {
+      tree.pool = g_thread_pool_new (delete_dir_run, &tree, threads, FALSE, NULL);
+      g_thread_pool_set_sort_function (tree.pool, delete_dir_compare, NULL);
+    }
+  g_mutex_init (&tree.mutex);
+  g_cond_init (&tree.cond);
+
+  delete_tree_push (&tree, root);
+  if (tree.pool)
+    {
+      g_mutex_lock (&tree.mutex);
+      while (!tree.done)
+        g_cond_wait (&tree.cond, &tree.mutex);
+      g_mutex_unlock (&tree.mutex);
+      g_thread_pool_free (tree.pool, FALSE, TRUE);
+    }
+  else
+    while ((dir = g_queue_pop_head (&tree.queue)))
+      delete_dir_run (dir, &tree);
+
+  g_mutex_clear (&tree.mutex);
+  g_cond_clear (&tree.cond);
+
+  /* the failed members are reported instead of the collection, the
+   * rest is left when cancelled */
+  if (g_cancellable_is_cancelled (cancellable))
+    status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+  else if (root->failed)
+    status = SOUP_STATUS_MULTI_STATUS;
+  else if (rmdir (local) < 0)
+    errsv = errno;
+  delete_dir_free (root);
+
+end:
+  if (errsv)
+    {
+      status = errsv == ENOENT ? SOUP_STATUS_NOT_FOUND : SOUP_STATUS_FORBIDDEN;
+      if (mstatus)
+        g_hash_table_insert (mstatus, g_strdup (path),
+                             response_new (NULL, status));
+    }
+
+  return status;
+}
+#endif
+
+gint
+phodav_delete_file (const gchar *path, GFile *file,
+                    GHashTable *mstatus, guint batch_size, guint threads,
+                    GCancellable *cancellable)
+{
+#ifdef HAVE_UNLINKAT
+  /* the path of a virtual dir is not what it contains */
+  gchar *local = PHODAV_IS_VIRTUAL_DIR (file) ? NULL : g_file_get_path (file);
+
+  if (local)
+    {
+      gint status = delete_file_native (path, local, mstatus, threads, cancellable);
+
+      g_free (local);
+      return status;
+    }
+#endif
+
+  return delete_file_gio (path, file, mstatus, batch_size, cancellable);
+}
+
 gint
 phodav_method_delete (PathHandler *handler, SoupServerMessage *msg,
                       const char *path, GError **err)
@@ -105,8 +425,15 @@ phodav_method_delete (PathHandler *handler, SoupServerMessage *msg,
   mstatus = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                                    (GDestroyNotify) response_free);
 
-  status = phodav_delete_file (path, file, mstatus, cancellable);
-  if (status == SOUP_STATUS_NO_CONTENT)
+  status = phodav_delete_file (path, file, mstatus,
+                               handler_get_enumerate_batch_size (handler),
+                               handler_get_worker_threads (handler),
+                               cancellable);
+  server_file_changed (handler_get_server (handler), file);
+  /* a partial delete still removed most of the members */
+  if (status == SOUP_STATUS_NO_CONTENT || status == SOUP_STATUS_MULTI_STATUS)
+    server_purge_path (handler_get_server (handler), path, NULL);
+  if (status == SOUP_STATUS_NO_CONTENT || status == SOUP_STATUS_MULTI_STATUS)
     if (g_hash_table_size (mstatus) > 0)
       status = set_response_multistatus (msg, mstatus);
 
@@ -16,6 +16,17 @@
  */
 
 #include "phodav-priv.h"
+#include "phodav-utils.h"
+
+#include "guuid.h"
+
+#ifdef HAVE_SENDFILE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <glib/gstdio.h>
+#endif
 
 static int
 compare_strings (gconstpointer a, gconstpointer b)
@@ -26,38 +37,37 @@ compare_strings (gconstpointer a, gconstpointer b)
   return g_strcmp0 (*sa, *sb);
 }
 
+static gboolean
+listing_add_entry (GFileInfo *info, gpointer data)
+{
+  GPtrArray *entries = data;
+  gboolean dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+
+  g_ptr_array_add (entries,
+                   g_markup_printf_escaped ("%s%s",
+                                            g_file_info_get_name (info), dir ? "/" : ""));
+
+  return TRUE;
+}
+
 static GString *
-get_directory_listing (GFile *file, GCancellable *cancellable, GError **err)
+get_directory_listing (PathHandler *handler, GFile *file,
+                       GCancellable *cancellable, GError **err)
 {
   GString *listing;
   GPtrArray *entries;
-  GFileEnumerator *e;
   gchar *escaped;
   gchar *name;
   gint i;
 
-  e = g_file_enumerate_children (file, "standard::*", G_FILE_QUERY_INFO_NONE,
-                                 cancellable, err);
-  g_return_val_if_fail (e != NULL, NULL);
-
-  entries = g_ptr_array_new ();
-  while (1)
+  entries = g_ptr_array_new_with_free_func (g_free);
+  if (!handler_enumerate_children (handler, file, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                   G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                   listing_add_entry, entries, cancellable, err))
     {
-      GFileInfo *info = g_file_enumerator_next_file (e, cancellable, err);
-      gboolean dir;
-
-      if (!info)
-        break;
-
-      dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
-
-      escaped = g_markup_printf_escaped ("%s%s",
-                                         g_file_info_get_name (info), dir ? "/" : "");
-      g_ptr_array_add (entries, escaped);
-      g_object_unref (info);
+      g_ptr_array_free (entries, TRUE);
+      return NULL;
     }
-  g_file_enumerator_close (e, cancellable, NULL);
-  g_clear_object (&e);
 
   g_ptr_array_sort (entries, compare_strings);
 
@@ -69,12 +79,9 @@ get_directory_listing (GFile *file, GCancellable *cancellable, GError **err)
   g_string_append_printf (listing, "<body><h1>Index of %s</h1>\r\n<p>\r\n", escaped);
   g_free (escaped);
   for (i = 0; i < entries->len; i++)
-    {
-      g_string_append_printf (listing, "<a href=\"%s\">%s</a><br/>\r\n",
-                              (gchar *) entries->pdata[i],
-                              (gchar *) entries->pdata[i]);
-      g_free (entries->pdata[i]);
-    }
+    g_string_append_printf (listing, "<a href=\"%s\">%s</a><br/>\r\n",
+                            (gchar *) entries->pdata[i],
+                            (gchar *) entries->pdata[i]);
   g_string_append (listing, "</p></body>\r\n</html>\r\n");
 
   g_ptr_array_free (entries, TRUE);
@@ -82,31 +89,782 @@ get_directory_listing (GFile *file, GCancellable *cancellable, GError **err)
 }
 
 static gint
-method_get (SoupServerMessage *msg, GFile *file,
+compare_ranges (gconstpointer a, gconstpointer b)
+{
+  const SoupRange *ra = a;
+  const SoupRange *rb = b;
+
+  return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+/* parses a "bytes=" Range header for a resource of @total bytes into
+ * sorted, coalesced @ranges. Returns SOUP_STATUS_PARTIAL_CONTENT if some
+ * range is satisfiable, SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE if none
+ * is, or SOUP_STATUS_OK if the header is invalid and must be ignored */
+static gint
+parse_ranges (const gchar *header, goffset total, GArray *ranges)
+{
+  gint status = SOUP_STATUS_OK;
+  gchar **specs;
+  guint i, j;
+
+  if (!g_str_has_prefix (header, "bytes="))
+    return SOUP_STATUS_OK;
+
+  specs = g_strsplit (header + strlen ("bytes="), ",", -1);
+  for (i = 0; specs[i]; i++)
+    {
+      gchar *spec = g_strstrip (specs[i]);
+      guint64 start, last;
+      SoupRange range;
+      gchar *end;
+
+      if (!*spec)
+        continue;
+
+      if (*spec == '-')
+        {
+          guint64 suffix;
+
+          if (!g_ascii_isdigit (spec[1]))
+            goto invalid;
+          suffix = g_ascii_strtoull (spec + 1, &end, 10);
+          if (*end)
+            goto invalid;
+          if (suffix == 0)
+            continue;
+
+          if (total == 0)
+            continue;
+
+          range.start = suffix < (guint64) total ? total - (goffset) suffix : 0;
+          range.end = total - 1;
+        }
+      else
+        {
+          if (!g_ascii_isdigit (*spec))
+            goto invalid;
+          start = g_ascii_strtoull (spec, &end, 10);
+          if (*end != '-')
+            goto invalid;
+
+          spec = end + 1;
+          last = G_MAXUINT64;
+          if (*spec)
+            {
+              if (!g_ascii_isdigit (*spec))
+                goto invalid;
+              last = g_ascii_strtoull (spec, &end, 10);
+              if (*end || last < start)
+                goto invalid;
+            }
+
+          /* compared unsigned, before the values can fit a goffset */
+          if (start >= (guint64) total)
+            continue;
+
+          range.start = start;
+          range.end = MIN (last, (guint64) total - 1);
+        }
+
+      g_array_append_val (ranges, range);
+    }
+
+  if (ranges->len == 0)
+    {
+      status = SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE;
+      goto end;
+    }
+
+  /* overlapping and adjacent ranges are merged, see RFC 7233 4.1 */
+  g_array_sort (ranges, compare_ranges);
+  for (i = 0, j = 1; j < ranges->len; j++)
+    {
+      SoupRange *cur = &g_array_index (ranges, SoupRange, i);
+      SoupRange *next = &g_array_index (ranges, SoupRange, j);
+
+      if (next->start <= cur->end + 1)
+        cur->end = MAX (cur->end, next->end);
+      else
+        g_array_index (ranges, SoupRange, ++i) = *next;
+    }
+  g_array_set_size (ranges, i + 1);
+
+  status = SOUP_STATUS_PARTIAL_CONTENT;
+  goto end;
+
+invalid:
+  g_array_set_size (ranges, 0);
+
+end:
+  g_strfreev (specs);
+  return status;
+}
+
+/* If-Range validates against the strong ETag or the modification date */
+static gboolean
+check_if_range (const gchar *if_range, const gchar *etag, GFileInfo *info)
+{
+  GDateTime *date, *mtime;
+  gboolean match;
+
+  if (*if_range == '"' || g_str_has_prefix (if_range, "W/"))
+    {
+      gchar *tmp;
+
+      if (!etag)
+        return FALSE;
+
+      tmp = g_strdup_printf ("\"%s\"", etag);
+      match = !g_strcmp0 (tmp, if_range);
+      g_free (tmp);
+
+      return match;
+    }
+
+  date = soup_date_time_new_from_http_string (if_range);
+  mtime = g_file_info_get_modification_date_time (info);
+  match = date && mtime &&
+    g_date_time_to_unix (date) == g_date_time_to_unix (mtime);
+
+  g_clear_pointer (&date, g_date_time_unref);
+  g_clear_pointer (&mtime, g_date_time_unref);
+
+  return match;
+}
+
+/* decides whether @msg gets the full representation (SOUP_STATUS_OK),
+ * the satisfiable @ranges (SOUP_STATUS_PARTIAL_CONTENT), or nothing
+ * (SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) */
+static gint
+get_ranges (SoupServerMessage *msg, GFileInfo *info, const gchar *etag,
+            goffset total, GArray *ranges)
+{
+  SoupMessageHeaders *request_headers = soup_server_message_get_request_headers (msg);
+  const gchar *range = soup_message_headers_get_one (request_headers, "Range");
+  const gchar *if_range = soup_message_headers_get_one (request_headers, "If-Range");
+  gint status = SOUP_STATUS_OK;
+
+  if (!range)
+    return SOUP_STATUS_OK;
+
+  if (!if_range || check_if_range (if_range, etag, info))
+    status = parse_ranges (range, total, ranges);
+
+  if (status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
+    {
+      gchar *tmp = g_strdup_printf ("bytes */%" G_GOFFSET_FORMAT, total);
+      soup_message_headers_replace (soup_server_message_get_response_headers (msg),
+                                    "Content-Range", tmp);
+      g_free (tmp);
+    }
+  else if (status == SOUP_STATUS_OK)
+    {
+      /* SoupServer would otherwise apply the ranges on its own,
+       * flattening the body and ignoring If-Range */
+      soup_message_headers_remove (request_headers, "Range");
+    }
+
+  return status;
+}
+
+#define GET_STREAM_CHUNK_SIZE (64 * 1024)
+#define GET_STREAM_READ_AHEAD 4
+
+typedef struct _GetSegment
+{
+  GBytes  *text;
+  goffset  offset;
+  goffset  length;
+} GetSegment;
+
+static GetSegment *
+get_segment_new (GBytes *text, goffset offset, goffset length)
+{
+  GetSegment *seg = g_slice_new0 (GetSegment);
+
+  seg->text = text;
+  seg->offset = offset;
+  seg->length = length;
+
+  return seg;
+}
+
+static void
+get_segment_free (GetSegment *seg)
+{
+  g_clear_pointer (&seg->text, g_bytes_unref);
+  g_slice_free (GetSegment, seg);
+}
+
+/* Streams @segments of @input into the response body with a bounded
+ * read-ahead, refilling from "wrote-chunk" as the connection drains.
+ * The message keeps a reference through its object data, the pending
+ * read keeps another one. */
+typedef struct _GetStream
+{
+  guint              refs;
+  SoupServerMessage *msg; /* weak, cleared when the message goes away */
+  GInputStream      *input;
+  GCancellable      *cancellable;
+  GQueue            *segments;
+  guint              queued;
+  gboolean           reading;
+} GetStream;
+
+static GetStream *
+get_stream_ref (GetStream *stream)
+{
+  stream->refs++;
+
+  return stream;
+}
+
+static void
+get_stream_unref (GetStream *stream)
+{
+  if (--stream->refs > 0)
+    return;
+
+  g_object_unref (stream->input);
+  g_object_unref (stream->cancellable);
+  g_queue_free_full (stream->segments, (GDestroyNotify) get_segment_free);
+  g_slice_free (GetStream, stream);
+}
+
+static void
+get_stream_release (GetStream *stream)
+{
+  stream->msg = NULL;
+  g_cancellable_cancel (stream->cancellable);
+  get_stream_unref (stream);
+}
+
+static GetStream *
+get_stream_new (GInputStream *input)
+{
+  GetStream *stream = g_slice_new0 (GetStream);
+
+  stream->refs = 1;
+  stream->input = g_object_ref (input);
+  stream->cancellable = g_cancellable_new ();
+  stream->segments = g_queue_new ();
+
+  return stream;
+}
+
+static void get_stream_pump (GetStream *stream);
+
+static void
+get_stream_abort (GetStream *stream)
+{
+  GIOStream *conn;
+
+  /* the promised Content-Length cannot be honoured anymore, the only
+   * way to let the client know is to drop the connection */
+  conn = soup_server_message_steal_connection (stream->msg);
+  stream->msg = NULL;
+  if (conn)
+    {
+      g_io_stream_close (conn, NULL, NULL);
+      g_object_unref (conn);
+    }
+}
+
+static void
+get_stream_append (GetStream *stream, GBytes *bytes)
+{
+  SoupMessageBody *body = soup_server_message_get_response_body (stream->msg);
+
+  stream->queued++;
+  soup_message_body_append_bytes (body, bytes);
+  if (g_queue_is_empty (stream->segments))
+    soup_message_body_complete (body);
+
+  soup_server_message_unpause (stream->msg);
+}
+
+static void
+get_stream_read_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  GetStream *stream = user_data;
+  GError *error = NULL;
+  GetSegment *seg;
+  GBytes *bytes;
+
+  stream->reading = FALSE;
+  bytes = g_input_stream_read_bytes_finish (G_INPUT_STREAM (source_object), res, &error);
+  if (!stream->msg)
+    goto end;
+
+  if (!bytes || g_bytes_get_size (bytes) == 0)
+    {
+      g_warning ("GET stream: %s", error ? error->message : "file truncated");
+      get_stream_abort (stream);
+      goto end;
+    }
+
+  seg = g_queue_peek_head (stream->segments);
+  seg->offset += g_bytes_get_size (bytes);
+  seg->length -= g_bytes_get_size (bytes);
+  if (seg->length == 0)
+    get_segment_free (g_queue_pop_head (stream->segments));
+
+  get_stream_append (stream, bytes);
+  get_stream_pump (stream);
+
+end:
+  g_clear_pointer (&bytes, g_bytes_unref);
+  g_clear_error (&error);
+  get_stream_unref (stream);
+}
+
+static void
+get_stream_pump (GetStream *stream)
+{
+  GError *error = NULL;
+  GetSegment *seg;
+
+  while (stream->msg && !stream->reading &&
+         stream->queued < GET_STREAM_READ_AHEAD &&
+         (seg = g_queue_peek_head (stream->segments)))
+    {
+      GSeekable *seekable = G_SEEKABLE (stream->input);
+
+      if (seg->text)
+        {
+          GBytes *text = g_steal_pointer (&seg->text);
+
+          get_segment_free (g_queue_pop_head (stream->segments));
+          get_stream_append (stream, text);
+          g_bytes_unref (text);
+          continue;
+        }
+
+      if (g_seekable_tell (seekable) != seg->offset &&
+          !g_seekable_seek (seekable, seg->offset, G_SEEK_SET,
+                            stream->cancellable, &error))
+        {
+          g_warning ("GET stream: %s", error->message);
+          g_clear_error (&error);
+          get_stream_abort (stream);
+          return;
+        }
+
+      stream->reading = TRUE;
+      g_input_stream_read_bytes_async (stream->input,
+                                       MIN (seg->length, GET_STREAM_CHUNK_SIZE),
+                                       G_PRIORITY_DEFAULT, stream->cancellable,
+                                       get_stream_read_cb, get_stream_ref (stream));
+    }
+}
+
+static void
+get_stream_wrote_chunk (SoupServerMessage *msg,
+                        gpointer           user_data)
+{
+  GetStream *stream = user_data;
+
+  stream->queued--;
+  get_stream_pump (stream);
+}
+
+static void
+get_stream_finished (SoupServerMessage *msg,
+                     gpointer           user_data)
+{
+  GetStream *stream = user_data;
+
+  stream->msg = NULL;
+  g_cancellable_cancel (stream->cancellable);
+}
+
+static void
+get_stream_start (GetStream *stream, SoupServerMessage *msg, goffset length)
+{
+  SoupMessageHeaders *response_headers = soup_server_message_get_response_headers (msg);
+
+  stream->msg = msg;
+  soup_message_headers_set_content_length (response_headers, length);
+  soup_message_body_set_accumulate (soup_server_message_get_response_body (msg), FALSE);
+
+  g_signal_connect (msg, "wrote-chunk", G_CALLBACK (get_stream_wrote_chunk), stream);
+  g_signal_connect (msg, "finished", G_CALLBACK (get_stream_finished), stream);
+  g_object_set_data_full (G_OBJECT (msg), "phodav-get-stream",
+                          get_stream_ref (stream), (GDestroyNotify) get_stream_release);
+
+  if (g_queue_is_empty (stream->segments))
+    soup_message_body_complete (soup_server_message_get_response_body (msg));
+  else
+    get_stream_pump (stream);
+}
+
+#ifdef HAVE_SENDFILE
+#define GET_SENDFILE_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Sends a file range straight from the page cache to the socket. The
+ * connection is taken from libsoup once the headers are written, and
+ * closed at the end of the body, since it can't be handed back: the
+ * client has to connect again for its next request. That is only
+ * worth it for bodies of the sendfile-threshold or more. libsoup does
+ * not see the body, so the bytes sent are added to the metrics here. */
+typedef struct _GetSendfile
+{
+  PhodavServer *server;
+  const gchar  *method;
+  GIOStream    *conn;
+  GSocket      *socket;
+  GSource      *source;
+  gint          fd;
+  goffset       offset;
+  goffset       remaining;
+  guint64       sent;
+} GetSendfile;
+
+static void
+get_sendfile_free (GetSendfile *sf)
+{
+  if (sf->sent)
+    server_add_bytes_out (sf->server, sf->method, sf->sent);
+  g_object_unref (sf->server);
+  if (sf->source)
+    {
+      g_source_destroy (sf->source);
+      g_source_unref (sf->source);
+    }
+  if (sf->conn)
+    {
+      g_io_stream_close (sf->conn, NULL, NULL);
+      g_object_unref (sf->conn);
+    }
+  g_clear_object (&sf->socket);
+  close (sf->fd);
+  g_slice_free (GetSendfile, sf);
+}
+
+static gboolean
+get_sendfile_pump (GSocket *socket, GIOCondition condition, gpointer user_data)
+{
+  GetSendfile *sf = user_data;
+
+  while (sf->remaining > 0)
+    {
+      off_t offset = sf->offset;
+      gssize n;
+
+      n = sendfile (g_socket_get_fd (sf->socket), sf->fd, &offset,
+                    MIN (sf->remaining, GET_SENDFILE_CHUNK_SIZE));
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n < 0 && errno == EAGAIN)
+        {
+          if (!sf->source)
+            {
+              sf->source = g_socket_create_source (sf->socket, G_IO_OUT, NULL);
+              g_source_set_callback (sf->source, (GSourceFunc) get_sendfile_pump, sf, NULL);
+              g_source_attach (sf->source, g_main_context_get_thread_default ());
+            }
+          return G_SOURCE_CONTINUE;
+        }
+
+      if (n <= 0)
+        {
+          g_warning ("GET sendfile: %s", n < 0 ? g_strerror (errno) : "file truncated");
+          break;
+        }
+
+      sf->offset += n;
+      sf->remaining -= n;
+      sf->sent += n;
+    }
+
+  get_sendfile_free (sf);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+get_sendfile_wrote_headers (SoupServerMessage *msg,
+                            gpointer           user_data)
+{
+  GetSendfile *sf = g_object_steal_data (G_OBJECT (msg), "phodav-get-sendfile");
+
+  g_return_if_fail (sf == user_data);
+
+  sf->socket = g_object_ref (soup_server_message_get_socket (msg));
+  sf->conn = soup_server_message_steal_connection (msg);
+  if (!sf->conn)
+    {
+      get_sendfile_free (sf);
+      return;
+    }
+
+  get_sendfile_pump (sf->socket, G_IO_OUT, sf);
+}
+
+/* TLS and HTTP/2 frame the body themselves, they keep the stream */
+static gboolean
+get_sendfile_start (PathHandler *handler, SoupServerMessage *msg, GFile *file,
+                    goffset offset, goffset length)
+{
+  SoupMessageHeaders *response_headers = soup_server_message_get_response_headers (msg);
+  GetSendfile *sf;
+  gchar *path;
+  gint fd;
+
+  if (length == 0 ||
+      (guint64) length < handler_get_sendfile_threshold (handler) ||
+      g_strcmp0 (g_uri_get_scheme (soup_server_message_get_uri (msg)), "http") ||
+      soup_server_message_get_http_version (msg) == SOUP_HTTP_2_0 ||
+      !soup_server_message_get_socket (msg))
+    return FALSE;
+
+  path = g_file_get_path (file);
+  fd = path ? g_open (path, O_RDONLY | O_CLOEXEC, 0) : -1;
+  g_free (path);
+  if (fd < 0)
+    return FALSE;
+
+  sf = g_slice_new0 (GetSendfile);
+  sf->server = g_object_ref (handler_get_server (handler));
+  sf->method = soup_server_message_get_method (msg);
+  sf->fd = fd;
+  sf->offset = offset;
+  sf->remaining = length;
+
+  soup_message_headers_set_content_length (response_headers, length);
+  soup_message_headers_replace (response_headers, "Connection", "close");
+  soup_message_body_set_accumulate (soup_server_message_get_response_body (msg), FALSE);
+
+  g_signal_connect (msg, "wrote-headers", G_CALLBACK (get_sendfile_wrote_headers), sf);
+  /* freed along with the message if the headers are never written */
+  g_object_set_data_full (G_OBJECT (msg), "phodav-get-sendfile",
+                          sf, (GDestroyNotify) get_sendfile_free);
+
+  return TRUE;
+}
+#endif
+
+/* the response body is made either of slices of a mapping of the whole
+ * file (@buffer), or of segments that are streamed later */
+typedef struct _GetBody
+{
+  SoupMessageBody *body;
+  GBytes          *buffer;
+  GQueue          *segments;
+  goffset          length;
+} GetBody;
+
+static void
+get_body_add_text (GetBody *b, gchar *text)
+{
+  gsize len = strlen (text);
+
+  b->length += len;
+  if (b->buffer)
+    soup_message_body_append (b->body, SOUP_MEMORY_TAKE, text, len);
+  else
+    g_queue_push_tail (b->segments,
+                       get_segment_new (g_bytes_new_take (text, len), 0, 0));
+}
+
+static void
+get_body_add_range (GetBody *b, goffset start, goffset length)
+{
+  b->length += length;
+  if (b->buffer)
+    {
+      GBytes *slice = g_bytes_new_from_bytes (b->buffer, start, length);
+
+      soup_message_body_append_bytes (b->body, slice);
+      g_bytes_unref (slice);
+    }
+  else if (length > 0)
+    g_queue_push_tail (b->segments, get_segment_new (NULL, start, length));
+}
+
+/* serves @ranges of a resource of @total bytes, as a single part
+ * or as multipart/byteranges */
+static void
+append_ranges (SoupServerMessage *msg, GetBody *b, goffset total,
+               GArray *ranges, const gchar *content_type)
+{
+  SoupMessageHeaders *response_headers = soup_server_message_get_response_headers (msg);
+  gchar *boundary, *tmp;
+  guint i;
+
+  if (ranges->len == 1)
+    {
+      SoupRange *range = &g_array_index (ranges, SoupRange, 0);
+
+      soup_message_headers_set_content_range (response_headers,
+                                              range->start, range->end, total);
+      get_body_add_range (b, range->start, range->end - range->start + 1);
+      return;
+    }
+
+  boundary = g_uuid_string_random ();
+  tmp = g_strdup_printf ("multipart/byteranges; boundary=%s", boundary);
+  soup_message_headers_replace (response_headers, "Content-Type", tmp);
+  g_free (tmp);
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      SoupRange *range = &g_array_index (ranges, SoupRange, i);
+
+      get_body_add_text (b, g_strdup_printf ("%s--%s\r\n"
+                                             "Content-Type: %s\r\n"
+                                             "Content-Range: bytes %" G_GOFFSET_FORMAT "-%"
+                                             G_GOFFSET_FORMAT "/%" G_GOFFSET_FORMAT "\r\n\r\n",
+                                             i ? "\r\n" : "", boundary, content_type,
+                                             range->start, range->end, total));
+      get_body_add_range (b, range->start, range->end - range->start + 1);
+    }
+
+  get_body_add_text (b, g_strdup_printf ("\r\n--%s--\r\n", boundary));
+  g_free (boundary);
+}
+
+static gint
+get_file_body (PathHandler *handler, SoupServerMessage *msg, GFile *file, GFileInfo *info,
+               const gchar *etag, guint64 stream_threshold,
+               GCancellable *cancellable, GError **err)
+{
+  const gchar *content_type = g_file_info_get_content_type (info) ? : "application/octet-stream";
+  GetBody b = { .body = soup_server_message_get_response_body (msg), };
+  GMappedFile *mapping = NULL;
+  GFileInputStream *input = NULL;
+  GetStream *stream = NULL;
+  GArray *ranges;
+  goffset total = g_file_info_get_size (info);
+  gint status;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (SoupRange));
+  status = get_ranges (msg, info, etag, total, ranges);
+  if (status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
+    goto end;
+
+#ifdef HAVE_SENDFILE
+  /* a single range is sent from the file itself, without mapping or
+   * reading it */
+  if (status == SOUP_STATUS_OK || ranges->len == 1)
+    {
+      SoupRange *range = &g_array_index (ranges, SoupRange, 0);
+      goffset start = status == SOUP_STATUS_OK ? 0 : range->start;
+      goffset length = status == SOUP_STATUS_OK ? total : range->end - range->start + 1;
+
+      if (get_sendfile_start (handler, msg, file, start, length))
+        {
+          if (status == SOUP_STATUS_PARTIAL_CONTENT)
+            soup_message_headers_set_content_range (soup_server_message_get_response_headers (msg),
+                                                    range->start, range->end, total);
+          goto end;
+        }
+    }
+#endif
+
+  if ((guint64) total <= stream_threshold)
+    {
+      gchar *path = g_file_get_path (file);
+
+      /* a failed mapping, e.g. a file too large for the address space,
+       * falls back to streaming, and so does a file that changed size
+       * since it was queried */
+      mapping = path ? g_mapped_file_new (path, FALSE, NULL) : NULL;
+      g_free (path);
+      if (mapping && g_mapped_file_get_length (mapping) != (gsize) total)
+        g_clear_pointer (&mapping, g_mapped_file_unref);
+    }
+
+  if (mapping)
+    b.buffer = g_bytes_new_with_free_func (g_mapped_file_get_contents (mapping),
+                                           g_mapped_file_get_length (mapping),
+                                           (GDestroyNotify) g_mapped_file_unref,
+                                           mapping);
+  else
+    {
+      input = g_file_read (file, cancellable, err);
+      if (!input)
+        {
+          status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+          goto end;
+        }
+
+      stream = get_stream_new (G_INPUT_STREAM (input));
+      b.segments = stream->segments;
+    }
+
+  if (status == SOUP_STATUS_PARTIAL_CONTENT)
+    append_ranges (msg, &b, total, ranges, content_type);
+  else
+    get_body_add_range (&b, 0, total);
+
+  if (stream)
+    get_stream_start (stream, msg, b.length);
+
+end:
+  g_array_unref (ranges);
+  g_clear_pointer (&b.buffer, g_bytes_unref);
+  g_clear_pointer (&stream, get_stream_unref);
+  g_clear_object (&input);
+
+  return status;
+}
+
+static gint
+method_get (PathHandler *handler, SoupServerMessage *msg, GFile *file,
             GCancellable *cancellable, GError **err)
 {
   GError *error = NULL;
   gint status = SOUP_STATUS_NOT_FOUND;
   GFileInfo *info;
   const gchar *etag;
+  GDateTime *mtime;
   SoupMessageHeaders *response_headers;
   const char *method;
 
-  info = g_file_query_info (file, "standard::*,etag::*",
-                            G_FILE_QUERY_INFO_NONE, cancellable, &error);
+  info = handler_query_info (handler, file, "standard::*,etag::*,time::modified",
+                             cancellable, &error);
   if (!info)
     goto end;
 
   if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
     {
+      GConverter *compressor = NULL;
       GString *listing;
       gsize len;
 
-      listing = get_directory_listing (file, cancellable, err);
+      listing = get_directory_listing (handler, file, cancellable, &error);
+      if (!listing)
+        {
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            status = SOUP_STATUS_NOT_FOUND;
+          else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED))
+            status = SOUP_STATUS_FORBIDDEN;
+          else
+            status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+          goto end;
+        }
+
       len = listing->len;
-      soup_server_message_set_response (msg, "text/html; charset=utf-8",
-                                        SOUP_MEMORY_TAKE,
-                                        g_string_free_and_steal (listing), len);
+      response_add_vary (msg);
+      if (len >= COMPRESSOR_MIN_SIZE)
+        compressor = response_compressor_new (msg);
+
+      if (compressor)
+        {
+          soup_server_message_set_response (msg, "text/html; charset=utf-8",
+                                            SOUP_MEMORY_STATIC, NULL, 0);
+          response_compressor_append (compressor, msg, listing->str, len, TRUE);
+          g_string_free (listing, TRUE);
+          g_object_unref (compressor);
+        }
+      else
+        soup_server_message_set_response (msg, "text/html; charset=utf-8",
+                                          SOUP_MEMORY_TAKE,
+                                          g_string_free_and_steal (listing), len);
       status = SOUP_STATUS_OK;
       goto end;
     }
@@ -123,32 +881,28 @@ method_get (SoupServerMessage *msg, GFile *file,
       g_free (tmp);
     }
 
+  mtime = g_file_info_get_modification_date_time (info);
+  if (mtime)
+    {
+      gchar *tmp = soup_date_time_to_string (mtime, SOUP_DATE_HTTP);
+      soup_message_headers_append (response_headers, "Last-Modified", tmp);
+      g_free (tmp);
+      g_date_time_unref (mtime);
+    }
+
+  /* a revalidation costs the stat above, and nothing is opened */
+  status = phodav_check_preconditions (msg, info);
+  if (status != SOUP_STATUS_OK)
+    goto end;
+
   soup_message_headers_set_content_type (response_headers,
                                          g_file_info_get_content_type (info), NULL);
+  soup_message_headers_append (response_headers, "Accept-Ranges", "bytes");
 
   method = soup_server_message_get_method (msg);
   if (method == SOUP_METHOD_GET)
-    {
-      GMappedFile *mapping;
-      GBytes *buffer;
-      gchar *path = g_file_get_path (file);
-
-      mapping = g_mapped_file_new (path, FALSE, NULL);
-      g_free (path);
-      if (!mapping)
-        {
-          status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
-          goto end;
-        }
-
-      buffer = g_bytes_new_with_free_func (g_mapped_file_get_contents (mapping),
-                                           g_mapped_file_get_length (mapping),
-                                           (GDestroyNotify) g_mapped_file_unref,
-                                           mapping);
-      soup_message_body_append_bytes (soup_server_message_get_response_body (msg), buffer);
-      g_bytes_unref (buffer);
-      status = SOUP_STATUS_OK;
-    }
+    status = get_file_body (handler, msg, file, info, etag,
+                            handler_get_stream_threshold (handler), cancellable, err);
   else if (method == SOUP_METHOD_HEAD)
     {
       gchar *length;
@@ -190,7 +944,7 @@ phodav_method_get (PathHandler *handler, SoupServerMessage *msg, const char *pat
   gint status;
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
-  status = method_get (msg, file, cancellable, err);
+  status = method_get (handler, msg, file, cancellable, err);
   g_object_unref (file);
 
   return status;
@@ -52,7 +52,7 @@ try_add_lock (PhodavServer *server, const gchar *path, DAVLock *lock)
     return FALSE;
 
   p = server_get_path (server, path);
-  path_add_lock (p, lock);
+  server_add_lock (server, p, lock);
 
   return TRUE;
 }
@@ -78,6 +78,9 @@ lock_ensure_file (PathHandler *handler, const char *path,
         g_propagate_error (err, e);
     }
 
+  if (created)
+    server_file_changed (handler_get_server (handler), file);
+
   g_clear_object (&stream);
   g_clear_object (&file);
 
@@ -215,7 +218,7 @@ phodav_method_lock (PathHandler *handler, SoupServerMessage *msg,
   if (!try_add_lock (handler_get_server (handler), path, lock))
     {
       g_warning ("lock failed");
-      dav_lock_free (lock);
+      server_release_lock (handler_get_server (handler), lock);
       status = SOUP_STATUS_LOCKED;
       goto end;
     }
@@ -65,6 +65,7 @@ phodav_method_mkcol (PathHandler *handler, SoupServerMessage *msg,
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
   status = do_mkcol_file (msg, file, cancellable, err);
+  server_file_changed (handler_get_server (handler), file);
 
 end:
   g_clear_object (&file);
@@ -15,65 +15,110 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include "phodav-priv.h"
 #include "phodav-utils.h"
 #include "phodav-lock.h"
+#include "phodav-copy.h"
+#include "phodav-multistatus.h"
 #include "phodav-virtual-dir.h"
+#include "phodav-store.h"
+#include "phodav-path.h"
+
+#ifdef G_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#endif
 
+/* a MOVE within a file system is a rename, of directories too: an
+ * overwritten destination is atomically swapped with the source and
+ * then deleted, the members left behind are reported in @mstatus.
+ * G_IO_ERROR_NOT_SUPPORTED asks the caller to fall back, for
+ * instance across devices. */
 static gboolean
-do_copy_r (GFile *src, GFile *dest, GFileCopyFlags flags,
-           GCancellable *cancellable, GError **err)
+move_file_rename (GFile *file, GFile *dest, const gchar *path,
+                  gboolean overwrite, guint batch_size, guint threads,
+                  GHashTable *mstatus, GCancellable *cancellable, GError **err)
 {
-  GFileEnumerator *e = NULL;
   gboolean success = FALSE;
-  GFile *src_child = NULL;
-  GFile *dest_child = NULL;
+#ifdef G_OS_UNIX
+  gchar *src_path = g_file_get_path (file);
+  gchar *dest_path = g_file_get_path (dest);
+#ifdef HAVE_RENAMEAT2
+  gint status;
+#endif
+  int r = -1;
 
-  if (!g_file_make_directory_with_parents (dest, cancellable, err))
-    goto end;
-
-  e = g_file_enumerate_children (src, "standard::*", G_FILE_QUERY_INFO_NONE,
-                                 cancellable, err);
-  if (!e)
-    goto end;
+  if (!src_path || !dest_path)
+    goto unsupported;
 
-  while (1)
+  if (!overwrite)
     {
-      GFileInfo *info = g_file_enumerator_next_file (e, cancellable, err);
-      if (!info)
-        break;
-
-      src_child = g_file_get_child (src, g_file_info_get_name (info));
-      dest_child = g_file_get_child (dest, g_file_info_get_name (info));
-      gboolean isdir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
-      g_object_unref (info);
-
-      if (isdir)
+#ifdef HAVE_RENAMEAT2
+      r = renameat2 (AT_FDCWD, src_path, AT_FDCWD, dest_path, RENAME_NOREPLACE);
+      if (r < 0 && errno == EINVAL)
+        goto unsupported;
+#else
+      goto unsupported;
+#endif
+    }
+  else
+    {
+      r = rename (src_path, dest_path);
+      if (r < 0 && (errno == EISDIR || errno == ENOTDIR ||
+                    errno == ENOTEMPTY || errno == EEXIST))
         {
-          if (!do_copy_r (src_child, dest_child, flags, cancellable, err))
-            goto end;
+#ifdef HAVE_RENAMEAT2
+          if (renameat2 (AT_FDCWD, src_path, AT_FDCWD, dest_path, RENAME_EXCHANGE) < 0)
+            goto unsupported;
+
+          /* the old destination is now in place of the source */
+          status = phodav_delete_file (path, file, mstatus, batch_size, threads,
+                                       cancellable);
+          if (status != SOUP_STATUS_NO_CONTENT && g_hash_table_size (mstatus) == 0)
+            g_hash_table_insert (mstatus, g_strdup (path), response_new (NULL, status));
+          r = 0;
+#else
+          goto unsupported;
+#endif
         }
-      else if (!g_file_copy (src_child, dest_child, flags, cancellable, NULL, NULL, err))
-        goto end;
+    }
+
+  /* EINVAL also covers moving a directory into itself */
+  if (r < 0 && (errno == EXDEV || errno == EINVAL))
+    goto unsupported;
 
-      g_clear_object (&src_child);
-      g_clear_object (&dest_child);
+  if (r < 0)
+    {
+      int errsv = errno;
+
+      g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s: %s", dest_path, g_strerror (errsv));
     }
+  else
+    success = TRUE;
 
-  success = TRUE;
+  goto end;
 
+unsupported:
+#endif
+  g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "rename not possible");
+#ifdef G_OS_UNIX
 end:
-  g_clear_object (&e);
-  g_clear_object (&src_child);
-  g_clear_object (&dest_child);
-
+  g_free (src_path);
+  g_free (dest_path);
+#endif
   return success;
 }
 
 static gint
-do_movecopy_file (SoupServerMessage *msg, GFile *file,
+do_movecopy_file (SoupServerMessage *msg, const gchar *path, GFile *file,
                   GFile *dest, const gchar *dest_path,
-                  GCancellable *cancellable, GError **err)
+                  guint batch_size, guint threads, GThreadPool *pool,
+                  GHashTable *mstatus, GCancellable *cancellable, GError **err)
 {
   GError *error = NULL;
   gboolean overwrite;
@@ -97,14 +142,21 @@ again:
     {
     case DEPTH_INFINITY:
     case DEPTH_ZERO: {
-        copy
-        ? g_file_copy (file, dest, flags, cancellable, NULL, NULL, &error)
-        : g_file_move (file, dest, flags, cancellable, NULL, NULL, &error);
+        if (copy)
+          phodav_copy_file (file, dest, flags, cancellable, &error);
+        else if (!PHODAV_IS_VIRTUAL_DIR (file) &&
+                 !move_file_rename (file, dest, path, overwrite, batch_size,
+                                    threads, mstatus, cancellable, &error) &&
+                 g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+          {
+            g_clear_error (&error);
+            g_file_move (file, dest, flags, cancellable, NULL, NULL, &error);
+          }
 
         if (overwrite && !retry &&
             (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY) ||
              g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_MERGE)) &&
-            phodav_delete_file (dest_path, dest, NULL, cancellable) == SOUP_STATUS_NO_CONTENT)
+            phodav_delete_file (dest_path, dest, NULL, batch_size, threads, cancellable) == SOUP_STATUS_NO_CONTENT)
           {
             g_clear_error (&error);
             retry = TRUE;
@@ -118,14 +170,22 @@ again:
           }
         else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE))
           {
+            guint failed = g_hash_table_size (mstatus);
+
             g_clear_error (&error);
-            if (copy)
+            if (depth == DEPTH_INFINITY)
               {
-                if (depth == DEPTH_INFINITY)
-                  do_copy_r (file, dest, flags, cancellable, &error);
-                else
-                  g_file_make_directory_with_parents (dest, cancellable, &error);
+                /* a directory moved to another device: the source is
+                 * kept if any member could not be copied */
+                if (phodav_copy_tree (file, dest, dest_path, flags, batch_size,
+                                      pool, mstatus, cancellable, &error) &&
+                    !copy && g_hash_table_size (mstatus) == failed &&
+                    phodav_delete_file (path, file, mstatus, batch_size, threads,
+                                        cancellable) != SOUP_STATUS_NO_CONTENT)
+                  g_warning ("MOVE: failed to remove the source %s", path);
               }
+            else if (copy)
+              g_file_make_directory_with_parents (dest, cancellable, &error);
           }
         else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
           {
@@ -150,6 +210,22 @@ end:
   return status;
 }
 
+/* whether the failed members are all below @path, the source, which
+ * then moved entirely: only what it replaced is left there */
+static gboolean
+mstatus_is_below (GHashTable *mstatus, const gchar *path)
+{
+  GHashTableIter iter;
+  const gchar *key;
+
+  g_hash_table_iter_init (&iter, mstatus);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+    if (!path_is_below (key, path))
+      return FALSE;
+
+  return TRUE;
+}
+
 gint
 phodav_method_movecopy (PathHandler *handler, SoupServerMessage *msg,
                         const char *path, GError **err)
@@ -159,8 +235,10 @@ phodav_method_movecopy (PathHandler *handler, SoupServerMessage *msg,
   GUri *dest_uri = NULL;
   gint status = SOUP_STATUS_NOT_FOUND;
   const gchar *dest;
-  gchar *udest;
+  gchar *udest = NULL;
   GList *submitted = NULL;
+  GHashTable *mstatus = NULL;
+  guint threads;
 
   dest = soup_message_headers_get_one (soup_server_message_get_request_headers (msg), "Destination");
   if (!dest)
@@ -174,15 +252,15 @@ phodav_method_movecopy (PathHandler *handler, SoupServerMessage *msg,
   if (status != SOUP_STATUS_OK)
     goto end;
 
-  if (server_path_has_other_locks (handler_get_server (handler), dest, submitted))
+  if (server_path_has_other_locks (handler_get_server (handler), dest,
+                                   submitted, TRUE))
     {
       status = SOUP_STATUS_LOCKED;
       goto end;
     }
 
-  udest = g_uri_unescape_string (dest + 1, NULL);
-  dest_file = g_file_get_child (handler_get_file (handler), udest);
-  g_free (udest);
+  udest = g_uri_unescape_string (dest, NULL);
+  dest_file = g_file_get_child (handler_get_file (handler), udest + 1);
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
 
@@ -192,12 +270,46 @@ phodav_method_movecopy (PathHandler *handler, SoupServerMessage *msg,
       status = SOUP_STATUS_FORBIDDEN;
       goto end;
     }
-  status = do_movecopy_file (msg, file, dest_file, dest,
-                             cancellable, err);
+  mstatus = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                   (GDestroyNotify) response_free);
+  /* the tree is walked in this thread when the server has no workers */
+  threads = handler_get_worker_threads (handler);
+  status = do_movecopy_file (msg, path, file, dest_file, dest,
+                             handler_get_enumerate_batch_size (handler),
+                             threads, handler_get_copy_pool (handler),
+                             mstatus, cancellable, err);
+  server_file_changed (handler_get_server (handler), dest_file);
+  if (soup_server_message_get_method (msg) == SOUP_METHOD_MOVE)
+    server_file_changed (handler_get_server (handler), file);
+
+  if (status == SOUP_STATUS_CREATED || status == SOUP_STATUS_NO_CONTENT)
+    {
+      gboolean copy = soup_server_message_get_method (msg) == SOUP_METHOD_COPY;
+      gboolean failed = g_hash_table_size (mstatus) > 0;
+
+      server_tree_changed (handler_get_server (handler), dest_file);
+      if (!failed || (!copy && mstatus_is_below (mstatus, path)))
+        {
+          if (!copy)
+            server_remove_path (handler_get_server (handler), path);
+          if (handler_get_store (handler))
+            prop_store_move (handler_get_store (handler), path, udest, copy);
+        }
+      else if (!copy)
+        server_purge_path (handler_get_server (handler), path, udest);
+
+      /* a partial copy reports the failed members, and so does a
+       * move that left some of what it replaced */
+      if (failed)
+        status = set_response_multistatus (msg, mstatus);
+    }
 
 end:
+  if (mstatus)
+    g_hash_table_unref (mstatus);
   if (dest_uri)
     g_uri_unref (dest_uri);
+  g_free (udest);
   g_clear_object (&file);
   g_clear_object (&dest_file);
   g_list_free_full (submitted, (GDestroyNotify) lock_submitted_free);
@@ -21,12 +21,21 @@
 #include "phodav-multistatus.h"
 #include "phodav-lock.h"
 #include "phodav-path.h"
+#include "phodav-arena.h"
+#include "phodav-store.h"
+#include "phodav-usage.h"
+#include "phodav-propfind.h"
+#include "phodav-journal.h"
 
-typedef struct _PropFind
+struct _PropFind
 {
   PropFindType type;
   GHashTable  *props;
-} PropFind;
+  gchar       *attributes;
+  Arena       *arena; /* for the response of one resource */
+};
+
+#define PROPFIND_ARENA_SIZE (16 * 1024)
 
 static PropFind*
 propfind_new (void)
@@ -38,13 +47,15 @@ propfind_new (void)
   return pf;
 }
 
-static void
+void
 propfind_free (PropFind *pf)
 {
   if (!pf)
     return;
 
   g_hash_table_unref (pf->props);
+  g_free (pf->attributes);
+  g_clear_pointer (&pf->arena, arena_free);
   g_slice_free (PropFind, pf);
 }
 
@@ -75,6 +86,15 @@ prop_resourcetype (PathHandler *handler, PropFind *pf,
   return node;
 }
 
+/* the same for every resource, only the name node is created */
+static const gchar supportedlock_fragment[] =
+  "<D:supportedlock>"
+  "<D:lockentry><D:lockscope><D:exclusive/></D:lockscope>"
+  "<D:locktype><D:write/></D:locktype></D:lockentry>"
+  "<D:lockentry><D:lockscope><D:shared/></D:lockscope>"
+  "<D:locktype><D:write/></D:locktype></D:lockentry>"
+  "</D:supportedlock>";
+
 static xmlNodePtr
 prop_supportedlock (PathHandler *handler, PropFind *pf,
                     const gchar *path, GFileInfo *info, xmlNsPtr ns)
@@ -84,21 +104,7 @@ prop_supportedlock (PathHandler *handler, PropFind *pf,
   if (pf->type == PROPFIND_PROPNAME)
     goto end;
 
-  {
-    xmlNodePtr entry = xmlNewChild (node, NULL, BAD_CAST "lockentry", NULL);
-    xmlNodePtr scope = xmlNewChild (entry, NULL, BAD_CAST "lockscope", NULL);
-    xmlNewChild (scope, NULL, BAD_CAST "exclusive", NULL);
-    xmlNodePtr type = xmlNewChild (entry, NULL, BAD_CAST "locktype", NULL);
-    xmlNewChild (type, NULL, BAD_CAST "write", NULL);
-  }
-
-  {
-    xmlNodePtr entry = xmlNewChild (node, NULL, BAD_CAST "lockentry", NULL);
-    xmlNodePtr scope = xmlNewChild (entry, NULL, BAD_CAST "lockscope", NULL);
-    xmlNewChild (scope, NULL, BAD_CAST "shared", NULL);
-    xmlNodePtr type = xmlNewChild (entry, NULL, BAD_CAST "locktype", NULL);
-    xmlNewChild (type, NULL, BAD_CAST "write", NULL);
-  }
+  PROP_SET_FRAGMENT (node, supportedlock_fragment);
 
 end:
   PROP_SET_STATUS (node, SOUP_STATUS_OK);
@@ -139,16 +145,42 @@ end:
 
 typedef enum {
         NODE_DATE_FORMAT_HTTP,
-        NODE_DATE_FORMAT_ISO8601
+        NODE_DATE_FORMAT_ISO8601,
+        NODE_DATE_FORMAT_LAST
 } NodeDateFormat;
 
+/* files of a directory often share timestamps, the formatted dates
+ * are memoized per second in a small direct-mapped cache */
+#define DATE_CACHE_SIZE 64
+
+typedef struct _CachedDate
+{
+  guint64 time;
+  gchar   text[40];
+} CachedDate;
+
+static CachedDate date_cache[NODE_DATE_FORMAT_LAST][DATE_CACHE_SIZE];
+G_LOCK_DEFINE_STATIC (date_cache);
+
 static void
 node_add_time (xmlNodePtr node, guint64 time, NodeDateFormat format)
 {
+  CachedDate *cached = &date_cache[format][time % DATE_CACHE_SIZE];
+  gchar buf[sizeof (cached->text)];
   GDateTime *date;
   gchar *text;
 
   g_warn_if_fail (time != 0);
+
+  G_LOCK (date_cache);
+  if (cached->time == time && cached->text[0])
+    {
+      memcpy (buf, cached->text, sizeof (buf));
+      G_UNLOCK (date_cache);
+      goto end;
+    }
+  G_UNLOCK (date_cache);
+
   date = g_date_time_new_from_unix_utc (time);
   switch (format)
     {
@@ -156,12 +188,21 @@ node_add_time (xmlNodePtr node, guint64 time, NodeDateFormat format)
       text = soup_date_time_to_string (date, SOUP_DATE_HTTP);
       break;
     case NODE_DATE_FORMAT_ISO8601:
+    default:
       text = g_date_time_format_iso8601 (date);
       break;
     }
-  xmlAddChild (node, xmlNewText (BAD_CAST text));
+  g_strlcpy (buf, text, sizeof (buf));
   g_free (text);
   g_date_time_unref (date);
+
+  G_LOCK (date_cache);
+  cached->time = time;
+  memcpy (cached->text, buf, sizeof (buf));
+  G_UNLOCK (date_cache);
+
+end:
+  xmlAddChild (node, xmlNewText (BAD_CAST buf));
 }
 
 static xmlNodePtr
@@ -385,6 +426,7 @@ prop_quota_used (PathHandler *handler, PropFind *pf,
   gint status = SOUP_STATUS_OK;
   GCancellable *cancellable = handler_get_cancellable(handler);
   xmlNodePtr node = xmlNewNode (ns, BAD_CAST "quota-used-bytes");
+  UsageIndex *usage;
   guint64 disk_usage = 0;
   GError *error = NULL;
   gchar *tmp = NULL;
@@ -393,6 +435,10 @@ prop_quota_used (PathHandler *handler, PropFind *pf,
     goto end;
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
+  usage = handler_get_usage (handler);
+  if (usage && usage_index_lookup (usage, file, &disk_usage))
+    goto found;
+
   if (!g_file_measure_disk_usage (file,
                                   G_FILE_MEASURE_NONE,
                                   cancellable,
@@ -405,6 +451,7 @@ prop_quota_used (PathHandler *handler, PropFind *pf,
       goto end;
     }
 
+found:
   tmp = g_strdup_printf ("%" G_GUINT64_FORMAT, disk_usage);
   xmlAddChild (node, xmlNewText (BAD_CAST tmp));
 
@@ -415,6 +462,60 @@ end:
   return node;
 }
 
+static xmlNodePtr
+prop_sync_token (PathHandler *handler, PropFind *pf,
+                 const gchar *path, GFileInfo *info, xmlNsPtr ns)
+{
+  gint status = SOUP_STATUS_OK;
+  xmlNodePtr node = xmlNewNode (ns, BAD_CAST "sync-token");
+  Journal *journal;
+  gchar *collection, *token;
+
+  if (pf->type == PROPFIND_PROPNAME)
+    goto end;
+
+  journal = handler_get_journal (handler);
+  if (!journal || g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+    {
+      status = SOUP_STATUS_NOT_FOUND;
+      goto end;
+    }
+
+  /* the token is for a sync of one level, valid once watching */
+  collection = g_strdup (path);
+  if (collection[1])
+    remove_trailing (collection, '/');
+  journal_watch (journal, collection, FALSE);
+  g_free (collection);
+
+  token = journal_get_token (journal);
+  xmlAddChild (node, xmlNewText (BAD_CAST token));
+  g_free (token);
+
+end:
+  PROP_SET_STATUS (node, status);
+  return node;
+}
+
+static xmlNodePtr
+prop_supported_report_set (PathHandler *handler, PropFind *pf,
+                           const gchar *path, GFileInfo *info, xmlNsPtr ns)
+{
+  xmlNodePtr node = xmlNewNode (ns, BAD_CAST "supported-report-set");
+  xmlNodePtr report;
+
+  if (pf->type == PROPFIND_PROPNAME)
+    goto end;
+
+  report = xmlNewChild (node, ns, BAD_CAST "supported-report", NULL);
+  report = xmlNewChild (report, ns, BAD_CAST "report", NULL);
+  xmlNewChild (report, ns, BAD_CAST "sync-collection", NULL);
+
+end:
+  PROP_SET_STATUS (node, SOUP_STATUS_OK);
+  return node;
+}
+
 static gint
 node_compare_int (xmlNodePtr a,
                   xmlNodePtr b)
@@ -422,37 +523,55 @@ node_compare_int (xmlNodePtr a,
   return GPOINTER_TO_INT (a->_private) - GPOINTER_TO_INT (b->_private);
 }
 
+/* the links come from the arena: the list is only freed with it */
 static void
-prop_add (GList **stat, xmlNodePtr node)
+prop_add (PropFind *pf, GList **stat, xmlNodePtr node)
 {
-  *stat = g_list_insert_sorted (*stat, node, (GCompareFunc) node_compare_int);
+  GList *link = arena_alloc (pf->arena, sizeof (GList));
+  GList *prev = NULL, *l;
+
+  for (l = *stat; l && node_compare_int (node, l->data) > 0; l = l->next)
+    prev = l;
+
+  link->data = node;
+  link->prev = prev;
+  link->next = l;
+  if (l)
+    l->prev = link;
+  if (prev)
+    prev->next = link;
+  else
+    *stat = link;
 }
 
-#define PROP(Name, Info) { G_STRINGIFY (Name), G_PASTE (prop_, Name), Info }
+#define PROP(Name, Info, Attrs) { G_STRINGIFY (Name), G_PASTE (prop_, Name), Info, FALSE, Attrs }
 static const struct _PropList
 {
   const gchar *name;
   xmlNodePtr (*func) (PathHandler *, PropFind *, const gchar *, GFileInfo *, xmlNsPtr);
   gboolean need_info;
   gboolean slow;
-
+  const gchar *attributes; /* queried for this prop */
 } prop_list[] = {
-  PROP (resourcetype, 1),
-  PROP (creationdate, 1),
-  PROP (getlastmodified, 1),
-  PROP (getcontentlength, 1),
-  PROP (getcontenttype, 1),
-  PROP (displayname, 1),
-  PROP (getetag, 1),
-  PROP (executable, 1),
-  PROP (supportedlock, 0),
-  PROP (lockdiscovery, 0),
+  PROP (resourcetype, 1, G_FILE_ATTRIBUTE_STANDARD_TYPE),
+  PROP (creationdate, 1, G_FILE_ATTRIBUTE_TIME_CREATED "," G_FILE_ATTRIBUTE_TIME_MODIFIED),
+  PROP (getlastmodified, 1, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+  PROP (getcontentlength, 1, G_FILE_ATTRIBUTE_STANDARD_SIZE),
+  PROP (getcontenttype, 1, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE),
+  PROP (displayname, 1, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME),
+  PROP (getetag, 1, G_FILE_ATTRIBUTE_ETAG_VALUE),
+  PROP (executable, 1, G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE "," G_FILE_ATTRIBUTE_STANDARD_TYPE),
+  PROP (supportedlock, 0, NULL),
+  PROP (lockdiscovery, 0, NULL),
   { "quota-available-bytes", prop_quota_available, },
-  { "quota-used-bytes", prop_quota_used, FALSE, TRUE, }
+  { "quota-used-bytes", prop_quota_used, FALSE, TRUE, },
+  /* RFC 6578: not in allprop */
+  { "sync-token", prop_sync_token, TRUE, TRUE, G_FILE_ATTRIBUTE_STANDARD_TYPE },
+  { "supported-report-set", prop_supported_report_set, FALSE, TRUE, }
 };
 
 static xmlNodePtr
-prop_xattr (gchar *xattr)
+prop_xattr (gchar *xattr, const gchar *value)
 {
   xmlNodePtr node;
   gchar *ns = xattr + 7;
@@ -472,17 +591,76 @@ prop_xattr (gchar *xattr)
   node = xmlNewNode (NULL, BAD_CAST name);
   if (ns)
     xmlNewNs (node, BAD_CAST ns, NULL);
+  if (value)
+    xmlAddChild (node, xmlNewText (BAD_CAST value));
 
   PROP_SET_STATUS (node, SOUP_STATUS_OK);
   return node;
 }
 
 #define FILE_QUERY "standard::*,time::*,access::*,etag::*,xattr::*"
+
+/* the attributes needed to answer a prop request, the name, type and
+ * symlink flag are always needed to list the children */
+static gchar *
+propfind_get_attributes (GHashTable *props)
+{
+  GString *attributes = g_string_new (G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                      G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                      G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK);
+  GHashTableIter iter;
+  xmlNodePtr node;
+  int i;
+
+  g_hash_table_iter_init (&iter, props);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &node, NULL))
+    {
+      for (i = 0; i < G_N_ELEMENTS (prop_list); i++)
+        if (xml_node_has_name (node, prop_list[i].name))
+          break;
+
+      if (i < G_N_ELEMENTS (prop_list))
+        {
+          if (prop_list[i].attributes)
+            g_string_append_printf (attributes, ",%s", prop_list[i].attributes);
+        }
+      else
+        {
+          gchar *xattr = xml_node_get_xattr_name (node, "xattr::");
+
+          /* dead props are stored as xattrs */
+          if (xattr && !strchr (xattr, ','))
+            g_string_append_printf (attributes, ",%s", xattr);
+          else if (xattr)
+            g_string_append (attributes, ",xattr::*");
+          g_free (xattr);
+        }
+    }
+
+  return g_string_free (attributes, FALSE);
+}
+typedef struct _PopulateStored
+{
+  PropFind *pf;
+  GList   **stat;
+} PopulateStored;
+
+static void
+populate_stored_prop (const gchar *name, const gchar *value, gpointer data)
+{
+  PopulateStored *p = data;
+  gchar *xattr = g_strdup (name);
+
+  prop_add (p->pf, p->stat, prop_xattr (xattr, p->pf->type == PROPFIND_ALLPROP ? value : NULL));
+  g_free (xattr);
+}
+
 static GList*
 propfind_populate (PathHandler *handler, const gchar *path,
                    PropFind *pf, GFileInfo *info,
                    xmlNsPtr ns)
 {
+  PropStore *store = handler_get_store (handler);
   GHashTableIter iter;
   xmlNodePtr node;
   GList *stat = NULL;
@@ -501,17 +679,27 @@ propfind_populate (PathHandler *handler, const gchar *path,
             }
 
           /* perhaps not include the 404? */
-          prop_add (&stat, prop_list[i].func (handler, pf, path, info, ns));
+          prop_add (pf, &stat, prop_list[i].func (handler, pf, path, info, ns));
         }
 
-      if (info)
+      if (store)
+        {
+          PopulateStored p = { pf, &stat };
+
+          /* all the dead props at once */
+          prop_store_foreach_prop (store, path, populate_stored_prop, &p);
+        }
+      else if (info)
         {
           gchar **attrs = g_file_info_list_attributes (info, "xattr");
 
           for (i = 0; attrs[i]; i++)
             {
-              node = prop_xattr(attrs[i]);
-              prop_add (&stat, node);
+              const gchar *val = pf->type == PROPFIND_ALLPROP ?
+                g_file_info_get_attribute_string (info, attrs[i]) : NULL;
+
+              node = prop_xattr (attrs[i], val);
+              prop_add (pf, &stat, node);
             }
 
           g_strfreev (attrs);
@@ -535,18 +723,19 @@ propfind_populate (PathHandler *handler, const gchar *path,
         {
           gchar *xattr = xml_node_get_xattr_name (node, "xattr::");
           node = xmlCopyNode (node, 2);
-          const gchar *val = NULL;
+          gchar *val = NULL;
 
-          if (xattr)
-            {
-              val = g_file_info_get_attribute_string (info, xattr);
-              g_free (xattr);
-            }
+          if (xattr && store)
+            val = prop_store_get_prop (store, path, xattr);
+          else if (xattr)
+            val = g_strdup (g_file_info_get_attribute_string (info, xattr));
+          g_free (xattr);
 
           if (val)
             {
               xmlAddChild (node, xmlNewText (BAD_CAST val));
               PROP_SET_STATUS (node, SOUP_STATUS_OK);
+              g_free (val);
             }
           else
             {
@@ -555,16 +744,56 @@ propfind_populate (PathHandler *handler, const gchar *path,
             }
         }
 
-      prop_add (&stat, node);
+      prop_add (pf, &stat, node);
     }
 
 end:
   return stat;
 }
 
+static void
+propfind_add_response (PropFind *pf, MultiStatus *ms,
+                       const gchar *path, GList *stat)
+{
+  Response resp = { .props = stat, .status = 0 };
+  GList *l;
+
+  multistatus_add (ms, path, &resp);
+  for (l = stat; l; l = l->next)
+    xmlFreeNode (l->data);
+
+  arena_reset (pf->arena);
+}
+
+/* the attributes to query for the info given to propfind_add() */
+const gchar *
+propfind_get_attributes_query (PropFind *pf)
+{
+  return pf->attributes ? : FILE_QUERY;
+}
+
+/* adds the response of @path, unescaped, described by @info */
+void
+propfind_add (PathHandler *handler, PropFind *pf, SoupServerMessage *msg,
+              MultiStatus *ms, const gchar *path, GFileInfo *info,
+              xmlNsPtr ns)
+{
+  gchar *escape = NULL;
+  GList *stat;
+
+  if (!pf->arena)
+    pf->arena = arena_new (PROPFIND_ARENA_SIZE);
+  if (strpbrk (path, "&<>'\""))
+    escape = g_markup_escape_text (path, -1);
+
+  stat = propfind_populate (handler, path, pf, info, ns);
+  propfind_add_response (pf, ms, escape ? : path, stat);
+  g_free (escape);
+}
+
 static gint
 propfind_query_zero (PathHandler *handler, PropFind *pf,
-                     const gchar *path, GHashTable *path_resp,
+                     const gchar *path, MultiStatus *ms,
                      xmlNsPtr     ns)
 {
   GCancellable *cancellable = handler_get_cancellable(handler);
@@ -575,8 +804,8 @@ propfind_query_zero (PathHandler *handler, PropFind *pf,
   gint status = SOUP_STATUS_OK;
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
-  info = g_file_query_info (file, FILE_QUERY,
-                            G_FILE_QUERY_INFO_NONE, cancellable, &err);
+  info = handler_query_info (handler, file, pf->attributes ? : FILE_QUERY,
+                             cancellable, &err);
   g_object_unref (file);
   if (err)
     {
@@ -587,54 +816,86 @@ propfind_query_zero (PathHandler *handler, PropFind *pf,
     }
 
   stat = propfind_populate (handler, path, pf, info, ns);
-  g_hash_table_insert (path_resp, g_strdup (path),
-                       response_new (stat, 0));
+  propfind_add_response (pf, ms, path, stat);
   g_clear_object (&info);
 
   return status;
 }
 
+typedef struct _QueryOne
+{
+  PathHandler *handler;
+  PropFind    *pf;
+  const gchar *path;
+  MultiStatus *ms;
+  xmlNsPtr     ns;
+  GQueue      *dirs;  /* to list next, at infinite depth */
+  guint        left;
+  gboolean     truncated;
+} QueryOne;
+
+static gboolean
+query_one_add_child (GFileInfo *info, gpointer data)
+{
+  QueryOne *q = data;
+  const gchar *name = g_file_info_get_name (info);
+  gchar *escape = NULL;
+  const gchar *sep;
+  gchar *child, *child_path;
+  GList *stat;
+
+  if (q->dirs && q->left == 0)
+    {
+      q->truncated = TRUE;
+      return FALSE;
+    }
+
+  /* most names have nothing to escape */
+  if (strpbrk (name, "&<>'\""))
+    name = escape = g_markup_escape_text (name, -1);
+
+  sep = g_str_has_suffix (q->path, "/") ? "" : "/";
+  child = arena_strconcat (q->pf->arena, q->path, sep, name, NULL);
+  child_path = escape ?
+    arena_strconcat (q->pf->arena, q->path, sep, g_file_info_get_name (info), NULL) : child;
+  g_free (escape);
+
+  if (q->dirs)
+    {
+      /* a symlinked collection is listed, but not walked: it may lead
+       * out of the tree, or loop */
+      if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY &&
+          !g_file_info_get_is_symlink (info))
+        g_queue_push_tail (q->dirs, g_strdup (child_path));
+      q->left--;
+    }
+
+  stat = propfind_populate (q->handler, child_path, q->pf, info, q->ns);
+  propfind_add_response (q->pf, q->ms, child, stat);
+
+  return TRUE;
+}
+
 static gint
 propfind_query_one (PathHandler *handler, PropFind *pf,
-                    const gchar *path, GHashTable *path_resp,
+                    const gchar *path, MultiStatus *ms,
                     xmlNsPtr     ns)
 {
   GCancellable *cancellable = handler_get_cancellable(handler);
+  QueryOne q = { handler, pf, path, ms, ns };
   GError *err = NULL;
   GFile *file;
-  GFileEnumerator *e;
   gint status;
 
-  status = propfind_query_zero (handler, pf, path, path_resp, ns);
+  status = propfind_query_zero (handler, pf, path, ms, ns);
   if (status != SOUP_STATUS_OK)
     return status;
 
   file = g_file_get_child (handler_get_file (handler), path + 1);
-  e = g_file_enumerate_children (file, FILE_QUERY, G_FILE_QUERY_INFO_NONE,
-                                 cancellable, &err);
+  handler_enumerate_children (handler, file, pf->attributes ? : FILE_QUERY,
+                              query_one_add_child, &q, cancellable, &err);
   g_object_unref (file);
-  if (!e)
-    goto end;
-
-  while (1)
-    {
-      GList *stat;
-      GFileInfo *info = g_file_enumerator_next_file (e, cancellable, &err);
-      if (!info)
-        break;
-
-      gchar *escape = g_markup_escape_text (g_file_info_get_name (info), -1);
-      stat = propfind_populate (handler, path, pf, info, ns);
-      g_hash_table_insert (path_resp, g_build_path ("/", path, escape, NULL),
-                           response_new (stat, 0));
-      g_free (escape);
-      g_object_unref (info);
-    }
 
-  g_file_enumerator_close (e, cancellable, NULL);
-  g_clear_object (&e);
-
-end:
   if (err)
     {
       if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY))
@@ -645,6 +906,74 @@ end:
   return status;
 }
 
+static void
+propfind_add_truncated (MultiStatus *ms, const gchar *path)
+{
+  Response resp = { .props = NULL, .status = SOUP_STATUS_INSUFFICIENT_STORAGE };
+  gchar *escape = g_markup_escape_text (path, -1);
+
+  multistatus_add (ms, escape, &resp);
+  g_free (escape);
+}
+
+/* Lists the tree breadth first, up to the depth-infinity-limit,
+ * without following symlinked collections. Only the collections still
+ * to list are kept, the responses are given to @ms as they come, and
+ * only sent as they come from a worker thread. Then the collections
+ * whose members were not all listed get a 507. */
+static gint
+propfind_query_infinity (PathHandler *handler, PropFind *pf,
+                         const gchar *path, MultiStatus *ms,
+                         xmlNsPtr     ns)
+{
+  GCancellable *cancellable = handler_get_cancellable(handler);
+  GQueue dirs = G_QUEUE_INIT;
+  QueryOne q = { handler, pf, NULL, ms, ns, &dirs,
+                 handler_get_depth_infinity_limit (handler), FALSE };
+  GError *err = NULL;
+  GFile *file;
+  gchar *dir;
+  gint status;
+
+  status = propfind_query_zero (handler, pf, path, ms, ns);
+  if (status != SOUP_STATUS_OK)
+    return status;
+
+  g_queue_push_tail (&dirs, g_strdup (path));
+  while (!q.truncated && (dir = g_queue_pop_head (&dirs)))
+    {
+      q.path = dir;
+      file = g_file_get_child (handler_get_file (handler), dir + 1);
+      handler_enumerate_children (handler, file, pf->attributes ? : FILE_QUERY,
+                                  query_one_add_child, &q, cancellable, &err);
+      g_object_unref (file);
+
+      if (err)
+        {
+          if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY) &&
+              !g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            g_warning ("query: %s", err->message);
+          g_clear_error (&err);
+        }
+
+      if (q.truncated)
+        propfind_add_truncated (ms, dir);
+      g_free (dir);
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+    }
+
+  while ((dir = g_queue_pop_head (&dirs)))
+    {
+      if (q.truncated)
+        propfind_add_truncated (ms, dir);
+      g_free (dir);
+    }
+
+  return status;
+}
+
 static gboolean
 parse_prop (xmlNodePtr node, GHashTable *props)
 {
@@ -660,8 +989,10 @@ parse_prop (xmlNodePtr node, GHashTable *props)
   return TRUE;
 }
 
-static PropFind*
-parse_propfind (xmlNodePtr xml)
+/* parses the allprop, propname or prop child of @xml, also used for
+ * the select of a SEARCH */
+PropFind *
+propfind_parse (xmlNodePtr xml)
 {
   PropFind *pf = propfind_new ();
   xmlNodePtr node;
@@ -685,6 +1016,7 @@ parse_propfind (xmlNodePtr xml)
         {
           pf->type = PROPFIND_PROP;
           parse_prop (node, pf->props);
+          pf->attributes = propfind_get_attributes (pf->props);
           goto end;
         }
     }
@@ -702,7 +1034,7 @@ phodav_method_propfind (PathHandler *handler, SoupServerMessage *msg,
 {
   PropFind *pf = NULL;
   DepthType depth;
-  GHashTable *mstatus = NULL;   // path -> statlist
+  MultiStatus *ms = NULL;
   DavDoc doc = {0, };
   gint status = SOUP_STATUS_NOT_FOUND;
   xmlNsPtr ns = NULL;
@@ -724,27 +1056,27 @@ phodav_method_propfind (PathHandler *handler, SoupServerMessage *msg,
           goto end;
         }
 
-      pf = parse_propfind (doc.root);
+      pf = propfind_parse (doc.root);
       if (!pf)
         goto end;
     }
 
+  if (!pf->arena)
+    pf->arena = arena_new (PROPFIND_ARENA_SIZE);
   ns = xmlNewNs (NULL, BAD_CAST "DAV:", BAD_CAST "D");
-  mstatus = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-                                   (GDestroyNotify) response_free);
+  ms = multistatus_new (msg);
   if (pf->type == PROPFIND_PROP ||
       pf->type == PROPFIND_ALLPROP ||
       pf->type == PROPFIND_PROPNAME)
     {
       if (depth == DEPTH_ZERO)
-        status = propfind_query_zero (handler, pf, path, mstatus, ns);
+        status = propfind_query_zero (handler, pf, path, ms, ns);
       else if (depth == DEPTH_ONE)
-        status = propfind_query_one (handler, pf, path, mstatus, ns);
+        status = propfind_query_one (handler, pf, path, ms, ns);
+      else if (handler_get_depth_infinity_limit (handler))
+        status = propfind_query_infinity (handler, pf, path, ms, ns);
       else
-        {
-          status = SOUP_STATUS_FORBIDDEN;
-          g_warn_if_reached ();
-        }
+        status = SOUP_STATUS_FORBIDDEN;
     }
   else
     g_warn_if_reached ();
@@ -752,13 +1084,12 @@ phodav_method_propfind (PathHandler *handler, SoupServerMessage *msg,
   if (status != SOUP_STATUS_OK)
     goto end;
 
-  status = set_response_multistatus (msg, mstatus);
+  status = multistatus_end (g_steal_pointer (&ms));
 
 end:
   davdoc_free (&doc);
   propfind_free (pf);
-  if (mstatus)
-    g_hash_table_unref (mstatus);
+  g_clear_pointer (&ms, multistatus_free);
   if (ns)
     xmlFreeNs(ns);
   return status;
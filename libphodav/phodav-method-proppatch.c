@@ -19,6 +19,7 @@
 #include "phodav-multistatus.h"
 #include "phodav-utils.h"
 #include "phodav-virtual-dir.h"
+#include "phodav-store.h"
 
 #include <sys/types.h>
 #ifdef HAVE_SYS_XATTR_H
@@ -38,14 +39,29 @@ node_children_to_string (xmlNodePtr node)
 }
 
 static gint
-set_attr (GFile *file, xmlNodePtr attrnode,
+set_attr (PathHandler *handler, const gchar *path,
+          GFile *file, gboolean exists, xmlNodePtr attrnode,
           GFileAttributeType type, gchar *mem, GCancellable *cancellable)
 {
+  PropStore *store = handler_get_store (handler);
   gchar *attrname;
   gint status = SOUP_STATUS_OK;
   GError *error = NULL;
 
-  if (type == G_FILE_ATTRIBUTE_TYPE_INVALID)
+  if (store)
+    {
+      /* the store does not know about files */
+      if (!exists)
+        return SOUP_STATUS_NOT_FOUND;
+
+      attrname = xml_node_get_xattr_name (attrnode, "xattr::");
+      g_return_val_if_fail (attrname, SOUP_STATUS_BAD_REQUEST);
+
+      prop_store_set_prop (store, path, attrname,
+                           type == G_FILE_ATTRIBUTE_TYPE_INVALID ? NULL : mem,
+                           &error);
+    }
+  else if (type == G_FILE_ATTRIBUTE_TYPE_INVALID)
     {
       attrname = xml_node_get_xattr_name (attrnode, "user.");
       g_return_val_if_fail (attrname, SOUP_STATUS_BAD_REQUEST);
@@ -92,8 +108,8 @@ set_attr (GFile *file, xmlNodePtr attrnode,
 }
 
 static gint
-prop_set (SoupServerMessage *msg,
-          GFile *file, xmlNodePtr parent, xmlNodePtr *attr,
+prop_set (PathHandler *handler, const gchar *path,
+          GFile *file, gboolean exists, xmlNodePtr parent, xmlNodePtr *attr,
           gboolean remove, GCancellable *cancellable)
 {
   xmlNodePtr node, attrnode;
@@ -121,7 +137,8 @@ prop_set (SoupServerMessage *msg,
               type = G_FILE_ATTRIBUTE_TYPE_STRING;
             }
 
-          status = set_attr (file, attrnode, type, (gchar *) xmlBufferContent (buf), cancellable);
+          status = set_attr (handler, path, file, exists, attrnode, type,
+                             buf ? (gchar *) xmlBufferContent (buf) : NULL, cancellable);
 
           if (buf)
             xmlBufferFree (buf);
@@ -143,6 +160,8 @@ phodav_method_proppatch (PathHandler *handler, SoupServerMessage *msg,
   DavDoc doc = {0, };
   xmlNodePtr node = NULL, attr = NULL;
   GList *props = NULL, *submitted = NULL;
+  GFileInfo *info = NULL;
+  gboolean exists = TRUE;
   gint status;
 
   if (!davdoc_parse (&doc, msg, soup_server_message_get_request_body (msg), "propertyupdate"))
@@ -151,11 +170,21 @@ phodav_method_proppatch (PathHandler *handler, SoupServerMessage *msg,
       goto end;
     }
 
-  status = phodav_check_if (handler, msg, path, &submitted);
+  file = g_file_get_child (handler_get_file (handler), path + 1);
+
+  /* with a store, the file is queried once, for the If header too */
+  if (handler_get_store (handler))
+    {
+      info = g_file_query_info (file, G_FILE_ATTRIBUTE_ETAG_VALUE,
+                                G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+      exists = info != NULL;
+      status = phodav_check_if_info (handler, msg, path, info, &submitted);
+    }
+  else
+    status = phodav_check_if (handler, msg, path, &submitted);
   if (status != SOUP_STATUS_OK)
     goto end;
 
-  file = g_file_get_child (handler_get_file (handler), path + 1);
   mstatus = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                                    (GDestroyNotify) response_free);
 
@@ -166,9 +195,9 @@ phodav_method_proppatch (PathHandler *handler, SoupServerMessage *msg,
         continue;
 
       if (xml_node_has_name (node, "set"))
-        status = prop_set (msg, file, node, &attr, FALSE, cancellable);
+        status = prop_set (handler, path, file, exists, node, &attr, FALSE, cancellable);
       else if (xml_node_has_name (node, "remove"))
-        status = prop_set (msg, file, node, &attr, TRUE, cancellable);
+        status = prop_set (handler, path, file, exists, node, &attr, TRUE, cancellable);
       else
         g_warn_if_reached ();
 
@@ -179,6 +208,7 @@ phodav_method_proppatch (PathHandler *handler, SoupServerMessage *msg,
         }
     }
 
+  server_file_changed (handler_get_server (handler), file);
   g_hash_table_insert (mstatus, g_strdup (path),
                        response_new (props, 0));
 
@@ -189,6 +219,7 @@ end:
   davdoc_free (&doc);
   if (mstatus)
     g_hash_table_unref (mstatus);
+  g_clear_object (&info);
   g_clear_object (&file);
 
   return status;
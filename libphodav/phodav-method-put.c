@@ -15,18 +15,308 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include "phodav-priv.h"
 #include "phodav-utils.h"
 
+#ifdef G_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <gio/gfiledescriptorbased.h>
+#endif
+
+#define PUT_HIGH_WATER (1024 * 1024)
+#define PUT_LOW_WATER  (256 * 1024)
+
+/* Chunks are queued as they arrive and written asynchronously, one at
+ * a time. The request body is paused when more than PUT_HIGH_WATER
+ * bytes are pending, and resumed below PUT_LOW_WATER. With @tmp, the
+ * content is written there, and renamed over @target when complete:
+ * @file, or the file it links to. */
+typedef struct _PutWriter
+{
+  guint              refs;
+  SoupServerMessage *msg; /* weak, cleared when the message is finished */
+  PhodavServer      *server;
+  GFile             *file;
+  GFile             *target;
+  GFile             *tmp;
+  gboolean           sync;
+  GIOStream         *io; /* for ranged and direct writes, owns output */
+  GOutputStream     *output;
+  GCancellable      *cancellable;
+  GQueue            *chunks;
+  gsize              queued;
+  gboolean           writing;
+  gboolean           paused;
+  gboolean           got_body;
+  gboolean           failed;
+  gboolean           claimed; /* server_begin_write() on file */
+} PutWriter;
+
+static PutWriter *
+put_writer_ref (PutWriter *w)
+{
+  w->refs++;
+
+  return w;
+}
+
 static void
-method_put_finished (SoupServerMessage *msg,
-                     gpointer           user_data)
+put_writer_unref (PutWriter *w)
+{
+  if (--w->refs > 0)
+    return;
+
+  g_debug ("PUT finished %p", w->output);
+  if (w->claimed)
+    server_end_write (w->server, w->file);
+  g_object_unref (w->server);
+  g_object_unref (w->file);
+  g_clear_object (&w->target);
+  if (w->tmp)
+    {
+      /* not committed */
+      g_file_delete (w->tmp, NULL, NULL);
+      g_object_unref (w->tmp);
+    }
+  g_object_unref (w->output);
+  g_clear_object (&w->io);
+  g_object_unref (w->cancellable);
+  g_queue_free_full (w->chunks, (GDestroyNotify) g_bytes_unref);
+  g_slice_free (PutWriter, w);
+}
+
+static void
+put_writer_pause (PutWriter *w, gboolean pause)
+{
+  if (!w->msg || w->paused == pause)
+    return;
+
+  w->paused = pause;
+  if (pause)
+    soup_server_message_pause (w->msg);
+  else
+    soup_server_message_unpause (w->msg);
+}
+
+static void
+put_writer_fail (PutWriter *w, GError *err)
+{
+  if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_warning ("error: %s", err->message);
+
+  /* the rest of the body is read and discarded */
+  w->failed = TRUE;
+  g_queue_clear_full (w->chunks, (GDestroyNotify) g_bytes_unref);
+  w->queued = 0;
+  if (w->msg)
+    soup_server_message_set_status (w->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR, NULL);
+}
+
+static void
+put_writer_close_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  PutWriter *w = user_data;
+  GError *err = NULL;
+
+  if (!(w->io ?
+         g_io_stream_close_finish (w->io, res, &err) :
+         g_output_stream_close_finish (w->output, res, &err)))
+    {
+      put_writer_fail (w, err);
+      g_clear_error (&err);
+    }
+
+  server_file_changed (w->server, w->file);
+  if (w->claimed)
+    {
+      w->claimed = FALSE;
+      server_end_write (w->server, w->file);
+    }
+  put_writer_pause (w, FALSE);
+  put_writer_unref (w);
+}
+
+#ifdef G_OS_UNIX
+static gint
+put_writer_get_fd (PutWriter *w)
+{
+  if (!G_IS_FILE_DESCRIPTOR_BASED (w->output))
+    return -1;
+
+  return g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (w->output));
+}
+#endif
+
+static void
+put_writer_commit_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  PutWriter *w = task_data;
+  GError *err = NULL;
+
+#ifdef G_OS_UNIX
+  if (!w->failed && w->sync)
+    {
+      gint fd = put_writer_get_fd (w);
+
+      if (fd >= 0 && fsync (fd) < 0)
+        {
+          int errsv = errno;
+
+          g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errsv),
+                                   "fsync: %s", g_strerror (errsv));
+          return;
+        }
+    }
+#endif
+
+  if (!g_output_stream_close (w->output, cancellable, &err) ||
+      (!w->failed &&
+       !g_file_move (w->tmp, w->target,
+                     G_FILE_COPY_OVERWRITE | G_FILE_COPY_NO_FALLBACK_FOR_MOVE,
+                     cancellable, NULL, NULL, &err)))
+    {
+      g_task_return_error (task, err);
+      return;
+    }
+
+#ifdef G_OS_UNIX
+  /* the rename itself is only durable once the directory is synced */
+  if (!w->failed && w->sync)
+    {
+      GFile *parent = g_file_get_parent (w->target);
+      gchar *path = parent ? g_file_get_path (parent) : NULL;
+      gint fd = path ? open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+      int errsv = 0;
+
+      if (fd >= 0 && fsync (fd) < 0)
+        errsv = errno;
+      if (fd >= 0)
+        close (fd);
+      g_clear_object (&parent);
+      g_free (path);
+
+      if (errsv)
+        {
+          g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errsv),
+                                   "fsync: %s", g_strerror (errsv));
+          return;
+        }
+    }
+#endif
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+put_writer_commit_cb (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
 {
-  GFileOutputStream *output = user_data;
+  PutWriter *w = user_data;
+  GError *err = NULL;
 
-  g_debug ("PUT finished %p", output);
+  if (!g_task_propagate_boolean (G_TASK (res), &err))
+    {
+      put_writer_fail (w, err);
+      g_clear_error (&err);
+    }
+  else if (!w->failed)
+    g_clear_object (&w->tmp);
 
-  g_object_unref (output);
+  server_file_changed (w->server, w->file);
+  put_writer_pause (w, FALSE);
+  put_writer_unref (w);
+}
+
+static void
+put_writer_commit (PutWriter *w)
+{
+  GTask *task;
+
+  /* the sync and the rename block, and so may the close */
+  task = g_task_new (NULL, w->cancellable, put_writer_commit_cb, put_writer_ref (w));
+  g_task_set_task_data (task, w, NULL);
+  g_task_run_in_thread (task, put_writer_commit_thread);
+  g_object_unref (task);
+}
+
+static void put_writer_next (PutWriter *w);
+
+static void
+put_writer_write_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  PutWriter *w = user_data;
+  GError *err = NULL;
+  GBytes *chunk;
+
+  w->writing = FALSE;
+  if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object), res, NULL, &err))
+    {
+      put_writer_fail (w, err);
+      g_clear_error (&err);
+    }
+  else
+    {
+      chunk = g_queue_pop_head (w->chunks);
+      w->queued -= g_bytes_get_size (chunk);
+      g_bytes_unref (chunk);
+    }
+
+  put_writer_next (w);
+  put_writer_unref (w);
+}
+
+static void
+put_writer_next (PutWriter *w)
+{
+  GBytes *chunk;
+
+  if (w->writing)
+    return;
+
+  chunk = g_queue_peek_head (w->chunks);
+  if (chunk)
+    {
+      gconstpointer data;
+      gsize data_length;
+
+      data = g_bytes_get_data (chunk, &data_length);
+      w->writing = TRUE;
+      g_output_stream_write_all_async (w->output, data, data_length,
+                                       G_PRIORITY_DEFAULT, w->cancellable,
+                                       put_writer_write_cb, put_writer_ref (w));
+      if (!w->got_body && w->queued < PUT_LOW_WATER)
+        put_writer_pause (w, FALSE);
+      return;
+    }
+
+  if (w->got_body)
+    {
+      /* the response waits for the data to be on disk */
+      w->got_body = FALSE;
+      if (w->tmp)
+        put_writer_commit (w);
+      else if (w->io)
+        g_io_stream_close_async (w->io, G_PRIORITY_DEFAULT, w->cancellable,
+                                 put_writer_close_cb, put_writer_ref (w));
+      else
+        g_output_stream_close_async (w->output, G_PRIORITY_DEFAULT, w->cancellable,
+                                     put_writer_close_cb, put_writer_ref (w));
+    }
+  else
+    put_writer_pause (w, FALSE);
 }
 
 static void
@@ -34,61 +324,281 @@ method_put_got_chunk (SoupServerMessage *msg,
                       GBytes            *chunk,
                       gpointer           user_data)
 {
-  GFileOutputStream *output = user_data;
-  PathHandler *handler = g_object_get_data (user_data, "handler");
-  GCancellable *cancellable = handler_get_cancellable (handler);
-  GError *err = NULL;
-  gsize bytes_written;
-  gconstpointer data;
-  gsize data_length;
+  PutWriter *w = user_data;
 
   g_debug ("PUT got chunk");
 
-  data = g_bytes_get_data (chunk, &data_length);
+  if (w->failed)
+    return;
 
-  if (!g_output_stream_write_all (G_OUTPUT_STREAM (output),
-                                  data, data_length,
-                                  &bytes_written, cancellable, &err))
+  g_queue_push_tail (w->chunks, g_bytes_ref (chunk));
+  w->queued += g_bytes_get_size (chunk);
+  if (w->queued > PUT_HIGH_WATER)
+    put_writer_pause (w, TRUE);
+
+  put_writer_next (w);
+}
+
+static void
+method_put_got_body (SoupServerMessage *msg,
+                     gpointer           user_data)
+{
+  PutWriter *w = user_data;
+
+  w->got_body = TRUE;
+  put_writer_pause (w, TRUE);
+  put_writer_next (w);
+}
+
+static void
+method_put_finished (SoupServerMessage *msg,
+                     gpointer           user_data)
+{
+  PutWriter *w = user_data;
+
+  w->msg = NULL;
+  g_cancellable_cancel (w->cancellable);
+}
+
+static void
+put_writer_start (PathHandler *handler, SoupServerMessage *msg, GFile *file,
+                  GFile *target, GFile *tmp, GIOStream *io,
+                  GOutputStream *output)
+{
+  PutWriter *w = g_slice_new0 (PutWriter);
+
+  w->refs = 1;
+  w->claimed = TRUE;
+  w->msg = msg;
+  w->server = g_object_ref (handler_get_server (handler));
+  w->file = g_object_ref (file);
+  w->target = target ? g_object_ref (target) : NULL;
+  w->tmp = tmp ? g_object_ref (tmp) : NULL;
+  w->sync = handler_get_put_durability (handler) == PHODAV_PUT_DURABILITY_SYNC;
+  w->io = io ? g_object_ref (io) : NULL;
+  w->output = g_object_ref (output);
+  w->cancellable = g_cancellable_new ();
+  w->chunks = g_queue_new ();
+
+  soup_message_body_set_accumulate (soup_server_message_get_request_body (msg), FALSE);
+  g_signal_connect (msg, "got-chunk", G_CALLBACK (method_put_got_chunk), w);
+  g_signal_connect (msg, "got-body", G_CALLBACK (method_put_got_body), w);
+  g_signal_connect (msg, "finished", G_CALLBACK (method_put_finished), w);
+  g_object_set_data_full (G_OBJECT (msg), "phodav-put-writer",
+                          w, (GDestroyNotify) put_writer_unref);
+}
+
+/* writes the request body at the offset given by Content-Range,
+ * in place of the existing content. That can't be atomic: a reader
+ * may see the range half written. The ranged writes to a file are
+ * serialized, from the preconditions to the close, and the change is
+ * only published once the data is written. */
+static gint
+put_start_range (SoupServerMessage *msg, GFile *file,
+                 GFileIOStream **io, GCancellable *cancellable,
+                 GError **err)
+{
+  SoupMessageHeaders *headers = soup_server_message_get_request_headers (msg);
+  GFileIOStream *s = NULL;
+  GFileInfo *info = NULL;
+  goffset start, end, total, size;
+  gint status = SOUP_STATUS_BAD_REQUEST;
+
+  if (!soup_message_headers_get_content_range (headers, &start, &end, &total) ||
+      end < start ||
+      (soup_message_headers_get_encoding (headers) == SOUP_ENCODING_CONTENT_LENGTH &&
+       soup_message_headers_get_content_length (headers) != end - start + 1))
     goto end;
 
+  s = g_file_open_readwrite (file, cancellable, err);
+  if (!s)
+    {
+      status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+      if (g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_clear_error (err);
+          status = SOUP_STATUS_NOT_FOUND;
+        }
+      goto end;
+    }
+
+  info = g_file_io_stream_query_info (s, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                      cancellable, err);
+  if (!info)
+    {
+      status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+      goto end;
+    }
+
+  /* holes are not allowed, writes may only overwrite or append */
+  size = g_file_info_get_size (info);
+  if (start > size)
+    {
+      gchar *tmp = g_strdup_printf ("bytes */%" G_GOFFSET_FORMAT, size);
+      soup_message_headers_append (soup_server_message_get_response_headers (msg),
+                                   "Content-Range", tmp);
+      g_free (tmp);
+      status = SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE;
+      goto end;
+    }
+
+  if (!g_seekable_seek (G_SEEKABLE (s), start, G_SEEK_SET, cancellable, err))
+    {
+      status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+      goto end;
+    }
+
+  status = SOUP_STATUS_NO_CONTENT;
+
 end:
-  if (err)
+  if (status != SOUP_STATUS_NO_CONTENT)
+    g_clear_object (&s);
+  g_clear_object (&info);
+  *io = s;
+  return status;
+}
+
+/* reserves the announced size, so the file is less fragmented and a
+ * full disk fails early */
+static void
+put_preallocate (SoupServerMessage *msg, GOutputStream *output)
+{
+#if defined (G_OS_UNIX) && defined (HAVE_FALLOCATE)
+  SoupMessageHeaders *headers = soup_server_message_get_request_headers (msg);
+  goffset length;
+
+  if (soup_message_headers_get_encoding (headers) != SOUP_ENCODING_CONTENT_LENGTH ||
+      !G_IS_FILE_DESCRIPTOR_BASED (output))
+    return;
+
+  length = soup_message_headers_get_content_length (headers);
+  if (length > 0)
+    fallocate (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (output)),
+               FALLOC_FL_KEEP_SIZE, 0, length);
+#endif
+}
+
+/* where the content of @file is renamed: for a symlink, the file it
+ * leads to, so that the link is kept */
+static GFile *
+put_get_target (GFile *file, GFileInfo *info)
+{
+#ifdef G_OS_UNIX
+  if (info && g_file_info_get_is_symlink (info))
     {
-      g_warning ("error: %s", err->message);
-      g_clear_error (&err);
-      soup_server_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR, NULL);
+      gchar *path = g_file_get_path (file);
+      gchar *real = path ? realpath (path, NULL) : NULL;
+      GFile *target = real ? g_file_new_for_path (real) : NULL;
+
+      g_free (path);
+      free (real);
+      if (target)
+        return target;
     }
+#endif
+
+  return g_object_ref (file);
 }
 
-static gint
-put_start (SoupServerMessage *msg, GFile *file,
-           GFileOutputStream **output, GCancellable *cancellable,
-           GError **err)
+#define PUT_METADATA_ATTRIBUTES                 \
+  G_FILE_ATTRIBUTE_UNIX_MODE ","                \
+  G_FILE_ATTRIBUTE_UNIX_UID ","                 \
+  G_FILE_ATTRIBUTE_UNIX_GID ","                 \
+  "xattr::*,xattr-sys::*"
+
+/* A hidden sibling of @file, so that the rename stays on one file
+ * system. The rename must not change the mode, owner and extended
+ * attributes of an existing file, they would be lost with it: dead
+ * properties are stored there without a PhodavStore. */
+static GFileOutputStream *
+put_create_tmp (PathHandler *handler, GFile *file, GFileInfo *info, GFile **tmp,
+                GCancellable *cancellable, GError **err)
 {
+  GFile *parent = g_file_get_parent (file);
+  gchar *basename = g_file_get_basename (file);
   GFileOutputStream *s = NULL;
-  gchar *etag = NULL;
-  gboolean created = TRUE;
-  SoupMessageHeaders *headers = soup_server_message_get_request_headers (msg);
-  gint status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+  GFileInfo *metadata = NULL;
+  GError *error = NULL;
+  gint i;
 
-  if (g_file_query_exists (file, cancellable))
-    created = FALSE;
+  for (i = 0; i < 8 && !s; i++)
+    {
+      gchar *name = put_tmp_name_new (handler_get_tmp_key (handler), basename);
 
-  if (soup_message_headers_get_list (headers, "If-Match"))
-    g_warn_if_reached ();
-  else if (soup_message_headers_get_list (headers, "If-None-Match"))
-    g_warn_if_reached ();
-  else if (soup_message_headers_get_list (headers, "Expect"))
-    g_warn_if_reached ();
+      g_clear_error (&error);
+      g_clear_object (tmp);
+      *tmp = g_file_get_child (parent, name);
+      s = g_file_create (*tmp, G_FILE_CREATE_PRIVATE, cancellable, &error);
+      g_free (name);
+
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+        break;
+    }
 
-  s = g_file_replace (file, etag, FALSE, G_FILE_CREATE_PRIVATE, cancellable, err);
   if (!s)
-    goto end;
+    {
+      g_propagate_error (err, error);
+      g_clear_object (tmp);
+      goto end;
+    }
+
+  if (info)
+    metadata = g_file_query_info (file, PUT_METADATA_ATTRIBUTES,
+                                  G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+  /* the owner may only be kept with the right privileges */
+  if (metadata &&
+      !g_file_set_attributes_from_info (*tmp, metadata, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        cancellable, &error))
+    {
+      g_debug ("PUT: not all the attributes are kept: %s", error->message);
+      g_clear_error (&error);
+    }
+
+end:
+  g_clear_object (&metadata);
+  g_object_unref (parent);
+  g_free (basename);
+  return s;
+}
+
+/* Opens @file for writing, in place or through a @tmp file renamed
+ * over @target, depending on the server durability, @info being the
+ * existing file if any. A file with other hard links is always written
+ * in place: a rename would leave them with the old content. */
+static gint
+put_start (PathHandler *handler, SoupServerMessage *msg, GFile *file,
+           GFileInfo *info, GFile **target, GFile **tmp, GIOStream **io,
+           GOutputStream **output, GCancellable *cancellable, GError **err)
+{
+  gint status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+  GFileIOStream *s;
+
+  if (handler_get_put_durability (handler) == PHODAV_PUT_DURABILITY_DIRECT ||
+      (info && g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_NLINK) > 1))
+    {
+      s = info ?
+        g_file_open_readwrite (file, cancellable, err) :
+        g_file_create_readwrite (file, G_FILE_CREATE_PRIVATE, cancellable, err);
+      if (!s)
+        goto end;
 
-  status = created ? SOUP_STATUS_CREATED : SOUP_STATUS_OK;
+      *io = G_IO_STREAM (s);
+      *output = g_object_ref (g_io_stream_get_output_stream (*io));
+      if (info && !g_seekable_truncate (G_SEEKABLE (s), 0, cancellable, err))
+        goto end;
+    }
+  else
+    {
+      *target = put_get_target (file, info);
+      *output = G_OUTPUT_STREAM (put_create_tmp (handler, *target, info, tmp, cancellable, err));
+      if (!*output)
+        goto end;
+    }
+
+  put_preallocate (msg, *output);
+  status = info ? SOUP_STATUS_OK : SOUP_STATUS_CREATED;
 
 end:
-  *output = s;
   return status;
 }
 
@@ -98,7 +608,12 @@ phodav_method_put (PathHandler *handler, SoupServerMessage *msg, const gchar *pa
   GCancellable *cancellable = handler_get_cancellable (handler);
   GFile *file = NULL;
   GList *submitted = NULL;
-  GFileOutputStream *output = NULL;
+  GOutputStream *output = NULL;
+  GFileIOStream *range_io = NULL;
+  GIOStream *io = NULL;
+  GFile *target = NULL, *tmp = NULL;
+  GFileInfo *info = NULL;
+  gboolean ranged, claimed = FALSE;
   gint status;
   SoupMessageHeaders *request_headers = soup_server_message_get_request_headers (msg);
 
@@ -112,23 +627,77 @@ phodav_method_put (PathHandler *handler, SoupServerMessage *msg, const gchar *pa
       goto end;
     }
 
-  status = phodav_check_if (handler, msg, path, &submitted);
+  file = g_file_get_child (handler_get_file (handler), path + 1);
+
+  if (soup_message_headers_get_list (request_headers, "Expect"))
+    g_warn_if_reached ();
+
+  /* a full write would replace or truncate the file under a ranged
+   * one, and the other way around */
+  claimed = server_begin_write (handler_get_server (handler), file);
+  if (!claimed)
+    {
+      g_debug ("another write to %s is in flight", path);
+      status = SOUP_STATUS_CONFLICT;
+      goto end;
+    }
+
+  ranged = soup_message_headers_get_one (request_headers, "Content-Range") != NULL;
+
+  /* queried once, right before opening, for both the If header and the
+   * preconditions, so a ranged write applies to the version of the
+   * file the client knows about */
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_ETAG_VALUE ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK ","
+                            G_FILE_ATTRIBUTE_UNIX_NLINK,
+                            G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+
+  status = phodav_check_if_info (handler, msg, path, info, &submitted);
   if (status != SOUP_STATUS_OK)
     goto end;
 
-  file = g_file_get_child (handler_get_file (handler), path + 1);
-  status = put_start (msg, file, &output, cancellable, err);
-  if (!output || *err)
+  status = phodav_check_preconditions (msg, info);
+  if (status != SOUP_STATUS_OK)
     goto end;
 
+  if (ranged)
+    {
+      status = put_start_range (msg, file, &range_io, cancellable, err);
+      if (!range_io || *err)
+        goto end;
+
+      /* the writer releases the claim once closed */
+      g_debug ("PUT range %p", range_io);
+      claimed = FALSE;
+      put_writer_start (handler, msg, file, NULL, NULL, G_IO_STREAM (range_io),
+                        g_io_stream_get_output_stream (G_IO_STREAM (range_io)));
+      goto end;
+    }
+
+  status = put_start (handler, msg, file, info, &target, &tmp, &io, &output,
+                      cancellable, err);
+  if (*err)
+    {
+      if (tmp)
+        g_file_delete (tmp, NULL, NULL);
+      goto end;
+    }
+
   g_debug ("PUT output %p", output);
-  soup_message_body_set_accumulate (soup_server_message_get_request_body (msg), FALSE);
-  g_object_set_data (G_OBJECT (output), "handler", handler);
-  g_signal_connect (msg, "got-chunk", G_CALLBACK (method_put_got_chunk), output);
-  g_signal_connect (msg, "finished", G_CALLBACK (method_put_finished), output);
+  claimed = FALSE;
+  put_writer_start (handler, msg, file, target, tmp, io, output);
 
 end:
+  if (claimed)
+    server_end_write (handler_get_server (handler), file);
   soup_server_message_set_status (msg, status, NULL);
+  g_clear_object (&output);
+  g_clear_object (&io);
+  g_clear_object (&range_io);
+  g_clear_object (&target);
+  g_clear_object (&tmp);
+  g_clear_object (&info);
   g_clear_object (&file);
   g_debug ("  -> %d %s\n", soup_server_message_get_status (msg), soup_server_message_get_reason_phrase (msg));
 }
@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "phodav-priv.h"
+
+#include "phodav-utils.h"
+#include "phodav-multistatus.h"
+#include "phodav-propfind.h"
+#include "phodav-journal.h"
+
+/* REPORT, with only the RFC 6578 sync-collection report. Without a
+ * token, all the members are listed with the token of the current
+ * state. With one, the members changed since, from the journal, and
+ * those removed with a 404. The infinite level lists up to the
+ * depth-infinity-limit, without following symlinked collections, and
+ * is refused when there is none. A listing of one level, unless
+ * limited, is sent as it is read. */
+
+typedef struct _SyncCollection
+{
+  PathHandler *handler;
+  PropFind    *pf;
+  gchar       *token;
+  gboolean     infinite;
+  guint        limit;
+  GPtrArray   *paths;
+  GPtrArray   *infos;
+} SyncCollection;
+
+static void
+set_error (SoupServerMessage *msg, const gchar *condition)
+{
+  gchar *text = g_strdup_printf ("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                                 "<D:error xmlns:D=\"DAV:\"><D:%s/></D:error>\n",
+                                 condition);
+
+  server_message_set_response (msg, "application/xml", text, strlen (text));
+}
+
+static gboolean
+parse_sync_collection (SyncCollection *sync, xmlNodePtr xml)
+{
+  xmlNodePtr node, child;
+  xmlChar *text;
+  gboolean level = FALSE;
+  guint64 n;
+
+  for (node = xml->children; node; node = node->next)
+    {
+      if (!xml_node_is_element (node))
+        continue;
+
+      if (xml_node_has_name (node, "sync-token"))
+        {
+          text = xmlNodeGetContent (node);
+          g_clear_pointer (&sync->token, g_free);
+          if (text && *g_strstrip ((gchar *) text))
+            sync->token = g_strdup ((gchar *) text);
+          xmlFree (text);
+        }
+      else if (xml_node_has_name (node, "sync-level"))
+        {
+          text = xmlNodeGetContent (node);
+          if (text)
+            g_strstrip ((gchar *) text);
+          level = text && (!g_strcmp0 ((gchar *) text, "1") ||
+                           !g_strcmp0 ((gchar *) text, "infinite"));
+          sync->infinite = level && !g_strcmp0 ((gchar *) text, "infinite");
+          xmlFree (text);
+          if (!level)
+            return FALSE;
+        }
+      else if (xml_node_has_name (node, "limit"))
+        {
+          for (child = node->children; child; child = child->next)
+            if (xml_node_has_name (child, "nresults"))
+              {
+                text = xmlNodeGetContent (child);
+                if (!text ||
+                    !g_ascii_string_to_unsigned (g_strstrip ((gchar *) text), 10,
+                                                 1, G_MAXUINT, &n, NULL))
+                  {
+                    xmlFree (text);
+                    return FALSE;
+                  }
+                sync->limit = n;
+                xmlFree (text);
+              }
+        }
+    }
+
+  if (!level)
+    return FALSE;
+
+  sync->pf = propfind_parse (xml);
+  return sync->pf != NULL;
+}
+
+typedef struct _SyncList
+{
+  SyncCollection    *sync;
+  SoupServerMessage *msg;
+  MultiStatus       *ms; /* when streamed */
+  xmlNsPtr           ns;
+  const gchar       *path;
+  GQueue            *dirs;
+  guint              left; /* at infinite level */
+  gboolean           truncated;
+} SyncList;
+
+static gboolean
+sync_list_child (GFileInfo *info, gpointer data)
+{
+  SyncList *l = data;
+  const gchar *sep = g_str_has_suffix (l->path, "/") ? "" : "/";
+  gchar *path;
+
+  if (l->dirs && l->left == 0)
+    {
+      l->truncated = TRUE;
+      return FALSE;
+    }
+
+  path = g_strconcat (l->path, sep, g_file_info_get_name (info), NULL);
+  if (l->dirs)
+    {
+      if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY &&
+          !g_file_info_get_is_symlink (info))
+        g_queue_push_tail (l->dirs, g_strdup (path));
+      l->left--;
+    }
+
+  if (l->ms)
+    {
+      propfind_add (l->sync->handler, l->sync->pf, l->msg, l->ms, path, info, l->ns);
+      g_free (path);
+    }
+  else
+    {
+      g_ptr_array_add (l->sync->paths, path);
+      g_ptr_array_add (l->sync->infos, g_object_ref (info));
+    }
+
+  /* nothing is sent past the limit */
+  if (l->sync->limit && l->sync->paths->len > l->sync->limit)
+    {
+      l->truncated = TRUE;
+      return FALSE;
+    }
+
+  return !g_cancellable_is_cancelled (handler_get_cancellable (l->sync->handler));
+}
+
+/* all the members, for an initial sync, added to @ms when given: FALSE
+ * when there are more than the depth-infinity-limit at infinite level,
+ * or than the limit of the request */
+static gboolean
+sync_list (SyncCollection *sync, const gchar *path, SoupServerMessage *msg,
+           MultiStatus *ms, xmlNsPtr ns)
+{
+  PathHandler *handler = sync->handler;
+  GCancellable *cancellable = handler_get_cancellable (handler);
+  GQueue dirs = G_QUEUE_INIT;
+  SyncList l = { sync, msg, ms, ns, NULL, sync->infinite ? &dirs : NULL,
+                 handler_get_depth_infinity_limit (handler), FALSE };
+  gchar *dir = g_strdup (path);
+  GError *err = NULL;
+  GFile *file;
+
+  do
+    {
+      l.path = dir;
+      file = g_file_get_child (handler_get_file (handler), dir + 1);
+      handler_enumerate_children (handler, file, propfind_get_attributes_query (sync->pf),
+                                  sync_list_child, &l, cancellable, &err);
+      g_object_unref (file);
+      if (err)
+        {
+          if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            g_warning ("query: %s", err->message);
+          g_clear_error (&err);
+        }
+      g_free (dir);
+    }
+  while (!l.truncated && !g_cancellable_is_cancelled (cancellable) &&
+         (dir = g_queue_pop_head (&dirs)));
+
+  g_queue_clear_full (&dirs, g_free);
+  return !l.truncated;
+}
+
+static gint
+sync_collection (SyncCollection *sync, SoupServerMessage *msg, const gchar *path)
+{
+  PathHandler *handler = sync->handler;
+  Journal *journal = handler_get_journal (handler);
+  GCancellable *cancellable = handler_get_cancellable (handler);
+  MultiStatus *ms = NULL;
+  xmlNsPtr ns = NULL;
+  gboolean truncated = FALSE;
+  gchar *collection, *next = NULL;
+  GFileInfo *info;
+  GFile *file;
+  gint status;
+  guint i;
+
+  collection = g_strdup (path);
+  if (collection[1])
+    remove_trailing (collection, '/');
+
+  file = g_file_get_child (handler_get_file (handler), collection + 1);
+  info = handler_query_info (handler, file, G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                             cancellable, NULL);
+  g_object_unref (file);
+  if (!info)
+    {
+      status = SOUP_STATUS_NOT_FOUND;
+      goto end;
+    }
+  if (!journal || g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      set_error (msg, "supported-report");
+      goto end;
+    }
+  if (sync->infinite && !handler_get_depth_infinity_limit (handler))
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      set_error (msg, "sync-traversal-supported");
+      goto end;
+    }
+
+  /* a token is only valid once the changes behind phodav are seen */
+  journal_watch (journal, collection, sync->infinite);
+
+  if (!sync->token)
+    {
+      /* taken first, the changes while listing are reported again */
+      next = journal_get_token (journal);
+      if (!sync->infinite && !sync->limit)
+        {
+          ns = xmlNewNs (NULL, BAD_CAST "DAV:", BAD_CAST "D");
+          ms = multistatus_new (msg);
+        }
+      if (!sync_list (sync, collection, msg, ms, ns))
+        {
+          status = SOUP_STATUS_INSUFFICIENT_STORAGE;
+          set_error (msg, "number-of-matches-within-limits");
+          goto end;
+        }
+    }
+  else if (!journal_get_changes (journal, sync->token, collection, sync->infinite,
+                                 sync->limit, sync->paths, &next, &truncated))
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      set_error (msg, "valid-sync-token");
+      goto end;
+    }
+
+  if (!ms)
+    {
+      ns = xmlNewNs (NULL, BAD_CAST "DAV:", BAD_CAST "D");
+      ms = multistatus_new (msg);
+    }
+  for (i = 0; i < sync->paths->len; i++)
+    {
+      const gchar *p = sync->paths->pdata[i];
+      GFileInfo *child = i < sync->infos->len ? g_object_ref (sync->infos->pdata[i]) : NULL;
+
+      if (!child)
+        {
+          file = g_file_get_child (handler_get_file (handler), p + 1);
+          child = handler_query_info (handler, file, propfind_get_attributes_query (sync->pf),
+                                      cancellable, NULL);
+          g_object_unref (file);
+        }
+
+      if (child)
+        {
+          propfind_add (handler, sync->pf, msg, ms, p, child, ns);
+          g_object_unref (child);
+        }
+      else
+        {
+          Response resp = { .props = NULL, .status = SOUP_STATUS_NOT_FOUND };
+          gchar *escape = g_markup_escape_text (p, -1);
+
+          multistatus_add (ms, escape, &resp);
+          g_free (escape);
+        }
+    }
+
+  /* RFC 6578 3.6: the rest is given with the next token */
+  if (truncated)
+    {
+      Response resp = { .props = NULL, .status = SOUP_STATUS_INSUFFICIENT_STORAGE };
+      gchar *escape = g_markup_escape_text (collection, -1);
+
+      multistatus_add (ms, escape, &resp);
+      g_free (escape);
+    }
+
+  multistatus_add_sync_token (ms, next);
+  status = multistatus_end (g_steal_pointer (&ms));
+
+end:
+  g_clear_pointer (&ms, multistatus_free);
+  if (ns)
+    xmlFreeNs (ns);
+  g_clear_object (&info);
+  g_free (collection);
+  g_free (next);
+  return status;
+}
+
+gint
+phodav_method_report (PathHandler *handler, SoupServerMessage *msg,
+                      const char *path, GError **err)
+{
+  SyncCollection sync = { handler, };
+  SoupMessageBody *request_body = soup_server_message_get_request_body (msg);
+  DavDoc doc = {0, };
+  gint status;
+
+  sync.paths = g_ptr_array_new_with_free_func (g_free);
+  sync.infos = g_ptr_array_new_with_free_func (g_object_unref);
+
+  if (!request_body || !request_body->length ||
+      !davdoc_parse (&doc, msg, request_body, NULL))
+    {
+      status = SOUP_STATUS_BAD_REQUEST;
+      goto end;
+    }
+
+  if (!xml_node_has_name (doc.root, "sync-collection"))
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      set_error (msg, "supported-report");
+      goto end;
+    }
+
+  if (!parse_sync_collection (&sync, doc.root))
+    {
+      status = SOUP_STATUS_BAD_REQUEST;
+      goto end;
+    }
+
+  status = sync_collection (&sync, msg, path);
+
+end:
+  davdoc_free (&doc);
+  propfind_free (sync.pf);
+  g_ptr_array_unref (sync.paths);
+  g_ptr_array_unref (sync.infos);
+  g_free (sync.token);
+  return status;
+}
@@ -0,0 +1,1332 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "phodav-priv.h"
+
+#include "phodav-utils.h"
+#include "phodav-multistatus.h"
+#include "phodav-propfind.h"
+#include "phodav-store.h"
+#include "phodav-usage.h"
+#include "phodav-virtual-dir.h"
+
+/* The RFC 5323 basicsearch grammar. The where condition can test the
+ * displayname, getcontentlength, getlastmodified and getcontenttype
+ * properties, and the dead properties.
+ *
+ * When the usage index keeps the files, the condition is first
+ * evaluated on its entries, which know the names, sizes, modification
+ * times and types, and the dead properties when they are in the store.
+ * Only the resources that could not be decided that way, and the
+ * results, are then queried, once the index is unlocked again: the
+ * properties of the results may need it, for quota-used-bytes.
+ * Otherwise the scope is walked, without following the symbolic links
+ * to directories.
+ *
+ * A scope of infinite depth is bounded like a PROPFIND of infinite
+ * depth, by the depth-infinity-limit of the server: refused when it
+ * is 0, and ending with a 507 response once that many resources were
+ * looked at.
+ *
+ * Without an orderby, the results are streamed as they are found.
+ * Otherwise they are kept to be sorted, up to the same limit, or
+ * SEARCH_SORT_MAX when there is none, and a 507 response ends the
+ * results past it. */
+
+#define SEARCH_SORT_MAX 10000
+
+/* for the evaluation, the rest is what the select needs */
+#define SEARCH_QUERY                            \
+  G_FILE_ATTRIBUTE_STANDARD_NAME ","            \
+  G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","    \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE ","            \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE ","            \
+  G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK ","      \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+typedef enum {
+  MATCH_FALSE,
+  MATCH_TRUE,
+  MATCH_UNKNOWN, /* on an undefined property */
+  MATCH_DEFER,   /* needs the file info */
+} Match;
+
+typedef enum {
+  SEARCH_AND,
+  SEARCH_OR,
+  SEARCH_NOT,
+  SEARCH_EQ,
+  SEARCH_LT,
+  SEARCH_GT,
+  SEARCH_LTE,
+  SEARCH_GTE,
+  SEARCH_LIKE,
+  SEARCH_IS_COLLECTION,
+  SEARCH_IS_DEFINED,
+} SearchOp;
+
+typedef enum {
+  SEARCH_PROP_DISPLAYNAME,
+  SEARCH_PROP_GETCONTENTLENGTH,
+  SEARCH_PROP_GETLASTMODIFIED,
+  SEARCH_PROP_GETCONTENTTYPE,
+  SEARCH_PROP_DEAD,
+} SearchPropType;
+
+typedef struct _SearchProp
+{
+  SearchPropType type;
+  gchar         *xattr; /* of a dead property */
+} SearchProp;
+
+typedef struct _SearchCond SearchCond;
+
+struct _SearchCond
+{
+  SearchOp    op;
+  GPtrArray  *children; /* of and, or and not */
+  SearchProp  prop;
+  gchar      *literal;
+  gint64      value;    /* the literal of a length or a date */
+};
+
+typedef struct _SearchOrder
+{
+  SearchProp prop;
+  gboolean   descending;
+} SearchOrder;
+
+typedef struct _SearchScope
+{
+  gchar *path;
+  gint   depth; /* -1 for infinity */
+} SearchScope;
+
+typedef struct _SearchItem
+{
+  gchar       *path; /* from the root, unescaped */
+  const gchar *name;
+  gboolean     dir;
+  guint64      size;
+  gint64       mtime;
+  GFileInfo   *info; /* NULL when known from the index */
+  gboolean     deferred;
+} SearchItem;
+
+typedef struct _Search
+{
+  PathHandler *handler;
+  PropStore   *store;
+  gint         status;
+  gchar       *attributes;
+  PropFind    *pf;
+  SoupServerMessage *msg;
+  MultiStatus *ms;
+  xmlNsPtr     ns;
+  guint        sent;
+  SearchCond  *where;
+  GArray      *orders;
+  guint        nresults;
+  guint        matched;
+  guint        limit;    /* of resources in infinite scopes */
+  guint        visited;
+  gboolean     infinite; /* in the current scope */
+  gboolean     truncated;
+  GPtrArray   *items;
+  GPtrArray   *candidates; /* of the index, taken once it is unlocked */
+  guint        certain;    /* of the candidates, that need no query */
+  GString     *path;
+} Search;
+
+static const gchar *unsupported_props[] = {
+  "creationdate", "resourcetype", "getetag", "executable",
+  "supportedlock", "lockdiscovery",
+  "quota-available-bytes", "quota-used-bytes",
+};
+
+static void
+search_cond_free (SearchCond *cond)
+{
+  if (!cond)
+    return;
+
+  g_clear_pointer (&cond->children, g_ptr_array_unref);
+  g_free (cond->prop.xattr);
+  g_free (cond->literal);
+  g_slice_free (SearchCond, cond);
+}
+
+static void
+search_order_clear (SearchOrder *order)
+{
+  g_free (order->prop.xattr);
+}
+
+static void
+search_scope_clear (SearchScope *scope)
+{
+  g_free (scope->path);
+}
+
+static void
+search_item_free (SearchItem *item)
+{
+  g_clear_object (&item->info);
+  g_free (item->path);
+  g_slice_free (SearchItem, item);
+}
+
+static void
+search_item_set_info (SearchItem *item, GFileInfo *info)
+{
+  g_clear_object (&item->info);
+  item->info = g_object_ref (info);
+  item->name = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME) ? :
+    g_file_info_get_name (info);
+  item->dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+  item->size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+  item->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+}
+
+static xmlNodePtr
+xml_node_first_element (xmlNodePtr node)
+{
+  for (node = node->children; node; node = node->next)
+    if (xml_node_is_element (node))
+      return node;
+
+  return NULL;
+}
+
+/* the property inside the prop element @node */
+static gboolean
+parse_search_prop (Search *s, xmlNodePtr node, SearchProp *prop)
+{
+  gint i;
+
+  if (!xml_node_has_name (node, "prop") ||
+      !(node = xml_node_first_element (node)))
+    {
+      s->status = SOUP_STATUS_BAD_REQUEST;
+      return FALSE;
+    }
+
+  if (xml_node_has_name (node, "displayname"))
+    prop->type = SEARCH_PROP_DISPLAYNAME;
+  else if (xml_node_has_name (node, "getcontentlength"))
+    prop->type = SEARCH_PROP_GETCONTENTLENGTH;
+  else if (xml_node_has_name (node, "getlastmodified"))
+    prop->type = SEARCH_PROP_GETLASTMODIFIED;
+  else if (xml_node_has_name (node, "getcontenttype"))
+    prop->type = SEARCH_PROP_GETCONTENTTYPE;
+  else
+    {
+      for (i = 0; i < G_N_ELEMENTS (unsupported_props); i++)
+        if (xml_node_has_name (node, unsupported_props[i]))
+          {
+            s->status = SOUP_STATUS_UNPROCESSABLE_ENTITY;
+            return FALSE;
+          }
+
+      prop->type = SEARCH_PROP_DEAD;
+      prop->xattr = xml_node_get_xattr_name (node, "xattr::");
+    }
+
+  return TRUE;
+}
+
+static gboolean
+parse_search_literal (Search *s, xmlNodePtr node, SearchCond *cond)
+{
+  GDateTime *date = NULL;
+  xmlChar *text;
+  guint64 number;
+
+  if (!node || !(xml_node_has_name (node, "literal") ||
+                 xml_node_has_name (node, "typed-literal")))
+    {
+      s->status = SOUP_STATUS_BAD_REQUEST;
+      return FALSE;
+    }
+
+  text = xmlNodeGetContent (node);
+  cond->literal = g_strdup (text ? (gchar *) text : "");
+  xmlFree (text);
+
+  switch (cond->prop.type)
+    {
+    case SEARCH_PROP_GETCONTENTLENGTH:
+      if (cond->op == SEARCH_LIKE ||
+          !g_ascii_string_to_unsigned (g_strstrip (cond->literal), 10, 0, G_MAXINT64,
+                                       &number, NULL))
+        goto bad;
+      cond->value = number;
+      break;
+
+    case SEARCH_PROP_GETLASTMODIFIED:
+      if (cond->op == SEARCH_LIKE)
+        goto bad;
+      date = soup_date_time_new_from_http_string (cond->literal);
+      if (!date)
+        date = g_date_time_new_from_iso8601 (cond->literal, NULL);
+      if (!date)
+        goto bad;
+      cond->value = g_date_time_to_unix (date);
+      g_date_time_unref (date);
+      break;
+
+    default:
+      break;
+    }
+
+  return TRUE;
+
+bad:
+  s->status = SOUP_STATUS_BAD_REQUEST;
+  return FALSE;
+}
+
+static SearchCond *
+parse_search_cond (Search *s, xmlNodePtr node)
+{
+  static const struct {
+    const gchar *name;
+    SearchOp     op;
+  } ops[] = {
+    { "and", SEARCH_AND },
+    { "or", SEARCH_OR },
+    { "not", SEARCH_NOT },
+    { "eq", SEARCH_EQ },
+    { "lt", SEARCH_LT },
+    { "gt", SEARCH_GT },
+    { "lte", SEARCH_LTE },
+    { "gte", SEARCH_GTE },
+    { "like", SEARCH_LIKE },
+    { "is-collection", SEARCH_IS_COLLECTION },
+    { "is-defined", SEARCH_IS_DEFINED },
+  };
+  SearchCond *cond = NULL;
+  xmlNodePtr child;
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS (ops); i++)
+    if (xml_node_has_name (node, ops[i].name))
+      break;
+
+  if (i == G_N_ELEMENTS (ops))
+    {
+      /* contains, and the extensions */
+      s->status = SOUP_STATUS_UNPROCESSABLE_ENTITY;
+      goto end;
+    }
+
+  cond = g_slice_new0 (SearchCond);
+  cond->op = ops[i].op;
+
+  switch (cond->op)
+    {
+    case SEARCH_AND:
+    case SEARCH_OR:
+    case SEARCH_NOT:
+      cond->children = g_ptr_array_new_with_free_func ((GDestroyNotify) search_cond_free);
+      for (child = node->children; child; child = child->next)
+        {
+          SearchCond *c;
+
+          if (!xml_node_is_element (child))
+            continue;
+
+          c = parse_search_cond (s, child);
+          if (!c)
+            goto fail;
+          g_ptr_array_add (cond->children, c);
+        }
+
+      if (cond->children->len == 0 ||
+          (cond->op == SEARCH_NOT && cond->children->len != 1))
+        {
+          s->status = SOUP_STATUS_BAD_REQUEST;
+          goto fail;
+        }
+      break;
+
+    case SEARCH_IS_COLLECTION:
+      break;
+
+    case SEARCH_IS_DEFINED:
+      child = xml_node_first_element (node);
+      if (!child || !parse_search_prop (s, child, &cond->prop))
+        goto fail;
+      break;
+
+    default:
+      child = xml_node_first_element (node);
+      if (!child || !parse_search_prop (s, child, &cond->prop))
+        goto fail;
+
+      for (child = child->next; child; child = child->next)
+        if (xml_node_is_element (child))
+          break;
+      if (!parse_search_literal (s, child, cond))
+        goto fail;
+      break;
+    }
+
+  goto end;
+
+fail:
+  g_clear_pointer (&cond, search_cond_free);
+
+end:
+  if (!cond && s->status == SOUP_STATUS_OK)
+    s->status = SOUP_STATUS_BAD_REQUEST;
+  return cond;
+}
+
+/* whether @path names a file of the root, and not outside of it */
+static gboolean
+search_is_exported (Search *s, const gchar *path)
+{
+  GFile *root = handler_get_file (s->handler);
+  GFile *file;
+  gboolean exported;
+
+  /* the virtual dirs resolve their own children */
+  if (PHODAV_IS_VIRTUAL_DIR (root))
+    return TRUE;
+
+  file = g_file_get_child (root, path + 1);
+  exported = g_file_equal (file, root) || g_file_has_prefix (file, root);
+  g_object_unref (file);
+
+  return exported;
+}
+
+static gboolean
+parse_search_scope (Search *s, SoupServerMessage *msg, xmlNodePtr node,
+                    GArray *scopes)
+{
+  SearchScope scope = { NULL, -1 };
+  xmlChar *href = NULL, *depth = NULL;
+  GUri *uri = NULL;
+
+  for (node = node->children; node; node = node->next)
+    {
+      if (xml_node_has_name (node, "href") && !href)
+        href = xmlNodeGetContent (node);
+      else if (xml_node_has_name (node, "depth") && !depth)
+        depth = xmlNodeGetContent (node);
+    }
+
+  if (!href)
+    goto end;
+
+  uri = g_uri_parse_relative (soup_server_message_get_uri (msg),
+                              g_strstrip ((gchar *) href), SOUP_HTTP_URI_FLAGS, NULL);
+  if (!uri)
+    goto end;
+
+  /* the dot segments were removed before unescaping */
+  scope.path = g_uri_unescape_string (g_uri_get_path (uri), "/");
+  if (!scope.path || *scope.path != '/' || path_has_dot_segment (scope.path))
+    {
+      g_clear_pointer (&scope.path, g_free);
+      goto end;
+    }
+  if (scope.path[1])
+    remove_trailing (scope.path, '/');
+
+  if (depth)
+    g_strstrip ((gchar *) depth);
+  if (depth && !g_strcmp0 ((gchar *) depth, "0"))
+    scope.depth = 0;
+  else if (depth && !g_strcmp0 ((gchar *) depth, "1"))
+    scope.depth = 1;
+  else if (depth && g_strcmp0 ((gchar *) depth, "infinity"))
+    g_clear_pointer (&scope.path, g_free);
+
+  if (scope.path && !search_is_exported (s, scope.path))
+    g_clear_pointer (&scope.path, g_free);
+
+  if (scope.path)
+    g_array_append_val (scopes, scope);
+
+end:
+  g_clear_pointer (&uri, g_uri_unref);
+  xmlFree (href);
+  xmlFree (depth);
+  return scope.path != NULL;
+}
+
+static gboolean
+parse_search_orderby (Search *s, xmlNodePtr node)
+{
+  xmlNodePtr child;
+
+  for (node = node->children; node; node = node->next)
+    {
+      SearchOrder order = { { 0, }, FALSE };
+
+      if (!xml_node_has_name (node, "order"))
+        continue;
+
+      child = xml_node_first_element (node);
+      if (!child || !parse_search_prop (s, child, &order.prop))
+        return FALSE;
+
+      for (child = child->next; child; child = child->next)
+        if (xml_node_has_name (child, "descending"))
+          order.descending = TRUE;
+
+      g_array_append_val (s->orders, order);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+parse_search_limit (Search *s, xmlNodePtr node)
+{
+  xmlChar *text;
+  guint64 n;
+  gboolean valid;
+
+  for (node = node->children; node; node = node->next)
+    if (xml_node_has_name (node, "nresults"))
+      break;
+
+  if (!node)
+    return TRUE;
+
+  text = xmlNodeGetContent (node);
+  valid = text &&
+    g_ascii_string_to_unsigned (g_strstrip ((gchar *) text), 10, 1, G_MAXUINT, &n, NULL);
+  xmlFree (text);
+
+  if (valid)
+    s->nresults = n;
+  else
+    s->status = SOUP_STATUS_BAD_REQUEST;
+
+  return valid;
+}
+
+/* Matches with % and _ wildcards and \ escapes, ignoring the case.
+ * On a mismatch, only the last % is retried one character further,
+ * the earlier ones can't match better, so it takes O(n*m) steps. */
+static gboolean
+like_match (const gchar *pattern, const gchar *str)
+{
+  const gchar *star = NULL, *mark = NULL;
+
+  while (*str)
+    {
+      const gchar *p = pattern;
+
+      if (*p == '%')
+        {
+          while (*p == '%')
+            p++;
+          if (!*p)
+            return TRUE;
+
+          star = pattern = p;
+          mark = str;
+          continue;
+        }
+
+      if (*p == '_')
+        {
+          pattern++;
+          str = g_utf8_next_char (str);
+          continue;
+        }
+
+      if (*p == '\\' && p[1])
+        p++;
+      if (*p && g_ascii_tolower (*p) == g_ascii_tolower (*str))
+        {
+          pattern = p + 1;
+          str++;
+          continue;
+        }
+
+      if (!star)
+        return FALSE;
+
+      /* the last % takes one more character */
+      mark = g_utf8_next_char (mark);
+      pattern = star;
+      str = mark;
+    }
+
+  while (*pattern == '%')
+    pattern++;
+
+  return *pattern == '\0';
+}
+
+/* the value of a string property, in @tmp when allocated */
+static Match
+search_get_string (Search *s, SearchItem *item, SearchProp *prop,
+                   const gchar **value, gchar **tmp)
+{
+  *value = NULL;
+
+  switch (prop->type)
+    {
+    case SEARCH_PROP_DISPLAYNAME:
+      *value = item->name;
+      break;
+
+    case SEARCH_PROP_GETCONTENTTYPE:
+      if (!item->info)
+        return MATCH_DEFER;
+      *value = g_file_info_get_attribute_string (item->info,
+                                                 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE);
+      break;
+
+    case SEARCH_PROP_DEAD:
+      if (!prop->xattr)
+        break;
+      if (s->store)
+        *value = *tmp = prop_store_get_prop (s->store, item->path, prop->xattr);
+      else if (!item->info)
+        return MATCH_DEFER;
+      else
+        *value = g_file_info_get_attribute_string (item->info, prop->xattr);
+      break;
+
+    default:
+      g_return_val_if_reached (MATCH_UNKNOWN);
+    }
+
+  return *value ? MATCH_TRUE : MATCH_UNKNOWN;
+}
+
+static Match
+search_get_number (SearchItem *item, SearchProp *prop, gint64 *value)
+{
+  switch (prop->type)
+    {
+    case SEARCH_PROP_GETCONTENTLENGTH:
+      if (item->dir)
+        return MATCH_UNKNOWN;
+      *value = item->size;
+      return MATCH_TRUE;
+
+    case SEARCH_PROP_GETLASTMODIFIED:
+      *value = item->mtime;
+      return MATCH_TRUE;
+
+    default:
+      return MATCH_FALSE;
+    }
+}
+
+static gboolean
+search_prop_is_number (SearchProp *prop)
+{
+  return prop->type == SEARCH_PROP_GETCONTENTLENGTH ||
+    prop->type == SEARCH_PROP_GETLASTMODIFIED;
+}
+
+static Match
+search_compare (SearchOp op, gint cmp)
+{
+  gboolean match;
+
+  switch (op)
+    {
+    case SEARCH_EQ:
+      match = cmp == 0;
+      break;
+    case SEARCH_LT:
+      match = cmp < 0;
+      break;
+    case SEARCH_GT:
+      match = cmp > 0;
+      break;
+    case SEARCH_LTE:
+      match = cmp <= 0;
+      break;
+    case SEARCH_GTE:
+      match = cmp >= 0;
+      break;
+    default:
+      g_return_val_if_reached (MATCH_FALSE);
+    }
+
+  return match ? MATCH_TRUE : MATCH_FALSE;
+}
+
+/* in the three-valued logic of RFC 5323, deferring what needs the info */
+static Match
+search_eval (Search *s, SearchCond *cond, SearchItem *item)
+{
+  const gchar *str;
+  gchar *tmp = NULL;
+  gint64 number;
+  Match match, m;
+  guint i;
+
+  if (!cond)
+    return MATCH_TRUE;
+
+  switch (cond->op)
+    {
+    case SEARCH_AND:
+      match = MATCH_TRUE;
+      for (i = 0; i < cond->children->len; i++)
+        {
+          m = search_eval (s, cond->children->pdata[i], item);
+          if (m == MATCH_FALSE)
+            return MATCH_FALSE;
+          if (m == MATCH_DEFER || match == MATCH_TRUE)
+            match = m;
+        }
+      return match;
+
+    case SEARCH_OR:
+      match = MATCH_FALSE;
+      for (i = 0; i < cond->children->len; i++)
+        {
+          m = search_eval (s, cond->children->pdata[i], item);
+          if (m == MATCH_TRUE)
+            return MATCH_TRUE;
+          if (m == MATCH_DEFER || match == MATCH_FALSE)
+            match = m;
+        }
+      return match;
+
+    case SEARCH_NOT:
+      match = search_eval (s, cond->children->pdata[0], item);
+      if (match == MATCH_TRUE || match == MATCH_FALSE)
+        match = match == MATCH_TRUE ? MATCH_FALSE : MATCH_TRUE;
+      return match;
+
+    case SEARCH_IS_COLLECTION:
+      return item->dir ? MATCH_TRUE : MATCH_FALSE;
+
+    case SEARCH_IS_DEFINED:
+      if (search_prop_is_number (&cond->prop))
+        match = search_get_number (item, &cond->prop, &number);
+      else
+        match = search_get_string (s, item, &cond->prop, &str, &tmp);
+      g_free (tmp);
+      return match == MATCH_UNKNOWN ? MATCH_FALSE : match;
+
+    default:
+      break;
+    }
+
+  if (search_prop_is_number (&cond->prop))
+    {
+      match = search_get_number (item, &cond->prop, &number);
+      if (match == MATCH_TRUE)
+        match = search_compare (cond->op, (number > cond->value) - (number < cond->value));
+      return match;
+    }
+
+  match = search_get_string (s, item, &cond->prop, &str, &tmp);
+  if (match == MATCH_TRUE)
+    {
+      if (cond->op == SEARCH_LIKE)
+        match = like_match (cond->literal, str) ? MATCH_TRUE : MATCH_FALSE;
+      else
+        match = search_compare (cond->op, g_ascii_strcasecmp (str, cond->literal));
+    }
+  g_free (tmp);
+
+  return match;
+}
+
+/* FALSE once enough results are found */
+static gboolean
+search_more (Search *s)
+{
+  if (s->truncated || g_cancellable_is_cancelled (handler_get_cancellable (s->handler)))
+    return FALSE;
+
+  return s->orders->len || !s->nresults || s->matched <= s->nresults;
+}
+
+/* FALSE, and truncated, once the limit of an infinite scope is reached */
+static gboolean
+search_count (Search *s)
+{
+  if (!s->infinite)
+    return TRUE;
+
+  if (s->visited == s->limit)
+    {
+      s->truncated = TRUE;
+      return FALSE;
+    }
+
+  s->visited++;
+  return TRUE;
+}
+
+/* queries the info of a candidate of the index, and decides it */
+static gboolean
+search_resolve_item (Search *s, SearchItem *item)
+{
+  GCancellable *cancellable = handler_get_cancellable (s->handler);
+  GFileInfo *info;
+  GFile *file;
+
+  if (item->info)
+    return TRUE;
+
+  file = g_file_get_child (handler_get_file (s->handler), item->path + 1);
+  info = handler_query_info (s->handler, file, s->attributes, cancellable, NULL);
+  g_object_unref (file);
+
+  /* gone since it was indexed */
+  if (!info)
+    return FALSE;
+
+  search_item_set_info (item, info);
+  g_object_unref (info);
+  item->deferred = FALSE;
+
+  return search_eval (s, s->where, item) == MATCH_TRUE;
+}
+
+/* takes @item, that may match: sent right away without an orderby,
+ * or kept to be sorted */
+static void
+search_take (Search *s, SearchItem *item, Match match)
+{
+  item->deferred = match == MATCH_DEFER;
+
+  if (s->orders->len)
+    {
+      guint max = s->limit ? s->limit : SEARCH_SORT_MAX;
+
+      if (s->items->len == max)
+        {
+          s->truncated = TRUE;
+          search_item_free (item);
+          return;
+        }
+
+      g_ptr_array_add (s->items, item);
+      return;
+    }
+
+  if (!search_resolve_item (s, item))
+    {
+      search_item_free (item);
+      return;
+    }
+
+  s->matched++;
+  if (!s->nresults || s->sent < s->nresults)
+    {
+      propfind_add (s->handler, s->pf, s->msg, s->ms, item->path, item->info, s->ns);
+      s->sent++;
+    }
+  search_item_free (item);
+}
+
+static void
+search_consider (Search *s, SearchItem *item)
+{
+  Match match = search_eval (s, s->where, item);
+
+  if (match != MATCH_TRUE && match != MATCH_DEFER)
+    {
+      search_item_free (item);
+      return;
+    }
+
+  search_take (s, item, match);
+}
+
+/* called with the index locked: the candidates are only copied out,
+ * their info is queried and they are sent once it is unlocked */
+static gboolean
+search_index_entry (const UsageEntry *entry, gpointer data)
+{
+  Search *s = data;
+  gsize len = s->path->len;
+  SearchItem tmp = { NULL, entry->name, entry->dir, entry->size, entry->mtime, NULL, FALSE };
+  Match match;
+
+  if (!search_count (s))
+    return FALSE;
+
+  if (*entry->path)
+    {
+      if (s->path->str[len - 1] != '/')
+        g_string_append_c (s->path, '/');
+      g_string_append (s->path, entry->path);
+    }
+  tmp.path = s->path->str;
+
+  match = search_eval (s, s->where, &tmp);
+  if (match == MATCH_TRUE || match == MATCH_DEFER)
+    {
+      SearchItem *item = g_slice_new0 (SearchItem);
+
+      *item = tmp;
+      item->path = g_strdup (tmp.path);
+      item->name = NULL;
+      item->deferred = match == MATCH_DEFER;
+      g_ptr_array_add (s->candidates, item);
+      if (match == MATCH_TRUE)
+        s->certain++;
+    }
+
+  g_string_truncate (s->path, len);
+
+  if (!search_more (s))
+    return FALSE;
+
+  /* one more than can be kept or sent is enough to know it */
+  if (s->orders->len)
+    return s->items->len + s->candidates->len <= (s->limit ? s->limit : SEARCH_SORT_MAX);
+
+  return !s->nresults || s->matched + s->certain <= s->nresults;
+}
+
+/* takes the candidates of the index, with the index unlocked */
+static void
+search_take_candidates (Search *s)
+{
+  SearchItem *item;
+  guint i;
+
+  for (i = 0; i < s->candidates->len; i++)
+    {
+      item = s->candidates->pdata[i];
+      if (search_more (s))
+        search_take (s, item, item->deferred ? MATCH_DEFER : MATCH_TRUE);
+      else
+        search_item_free (item);
+    }
+
+  g_ptr_array_set_size (s->candidates, 0);
+  s->certain = 0;
+}
+
+typedef struct _SearchWalk
+{
+  Search      *s;
+  const gchar *path;
+  gint         depth;
+  GQueue      *dirs;
+} SearchWalk;
+
+static gboolean
+search_walk_child (GFileInfo *info, gpointer data)
+{
+  SearchWalk *w = data;
+  SearchItem *item;
+  const gchar *sep = g_str_has_suffix (w->path, "/") ? "" : "/";
+
+  if (!search_count (w->s))
+    return FALSE;
+
+  item = g_slice_new0 (SearchItem);
+  item->path = g_strconcat (w->path, sep, g_file_info_get_name (info), NULL);
+  search_item_set_info (item, info);
+
+  /* a link to a parent would loop */
+  if (item->dir && w->depth != 0 && !g_file_info_get_is_symlink (info))
+    {
+      SearchScope *dir = g_slice_new (SearchScope);
+
+      dir->path = g_strdup (item->path);
+      dir->depth = w->depth;
+      g_queue_push_tail (w->dirs, dir);
+    }
+
+  search_consider (w->s, item);
+  return search_more (w->s);
+}
+
+static gint
+search_walk (Search *s, SearchScope *scope)
+{
+  GCancellable *cancellable = handler_get_cancellable (s->handler);
+  GQueue dirs = G_QUEUE_INIT;
+  SearchScope *dir;
+  SearchItem *item;
+  GFileInfo *info;
+  GFile *file;
+  GError *err = NULL;
+
+  file = g_file_get_child (handler_get_file (s->handler), scope->path + 1);
+  info = handler_query_info (s->handler, file, s->attributes, cancellable, &err);
+  g_object_unref (file);
+  if (!info)
+    {
+      if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_warning ("queryinfo: %s", err->message);
+      g_clear_error (&err);
+      return SOUP_STATUS_NOT_FOUND;
+    }
+
+  item = g_slice_new0 (SearchItem);
+  item->path = g_strdup (scope->path);
+  search_item_set_info (item, info);
+  if (item->dir && scope->depth != 0)
+    {
+      dir = g_slice_new (SearchScope);
+      dir->path = g_strdup (scope->path);
+      dir->depth = scope->depth;
+      g_queue_push_tail (&dirs, dir);
+    }
+  search_consider (s, item);
+  g_object_unref (info);
+
+  while ((dir = g_queue_pop_head (&dirs)))
+    {
+      /* with the depth left below the children */
+      SearchWalk w = { s, dir->path, dir->depth > 0 ? dir->depth - 1 : -1, &dirs };
+
+      if (search_more (s))
+        {
+          file = g_file_get_child (handler_get_file (s->handler), dir->path + 1);
+          handler_enumerate_children (s->handler, file, s->attributes,
+                                      search_walk_child, &w, cancellable, &err);
+          g_object_unref (file);
+          if (err)
+            {
+              if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+                g_warning ("query: %s", err->message);
+              g_clear_error (&err);
+            }
+        }
+
+      search_scope_clear (dir);
+      g_slice_free (SearchScope, dir);
+    }
+
+  return SOUP_STATUS_OK;
+}
+
+static gint
+search_scope (Search *s, UsageIndex *index, SearchScope *scope)
+{
+  gboolean indexed = FALSE;
+  GFile *file;
+
+  if (index)
+    {
+      file = g_file_get_child (handler_get_file (s->handler), scope->path + 1);
+      g_string_assign (s->path, scope->path);
+      indexed = usage_index_search (index, file, scope->depth, search_index_entry, s);
+      g_object_unref (file);
+      search_take_candidates (s);
+    }
+
+  return indexed ? SOUP_STATUS_OK : search_walk (s, scope);
+}
+
+/* queries the kept candidates of the index, deciding the deferred ones */
+static void
+search_resolve (Search *s)
+{
+  GPtrArray *items = g_ptr_array_new_with_free_func ((GDestroyNotify) search_item_free);
+  SearchItem *item;
+  guint i;
+
+  for (i = 0; i < s->items->len; i++)
+    {
+      item = s->items->pdata[i];
+      if (search_resolve_item (s, item))
+        g_ptr_array_add (items, item);
+      else
+        search_item_free (item);
+    }
+
+  g_ptr_array_set_free_func (s->items, NULL);
+  g_ptr_array_unref (s->items);
+  s->items = items;
+}
+
+static void
+search_add_prop_attributes (Search *s, GString *attributes, SearchProp *prop)
+{
+  if (prop->type == SEARCH_PROP_GETCONTENTTYPE)
+    g_string_append (attributes, "," G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE);
+  else if (prop->type == SEARCH_PROP_DEAD && prop->xattr && !s->store)
+    {
+      /* a name with a comma can't be listed */
+      if (strchr (prop->xattr, ','))
+        g_string_append (attributes, ",xattr::*");
+      else
+        g_string_append_printf (attributes, ",%s", prop->xattr);
+    }
+}
+
+static void
+search_add_cond_attributes (Search *s, GString *attributes, SearchCond *cond)
+{
+  guint i;
+
+  if (!cond)
+    return;
+
+  if (cond->children)
+    for (i = 0; i < cond->children->len; i++)
+      search_add_cond_attributes (s, attributes, cond->children->pdata[i]);
+  else
+    search_add_prop_attributes (s, attributes, &cond->prop);
+}
+
+/* the attributes of the select, and the ones the where and orderby
+ * refer to */
+static gchar *
+search_get_attributes (Search *s)
+{
+  GString *attributes = g_string_new (SEARCH_QUERY);
+  guint i;
+
+  g_string_append_printf (attributes, ",%s", propfind_get_attributes_query (s->pf));
+  search_add_cond_attributes (s, attributes, s->where);
+  for (i = 0; i < s->orders->len; i++)
+    search_add_prop_attributes (s, attributes,
+                                &g_array_index (s->orders, SearchOrder, i).prop);
+
+  return g_string_free (attributes, FALSE);
+}
+
+static gint
+search_order_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  Search *s = user_data;
+  SearchItem *ia = *(SearchItem **) a;
+  SearchItem *ib = *(SearchItem **) b;
+  gint cmp = 0;
+  guint i;
+
+  for (i = 0; i < s->orders->len && !cmp; i++)
+    {
+      SearchOrder *order = &g_array_index (s->orders, SearchOrder, i);
+      const gchar *sa, *sb;
+      gchar *ta = NULL, *tb = NULL;
+      gint64 na, nb;
+      Match ma, mb;
+
+      if (search_prop_is_number (&order->prop))
+        {
+          ma = search_get_number (ia, &order->prop, &na);
+          mb = search_get_number (ib, &order->prop, &nb);
+          if (ma == MATCH_TRUE && mb == MATCH_TRUE)
+            cmp = (na > nb) - (na < nb);
+        }
+      else
+        {
+          ma = search_get_string (s, ia, &order->prop, &sa, &ta);
+          mb = search_get_string (s, ib, &order->prop, &sb, &tb);
+          if (ma == MATCH_TRUE && mb == MATCH_TRUE)
+            cmp = g_ascii_strcasecmp (sa, sb);
+          g_free (ta);
+          g_free (tb);
+        }
+
+      /* the undefined values come last */
+      if (ma != mb)
+        cmp = ma == MATCH_TRUE ? -1 : mb == MATCH_TRUE ? 1 : 0;
+      else if (order->descending)
+        cmp = -cmp;
+    }
+
+  return cmp;
+}
+
+static void
+search_free (Search *s)
+{
+  search_cond_free (s->where);
+  g_array_unref (s->orders);
+  g_ptr_array_unref (s->items);
+  g_ptr_array_unref (s->candidates);
+  g_string_free (s->path, TRUE);
+  g_free (s->attributes);
+}
+
+static gboolean
+parse_searchrequest (Search *s, SoupServerMessage *msg, xmlNodePtr xml,
+                     PropFind **pf, GArray *scopes)
+{
+  xmlNodePtr node, child;
+
+  for (xml = xml->children; xml; xml = xml->next)
+    if (xml_node_is_element (xml))
+      break;
+
+  if (!xml || !xml_node_has_name (xml, "basicsearch"))
+    {
+      /* the only grammar we know */
+      s->status = SOUP_STATUS_UNPROCESSABLE_ENTITY;
+      return FALSE;
+    }
+
+  for (node = xml->children; node; node = node->next)
+    {
+      if (!xml_node_is_element (node))
+        continue;
+
+      if (xml_node_has_name (node, "select"))
+        {
+          if (!*pf)
+            *pf = propfind_parse (node);
+          if (!*pf)
+            goto bad;
+        }
+      else if (xml_node_has_name (node, "from"))
+        {
+          for (child = node->children; child; child = child->next)
+            if (xml_node_has_name (child, "scope") &&
+                !parse_search_scope (s, msg, child, scopes))
+              goto bad;
+        }
+      else if (xml_node_has_name (node, "where"))
+        {
+          child = xml_node_first_element (node);
+          if (child && !(s->where = parse_search_cond (s, child)))
+            return FALSE;
+        }
+      else if (xml_node_has_name (node, "orderby"))
+        {
+          if (!parse_search_orderby (s, node))
+            return FALSE;
+        }
+      else if (xml_node_has_name (node, "limit"))
+        {
+          if (!parse_search_limit (s, node))
+            return FALSE;
+        }
+    }
+
+  if (*pf && scopes->len)
+    return TRUE;
+
+bad:
+  s->status = SOUP_STATUS_BAD_REQUEST;
+  return FALSE;
+}
+
+gint
+phodav_method_search (PathHandler *handler, SoupServerMessage *msg,
+                      const char *path, GError **err)
+{
+  Search s = { handler, handler_get_store (handler), SOUP_STATUS_OK, };
+  GArray *scopes = g_array_new (FALSE, FALSE, sizeof (SearchScope));
+  UsageIndex *index = handler_get_search_index (handler);
+  SoupMessageBody *request_body = soup_server_message_get_request_body (msg);
+  DavDoc doc = {0, };
+  gint status;
+  guint i;
+
+  s.orders = g_array_new (FALSE, FALSE, sizeof (SearchOrder));
+  g_array_set_clear_func (s.orders, (GDestroyNotify) search_order_clear);
+  g_array_set_clear_func (scopes, (GDestroyNotify) search_scope_clear);
+  s.items = g_ptr_array_new_with_free_func ((GDestroyNotify) search_item_free);
+  s.candidates = g_ptr_array_new ();
+  s.path = g_string_new (NULL);
+  s.msg = msg;
+
+  if (!request_body || !request_body->length ||
+      !davdoc_parse (&doc, msg, request_body, "searchrequest"))
+    {
+      status = SOUP_STATUS_BAD_REQUEST;
+      goto end;
+    }
+
+  if (!parse_searchrequest (&s, msg, doc.root, &s.pf, scopes))
+    {
+      status = s.status;
+      goto end;
+    }
+
+  s.limit = handler_get_depth_infinity_limit (handler);
+  for (i = 0; i < scopes->len && s.limit == 0; i++)
+    if (g_array_index (scopes, SearchScope, i).depth < 0)
+      {
+        status = SOUP_STATUS_FORBIDDEN;
+        goto end;
+      }
+
+  s.attributes = search_get_attributes (&s);
+  s.ns = xmlNewNs (NULL, BAD_CAST "DAV:", BAD_CAST "D");
+  s.ms = multistatus_new (msg);
+  for (i = 0; i < scopes->len; i++)
+    {
+      SearchScope *scope = &g_array_index (scopes, SearchScope, i);
+      Response resp = { .props = NULL, };
+
+      s.infinite = scope->depth < 0;
+      status = s.truncated ? SOUP_STATUS_OK : search_scope (&s, index, scope);
+      /* RFC 5323 5.17: the scope was not all searched */
+      if (status == SOUP_STATUS_OK && s.truncated)
+        status = SOUP_STATUS_INSUFFICIENT_STORAGE;
+      if (status != SOUP_STATUS_OK)
+        {
+          resp.status = status;
+          gchar *escape = g_markup_escape_text (scope->path, -1);
+
+          multistatus_add (s.ms, escape, &resp);
+          g_free (escape);
+        }
+    }
+
+  if (s.orders->len)
+    {
+      search_resolve (&s);
+      g_ptr_array_sort_with_data (s.items, search_order_compare, &s);
+      s.matched = s.items->len;
+
+      for (i = 0; i < s.items->len && (!s.nresults || i < s.nresults); i++)
+        {
+          SearchItem *item = s.items->pdata[i];
+
+          propfind_add (handler, s.pf, msg, s.ms, item->path, item->info, s.ns);
+        }
+    }
+
+  /* RFC 5323 5.17: the results were truncated */
+  if (!s.truncated && s.nresults && s.matched > s.nresults)
+    {
+      SearchScope *scope = &g_array_index (scopes, SearchScope, 0);
+      Response resp = { .props = NULL, .status = SOUP_STATUS_INSUFFICIENT_STORAGE };
+      gchar *escape = g_markup_escape_text (scope->path, -1);
+
+      multistatus_add (s.ms, escape, &resp);
+      g_free (escape);
+    }
+
+  status = multistatus_end (g_steal_pointer (&s.ms));
+
+end:
+  davdoc_free (&doc);
+  propfind_free (s.pf);
+  search_free (&s);
+  g_array_unref (scopes);
+  g_clear_pointer (&s.ms, multistatus_free);
+  if (s.ns)
+    xmlFreeNs (s.ns);
+  return status;
+}
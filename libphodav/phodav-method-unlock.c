@@ -51,7 +51,7 @@ phodav_method_unlock (PathHandler *handler, SoupServerMessage *msg,
       goto end;
     }
 
-  dav_lock_free (lock);
+  server_release_lock (handler_get_server (handler), lock);
   status = SOUP_STATUS_NO_CONTENT;
 
 end:
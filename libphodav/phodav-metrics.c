@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phodav-metrics.h"
+
+/* Counters and log2 histograms of the requests, per method. They are
+ * updated from the context of every server sharing them, and read
+ * from anywhere. The method comes from the client: only the known
+ * ones are counted apart, the rest together as "other". */
+
+static const gchar *known_methods[] = {
+  "GET", "HEAD", "PUT", "POST", "DELETE", "OPTIONS", "TRACE", "CONNECT", "PATCH",
+  "PROPFIND", "PROPPATCH", "MKCOL", "COPY", "MOVE", "LOCK", "UNLOCK",
+  "SEARCH", "REPORT",
+};
+
+typedef struct _Histogram
+{
+  guint64 count;
+  guint64 sum;
+  guint64 buckets[METRICS_BUCKETS + 1];
+} Histogram;
+
+typedef struct _MethodMetrics
+{
+  guint64     bytes_in;
+  guint64     bytes_out;
+  Histogram   latency;  /* in microseconds */
+  GHashTable *statuses; /* status -> guint64 * */
+} MethodMetrics;
+
+struct _Metrics
+{
+  GMutex      mutex;
+  GHashTable *methods;  /* static method name -> MethodMetrics */
+  Histogram   enumerations;
+};
+
+static void
+method_metrics_free (MethodMetrics *m)
+{
+  g_hash_table_unref (m->statuses);
+  g_slice_free (MethodMetrics, m);
+}
+
+Metrics *
+metrics_new (void)
+{
+  Metrics *metrics = g_slice_new0 (Metrics);
+
+  g_mutex_init (&metrics->mutex);
+  metrics->methods = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify) method_metrics_free);
+
+  return metrics;
+}
+
+void
+metrics_free (Metrics *metrics)
+{
+  g_hash_table_unref (metrics->methods);
+  g_mutex_clear (&metrics->mutex);
+  g_slice_free (Metrics, metrics);
+}
+
+static void
+histogram_add (Histogram *h, guint64 value)
+{
+  guint i = value ? g_bit_storage (value) : 0;
+
+  h->count++;
+  h->sum += value;
+  h->buckets[MIN (i, METRICS_BUCKETS)]++;
+}
+
+static GVariant *
+histogram_to_variant (const Histogram *h)
+{
+  return g_variant_new ("(tt@at)", h->count, h->sum,
+                        g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                   h->buckets, METRICS_BUCKETS + 1,
+                                                   sizeof (guint64)));
+}
+
+static const gchar *
+metrics_method_name (const gchar *method)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (known_methods); i++)
+    if (!g_strcmp0 (method, known_methods[i]))
+      return known_methods[i];
+
+  return "other";
+}
+
+/* called with the mutex held */
+static MethodMetrics *
+metrics_get_method (Metrics *metrics, const gchar *method)
+{
+  MethodMetrics *m;
+
+  method = metrics_method_name (method);
+  m = g_hash_table_lookup (metrics->methods, method);
+  if (!m)
+    {
+      m = g_slice_new0 (MethodMetrics);
+      m->statuses = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+      g_hash_table_insert (metrics->methods, (gpointer) method, m);
+    }
+
+  return m;
+}
+
+void
+metrics_add_request (Metrics *metrics, const gchar *method, guint status,
+                     guint64 bytes_in, guint64 bytes_out, gint64 usec)
+{
+  MethodMetrics *m;
+  guint64 *count;
+
+  g_mutex_lock (&metrics->mutex);
+  m = metrics_get_method (metrics, method);
+  m->bytes_in += bytes_in;
+  m->bytes_out += bytes_out;
+  histogram_add (&m->latency, MAX (usec, 0));
+
+  count = g_hash_table_lookup (m->statuses, GUINT_TO_POINTER (status));
+  if (!count)
+    {
+      count = g_new0 (guint64, 1);
+      g_hash_table_insert (m->statuses, GUINT_TO_POINTER (status), count);
+    }
+  (*count)++;
+  g_mutex_unlock (&metrics->mutex);
+}
+
+/* bytes sent for a request already counted, behind libsoup */
+void
+metrics_add_bytes_out (Metrics *metrics, const gchar *method, guint64 bytes)
+{
+  g_mutex_lock (&metrics->mutex);
+  metrics_get_method (metrics, method)->bytes_out += bytes;
+  g_mutex_unlock (&metrics->mutex);
+}
+
+void
+metrics_add_enumeration (Metrics *metrics, guint entries)
+{
+  g_mutex_lock (&metrics->mutex);
+  histogram_add (&metrics->enumerations, entries);
+  g_mutex_unlock (&metrics->mutex);
+}
+
+/* adds "methods" and "enumerations" to the a{sv} @builder */
+void
+metrics_build (Metrics *metrics, GVariantBuilder *builder)
+{
+  GVariantBuilder methods;
+  GHashTableIter iter, siter;
+  const gchar *method;
+  MethodMetrics *m;
+  gpointer status, count;
+
+  g_variant_builder_init (&methods, G_VARIANT_TYPE ("a{sa{sv}}"));
+
+  g_mutex_lock (&metrics->mutex);
+  g_hash_table_iter_init (&iter, metrics->methods);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &method, (gpointer *) &m))
+    {
+      GVariantBuilder statuses;
+
+      g_variant_builder_init (&statuses, G_VARIANT_TYPE ("a{ut}"));
+      g_hash_table_iter_init (&siter, m->statuses);
+      while (g_hash_table_iter_next (&siter, &status, &count))
+        g_variant_builder_add (&statuses, "{ut}",
+                               GPOINTER_TO_UINT (status), *(guint64 *) count);
+
+      g_variant_builder_open (&methods, G_VARIANT_TYPE ("{sa{sv}}"));
+      g_variant_builder_add (&methods, "s", method);
+      g_variant_builder_open (&methods, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&methods, "{sv}", "bytes-in", g_variant_new_uint64 (m->bytes_in));
+      g_variant_builder_add (&methods, "{sv}", "bytes-out", g_variant_new_uint64 (m->bytes_out));
+      g_variant_builder_add (&methods, "{sv}", "latency", histogram_to_variant (&m->latency));
+      g_variant_builder_add (&methods, "{sv}", "statuses", g_variant_builder_end (&statuses));
+      g_variant_builder_close (&methods);
+      g_variant_builder_close (&methods);
+    }
+
+  g_variant_builder_add (builder, "{sv}", "enumerations",
+                         histogram_to_variant (&metrics->enumerations));
+  g_mutex_unlock (&metrics->mutex);
+
+  g_variant_builder_add (builder, "{sv}", "methods", g_variant_builder_end (&methods));
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_METRICS_H__
+#define __PHODAV_METRICS_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+/* bucket i counts the values that need i bits, so values below 2^i,
+ * and a last one, past them, the larger values */
+#define METRICS_BUCKETS 32
+
+typedef struct _Metrics Metrics;
+
+Metrics *        metrics_new                     (void);
+void             metrics_free                    (Metrics *metrics);
+
+void             metrics_add_request             (Metrics *metrics, const gchar *method,
+                                                  guint status, guint64 bytes_in,
+                                                  guint64 bytes_out, gint64 usec);
+void             metrics_add_bytes_out           (Metrics *metrics, const gchar *method,
+                                                  guint64 bytes);
+void             metrics_add_enumeration         (Metrics *metrics, guint entries);
+void             metrics_build                   (Metrics *metrics, GVariantBuilder *builder);
+
+G_END_DECLS
+
+#endif /* __PHODAV_METRICS_H__ */
@@ -39,96 +39,225 @@ response_free (Response *h)
   g_slice_free (Response, h);
 }
 
-static gchar*
+/* status lines are formatted once and kept for the process lifetime */
+static const gchar *
 status_to_string (gint status)
 {
-  return g_strdup_printf ("HTTP/1.1 %d %s",
-                          status, soup_status_get_phrase (status));
-}
-
-static xmlNodePtr
-status_node_new (xmlNsPtr ns, gint status)
-{
-  xmlNodePtr node;
+  static const gchar *lines[600];
+  const gchar *line = NULL;
   gchar *text;
 
-  text = status_to_string (status);
-  node = xmlNewNode (ns, BAD_CAST "status");
-  xmlAddChild (node, xmlNewText (BAD_CAST text));
+  if (status >= 0 && status < G_N_ELEMENTS (lines))
+    line = g_atomic_pointer_get (&lines[status]);
+  if (line)
+    return line;
+
+  text = g_strdup_printf ("<D:status>HTTP/1.1 %d %s</D:status>",
+                          status, soup_status_get_phrase (status));
+  line = g_intern_string (text);
   g_free (text);
 
-  return node;
+  if (status >= 0 && status < G_N_ELEMENTS (lines))
+    g_atomic_pointer_set (&lines[status], line);
+
+  return line;
 }
 
 static void
-add_propstat (xmlNodePtr parent, xmlNsPtr ns, SoupServerMessage *msg,
-              const gchar *path, GList *props)
+add_prop (xmlBufferPtr buf, xmlNodePtr node)
 {
-  xmlNodePtr node, propstat, prop = NULL, stnode = NULL;
+  if (node->psvi)
+    xmlBufferCCat (buf, node->psvi);
+  else
+    xmlNodeDump (buf, NULL, node, 0, 0);
+}
+
+/* props are grouped by status, better if sorted by status */
+static void
+add_propstat (xmlBufferPtr buf, GList *props)
+{
+  xmlNodePtr node;
   GList *s;
   gint status = -1;
 
-  /* better if sorted by status */
   for (s = props; s != NULL; s = s->next)
     {
       node = s->data;
       if (GPOINTER_TO_INT (node->_private) != status)
         {
-          status = GPOINTER_TO_INT (node->_private);
-          if (stnode)
-            xmlAddChild (propstat, stnode);
+          if (status != -1)
+            {
+              xmlBufferCCat (buf, "</D:prop>");
+              xmlBufferCCat (buf, status_to_string (status));
+              xmlBufferCCat (buf, "</D:propstat>");
+            }
 
-          stnode = status_node_new (ns, status);
-          propstat = xmlNewChild (parent, ns, BAD_CAST "propstat", NULL);
-          prop = xmlNewChild (propstat, ns, BAD_CAST "prop", NULL);
+          status = GPOINTER_TO_INT (node->_private);
+          xmlBufferCCat (buf, "<D:propstat><D:prop>");
         }
-      g_return_if_fail (prop != NULL);
-      xmlAddChild (prop, node);
-      s->data = NULL;
+
+      add_prop (buf, node);
+    }
+
+  if (status != -1)
+    {
+      xmlBufferCCat (buf, "</D:prop>");
+      xmlBufferCCat (buf, status_to_string (status));
+      xmlBufferCCat (buf, "</D:propstat>");
     }
+}
+
+#define MULTISTATUS_CHUNK_SIZE COMPRESSOR_MIN_SIZE
+
+/* Writes a multistatus response incrementally: each response is
+ * written as text right away, only the props are dumped from their
+ * nodes, and the text is given to the chunked response body every
+ * MULTISTATUS_CHUNK_SIZE bytes. From a worker thread, the chunks are
+ * sent while the method goes on; in the server context, they are only
+ * sent once the method returns. A response that does not fit in the
+ * first chunk is compressed on the way, if the client accepts it. */
+struct _MultiStatus
+{
+  SoupServerMessage *msg;
+  xmlNsPtr           ns;
+  xmlBufferPtr       buf;
+  GConverter        *compressor;
+  gboolean           started;
+  gboolean           flushed;
+  gboolean           aborted;
+};
+
+MultiStatus *
+multistatus_new (SoupServerMessage *msg)
+{
+  MultiStatus *ms = g_slice_new0 (MultiStatus);
+
+  ms->msg = msg;
+  ms->ns = xmlNewNs (NULL, BAD_CAST "DAV:", BAD_CAST "D");
+  ms->buf = xmlBufferCreate ();
+
+  return ms;
+}
+
+void
+multistatus_free (MultiStatus *ms)
+{
+  xmlFreeNs (ms->ns);
+  xmlBufferFree (ms->buf);
+  g_clear_object (&ms->compressor);
+  g_slice_free (MultiStatus, ms);
+}
+
+static void
+multistatus_flush (MultiStatus *ms, gboolean last)
+{
+  int len = xmlBufferLength (ms->buf);
+
+  if (!last && len < MULTISTATUS_CHUNK_SIZE)
+    return;
+
+  if (!ms->flushed && !last)
+    ms->compressor = response_compressor_new (ms->msg);
+  ms->flushed = TRUE;
+
+  /* the connection is dropped, the rest is thrown away */
+  if (ms->aborted)
+    len = 0;
 
-  if (stnode)
-    xmlAddChild (propstat, stnode);
+  if (ms->compressor && !ms->aborted)
+    ms->aborted = !response_compressor_append (ms->compressor, ms->msg,
+                                               (const gchar *) xmlBufferContent (ms->buf),
+                                               len, last);
+  else if (len > 0)
+    server_message_append (ms->msg, xmlBufferContent (ms->buf), len);
+  xmlBufferEmpty (ms->buf);
+}
+
+static void
+multistatus_start (MultiStatus *ms)
+{
+  SoupMessageHeaders *headers = server_message_get_response_headers (ms->msg);
+
+  if (ms->started)
+    return;
+
+  ms->started = TRUE;
+  soup_message_headers_set_content_type (headers, "application/xml", NULL);
+  response_add_vary (ms->msg);
+  server_message_stream (ms->msg, SOUP_STATUS_MULTI_STATUS);
+
+  xmlBufferCCat (ms->buf, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                 "<D:multistatus xmlns:D=\"DAV:\">");
+}
+
+void
+multistatus_add (MultiStatus *ms, const gchar *path, Response *resp)
+{
+  xmlNodePtr href;
+  GUri *new_uri;
+  gchar *text;
+
+  multistatus_start (ms);
+
+  new_uri = g_uri_parse_relative (soup_server_message_get_uri (ms->msg), path, SOUP_HTTP_URI_FLAGS, NULL);
+  text = g_uri_to_string (new_uri);
+  href = xmlNewNode (ms->ns, BAD_CAST "href");
+  xmlNodeSetContent (href, BAD_CAST text);
+  g_free (text);
+  g_uri_unref (new_uri);
+
+  xmlBufferCCat (ms->buf, "<D:response>");
+  xmlNodeDump (ms->buf, NULL, href, 0, 0);
+  xmlFreeNode (href);
+
+  if (resp->props)
+    add_propstat (ms->buf, resp->props);
+  else if (resp->status)
+    xmlBufferCCat (ms->buf, status_to_string (resp->status));
+
+  xmlBufferCCat (ms->buf, "</D:response>");
+
+  multistatus_flush (ms, FALSE);
+}
+
+/* the RFC 6578 sync-token, after the responses */
+void
+multistatus_add_sync_token (MultiStatus *ms, const gchar *token)
+{
+  xmlNodePtr node;
+
+  multistatus_start (ms);
+
+  node = xmlNewNode (ms->ns, BAD_CAST "sync-token");
+  xmlNodeAddContent (node, BAD_CAST token);
+  xmlNodeDump (ms->buf, NULL, node, 0, 0);
+  xmlFreeNode (node);
+}
+
+gint
+multistatus_end (MultiStatus *ms)
+{
+  multistatus_start (ms);
+  xmlBufferCCat (ms->buf, "</D:multistatus>\n");
+  multistatus_flush (ms, TRUE);
+  server_message_complete (ms->msg);
+  multistatus_free (ms);
+
+  return SOUP_STATUS_MULTI_STATUS;
 }
 
 gint
 set_response_multistatus (SoupServerMessage *msg,
                           GHashTable  *mstatus)
 {
-  xmlChar *mem = NULL;
-  int size;
-  xmlNodePtr root;
+  MultiStatus *ms = multistatus_new (msg);
   GHashTableIter iter;
   Response *resp;
-  gchar *path, *text;
-  xmlNsPtr ns;
-
-  root = xmlNewNode (NULL, BAD_CAST "multistatus");
-  ns = xmlNewNs (root, BAD_CAST "DAV:", BAD_CAST "D");
-  xmlSetNs (root, ns);
+  gchar *path;
 
   g_hash_table_iter_init (&iter, mstatus);
   while (g_hash_table_iter_next (&iter, (gpointer *) &path, (gpointer *) &resp))
-    {
-      xmlNodePtr response;
-      GUri *new_uri;
-
-      response = xmlNewChild (root, ns, BAD_CAST "response", NULL);
-      new_uri = g_uri_parse_relative (soup_server_message_get_uri (msg), path, SOUP_HTTP_URI_FLAGS, NULL);
-      text = g_uri_to_string (new_uri);
-      xmlNewChild (response, ns, BAD_CAST "href", BAD_CAST text);
-      g_free (text);
-      g_uri_unref (new_uri);
-
-      if (resp->props)
-        add_propstat (response, ns, msg, path, resp->props);
-      else if (resp->status)
-        xmlAddChild (response, status_node_new (ns, resp->status));
-    }
+    multistatus_add (ms, path, resp);
 
-  xml_node_to_string (root, &mem, &size);
-  soup_server_message_set_response (msg, "application/xml",
-                                    SOUP_MEMORY_TAKE, (gchar *) mem, size);
-
-  return SOUP_STATUS_MULTI_STATUS;
+  return multistatus_end (ms);
 }
@@ -28,10 +28,27 @@ typedef struct _Response
   gint   status;
 } Response;
 
+typedef struct _MultiStatus MultiStatus;
+
+/* the prop @Node is written as the constant, already serialized
+ * @Fragment instead of being dumped */
+#define PROP_SET_FRAGMENT(Node, Fragment) G_STMT_START {        \
+    (Node)->psvi = (gpointer) (Fragment);                       \
+  } G_STMT_END
+
 Response *     response_new                      (GList       *props,
                                                   gint         status);
 void           response_free                     (Response    *h);
 
+MultiStatus *  multistatus_new                   (SoupServerMessage *msg);
+void           multistatus_free                  (MultiStatus       *ms);
+void           multistatus_add                   (MultiStatus       *ms,
+                                                  const gchar       *path,
+                                                  Response          *resp);
+void           multistatus_add_sync_token        (MultiStatus       *ms,
+                                                  const gchar       *token);
+gint           multistatus_end                   (MultiStatus       *ms);
+
 gint           set_response_multistatus          (SoupServerMessage *msg,
                                                   GHashTable        *mstatus);
 G_END_DECLS
@@ -14,13 +14,15 @@
  * You should have received a copy of the GNU Lesser General Public
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
+#include <string.h>
+
 #include "phodav-path.h"
 #include "phodav-lock.h"
 
 Path *
 path_ref (Path *path)
 {
-    path->refs++;
+    g_atomic_int_inc (&path->refs);
 
     return path;
 }
@@ -28,9 +30,7 @@ path_ref (Path *path)
 void
 path_unref (Path *path)
 {
-    path->refs--;
-
-    if (path->refs == 0)
+    if (g_atomic_int_dec_and_test (&path->refs))
     {
         g_list_free_full (path->locks, (GDestroyNotify) dav_lock_free);
         g_free (path->path);
@@ -55,3 +55,234 @@ path_add_lock (Path *path, DAVLock *lock)
 
     path->locks = g_list_append (path->locks, lock);
 }
+
+/* whether @path is @parent or one of its descendants */
+gboolean
+path_is_below (const gchar *path, const gchar *parent)
+{
+    gsize len = strlen (parent);
+
+    return !strncmp (path, parent, len) &&
+        (path[len] == '\0' || path[len] == '/' || (len && parent[len - 1] == '/'));
+}
+
+/* Paths are kept in a tree of path components, so that walking the
+ * parents of a path is a series of lookups, without building every
+ * intermediate path. The root node is the "/" path. */
+struct _PathNode
+{
+  Path       *path;
+  GHashTable *children;
+};
+
+PathNode *
+path_node_new (void)
+{
+    return g_slice_new0 (PathNode);
+}
+
+void
+path_node_free (PathNode *node)
+{
+    g_clear_pointer (&node->path, path_unref);
+    g_clear_pointer (&node->children, g_hash_table_unref);
+    g_slice_free (PathNode, node);
+}
+
+static const gchar *
+next_component (const gchar *str, gsize *len)
+{
+    while (*str == '/')
+        str++;
+
+    *len = strcspn (str, "/");
+    return str;
+}
+
+static PathNode *
+path_node_child (PathNode *node, const gchar *name, gsize len, gboolean create)
+{
+    gchar buf[256];
+    gchar *key = len < sizeof (buf) ? buf : g_malloc (len + 1);
+    PathNode *child = NULL;
+
+    memcpy (key, name, len);
+    key[len] = '\0';
+
+    if (node->children)
+        child = g_hash_table_lookup (node->children, key);
+
+    if (!child && create)
+    {
+        if (!node->children)
+            node->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                    (GDestroyNotify) path_node_free);
+        child = path_node_new ();
+        g_hash_table_insert (node->children, g_strdup (key), child);
+    }
+
+    if (key != buf)
+        g_free (key);
+
+    return child;
+}
+
+static PathNode *
+path_node_walk (PathNode *root, const gchar *path, gboolean create)
+{
+    PathNode *node = root;
+    const gchar *name;
+    gsize len;
+
+    for (name = next_component (path, &len); node && len;
+         name = next_component (name + len, &len))
+        node = path_node_child (node, name, len, create);
+
+    return node;
+}
+
+Path *
+path_node_lookup (PathNode *root, const gchar *path)
+{
+    PathNode *node = path_node_walk (root, path, FALSE);
+
+    return node ? node->path : NULL;
+}
+
+void
+path_node_insert (PathNode *root, Path *path)
+{
+    PathNode *node = path_node_walk (root, path->path, TRUE);
+
+    g_return_if_fail (node->path == NULL);
+    node->path = path_ref (path);
+}
+
+static void
+path_node_drop_locks (PathNode *node)
+{
+    GHashTableIter iter;
+    PathNode *child;
+
+    if (node->path)
+        while (node->path->locks)
+            dav_lock_free (node->path->locks->data);
+
+    if (!node->children)
+        return;
+
+    g_hash_table_iter_init (&iter, node->children);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+        path_node_drop_locks (child);
+}
+
+/* detaches @path and the paths below it, dropping their locks: locks
+ * do not follow a moved resource (RFC 4918 7.5) */
+void
+path_node_remove (PathNode *root, const gchar *path)
+{
+    PathNode *parent = NULL, *node = root;
+    const gchar *name, *last = NULL;
+    gsize len, last_len = 0;
+    gchar *key;
+
+    for (name = next_component (path, &len); node && len;
+         name = next_component (name + len, &len))
+    {
+        parent = node;
+        last = name;
+        last_len = len;
+        node = path_node_child (node, name, len, FALSE);
+    }
+
+    if (!node || !parent)
+        return;
+
+    path_node_drop_locks (node);
+    key = g_strndup (last, last_len);
+    g_hash_table_remove (parent->children, key);
+    g_free (key);
+}
+
+/* whether @node can be removed once its children are pruned */
+static gboolean
+path_node_prune_r (PathNode *node, const gchar *path)
+{
+    PathNode *child;
+    const gchar *name;
+    gsize len;
+
+    name = next_component (path, &len);
+    if (len && (child = path_node_child (node, name, len, FALSE)) &&
+        path_node_prune_r (child, name + len))
+    {
+        gchar *key = g_strndup (name, len);
+        g_hash_table_remove (node->children, key);
+        g_free (key);
+    }
+
+    return (!node->children || g_hash_table_size (node->children) == 0) &&
+        (!node->path || !node->path->locks);
+}
+
+/* removes @path and its parents, as long as they have no locks and
+ * no other children */
+void
+path_node_prune (PathNode *root, const gchar *path)
+{
+    path_node_prune_r (root, path);
+}
+
+/* calls @cb for each existing Path from the top-level component down to
+ * @path itself, stopping when @cb returns FALSE */
+gboolean
+path_node_foreach_parent (PathNode *root, const gchar *path,
+                          PathCb cb, gpointer data)
+{
+    PathNode *node = root;
+    const gchar *name;
+    gsize len;
+
+    for (name = next_component (path, &len); len;
+         name = next_component (name + len, &len))
+    {
+        node = path_node_child (node, name, len, FALSE);
+        if (!node)
+            break;
+
+        if (node->path && !cb (node->path->path, node->path, data))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+path_node_foreach_r (PathNode *node, PathCb cb, gpointer data)
+{
+    GHashTableIter iter;
+    PathNode *child;
+
+    if (!node->children)
+        return TRUE;
+
+    g_hash_table_iter_init (&iter, node->children);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+        if ((child->path && !cb (child->path->path, child->path, data)) ||
+            !path_node_foreach_r (child, cb, data))
+            return FALSE;
+
+    return TRUE;
+}
+
+/* calls @cb for each existing Path below @path, in no particular
+ * order, stopping when @cb returns FALSE. Only the paths with locks,
+ * or on the way to one, are in the tree. */
+gboolean
+path_node_foreach_below (PathNode *root, const gchar *path,
+                         PathCb cb, gpointer data)
+{
+    PathNode *node = path_node_walk (root, path, FALSE);
+
+    return !node || path_node_foreach_r (node, cb, data);
+}
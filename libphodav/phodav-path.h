@@ -21,17 +21,31 @@
 
 G_BEGIN_DECLS
 
+typedef struct _PathNode PathNode;
+
 struct _Path
 {
   gchar         *path;
   GList         *locks;
-  guint32        refs;
+  gint           refs; /* atomic, paths are also held by the locks */
 };
 
 Path *                  path_ref                    (Path *path);
 void                    path_unref                  (Path *path);
 void                    path_remove_lock            (Path *path, DAVLock *lock);
 void                    path_add_lock               (Path *path, DAVLock *lock);
+gboolean                path_is_below               (const gchar *path, const gchar *parent);
+
+PathNode *              path_node_new               (void);
+void                    path_node_free              (PathNode *node);
+Path *                  path_node_lookup            (PathNode *root, const gchar *path);
+void                    path_node_insert            (PathNode *root, Path *path);
+void                    path_node_remove            (PathNode *root, const gchar *path);
+void                    path_node_prune             (PathNode *root, const gchar *path);
+gboolean                path_node_foreach_parent    (PathNode *root, const gchar *path,
+                                                     PathCb cb, gpointer data);
+gboolean                path_node_foreach_below     (PathNode *root, const gchar *path,
+                                                     PathCb cb, gpointer data);
 
 G_END_DECLS
 
@@ -33,7 +33,15 @@ G_BEGIN_DECLS
 
 typedef struct _DAVLock DAVLock;
 typedef struct _Path    Path;
+typedef struct _LockManager LockManager;
+typedef struct _PropStore PropStore;
 typedef struct _PathHandler PathHandler;
+typedef struct _UsageIndex UsageIndex;
+typedef struct _Journal Journal;
+
+/* not known to libsoup, interned like its methods */
+#define PHODAV_METHOD_SEARCH g_intern_static_string ("SEARCH")
+#define PHODAV_METHOD_REPORT g_intern_static_string ("REPORT")
 
 typedef enum _DAVLockScopeType {
   DAV_LOCK_SCOPE_NONE,
@@ -67,17 +75,68 @@ struct _DAVLock
   DepthType        depth;
   xmlNodePtr       owner;
   guint64          timeout;
+  LockManager     *manager;
+  guint            heap_index;
 };
 
 typedef gboolean (* PathCb) (const gchar *key,
                              Path        *path,
                              gpointer     data);
 
-GFile *                 handler_get_file                     (PathHandler *handler);
-GCancellable *          handler_get_cancellable              (PathHandler *handler);
-PhodavServer *          handler_get_server                   (PathHandler *handler);
-gboolean                handler_get_readonly                 (PathHandler *handler);
-
+typedef gboolean (* EnumerateFunc) (GFileInfo *info,
+                                    gpointer   data);
+
+GFile *                 handler_get_file                     (PathHandler *handler) G_GNUC_PURE;
+GCancellable *          handler_get_cancellable              (PathHandler *handler) G_GNUC_PURE;
+PhodavServer *          handler_get_server                   (PathHandler *handler) G_GNUC_PURE;
+gboolean                handler_get_readonly                 (PathHandler *handler) G_GNUC_PURE;
+guint64                 handler_get_stream_threshold         (PathHandler *handler) G_GNUC_PURE;
+guint64                 handler_get_sendfile_threshold       (PathHandler *handler) G_GNUC_PURE;
+PhodavPutDurability     handler_get_put_durability           (PathHandler *handler) G_GNUC_PURE;
+const gchar *           handler_get_tmp_key                  (PathHandler *handler) G_GNUC_PURE;
+guint                   handler_get_enumerate_batch_size     (PathHandler *handler) G_GNUC_PURE;
+guint                   handler_get_depth_infinity_limit     (PathHandler *handler) G_GNUC_PURE;
+guint                   handler_get_worker_threads           (PathHandler *handler) G_GNUC_PURE;
+GThreadPool *           handler_get_copy_pool                (PathHandler *handler);
+PropStore *             handler_get_store                    (PathHandler *handler) G_GNUC_PURE;
+UsageIndex *            handler_get_usage                    (PathHandler *handler);
+UsageIndex *            handler_get_search_index             (PathHandler *handler);
+Journal *               handler_get_journal                  (PathHandler *handler);
+GFileInfo *             handler_query_info                   (PathHandler *handler, GFile *file,
+                                                              const gchar *attributes,
+                                                              GCancellable *cancellable,
+                                                              GError **err);
+gboolean                handler_enumerate_children           (PathHandler *handler, GFile *file,
+                                                              const gchar *attributes,
+                                                              EnumerateFunc func, gpointer data,
+                                                              GCancellable *cancellable,
+                                                              GError **err);
+
+void                    server_file_changed                  (PhodavServer *server,
+                                                              GFile *file);
+void                    server_tree_changed                  (PhodavServer *server,
+                                                              GFile *dir);
+gboolean                server_begin_write                   (PhodavServer *server,
+                                                              GFile *file);
+void                    server_end_write                     (PhodavServer *server,
+                                                              GFile *file);
+void                    server_add_bytes_out                 (PhodavServer *server,
+                                                              const gchar *method,
+                                                              guint64 bytes);
+
+SoupMessageHeaders *    server_message_get_response_headers  (SoupServerMessage *msg);
+void                    server_message_set_response          (SoupServerMessage *msg,
+                                                              const gchar *content_type,
+                                                              gchar *data, gsize len);
+void                    server_message_stream                (SoupServerMessage *msg,
+                                                              gint status);
+void                    server_message_append                (SoupServerMessage *msg,
+                                                              gconstpointer data, gsize len);
+void                    server_message_complete              (SoupServerMessage *msg);
+void                    server_message_abort                 (SoupServerMessage *msg);
+
+void                    server_lock_paths                    (PhodavServer *server);
+void                    server_unlock_paths                  (PhodavServer *server);
 gboolean                server_foreach_parent_path           (PhodavServer *server,
                                                               const gchar *path,
                                                               PathCb cb, gpointer data);
@@ -86,15 +145,29 @@ DAVLock *               server_path_get_lock                 (PhodavServer *serv
                                                               const gchar *token);
 gboolean                server_path_has_other_locks          (PhodavServer *self,
                                                               const gchar *path,
-                                                              GList *locks);
+                                                              GList *locks,
+                                                              gboolean below);
 Path *                  server_get_path                      (PhodavServer *self,
                                                               const gchar *_path);
+void                    server_remove_path                   (PhodavServer *self,
+                                                              const gchar *path);
+void                    server_purge_path                    (PhodavServer *self,
+                                                              const gchar *path,
+                                                              const gchar *dest);
+void                    server_add_lock                      (PhodavServer *self,
+                                                              Path *path, DAVLock *lock);
+void                    server_release_lock                  (PhodavServer *self,
+                                                              DAVLock *lock);
 
 gint                    phodav_check_if                      (PathHandler *handler, SoupServerMessage *msg,
                                                               const gchar *path, GList **locks);
+gint                    phodav_check_if_info                 (PathHandler *handler, SoupServerMessage *msg,
+                                                              const gchar *path, GFileInfo *info,
+                                                              GList **locks);
 
 gint                    phodav_delete_file                   (const gchar *path, GFile *file,
                                                               GHashTable *mstatus,
+                                                              guint batch_size, guint threads,
                                                               GCancellable *cancellable);
 
 gint                    phodav_method_get                    (PathHandler *handler, SoupServerMessage *msg,
@@ -113,6 +186,10 @@ gint                    phodav_method_lock                   (PathHandler *handl
                                                               const char *path, GError **err);
 gint                    phodav_method_unlock                 (PathHandler *handler, SoupServerMessage *msg,
                                                               const char *path, GError **err);
+gint                    phodav_method_search                 (PathHandler *handler, SoupServerMessage *msg,
+                                                              const char *path, GError **err);
+gint                    phodav_method_report                 (PathHandler *handler, SoupServerMessage *msg,
+                                                              const char *path, GError **err);
 void                    phodav_method_put                    (PathHandler *handler, SoupServerMessage *msg,
                                                               const gchar *path, GError **err);
 
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_PROPFIND_H__
+#define __PHODAV_PROPFIND_H__
+
+#include "phodav-priv.h"
+#include "phodav-multistatus.h"
+
+G_BEGIN_DECLS
+
+typedef struct _PropFind PropFind;
+
+PropFind *       propfind_parse                  (xmlNodePtr xml);
+void             propfind_free                   (PropFind *pf);
+const gchar *    propfind_get_attributes_query   (PropFind *pf);
+void             propfind_add                    (PathHandler *handler, PropFind *pf,
+                                                  SoupServerMessage *msg,
+                                                  MultiStatus *ms, const gchar *path,
+                                                  GFileInfo *info, xmlNsPtr ns);
+
+G_END_DECLS
+
+#endif /* __PHODAV_PROPFIND_H__ */
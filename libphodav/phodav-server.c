@@ -23,6 +23,13 @@
 #include "phodav-path.h"
 #include "phodav-lock.h"
 #include "phodav-utils.h"
+#include "phodav-info-cache.h"
+#include "phodav-lock-manager.h"
+#include "phodav-metrics.h"
+#include "phodav-store.h"
+#include "phodav-usage.h"
+#include "phodav-journal.h"
+#include "phodav-copy.h"
 
 /**
  * SECTION:phodav-server
@@ -35,6 +42,8 @@
  * PhodavServer implements a simple WebDAV server.
  */
 
+typedef struct _ServerShared ServerShared;
+
 struct _PhodavServer
 {
   GObject       parent;
@@ -42,8 +51,19 @@ struct _PhodavServer
   GCancellable *cancellable;
   GFile        *root_file;
   PathHandler  *root_handler; /* weak ref */
-  GHashTable   *paths;
+  ServerShared *shared;
   gboolean      readonly;
+  guint64       stream_threshold;
+  guint64       sendfile_threshold;
+  PhodavPutDurability put_durability;
+  guint         enumerate_batch_size;
+  guint         depth_infinity_limit;
+  gboolean      search_index;
+  InfoCache    *cache;
+  guint         cache_size;
+  GMainContext *context;
+  GThreadPool  *pool;
+  guint         worker_threads;
 };
 
 struct _PhodavServerClass
@@ -51,8 +71,31 @@ struct _PhodavServerClass
   GObjectClass parent_class;
 };
 
+/* the lock table, the store and the metrics, shared with the
+ * servers created with a #PhodavServer:peer */
+struct _ServerShared
+{
+  gatomicrefcount ref_count;
+  PathNode       *paths;
+  GRecMutex       paths_mutex;
+  LockManager    *locks;
+  GFile          *store_file;
+  PropStore      *store;
+  Metrics        *metrics;
+  UsageIndex     *usage; /* created at the first quota lookup */
+  Journal        *journal; /* created at the first sync */
+  GHashTable     *writes; /* GFile -> the in-place writes in flight */
+  GThreadPool    *copy_pool; /* created at the first tree copy */
+  gchar          *tmp_key; /* tags the names of the PUT tmp files */
+};
+
 G_DEFINE_TYPE (PhodavServer, phodav_server, G_TYPE_OBJECT)
 
+G_DEFINE_ENUM_TYPE (PhodavPutDurability, phodav_put_durability,
+                    G_DEFINE_ENUM_VALUE (PHODAV_PUT_DURABILITY_DIRECT, "direct"),
+                    G_DEFINE_ENUM_VALUE (PHODAV_PUT_DURABILITY_ATOMIC, "atomic"),
+                    G_DEFINE_ENUM_VALUE (PHODAV_PUT_DURABILITY_SYNC, "sync"))
+
 /* Properties */
 enum {
   PROP_0,
@@ -60,6 +103,16 @@ enum {
   PROP_ROOT_FILE,
   PROP_SERVER,
   PROP_READONLY,
+  PROP_STREAM_THRESHOLD,
+  PROP_SENDFILE_THRESHOLD,
+  PROP_PUT_DURABILITY,
+  PROP_WORKER_THREADS,
+  PROP_ENUMERATE_BATCH_SIZE,
+  PROP_DEPTH_INFINITY_LIMIT,
+  PROP_INFO_CACHE_SIZE,
+  PROP_SEARCH_INDEX,
+  PROP_STORE_FILE,
+  PROP_PEER,
 };
 
 static void server_callback (SoupServer        *server,
@@ -67,6 +120,258 @@ static void server_callback (SoupServer        *server,
                              const char        *path,
                              GHashTable        *query,
                              gpointer           user_data);
+static void server_job_run  (gpointer           data,
+                             gpointer           user_data);
+
+/* the lock state in the paths tree is shared with the worker threads,
+ * and with the other servers of the same peer */
+void
+server_lock_paths (PhodavServer *self)
+{
+  g_rec_mutex_lock (&self->shared->paths_mutex);
+}
+
+void
+server_unlock_paths (PhodavServer *self)
+{
+  g_rec_mutex_unlock (&self->shared->paths_mutex);
+}
+
+void
+server_remove_path (PhodavServer *self, const gchar *path)
+{
+  server_lock_paths (self);
+  path_node_remove (self->shared->paths, path);
+  server_unlock_paths (self);
+}
+
+/* drops what the store keeps at or below @path for the members that
+ * are gone after a partial DELETE or MOVE, and their locks; with
+ * @dest, the properties of the members found there follow them */
+void
+server_purge_path (PhodavServer *self, const gchar *path, const gchar *dest)
+{
+  PropStore *store = self->shared->store;
+  GList *paths, *l;
+  gchar *base, *to = NULL, *gone = NULL;
+
+  if (!store)
+    return;
+
+  base = g_strdup (path);
+  remove_trailing (base, '/');
+  if (dest)
+    {
+      to = g_strdup (dest);
+      remove_trailing (to, '/');
+    }
+
+  paths = prop_store_get_paths (store, base);
+  for (l = paths; l; l = l->next)
+    {
+      gchar *p = l->data;
+      GFile *file;
+
+      remove_trailing (p, '/');
+      /* the members of a gone directory went with it */
+      if (!*p || (gone && path_is_below (p, gone)))
+        continue;
+
+      file = g_file_get_child (self->root_file, p + 1);
+      if (!g_file_query_exists (file, NULL))
+        {
+          gchar *d = NULL;
+          GFile *dest_file = NULL;
+
+          if (to)
+            {
+              d = g_strconcat (to, p + strlen (base), NULL);
+              dest_file = g_file_get_child (self->root_file, d + 1);
+            }
+
+          if (dest_file && g_file_query_exists (dest_file, NULL))
+            prop_store_move (store, p, d, FALSE);
+          else
+            prop_store_remove (store, p);
+          server_remove_path (self, p);
+
+          g_free (gone);
+          gone = g_strdup (p);
+          g_clear_object (&dest_file);
+          g_free (d);
+        }
+      g_object_unref (file);
+    }
+
+  g_free (gone);
+  g_free (to);
+  g_free (base);
+  g_list_free_full (paths, g_free);
+}
+
+void
+server_add_lock (PhodavServer *self, Path *path, DAVLock *lock)
+{
+  server_lock_paths (self);
+  path_add_lock (path, lock);
+  lock_manager_add (self->shared->locks, lock);
+  server_unlock_paths (self);
+}
+
+static void
+shared_release_lock (ServerShared *shared, DAVLock *lock)
+{
+  gchar *path;
+
+  g_rec_mutex_lock (&shared->paths_mutex);
+  path = g_strdup (lock->path->path);
+  dav_lock_free (lock);
+  path_node_prune (shared->paths, path);
+  g_rec_mutex_unlock (&shared->paths_mutex);
+
+  g_free (path);
+}
+
+/* frees @lock, and the paths left without locks */
+void
+server_release_lock (PhodavServer *self, DAVLock *lock)
+{
+  shared_release_lock (self->shared, lock);
+}
+
+static gboolean
+shared_expire_locks (gpointer user_data)
+{
+  ServerShared *shared = user_data;
+  DAVLock *lock;
+
+  g_rec_mutex_lock (&shared->paths_mutex);
+  while ((lock = lock_manager_pop_expired (shared->locks)))
+    {
+      g_debug ("lock %s on %s expired", lock->token, lock->path->path);
+      shared_release_lock (shared, lock);
+    }
+  g_rec_mutex_unlock (&shared->paths_mutex);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static ServerShared *
+server_shared_new (GMainContext *context)
+{
+  ServerShared *shared = g_slice_new0 (ServerShared);
+
+  g_atomic_ref_count_init (&shared->ref_count);
+  g_rec_mutex_init (&shared->paths_mutex);
+  shared->paths = path_node_new ();
+  shared->locks = lock_manager_new (context, shared_expire_locks, shared);
+  shared->metrics = metrics_new ();
+  shared->writes = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
+                                          g_object_unref, NULL);
+  shared->tmp_key = g_uuid_string_random ();
+
+  return shared;
+}
+
+static ServerShared *
+server_shared_ref (ServerShared *shared)
+{
+  g_atomic_ref_count_inc (&shared->ref_count);
+  return shared;
+}
+
+static void
+server_shared_unref (ServerShared *shared)
+{
+  if (!g_atomic_ref_count_dec (&shared->ref_count))
+    return;
+
+  g_clear_pointer (&shared->locks, lock_manager_free);
+  g_clear_pointer (&shared->store, prop_store_free);
+  g_clear_object (&shared->store_file);
+  g_clear_pointer (&shared->paths, path_node_free);
+  g_clear_pointer (&shared->metrics, metrics_free);
+  g_clear_pointer (&shared->usage, usage_index_free);
+  g_clear_pointer (&shared->journal, journal_free);
+  g_clear_pointer (&shared->writes, g_hash_table_unref);
+  if (shared->copy_pool)
+    g_thread_pool_free (shared->copy_pool, TRUE, TRUE);
+  g_free (shared->tmp_key);
+  g_rec_mutex_clear (&shared->paths_mutex);
+  g_slice_free (ServerShared, shared);
+}
+
+typedef struct _RestoreLocks
+{
+  PhodavServer *self;
+  GList        *expired;
+} RestoreLocks;
+
+static void
+server_restore_lock (const StoredLock *stored, gpointer data)
+{
+  RestoreLocks *r = data;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  xmlDocPtr doc = NULL;
+  guint timeout = 0;
+  DAVLock *lock;
+
+  if (stored->expires && stored->expires <= now)
+    {
+      r->expired = g_list_prepend (r->expired, g_strdup (stored->token));
+      return;
+    }
+
+  if (stored->expires)
+    timeout = stored->expires - now;
+  if (stored->owner)
+    doc = xmlReadMemory (stored->owner, strlen (stored->owner), NULL, NULL,
+                         XML_PARSE_NONET);
+
+  lock = dav_lock_new (server_get_path (r->self, stored->path), stored->token,
+                       stored->scope, stored->type, stored->depth,
+                       doc ? xmlDocGetRootElement (doc) : NULL, timeout);
+  if (lock)
+    server_add_lock (r->self, lock->path, lock);
+
+  if (doc)
+    xmlFreeDoc (doc);
+}
+
+static void
+set_store_file (PhodavServer *self, GFile *file)
+{
+  ServerShared *shared = self->shared;
+  RestoreLocks r = { self, NULL };
+  GError *err = NULL;
+  GList *l;
+
+  server_lock_paths (self);
+  lock_manager_set_store (shared->locks, NULL);
+  g_clear_pointer (&shared->store, prop_store_free);
+  g_clear_object (&shared->store_file);
+
+  if (!file)
+    goto end;
+
+  shared->store = prop_store_log_new (file, &err);
+  if (!shared->store)
+    {
+      g_warning ("failed to open the store: %s", err->message);
+      g_clear_error (&err);
+      goto end;
+    }
+
+  shared->store_file = g_object_ref (file);
+  prop_store_foreach_lock (shared->store, server_restore_lock, &r);
+  for (l = r.expired; l; l = l->next)
+    shared->store->funcs->remove_lock (shared->store, l->data);
+  g_list_free_full (r.expired, g_free);
+  lock_manager_set_store (shared->locks, shared->store);
+
+end:
+  server_unlock_paths (self);
+}
 
 static void request_started (SoupServer        *server,
                              SoupServerMessage *message,
@@ -79,17 +384,19 @@ server_get_path (PhodavServer *self, const gchar *_path)
   gchar *path = g_strdup (_path);
 
   remove_trailing (path, '/');
-  p = g_hash_table_lookup (self->paths, path);
+  server_lock_paths (self);
+  p = path_node_lookup (self->shared->paths, path);
   if (!p)
     {
       p = g_slice_new0 (Path);
       p->path = path;
-      g_hash_table_insert (self->paths, p->path, path_ref (p));
+      path_node_insert (self->shared->paths, p);
     }
   else
     {
       g_free (path);
     }
+  server_unlock_paths (self);
 
   return p;
 }
@@ -124,6 +431,281 @@ handler_get_readonly (PathHandler *handler)
   return handler->self->readonly;
 }
 
+guint64 G_GNUC_PURE
+handler_get_stream_threshold (PathHandler *handler)
+{
+  return handler->self->stream_threshold;
+}
+
+guint64 G_GNUC_PURE
+handler_get_sendfile_threshold (PathHandler *handler)
+{
+  return handler->self->sendfile_threshold;
+}
+
+PhodavPutDurability G_GNUC_PURE
+handler_get_put_durability (PathHandler *handler)
+{
+  return handler->self->put_durability;
+}
+
+const gchar * G_GNUC_PURE
+handler_get_tmp_key (PathHandler *handler)
+{
+  return handler->self->shared->tmp_key;
+}
+
+guint G_GNUC_PURE
+handler_get_enumerate_batch_size (PathHandler *handler)
+{
+  return handler->self->enumerate_batch_size;
+}
+
+guint G_GNUC_PURE
+handler_get_depth_infinity_limit (PathHandler *handler)
+{
+  return handler->self->depth_infinity_limit;
+}
+
+guint G_GNUC_PURE
+handler_get_worker_threads (PathHandler *handler)
+{
+  return handler->self->worker_threads;
+}
+
+/* NULL when the server has less than 2 workers */
+GThreadPool *
+handler_get_copy_pool (PathHandler *handler)
+{
+  PhodavServer *self = handler->self;
+  GThreadPool *pool = g_atomic_pointer_get (&self->shared->copy_pool);
+  GError *err = NULL;
+
+  if (pool || self->worker_threads < 2)
+    return pool;
+
+  server_lock_paths (self);
+  if (!self->shared->copy_pool)
+    {
+      pool = phodav_copy_pool_new (self->worker_threads, &err);
+      if (!pool)
+        {
+          g_warning ("failed to set up the copy threads: %s", err->message);
+          g_clear_error (&err);
+        }
+      g_atomic_pointer_set (&self->shared->copy_pool, pool);
+    }
+  pool = self->shared->copy_pool;
+  server_unlock_paths (self);
+
+  return pool;
+}
+
+PropStore * G_GNUC_PURE
+handler_get_store (PathHandler *handler)
+{
+  return handler->self->shared->store;
+}
+
+/* NULL when the root is not a local directory */
+UsageIndex *
+handler_get_usage (PathHandler *handler)
+{
+  PhodavServer *self = handler->self;
+  UsageIndex *usage = g_atomic_pointer_get (&self->shared->usage);
+
+  if (usage || !g_file_is_native (self->root_file))
+    return usage;
+
+  server_lock_paths (self);
+  if (!self->shared->usage)
+    g_atomic_pointer_set (&self->shared->usage,
+                          usage_index_new (self->root_file, self->context,
+                                           self->search_index));
+  usage = self->shared->usage;
+  server_unlock_paths (self);
+
+  return usage;
+}
+
+/* NULL when the root is not a local directory */
+Journal *
+handler_get_journal (PathHandler *handler)
+{
+  PhodavServer *self = handler->self;
+  Journal *journal = g_atomic_pointer_get (&self->shared->journal);
+
+  if (journal || !g_file_is_native (self->root_file))
+    return journal;
+
+  server_lock_paths (self);
+  if (!self->shared->journal)
+    g_atomic_pointer_set (&self->shared->journal,
+                          journal_new (self->root_file, self->context));
+  journal = self->shared->journal;
+  server_unlock_paths (self);
+
+  return journal;
+}
+
+/* NULL unless the files are indexed for searches */
+UsageIndex *
+handler_get_search_index (PathHandler *handler)
+{
+  if (!handler->self->search_index)
+    return NULL;
+
+  return handler_get_usage (handler);
+}
+
+/* the returned info may come from the cache, and must not be modified */
+GFileInfo *
+handler_query_info (PathHandler *handler, GFile *file, const gchar *attributes,
+                    GCancellable *cancellable, GError **err)
+{
+  InfoCache *cache = handler->self->cache;
+  GFileInfo *info;
+  guint64 serial;
+  gchar *query;
+
+  info = info_cache_lookup_info (cache, file, attributes);
+  if (info)
+    return info;
+
+  serial = info_cache_get_serial (cache);
+  query = info_cache_get_query (cache, attributes);
+  info = g_file_query_info (file, query ? : attributes, G_FILE_QUERY_INFO_NONE,
+                            cancellable, err);
+  if (info && query)
+    info_cache_store_info (cache, file, attributes, serial, info);
+  g_free (query);
+
+  return info;
+}
+
+typedef struct _EnumerateShown
+{
+  EnumerateFunc func;
+  gpointer      data;
+  const gchar  *tmp_key;
+  guint         n;
+  GPtrArray    *children; /* kept for the cache */
+  gboolean      stopped;
+} EnumerateShown;
+
+static gboolean
+enumerate_shown (GFileInfo *info, gpointer data)
+{
+  EnumerateShown *e = data;
+
+  /* the uploads in progress are not shown */
+  if (put_is_tmp_name (e->tmp_key, g_file_info_get_name (info)))
+    return TRUE;
+
+  if (e->children)
+    g_ptr_array_add (e->children, g_object_ref (info));
+  e->n++;
+  e->stopped = !e->func (info, e->data);
+
+  return !e->stopped;
+}
+
+/* like phodav_enumerate_children(), without the files written aside,
+ * possibly from a cached listing */
+gboolean
+handler_enumerate_children (PathHandler *handler, GFile *file, const gchar *attributes,
+                            EnumerateFunc func, gpointer data,
+                            GCancellable *cancellable, GError **err)
+{
+  InfoCache *cache = handler->self->cache;
+  EnumerateShown e = { func, data, handler_get_tmp_key (handler), 0 };
+  GPtrArray *children;
+  gboolean success;
+  guint64 serial;
+  guint i;
+
+  children = info_cache_lookup_children (cache, file, attributes);
+  if (children)
+    {
+      for (i = 0; i < children->len; i++)
+        if (!func (children->pdata[i], data))
+          break;
+
+      metrics_add_enumeration (handler->self->shared->metrics, i);
+      g_ptr_array_unref (children);
+      return TRUE;
+    }
+
+  serial = info_cache_get_serial (cache);
+  if (handler->self->cache_size)
+    e.children = g_ptr_array_new_with_free_func (g_object_unref);
+  success = phodav_enumerate_children (file, attributes, G_FILE_QUERY_INFO_NONE,
+                                       handler->self->enumerate_batch_size,
+                                       enumerate_shown, &e, cancellable, err);
+  if (success)
+    {
+      if (e.children && !e.stopped)
+        info_cache_store_children (cache, file, attributes, serial, e.children);
+      metrics_add_enumeration (handler->self->shared->metrics, e.n);
+    }
+
+  g_clear_pointer (&e.children, g_ptr_array_unref);
+  return success;
+}
+
+/* to be called whenever phodav modifies @file */
+void
+server_file_changed (PhodavServer *self, GFile *file)
+{
+  UsageIndex *usage = g_atomic_pointer_get (&self->shared->usage);
+  Journal *journal = g_atomic_pointer_get (&self->shared->journal);
+
+  info_cache_invalidate (self->cache, file);
+  if (usage)
+    usage_index_changed (usage, file);
+  if (journal)
+    journal_record (journal, file);
+}
+
+/* to be called when phodav copies or moves @dir in, for the members */
+void
+server_tree_changed (PhodavServer *self, GFile *dir)
+{
+  Journal *journal = g_atomic_pointer_get (&self->shared->journal);
+
+  if (journal)
+    journal_record_tree (journal, dir);
+}
+
+/* claims @file for a PUT, returns FALSE if another one is in
+ * flight */
+gboolean
+server_begin_write (PhodavServer *self, GFile *file)
+{
+  gboolean claimed;
+
+  server_lock_paths (self);
+  claimed = g_hash_table_add (self->shared->writes, g_object_ref (file));
+  server_unlock_paths (self);
+
+  return claimed;
+}
+
+void
+server_end_write (PhodavServer *self, GFile *file)
+{
+  server_lock_paths (self);
+  g_warn_if_fail (g_hash_table_remove (self->shared->writes, file));
+  server_unlock_paths (self);
+}
+
+/* for bodies sent behind libsoup, which does not count them */
+void
+server_add_bytes_out (PhodavServer *self, const gchar *method, guint64 bytes)
+{
+  metrics_add_bytes_out (self->shared->metrics, method, bytes);
+}
+
 static PathHandler *
 path_handler_new (PhodavServer *self, GFile *file)
 {
@@ -145,9 +727,13 @@ static void
 phodav_server_init (PhodavServer *self)
 {
   self->cancellable = g_cancellable_new ();
-
-  self->paths = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                       NULL, (GDestroyNotify) path_unref);
+  self->stream_threshold = G_MAXUINT64;
+  self->sendfile_threshold = G_MAXUINT64;
+  self->put_durability = PHODAV_PUT_DURABILITY_ATOMIC;
+  self->enumerate_batch_size = ENUMERATE_BATCH_SIZE;
+  self->context = g_main_context_ref_thread_default ();
+  self->cache = info_cache_new (self->context, 0);
+  self->shared = server_shared_new (self->context);
 }
 
 static void
@@ -159,6 +745,7 @@ update_root_handler (PhodavServer *self)
     return;
 
   handler = path_handler_new (self, self->root_file);
+  info_cache_set_root (self->cache, self->root_file);
 
   soup_server_add_handler (self->server, "/",
                            server_callback,
@@ -168,6 +755,20 @@ update_root_handler (PhodavServer *self)
   self->root_handler = handler;
 }
 
+static void
+update_search_index (PhodavServer *self)
+{
+  UsageIndex *usage;
+
+  if (!self->root_handler)
+    return;
+
+  usage = self->search_index ?
+    handler_get_usage (self->root_handler) : g_atomic_pointer_get (&self->shared->usage);
+  if (usage)
+    usage_index_set_files (usage, self->search_index);
+}
+
 static void
 phodav_server_constructed (GObject *gobject)
 {
@@ -190,6 +791,13 @@ phodav_server_dispose (GObject *gobject)
 {
   PhodavServer *self = PHODAV_SERVER (gobject);
 
+  /* pending jobs hold a reference on the server, so there are none left */
+  if (self->pool)
+    {
+      g_thread_pool_free (self->pool, FALSE, TRUE);
+      self->pool = NULL;
+    }
+
   /* SoupServer could live longer than PhodavServer,
    * this frees the PhodavHandler passed as user_data */
   soup_server_remove_handler (self->server, "/");
@@ -197,13 +805,51 @@ phodav_server_dispose (GObject *gobject)
   g_clear_object (&self->server);
   g_clear_object (&self->cancellable);
   g_clear_object (&self->root_file);
-  g_clear_pointer (&self->paths, g_hash_table_unref);
+  g_clear_pointer (&self->shared, server_shared_unref);
+  g_clear_pointer (&self->cache, info_cache_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
 
   /* Chain up to the parent class */
   if (G_OBJECT_CLASS (phodav_server_parent_class)->dispose)
     G_OBJECT_CLASS (phodav_server_parent_class)->dispose (gobject);
 }
 
+static void
+set_worker_threads (PhodavServer *self, guint n)
+{
+  GError *err = NULL;
+
+  self->worker_threads = n;
+  if (n == 0)
+    return;
+
+  if (self->pool)
+    g_thread_pool_set_max_threads (self->pool, n, &err);
+  else
+    self->pool = g_thread_pool_new (server_job_run, self, n, FALSE, &err);
+
+  if (err)
+    {
+      g_warning ("failed to set up worker threads: %s", err->message);
+      g_clear_error (&err);
+      self->worker_threads = 0;
+    }
+}
+
+static void
+set_peer (PhodavServer *self, PhodavServer *peer)
+{
+  if (!peer)
+    return;
+
+  g_clear_pointer (&self->shared, server_shared_unref);
+  self->shared = server_shared_ref (peer->shared);
+
+  g_clear_pointer (&self->cache, info_cache_unref);
+  self->cache = info_cache_ref (peer->cache);
+  self->cache_size = peer->cache_size;
+}
+
 static void
 phodav_server_get_property (GObject    *gobject,
                             guint       prop_id,
@@ -231,6 +877,42 @@ phodav_server_get_property (GObject    *gobject,
       g_value_set_boolean (value, self->readonly);
       break;
 
+    case PROP_STREAM_THRESHOLD:
+      g_value_set_uint64 (value, self->stream_threshold);
+      break;
+
+    case PROP_SENDFILE_THRESHOLD:
+      g_value_set_uint64 (value, self->sendfile_threshold);
+      break;
+
+    case PROP_PUT_DURABILITY:
+      g_value_set_enum (value, self->put_durability);
+      break;
+
+    case PROP_WORKER_THREADS:
+      g_value_set_uint (value, self->worker_threads);
+      break;
+
+    case PROP_ENUMERATE_BATCH_SIZE:
+      g_value_set_uint (value, self->enumerate_batch_size);
+      break;
+
+    case PROP_DEPTH_INFINITY_LIMIT:
+      g_value_set_uint (value, self->depth_infinity_limit);
+      break;
+
+    case PROP_INFO_CACHE_SIZE:
+      g_value_set_uint (value, self->cache_size);
+      break;
+
+    case PROP_SEARCH_INDEX:
+      g_value_set_boolean (value, self->search_index);
+      break;
+
+    case PROP_STORE_FILE:
+      g_value_set_object (value, self->shared->store_file);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
       break;
@@ -246,6 +928,12 @@ phodav_server_set_property (GObject      *gobject,
   PhodavServer *self = PHODAV_SERVER (gobject);
   const gchar *root;
 
+  if (prop_id == PROP_PEER)
+    {
+      set_peer (self, g_value_get_object (value));
+      return;
+    }
+
   /* do not overwrite the root file during construction,
    * phodav should be constructed either with "root" or "root-file", not both */
   if (!self->server && self->root_file)
@@ -271,24 +959,62 @@ phodav_server_set_property (GObject      *gobject,
       self->readonly = g_value_get_boolean (value);
       break;
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+    case PROP_STREAM_THRESHOLD:
+      self->stream_threshold = g_value_get_uint64 (value);
       break;
-    }
-}
 
-static void
-phodav_server_class_init (PhodavServerClass *klass)
-{
-  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    case PROP_SENDFILE_THRESHOLD:
+      self->sendfile_threshold = g_value_get_uint64 (value);
+      break;
 
-  gobject_class->dispose      = phodav_server_dispose;
-  gobject_class->constructed  = phodav_server_constructed;
-  gobject_class->get_property = phodav_server_get_property;
-  gobject_class->set_property = phodav_server_set_property;
+    case PROP_PUT_DURABILITY:
+      self->put_durability = g_value_get_enum (value);
+      break;
 
-  /**
-   * PhodavServer:root:
+    case PROP_WORKER_THREADS:
+      set_worker_threads (self, g_value_get_uint (value));
+      break;
+
+    case PROP_ENUMERATE_BATCH_SIZE:
+      self->enumerate_batch_size = g_value_get_uint (value);
+      break;
+
+    case PROP_DEPTH_INFINITY_LIMIT:
+      self->depth_infinity_limit = g_value_get_uint (value);
+      break;
+
+    case PROP_INFO_CACHE_SIZE:
+      self->cache_size = g_value_get_uint (value);
+      info_cache_set_max_size (self->cache, self->cache_size);
+      break;
+
+    case PROP_SEARCH_INDEX:
+      self->search_index = g_value_get_boolean (value);
+      update_search_index (self);
+      break;
+
+    case PROP_STORE_FILE:
+      set_store_file (self, g_value_get_object (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+phodav_server_class_init (PhodavServerClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->dispose      = phodav_server_dispose;
+  gobject_class->constructed  = phodav_server_constructed;
+  gobject_class->get_property = phodav_server_get_property;
+  gobject_class->set_property = phodav_server_set_property;
+
+  /**
+   * PhodavServer:root:
    *
    * This property is interconnected with the property #PhodavServer:root-file.
    * Changing #PhodavServer:root affects #PhodavServer:root-file and vice versa.
@@ -341,82 +1067,252 @@ phodav_server_class_init (PhodavServerClass *klass)
                            FALSE,
                            G_PARAM_READWRITE |
                            G_PARAM_STATIC_STRINGS));
-}
 
-gboolean
-server_foreach_parent_path (PhodavServer *self, const gchar *path, PathCb cb, gpointer data)
-{
-  gchar **pathv, *partial = g_strdup ("/");
-  gboolean ret = FALSE;
-  gchar *key = NULL;
-  Path *p;
-  gint i;
+  /**
+   * PhodavServer:stream-threshold:
+   *
+   * Files larger than this size, in bytes, are read and sent in chunks
+   * instead of being mapped in memory as a whole. By default, files are
+   * only streamed when they cannot be mapped.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_STREAM_THRESHOLD,
+     g_param_spec_uint64 ("stream-threshold",
+                          "Stream threshold",
+                          "Size above which files are streamed",
+                          0, G_MAXUINT64, G_MAXUINT64,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS));
 
-  pathv = g_strsplit (path, "/", -1);
+  /**
+   * PhodavServer:sendfile-threshold:
+   *
+   * GET responses over plain HTTP/1 made of a single range, or a whole
+   * file, of at least this size, in bytes, are sent from the page cache
+   * to the socket with sendfile(), whether the file would be mapped or
+   * streamed otherwise, where sendfile() is available. libsoup can't
+   * take the connection back after that, so it is closed at the end of
+   * the body, and the client connects again for its next request: set
+   * it only to sizes where the copy saved outweighs a new connection,
+   * e.g. disk images. Disabled by default.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_SENDFILE_THRESHOLD,
+     g_param_spec_uint64 ("sendfile-threshold",
+                          "Sendfile threshold",
+                          "Size from which GET bodies are sent with sendfile()",
+                          0, G_MAXUINT64, G_MAXUINT64,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS));
 
-  for (i = 0; pathv[i]; i++)
-    {
-      if (!*pathv[i])
-        continue;
+  /**
+   * PhodavServer:put-durability:
+   *
+   * How PUT requests commit the content of a file. A file is renamed
+   * in place by default, syncing it first costs a flush per file, and
+   * is only worth it when a crash of the system must not lose a
+   * complete upload. Writing in place saves the rename too, which
+   * matters with many small files, but should only be used with
+   * trusted clients. When a Content-Length is given, the space of the
+   * file is reserved before writing.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_PUT_DURABILITY,
+     g_param_spec_enum ("put-durability",
+                        "PUT durability",
+                        "How PUT requests commit files",
+                        PHODAV_TYPE_PUT_DURABILITY,
+                        PHODAV_PUT_DURABILITY_ATOMIC,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS));
 
-      gchar *tmp = g_build_path ("/", partial, pathv[i], NULL);
-      g_free (partial);
-      partial = tmp;
+  /**
+   * PhodavServer:worker-threads:
+   *
+   * The maximum number of threads used to run the methods doing
+   * blocking file system work (PROPFIND, PROPPATCH, MKCOL, DELETE,
+   * MOVE, COPY, SEARCH and REPORT), so they do not stall the main
+   * loop. A DELETE, MOVE or COPY of a collection also walks it on up
+   * to that many threads of its own. When 0, the default, every
+   * method runs synchronously in the main context, in a single
+   * thread.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_WORKER_THREADS,
+     g_param_spec_uint ("worker-threads",
+                        "Worker threads",
+                        "Maximum number of worker threads",
+                        0, G_MAXINT, 0,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS));
 
-      if (g_hash_table_lookup_extended (self->paths, partial,
-                                        (gpointer *) &key, (gpointer *) &p))
-        {
-          if (!cb (key, p, data))
-            goto end;
-        }
-    }
+  /**
+   * PhodavServer:enumerate-batch-size:
+   *
+   * The number of directory entries read at once when listing a
+   * collection, before they are handled.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_ENUMERATE_BATCH_SIZE,
+     g_param_spec_uint ("enumerate-batch-size",
+                        "Enumerate batch size",
+                        "Number of entries listed at once",
+                        1, G_MAXINT, ENUMERATE_BATCH_SIZE,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS));
 
-  ret = TRUE;
+  /**
+   * PhodavServer:depth-infinity-limit:
+   *
+   * The maximum number of resources listed by a PROPFIND with
+   * Depth: infinity. The tree is walked breadth first, without
+   * following symbolic links to collections. The responses are sent
+   * as they are listed when the method runs in the
+   * #PhodavServer:worker-threads pool; otherwise, the whole response
+   * is kept until the listing ends. When the limit is reached, the
+   * listing ends with a 507 response for every collection whose
+   * members were not all listed, for the client to go on from there.
+   * When 0, the default, such requests are refused.
+   *
+   * It also bounds the resources looked at by a SEARCH of infinite
+   * depth, the default scope, which ends with a 507 response once it
+   * is reached, or is refused when 0. So it does for the initial
+   * listing of a sync-collection REPORT at infinite level.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_DEPTH_INFINITY_LIMIT,
+     g_param_spec_uint ("depth-infinity-limit",
+                        "Depth infinity limit",
+                        "Maximum number of resources listed at infinite depth",
+                        0, G_MAXUINT, 0,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS));
 
-end:
-  g_strfreev (pathv);
-  g_free (partial);
+  /**
+   * PhodavServer:info-cache-size:
+   *
+   * The maximum number of file infos kept in memory to answer repeated
+   * PROPFIND and GET requests without touching the file system. A
+   * cached directory listing counts one per member. The directories
+   * listed below a local root are monitored, up to 256 of them, and a
+   * change made behind the server drops what it affects, as soon as
+   * it is reported. An info outside of them is checked against a
+   * stat of the file on every hit, and listings are only cached
+   * inside. When 0, the default, nothing is cached.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_INFO_CACHE_SIZE,
+     g_param_spec_uint ("info-cache-size",
+                        "Info cache size",
+                        "Maximum number of cached file infos",
+                        0, G_MAXUINT, 0,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS));
 
-  return ret;
-}
+  /**
+   * PhodavServer:search-index:
+   *
+   * Whether to keep the name, size, modification time and type of
+   * every file of a local root in memory, so that most SEARCH requests
+   * are answered without walking the file system. The index is built
+   * in the background and kept up to date with file monitors. When
+   * %FALSE, the default, SEARCH walks its scope.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_SEARCH_INDEX,
+     g_param_spec_boolean ("search-index",
+                           "Search index",
+                           "Whether to index the files for searches",
+                           FALSE,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS));
 
-typedef struct _PathGetLock
-{
-  const gchar *token;
-  DAVLock     *lock;
-} PathGetLock;
+  /**
+   * PhodavServer:store-file:
+   *
+   * A local file where dead properties and locks are kept, in an
+   * append-only log. Locks are then restored when the server starts
+   * again, and properties do not need extended attributes on the
+   * exported file system. When %NULL, the default, properties are
+   * kept in extended attributes and locks only in memory.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_STORE_FILE,
+     g_param_spec_object ("store-file",
+                          "Store file",
+                          "File keeping properties and locks",
+                          G_TYPE_FILE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS));
 
-static gboolean
-_path_get_lock (const gchar *key, Path *path, gpointer data)
-{
-  PathGetLock *d = data;
-  GList *l;
+  /**
+   * PhodavServer:peer:
+   *
+   * A #PhodavServer to share the lock table, the store and the info
+   * cache with, so that several servers, each running in its own
+   * thread and #GMainContext, can export the same root with
+   * consistent locking. Lock timeouts are handled in the context of
+   * the first server.
+   *
+   * Since: 3.1
+   **/
+  g_object_class_install_property
+    (gobject_class, PROP_PEER,
+     g_param_spec_object ("peer",
+                          "Peer server",
+                          "Server to share the locks with",
+                          PHODAV_TYPE_SERVER,
+                          G_PARAM_WRITABLE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS));
+}
 
-  for (l = path->locks; l != NULL; l = l->next)
-    {
-      DAVLock *lock = l->data;
+gboolean
+server_foreach_parent_path (PhodavServer *self, const gchar *path, PathCb cb, gpointer data)
+{
+  gboolean ret;
 
-      if (!g_strcmp0 (lock->token, d->token))
-        {
-          d->lock = lock;
-          return FALSE;
-        }
-    }
+  server_lock_paths (self);
+  ret = path_node_foreach_parent (self->shared->paths, path, cb, data);
+  server_unlock_paths (self);
 
-  return TRUE;
+  return ret;
 }
 
+/* the lock of @token, if it applies to @path */
 DAVLock *
 server_path_get_lock (PhodavServer *self, const gchar *path, const gchar *token)
 {
-  PathGetLock p = { .token = token };
-  gboolean success = !server_foreach_parent_path (self, path,
-                                                  _path_get_lock, (gpointer) &p);
+  DAVLock *lock;
 
-  if (!success)
+  server_lock_paths (self);
+  lock = lock_manager_lookup (self->shared->locks, token);
+  if (lock && !path_is_below (path, lock->path->path))
+    lock = NULL;
+  server_unlock_paths (self);
+
+  if (!lock)
     g_message ("Invalid lock token %s for %s", token, path);
 
-  return p.lock;
+  return lock;
 }
 
 static gboolean
@@ -435,10 +1331,20 @@ other_lock_exists (const gchar *key, Path *path, gpointer data)
   return TRUE;
 }
 
+/* whether a lock not in @locks applies to @path, or with @below to
+ * one of its members */
 gboolean
-server_path_has_other_locks (PhodavServer *self, const gchar *path, GList *locks)
+server_path_has_other_locks (PhodavServer *self, const gchar *path,
+                             GList *locks, gboolean below)
 {
-  return !server_foreach_parent_path (self, path, other_lock_exists, locks);
+  gboolean ret;
+
+  server_lock_paths (self);
+  ret = !path_node_foreach_parent (self->shared->paths, path, other_lock_exists, locks) ||
+    (below && !path_node_foreach_below (self->shared->paths, path, other_lock_exists, locks));
+  server_unlock_paths (self);
+
+  return ret;
 }
 
 static void
@@ -460,14 +1366,496 @@ got_headers (SoupServerMessage *msg,
     }
 }
 
+typedef struct _RequestMetrics
+{
+  Metrics *metrics;
+  gint64   start;
+  guint64  bytes_in;
+  guint64  bytes_out;
+} RequestMetrics;
+
+static void
+request_got_chunk (SoupServerMessage *msg, GBytes *chunk, gpointer user_data)
+{
+  RequestMetrics *r = user_data;
+
+  r->bytes_in += g_bytes_get_size (chunk);
+}
+
+static void
+request_wrote_body_data (SoupServerMessage *msg, guint size, gpointer user_data)
+{
+  RequestMetrics *r = user_data;
+
+  r->bytes_out += size;
+}
+
+static void
+request_finished (SoupServerMessage *msg, gpointer user_data)
+{
+  RequestMetrics *r = user_data;
+
+  metrics_add_request (r->metrics, soup_server_message_get_method (msg),
+                       soup_server_message_get_status (msg),
+                       r->bytes_in, r->bytes_out,
+                       g_get_monotonic_time () - r->start);
+}
+
+static void
+request_metrics_free (RequestMetrics *r)
+{
+  g_slice_free (RequestMetrics, r);
+}
+
 static void
 request_started (SoupServer        *server,
                  SoupServerMessage *message,
                  gpointer           user_data)
 {
   PhodavServer *self = user_data;
+  RequestMetrics *r = g_slice_new0 (RequestMetrics);
+
+  /* the shared metrics outlive the messages of every server */
+  r->metrics = self->shared->metrics;
+  r->start = g_get_monotonic_time ();
+  g_object_set_data_full (G_OBJECT (message), "phodav-metrics", r,
+                          (GDestroyNotify) request_metrics_free);
 
   g_signal_connect (message, "got-headers", G_CALLBACK (got_headers), self);
+  g_signal_connect (message, "got-chunk", G_CALLBACK (request_got_chunk), r);
+  g_signal_connect (message, "wrote-body-data", G_CALLBACK (request_wrote_body_data), r);
+  g_signal_connect (message, "finished", G_CALLBACK (request_finished), r);
+}
+
+static gint
+server_dispatch (PathHandler *handler, SoupServerMessage *msg,
+                 const char *method, const char *path, GError **err)
+{
+  if (method == SOUP_METHOD_PROPFIND)
+    return phodav_method_propfind (handler, msg, path, err);
+  else if (method == SOUP_METHOD_PROPPATCH)
+    return phodav_method_proppatch (handler, msg, path, err);
+  else if (method == SOUP_METHOD_MKCOL)
+    return phodav_method_mkcol (handler, msg, path, err);
+  else if (method == SOUP_METHOD_DELETE)
+    return phodav_method_delete (handler, msg, path, err);
+  else if (method == SOUP_METHOD_MOVE ||
+           method == SOUP_METHOD_COPY)
+    return phodav_method_movecopy (handler, msg, path, err);
+  else if (method == PHODAV_METHOD_SEARCH)
+    return phodav_method_search (handler, msg, path, err);
+  else if (method == PHODAV_METHOD_REPORT)
+    return phodav_method_report (handler, msg, path, err);
+
+  g_return_val_if_reached (SOUP_STATUS_NOT_IMPLEMENTED);
+}
+
+static void
+server_message_done (SoupServerMessage *msg, gint status, GError *err)
+{
+  soup_server_message_set_status (msg, status, NULL);
+
+  g_debug ("  -> %d %s\n", soup_server_message_get_status (msg), soup_server_message_get_reason_phrase (msg));
+  if (err)
+    g_warning ("error: %s", err->message);
+}
+
+/* A method running in the worker pool, the message stays paused
+ * until the result is given back in the server main context: the
+ * worker only touches the request, and gives the status, the response
+ * headers and the body to the job. A streamed body is handed to the
+ * message in the server context as it comes, and the worker waits
+ * while more than SERVER_JOB_MAX_PENDING bytes are not written. */
+typedef struct _ServerJob
+{
+  PathHandler        *handler;
+  PhodavServer       *self;
+  SoupServerMessage  *msg;
+  const char         *method;
+  gchar              *path;
+  gint                status;
+  GError             *err;
+
+  GMutex              mutex;
+  GCond               cond;
+  SoupMessageHeaders *headers;
+  GBytes             *response;
+  gint                stream_status; /* 0 until streamed */
+  gboolean            started;
+  gboolean            complete;
+  GQueue              chunks;  /* not given to the message yet */
+  GQueue              sizes;   /* of the chunks given, not written */
+  gsize               pending;
+  GSource            *flush_source;
+  gboolean            finished;
+  gboolean            aborted;
+} ServerJob;
+
+#define SERVER_JOB_MAX_PENDING (4 * COMPRESSOR_MIN_SIZE)
+
+static GQuark
+server_job_quark (void)
+{
+  return g_quark_from_static_string ("phodav-server-job");
+}
+
+/* the job of @msg, NULL when the method runs in the server context */
+static ServerJob *
+server_message_get_job (SoupServerMessage *msg)
+{
+  return g_object_get_qdata (G_OBJECT (msg), server_job_quark ());
+}
+
+/* the response headers, to be set before any of the body is given */
+SoupMessageHeaders *
+server_message_get_response_headers (SoupServerMessage *msg)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  return job ? job->headers : soup_server_message_get_response_headers (msg);
+}
+
+/* the whole response body, taking @data */
+void
+server_message_set_response (SoupServerMessage *msg, const gchar *content_type,
+                             gchar *data, gsize len)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  if (!job)
+    {
+      soup_server_message_set_response (msg, content_type, SOUP_MEMORY_TAKE, data, len);
+      return;
+    }
+
+  soup_message_headers_set_content_type (job->headers, content_type, NULL);
+  g_clear_pointer (&job->response, g_bytes_unref);
+  job->response = g_bytes_new_take (data, len);
+}
+
+/* the body is chunked and will be appended, with @status: from a
+ * worker, it is then sent as it comes */
+void
+server_message_stream (SoupServerMessage *msg, gint status)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  if (!job)
+    {
+      soup_message_headers_set_encoding (soup_server_message_get_response_headers (msg),
+                                         SOUP_ENCODING_CHUNKED);
+      soup_message_body_set_accumulate (soup_server_message_get_response_body (msg), FALSE);
+      return;
+    }
+
+  soup_message_headers_set_encoding (job->headers, SOUP_ENCODING_CHUNKED);
+  job->stream_status = status;
+}
+
+static void
+append_header (const char *name, const char *value, gpointer user_data)
+{
+  soup_message_headers_append (user_data, name, value);
+}
+
+static void
+remove_header (const char *name, const char *value, gpointer user_data)
+{
+  soup_message_headers_remove (user_data, name);
+}
+
+/* in the server context */
+static void
+server_job_flush (ServerJob *job)
+{
+  SoupMessageHeaders *headers = soup_server_message_get_response_headers (job->msg);
+  SoupMessageBody *body = soup_server_message_get_response_body (job->msg);
+  GBytes *bytes;
+
+  g_mutex_lock (&job->mutex);
+  if (job->finished)
+    {
+      g_mutex_unlock (&job->mutex);
+      return;
+    }
+
+  if (!job->started)
+    {
+      job->started = TRUE;
+      soup_message_headers_foreach (job->headers, remove_header, headers);
+      soup_message_headers_foreach (job->headers, append_header, headers);
+      soup_message_headers_set_encoding (headers, SOUP_ENCODING_CHUNKED);
+      soup_message_body_set_accumulate (body, FALSE);
+      soup_server_message_set_status (job->msg, job->stream_status, NULL);
+    }
+
+  while ((bytes = g_queue_pop_head (&job->chunks)))
+    {
+      g_queue_push_tail (&job->sizes, GSIZE_TO_POINTER (g_bytes_get_size (bytes)));
+      soup_message_body_append_bytes (body, bytes);
+      g_bytes_unref (bytes);
+    }
+  if (job->complete)
+    soup_message_body_complete (body);
+  g_mutex_unlock (&job->mutex);
+
+  soup_server_message_unpause (job->msg);
+}
+
+static gboolean
+server_job_flush_cb (gpointer user_data)
+{
+  ServerJob *job = user_data;
+
+  g_mutex_lock (&job->mutex);
+  g_clear_pointer (&job->flush_source, g_source_unref);
+  g_mutex_unlock (&job->mutex);
+
+  server_job_flush (job);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* with the job mutex held */
+static void
+server_job_schedule_flush (ServerJob *job)
+{
+  if (job->flush_source || !job->stream_status)
+    return;
+
+  job->flush_source = g_idle_source_new ();
+  g_source_set_callback (job->flush_source, server_job_flush_cb, job, NULL);
+  g_source_attach (job->flush_source, job->self->context);
+}
+
+/* appends a copy of @data to the body */
+void
+server_message_append (SoupServerMessage *msg, gconstpointer data, gsize len)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  if (!job)
+    {
+      soup_message_body_append (soup_server_message_get_response_body (msg),
+                                SOUP_MEMORY_COPY, data, len);
+      return;
+    }
+
+  if (len == 0)
+    return;
+
+  g_mutex_lock (&job->mutex);
+  if (!job->finished && !job->aborted)
+    {
+      g_queue_push_tail (&job->chunks, g_bytes_new (data, len));
+      job->pending += len;
+      server_job_schedule_flush (job);
+    }
+
+  /* until the client reads enough */
+  while (job->stream_status && !job->finished && !job->aborted &&
+         job->pending > SERVER_JOB_MAX_PENDING)
+    g_cond_wait (&job->cond, &job->mutex);
+  g_mutex_unlock (&job->mutex);
+}
+
+void
+server_message_complete (SoupServerMessage *msg)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  if (!job)
+    {
+      soup_message_body_complete (soup_server_message_get_response_body (msg));
+      return;
+    }
+
+  g_mutex_lock (&job->mutex);
+  job->complete = TRUE;
+  server_job_schedule_flush (job);
+  g_mutex_unlock (&job->mutex);
+}
+
+static void
+server_message_close (SoupServerMessage *msg)
+{
+  GIOStream *conn = soup_server_message_steal_connection (msg);
+
+  if (conn)
+    {
+      g_io_stream_close (conn, NULL, NULL);
+      g_object_unref (conn);
+    }
+}
+
+/* drops the connection once the status is sent, and the rest of the
+ * body: the only way to tell the client that it is incomplete */
+void
+server_message_abort (SoupServerMessage *msg)
+{
+  ServerJob *job = server_message_get_job (msg);
+
+  if (!job)
+    {
+      server_message_close (msg);
+      return;
+    }
+
+  /* closed in the server context, when the job is done */
+  g_mutex_lock (&job->mutex);
+  job->aborted = TRUE;
+  g_queue_clear_full (&job->chunks, (GDestroyNotify) g_bytes_unref);
+  job->pending = 0;
+  g_cond_broadcast (&job->cond);
+  g_mutex_unlock (&job->mutex);
+}
+
+static void
+server_job_wrote_chunk (SoupServerMessage *msg, gpointer user_data)
+{
+  ServerJob *job = user_data;
+
+  g_mutex_lock (&job->mutex);
+  job->pending -= MIN (job->pending, GPOINTER_TO_SIZE (g_queue_pop_head (&job->sizes)));
+  g_cond_broadcast (&job->cond);
+  g_mutex_unlock (&job->mutex);
+}
+
+static void
+server_job_finished (SoupServerMessage *msg, gpointer user_data)
+{
+  ServerJob *job = user_data;
+
+  g_mutex_lock (&job->mutex);
+  job->finished = TRUE;
+  g_queue_clear_full (&job->chunks, (GDestroyNotify) g_bytes_unref);
+  job->pending = 0;
+  g_cond_broadcast (&job->cond);
+  g_mutex_unlock (&job->mutex);
+}
+
+static void
+server_job_free (ServerJob *job)
+{
+  g_signal_handlers_disconnect_by_func (job->msg, server_job_finished, job);
+  g_signal_handlers_disconnect_by_func (job->msg, server_job_wrote_chunk, job);
+  g_object_set_qdata (G_OBJECT (job->msg), server_job_quark (), NULL);
+  if (job->flush_source)
+    {
+      g_source_destroy (job->flush_source);
+      g_source_unref (job->flush_source);
+    }
+
+  g_queue_clear_full (&job->chunks, (GDestroyNotify) g_bytes_unref);
+  g_queue_clear (&job->sizes);
+  g_clear_pointer (&job->response, g_bytes_unref);
+  soup_message_headers_unref (job->headers);
+  g_mutex_clear (&job->mutex);
+  g_cond_clear (&job->cond);
+  g_clear_error (&job->err);
+  g_object_unref (job->msg);
+  g_object_unref (job->self);
+  g_free (job->path);
+  g_slice_free (ServerJob, job);
+}
+
+static gboolean
+server_job_done (gpointer user_data)
+{
+  ServerJob *job = user_data;
+  SoupMessageHeaders *headers = soup_server_message_get_response_headers (job->msg);
+  SoupMessageBody *body = soup_server_message_get_response_body (job->msg);
+  GBytes *bytes;
+
+  if (job->finished)
+    goto end;
+
+  if (job->aborted)
+    {
+      if (job->err)
+        g_warning ("error: %s", job->err->message);
+      server_message_close (job->msg);
+      goto end;
+    }
+
+  if (job->started)
+    {
+      /* the status is already sent, the body is ended in any case */
+      job->complete = TRUE;
+      server_job_flush (job);
+      if (job->err)
+        g_warning ("error: %s", job->err->message);
+      goto end;
+    }
+
+  soup_message_headers_foreach (job->headers, remove_header, headers);
+  soup_message_headers_foreach (job->headers, append_header, headers);
+  if (job->response)
+    soup_message_body_append_bytes (body, job->response);
+  while ((bytes = g_queue_pop_head (&job->chunks)))
+    {
+      soup_message_body_append_bytes (body, bytes);
+      g_bytes_unref (bytes);
+    }
+  if (job->complete)
+    soup_message_body_complete (body);
+
+  server_message_done (job->msg, job->status, job->err);
+  soup_server_message_unpause (job->msg);
+
+end:
+  server_job_free (job);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+server_job_run (gpointer data, gpointer user_data)
+{
+  ServerJob *job = data;
+  PhodavServer *self = user_data;
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    job->status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+  else
+    job->status = server_dispatch (job->handler, job->msg,
+                                   job->method, job->path, &job->err);
+
+  g_main_context_invoke (self->context, server_job_done, job);
+}
+
+static gboolean
+server_job_push (PathHandler *handler, SoupServerMessage *msg,
+                 const char *method, const char *path)
+{
+  PhodavServer *self = handler->self;
+  ServerJob *job;
+  GError *err = NULL;
+
+  job = g_slice_new0 (ServerJob);
+  job->handler = handler;
+  job->self = g_object_ref (self);
+  job->msg = g_object_ref (msg);
+  job->method = method;
+  job->path = g_strdup (path);
+  job->headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  g_mutex_init (&job->mutex);
+  g_cond_init (&job->cond);
+
+  g_object_set_qdata (G_OBJECT (msg), server_job_quark (), job);
+  g_signal_connect (msg, "finished", G_CALLBACK (server_job_finished), job);
+  g_signal_connect (msg, "wrote-chunk", G_CALLBACK (server_job_wrote_chunk), job);
+  soup_server_message_pause (msg);
+
+  if (!g_thread_pool_push (self->pool, job, &err))
+    {
+      g_warning ("failed to queue %s %s: %s", method, path, err->message);
+      g_clear_error (&err);
+      soup_server_message_unpause (msg);
+      server_job_free (job);
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 static void
@@ -527,39 +1915,45 @@ server_callback (SoupServer *server, SoupServerMessage *msg,
       /* according to http://code.google.com/p/sabredav/wiki/Windows */
       soup_message_headers_append (response_headers, "MS-Author-Via", "DAV");
 
+      soup_message_headers_append (response_headers, "DASL", "<DAV:basicsearch>");
+
       soup_message_headers_append (response_headers, "Allow",
-                                   "GET, HEAD, PUT, PROPFIND, PROPPATCH, MKCOL, DELETE, MOVE, COPY, LOCK, UNLOCK");
+                                   "GET, HEAD, PUT, PROPFIND, PROPPATCH, MKCOL, DELETE, MOVE, COPY, LOCK, UNLOCK, SEARCH, REPORT");
       status = SOUP_STATUS_OK;
     }
   else if (method == SOUP_METHOD_GET ||
            method == SOUP_METHOD_HEAD)
     status = phodav_method_get (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_PROPFIND)
-    status = phodav_method_propfind (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_PROPPATCH)
-    status = phodav_method_proppatch (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_MKCOL)
-    status = phodav_method_mkcol (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_DELETE)
-    status = phodav_method_delete (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_MOVE ||
-           method == SOUP_METHOD_COPY)
-    status = phodav_method_movecopy (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_LOCK)
-    status = phodav_method_lock (handler, msg, path, &err);
-  else if (method == SOUP_METHOD_UNLOCK)
-    status = phodav_method_unlock (handler, msg, path, &err);
-  else
-    g_warn_if_reached ();
-
-  soup_server_message_set_status (msg, status, NULL);
+  else if (method == SOUP_METHOD_PROPFIND ||
+           method == SOUP_METHOD_PROPPATCH ||
+           method == SOUP_METHOD_MKCOL ||
+           method == SOUP_METHOD_DELETE ||
+           method == SOUP_METHOD_MOVE ||
+           method == SOUP_METHOD_COPY ||
+           method == PHODAV_METHOD_SEARCH ||
+           method == PHODAV_METHOD_REPORT)
+    {
+      if (handler->self->worker_threads &&
+          server_job_push (handler, msg, method, path))
+        return;
 
-  g_debug ("  -> %d %s\n", soup_server_message_get_status (msg), soup_server_message_get_reason_phrase (msg));
-  if (err)
+      status = server_dispatch (handler, msg, method, path, &err);
+    }
+  else if (method == SOUP_METHOD_LOCK ||
+           method == SOUP_METHOD_UNLOCK)
     {
-      g_warning ("error: %s", err->message);
-      g_clear_error (&err);
+      server_lock_paths (handler->self);
+      if (method == SOUP_METHOD_LOCK)
+        status = phodav_method_lock (handler, msg, path, &err);
+      else
+        status = phodav_method_unlock (handler, msg, path, &err);
+      server_unlock_paths (handler->self);
     }
+  else
+    g_warn_if_reached ();
+
+  server_message_done (msg, status, err);
+  g_clear_error (&err);
 }
 
 /**
@@ -578,6 +1972,57 @@ phodav_server_get_soup_server (PhodavServer *self)
   return self->server;
 }
 
+/**
+ * phodav_server_get_metrics:
+ * @server: a %PhodavServer
+ *
+ * Returns a snapshot of the counters kept by @server, and the servers
+ * sharing its #PhodavServer:peer, as a dictionary of type a{sv} with
+ * the following entries:
+ *
+ * - "methods" (a{sa{sv}}): for each request method, "bytes-in" (t)
+ *   and "bytes-out" (t), the "statuses" (a{ut}) counting the
+ *   responses by status code, and the "latency" histogram in
+ *   microseconds. The methods unknown to HTTP and WebDAV are counted
+ *   together as "other".
+ * - "enumerations": the histogram of the number of entries listed
+ *   per collection.
+ * - "locks" (u): the number of active locks.
+ * - "info-cache-hits" (t) and "info-cache-misses" (t).
+ *
+ * Histograms have the type (ttat): the count, the sum, and 33
+ * buckets, where bucket i < 32 counts the values that need i bits,
+ * that is the values below 2^i, and the last one the values of 2^31
+ * and above.
+ *
+ * Returns: (transfer full): a new #GVariant
+ *
+ * Since: 3.1
+ **/
+GVariant *
+phodav_server_get_metrics (PhodavServer *self)
+{
+  GVariantBuilder builder;
+  guint64 hits, misses;
+  guint locks;
+
+  g_return_val_if_fail (PHODAV_IS_SERVER (self), NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  metrics_build (self->shared->metrics, &builder);
+
+  server_lock_paths (self);
+  locks = lock_manager_get_size (self->shared->locks);
+  server_unlock_paths (self);
+  g_variant_builder_add (&builder, "{sv}", "locks", g_variant_new_uint32 (locks));
+
+  info_cache_get_stats (self->cache, &hits, &misses);
+  g_variant_builder_add (&builder, "{sv}", "info-cache-hits", g_variant_new_uint64 (hits));
+  g_variant_builder_add (&builder, "{sv}", "info-cache-misses", g_variant_new_uint64 (misses));
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 /**
  * phodav_server_new:
  * @root: (allow-none): Root path.
@@ -32,11 +32,41 @@ G_BEGIN_DECLS
 typedef struct _PhodavServer PhodavServer;
 typedef struct _PhodavServerClass PhodavServerClass;
 
+/**
+ * PhodavPutDurability:
+ * @PHODAV_PUT_DURABILITY_DIRECT: the file is truncated and written in
+ *   place. Readers may see a partial file, and a failed upload leaves
+ *   one behind.
+ * @PHODAV_PUT_DURABILITY_ATOMIC: the file is written aside and renamed
+ *   over the existing one when complete, without waiting for the data
+ *   to reach the disk. The new file keeps the mode, owner when
+ *   possible, and extended attributes of the old one, and a symbolic
+ *   link is kept, the file it leads to being replaced.
+ * @PHODAV_PUT_DURABILITY_SYNC: like @PHODAV_PUT_DURABILITY_ATOMIC, and
+ *   the data is synced to the disk before the rename, the directory
+ *   after.
+ *
+ * How a PUT request commits the new content of a file. A file with
+ * several hard links is always written in place, as a rename would
+ * only replace one of them.
+ *
+ * Since: 3.1
+ */
+typedef enum {
+  PHODAV_PUT_DURABILITY_DIRECT,
+  PHODAV_PUT_DURABILITY_ATOMIC,
+  PHODAV_PUT_DURABILITY_SYNC,
+} PhodavPutDurability;
+
+#define PHODAV_TYPE_PUT_DURABILITY (phodav_put_durability_get_type ())
+
+GType           phodav_put_durability_get_type  (void);
 GType           phodav_server_get_type          (void);
 
 PhodavServer *  phodav_server_new               (const gchar *root);
 PhodavServer *  phodav_server_new_for_root_file (GFile *root);
 SoupServer *    phodav_server_get_soup_server   (PhodavServer *server);
+GVariant *      phodav_server_get_metrics       (PhodavServer *server);
 
 G_END_DECLS
 
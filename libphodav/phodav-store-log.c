@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "phodav-store.h"
+#include "phodav-path.h"
+
+/* An append-only log of changes, replayed in memory when opened. Each
+ * record is a little-endian 32-bit size followed by a serialized
+ * (ysv) GVariant: the operation, a path and its arguments. A torn
+ * record at the end is ignored. The log is rewritten with the live
+ * entries only, when opened and when most of it is garbage. */
+
+#define RECORD_TYPE "(ysv)"
+#define COMPACT_INTERVAL 1024
+
+enum {
+  LOG_SET_PROP = 'p',    /* (sms) name, value or nothing to remove */
+  LOG_REMOVE = 'r',      /* b, unused */
+  LOG_MOVE = 'm',        /* (sb) destination, copy */
+  LOG_LOCK = 'l',        /* (syyymsx) token, scope, type, depth, owner, expires */
+  LOG_UNLOCK = 'u',      /* s token, without path */
+};
+
+typedef struct _LogStore
+{
+  PropStore      parent;
+  GMutex         mutex;
+  GFile         *file;
+  GOutputStream *out;
+  GHashTable    *props; /* path -> name -> value */
+  GHashTable    *locks; /* token -> StoredLock */
+  guint          records;
+  guint          appended;
+} LogStore;
+
+static void
+stored_lock_free (StoredLock *lock)
+{
+  g_free (lock->path);
+  g_free (lock->token);
+  g_free (lock->owner);
+  g_slice_free (StoredLock, lock);
+}
+
+static void
+log_set_prop (LogStore *log, const gchar *path,
+              const gchar *name, const gchar *value)
+{
+  GHashTable *props = g_hash_table_lookup (log->props, path);
+
+  if (value)
+    {
+      if (!props)
+        {
+          props = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+          g_hash_table_insert (log->props, g_strdup (path), props);
+        }
+      g_hash_table_insert (props, g_strdup (name), g_strdup (value));
+    }
+  else if (props)
+    {
+      g_hash_table_remove (props, name);
+      if (g_hash_table_size (props) == 0)
+        g_hash_table_remove (log->props, path);
+    }
+}
+
+static GList *
+log_get_paths_below (LogStore *log, const gchar *path)
+{
+  GHashTableIter iter;
+  const gchar *key;
+  GList *paths = NULL;
+
+  g_hash_table_iter_init (&iter, log->props);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+    if (path_is_below (key, path))
+      paths = g_list_prepend (paths, g_strdup (key));
+
+  return paths;
+}
+
+static void
+log_remove (LogStore *log, const gchar *path)
+{
+  GList *paths = log_get_paths_below (log, path);
+  GList *l;
+
+  for (l = paths; l; l = l->next)
+    g_hash_table_remove (log->props, l->data);
+
+  g_list_free_full (paths, g_free);
+}
+
+static GHashTable *
+props_copy (GHashTable *props)
+{
+  GHashTable *copy = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  GHashTableIter iter;
+  gpointer name, value;
+
+  g_hash_table_iter_init (&iter, props);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    g_hash_table_insert (copy, g_strdup (name), g_strdup (value));
+
+  return copy;
+}
+
+static void
+log_move (LogStore *log, const gchar *path, const gchar *dest, gboolean copy)
+{
+  gsize len = strlen (path);
+  GList *paths, *l;
+
+  log_remove (log, dest);
+  paths = log_get_paths_below (log, path);
+  for (l = paths; l; l = l->next)
+    {
+      const gchar *key = l->data;
+      GHashTable *props;
+
+      if (copy)
+        props = props_copy (g_hash_table_lookup (log->props, key));
+      else
+        g_hash_table_steal_extended (log->props, key, NULL, (gpointer *) &props);
+
+      g_hash_table_insert (log->props, g_strconcat (dest, key + len, NULL), props);
+    }
+
+  g_list_free_full (paths, g_free);
+}
+
+static void
+log_apply (LogStore *log, guchar op, const gchar *path, GVariant *args)
+{
+  switch (op)
+    {
+    case LOG_SET_PROP:
+      if (g_variant_is_of_type (args, G_VARIANT_TYPE ("(sms)")))
+        {
+          const gchar *name, *value;
+
+          g_variant_get (args, "(&sm&s)", &name, &value);
+          log_set_prop (log, path, name, value);
+        }
+      break;
+
+    case LOG_REMOVE:
+      log_remove (log, path);
+      break;
+
+    case LOG_MOVE:
+      if (g_variant_is_of_type (args, G_VARIANT_TYPE ("(sb)")))
+        {
+          const gchar *dest;
+          gboolean copy;
+
+          g_variant_get (args, "(&sb)", &dest, &copy);
+          log_move (log, path, dest, copy);
+        }
+      break;
+
+    case LOG_LOCK:
+      if (g_variant_is_of_type (args, G_VARIANT_TYPE ("(syyymsx)")))
+        {
+          StoredLock *lock = g_slice_new0 (StoredLock);
+          guchar scope, type, depth;
+
+          g_variant_get (args, "(syyymsx)", &lock->token, &scope, &type,
+                         &depth, &lock->owner, &lock->expires);
+          lock->path = g_strdup (path);
+          lock->scope = scope;
+          lock->type = type;
+          lock->depth = depth;
+          g_hash_table_replace (log->locks, lock->token, lock);
+        }
+      break;
+
+    case LOG_UNLOCK:
+      if (g_variant_is_of_type (args, G_VARIANT_TYPE_STRING))
+        g_hash_table_remove (log->locks, g_variant_get_string (args, NULL));
+      break;
+
+    default:
+      g_warning ("unknown store log record %c", op);
+    }
+}
+
+static void
+record_write (GByteArray *buf, GVariant *record)
+{
+  guint32 len;
+
+  g_variant_ref_sink (record);
+  len = GUINT32_TO_LE (g_variant_get_size (record));
+  g_byte_array_append (buf, (guint8 *) &len, sizeof (len));
+  g_byte_array_append (buf, g_variant_get_data (record), g_variant_get_size (record));
+  g_variant_unref (record);
+}
+
+static GVariant *
+lock_record_new (const StoredLock *lock)
+{
+  return g_variant_new ("(ysv)", LOG_LOCK, lock->path,
+                        g_variant_new ("(syyymsx)", lock->token,
+                                       (guchar) lock->scope, (guchar) lock->type,
+                                       (guchar) lock->depth, lock->owner,
+                                       lock->expires));
+}
+
+static guint
+log_get_live (LogStore *log)
+{
+  GHashTableIter iter;
+  GHashTable *props;
+  guint live = g_hash_table_size (log->locks);
+
+  g_hash_table_iter_init (&iter, log->props);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &props))
+    live += g_hash_table_size (props);
+
+  return live;
+}
+
+static gboolean
+log_compact (LogStore *log, GError **err)
+{
+  GByteArray *buf = g_byte_array_new ();
+  GHashTableIter iter, piter;
+  const gchar *path;
+  GHashTable *props;
+  StoredLock *lock;
+  gpointer name, value;
+  gboolean success = FALSE;
+
+  log->records = 0;
+  g_hash_table_iter_init (&iter, log->props);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &path, (gpointer *) &props))
+    {
+      g_hash_table_iter_init (&piter, props);
+      while (g_hash_table_iter_next (&piter, &name, &value))
+        {
+          record_write (buf, g_variant_new ("(ysv)", LOG_SET_PROP, path,
+                                            g_variant_new ("(sms)", name, value)));
+          log->records++;
+        }
+    }
+
+  g_hash_table_iter_init (&iter, log->locks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lock))
+    {
+      record_write (buf, lock_record_new (lock));
+      log->records++;
+    }
+
+  if (log->out)
+    g_output_stream_close (log->out, NULL, NULL);
+  g_clear_object (&log->out);
+
+  if (!g_file_replace_contents (log->file, (gchar *) buf->data, buf->len,
+                                NULL, FALSE, G_FILE_CREATE_PRIVATE,
+                                NULL, NULL, err))
+    goto end;
+
+  log->out = G_OUTPUT_STREAM (g_file_append_to (log->file, G_FILE_CREATE_PRIVATE,
+                                                NULL, err));
+  success = log->out != NULL;
+
+end:
+  log->appended = 0;
+  g_byte_array_unref (buf);
+  return success;
+}
+
+static void
+log_append (LogStore *log, GVariant *record)
+{
+  GByteArray *buf = g_byte_array_new ();
+  GError *err = NULL;
+
+  record_write (buf, record);
+  if (!log->out ||
+      !g_output_stream_write_all (log->out, buf->data, buf->len, NULL, NULL, &err) ||
+      !g_output_stream_flush (log->out, NULL, &err))
+    {
+      g_warning ("failed to write the store log: %s",
+                 err ? err->message : "not open");
+      g_clear_error (&err);
+    }
+  g_byte_array_unref (buf);
+
+  log->records++;
+  if (++log->appended >= COMPACT_INTERVAL &&
+      log->records > 2 * log_get_live (log))
+    {
+      if (!log_compact (log, &err))
+        {
+          g_warning ("failed to compact the store log: %s", err->message);
+          g_clear_error (&err);
+        }
+    }
+  else if (log->appended >= COMPACT_INTERVAL)
+    log->appended = 0;
+}
+
+static gboolean
+log_replay (LogStore *log, GError **err)
+{
+  gchar *path = g_file_get_path (log->file);
+  GError *error = NULL;
+  GMappedFile *map;
+  const gchar *data;
+  gsize size, offset = 0;
+
+  if (!path)
+    {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "the store must be a local file");
+      return FALSE;
+    }
+
+  map = g_mapped_file_new (path, FALSE, &error);
+  g_free (path);
+  if (!map)
+    {
+      if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_clear_error (&error);
+          return TRUE;
+        }
+
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  data = g_mapped_file_get_contents (map);
+  size = g_mapped_file_get_length (map);
+  while (size - offset >= sizeof (guint32))
+    {
+      GVariant *record, *args;
+      const gchar *rpath;
+      guint32 len;
+      guchar op;
+
+      memcpy (&len, data + offset, sizeof (len));
+      len = GUINT32_FROM_LE (len);
+      offset += sizeof (len);
+      if (len > size - offset)
+        break;
+
+      record = g_variant_new_from_data (G_VARIANT_TYPE (RECORD_TYPE),
+                                        data + offset, len, FALSE, NULL, NULL);
+      g_variant_ref_sink (record);
+      g_variant_get (record, "(y&sv)", &op, &rpath, &args);
+      log_apply (log, op, rpath, args);
+      g_variant_unref (args);
+      g_variant_unref (record);
+
+      offset += len;
+      log->records++;
+    }
+
+  g_mapped_file_unref (map);
+  return TRUE;
+}
+
+static gboolean
+log_store_set_prop (PropStore *store, const gchar *path,
+                    const gchar *name, const gchar *value, GError **err)
+{
+  LogStore *log = (LogStore *) store;
+
+  g_mutex_lock (&log->mutex);
+  log_set_prop (log, path, name, value);
+  log_append (log, g_variant_new ("(ysv)", LOG_SET_PROP, path,
+                                  g_variant_new ("(sms)", name, value)));
+  g_mutex_unlock (&log->mutex);
+
+  return TRUE;
+}
+
+static gchar *
+log_store_get_prop (PropStore *store, const gchar *path, const gchar *name)
+{
+  LogStore *log = (LogStore *) store;
+  GHashTable *props;
+  gchar *value = NULL;
+
+  g_mutex_lock (&log->mutex);
+  props = g_hash_table_lookup (log->props, path);
+  if (props)
+    value = g_strdup (g_hash_table_lookup (props, name));
+  g_mutex_unlock (&log->mutex);
+
+  return value;
+}
+
+static void
+log_store_foreach_prop (PropStore *store, const gchar *path,
+                        PropStoreFunc func, gpointer data)
+{
+  LogStore *log = (LogStore *) store;
+  GHashTable *props;
+  GHashTableIter iter;
+  gpointer name, value;
+
+  g_mutex_lock (&log->mutex);
+  props = g_hash_table_lookup (log->props, path);
+  if (props)
+    {
+      g_hash_table_iter_init (&iter, props);
+      while (g_hash_table_iter_next (&iter, &name, &value))
+        func (name, value, data);
+    }
+  g_mutex_unlock (&log->mutex);
+}
+
+static void
+log_store_remove (PropStore *store, const gchar *path)
+{
+  LogStore *log = (LogStore *) store;
+
+  g_mutex_lock (&log->mutex);
+  log_remove (log, path);
+  log_append (log, g_variant_new ("(ysv)", LOG_REMOVE, path,
+                                  g_variant_new_boolean (FALSE)));
+  g_mutex_unlock (&log->mutex);
+}
+
+static void
+log_store_move (PropStore *store, const gchar *path,
+                const gchar *dest, gboolean copy)
+{
+  LogStore *log = (LogStore *) store;
+
+  g_mutex_lock (&log->mutex);
+  log_move (log, path, dest, copy);
+  log_append (log, g_variant_new ("(ysv)", LOG_MOVE, path,
+                                  g_variant_new ("(sb)", dest, copy)));
+  g_mutex_unlock (&log->mutex);
+}
+
+static GList *
+log_store_get_paths (PropStore *store, const gchar *path)
+{
+  LogStore *log = (LogStore *) store;
+  GHashTable *set = g_hash_table_new (g_str_hash, g_str_equal);
+  GHashTableIter iter;
+  StoredLock *lock;
+  GList *paths, *l;
+
+  g_mutex_lock (&log->mutex);
+  paths = log_get_paths_below (log, path);
+  for (l = paths; l; l = l->next)
+    g_hash_table_add (set, l->data);
+
+  g_hash_table_iter_init (&iter, log->locks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lock))
+    if (path_is_below (lock->path, path) && !g_hash_table_contains (set, lock->path))
+      {
+        paths = g_list_prepend (paths, g_strdup (lock->path));
+        g_hash_table_add (set, paths->data);
+      }
+  g_mutex_unlock (&log->mutex);
+
+  g_hash_table_unref (set);
+  return paths;
+}
+
+static void
+log_store_save_lock (PropStore *store, const StoredLock *lock)
+{
+  LogStore *log = (LogStore *) store;
+  StoredLock *copy = g_slice_new (StoredLock);
+
+  *copy = *lock;
+  copy->path = g_strdup (lock->path);
+  copy->token = g_strdup (lock->token);
+  copy->owner = g_strdup (lock->owner);
+
+  g_mutex_lock (&log->mutex);
+  g_hash_table_replace (log->locks, copy->token, copy);
+  log_append (log, lock_record_new (copy));
+  g_mutex_unlock (&log->mutex);
+}
+
+static void
+log_store_remove_lock (PropStore *store, const gchar *token)
+{
+  LogStore *log = (LogStore *) store;
+
+  g_mutex_lock (&log->mutex);
+  if (g_hash_table_remove (log->locks, token))
+    log_append (log, g_variant_new ("(ysv)", LOG_UNLOCK, "",
+                                    g_variant_new_string (token)));
+  g_mutex_unlock (&log->mutex);
+}
+
+static void
+log_store_foreach_lock (PropStore *store, LockStoreFunc func, gpointer data)
+{
+  LogStore *log = (LogStore *) store;
+  GHashTableIter iter;
+  StoredLock *lock;
+
+  g_mutex_lock (&log->mutex);
+  g_hash_table_iter_init (&iter, log->locks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lock))
+    func (lock, data);
+  g_mutex_unlock (&log->mutex);
+}
+
+static void
+log_store_free (PropStore *store)
+{
+  LogStore *log = (LogStore *) store;
+
+  if (log->out)
+    g_output_stream_close (log->out, NULL, NULL);
+  g_clear_object (&log->out);
+  g_clear_object (&log->file);
+  g_hash_table_unref (log->props);
+  g_hash_table_unref (log->locks);
+  g_mutex_clear (&log->mutex);
+  g_slice_free (LogStore, log);
+}
+
+static const PropStoreFuncs log_store_funcs = {
+  .set_prop = log_store_set_prop,
+  .get_prop = log_store_get_prop,
+  .foreach_prop = log_store_foreach_prop,
+  .remove = log_store_remove,
+  .move = log_store_move,
+  .get_paths = log_store_get_paths,
+  .save_lock = log_store_save_lock,
+  .remove_lock = log_store_remove_lock,
+  .foreach_lock = log_store_foreach_lock,
+  .free = log_store_free,
+};
+
+PropStore *
+prop_store_log_new (GFile *file, GError **err)
+{
+  LogStore *log = g_slice_new0 (LogStore);
+
+  log->parent.funcs = &log_store_funcs;
+  g_mutex_init (&log->mutex);
+  log->file = g_object_ref (file);
+  log->props = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify) g_hash_table_unref);
+  log->locks = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                      (GDestroyNotify) stored_lock_free);
+
+  if (!log_replay (log, err) || !log_compact (log, err))
+    {
+      log_store_free (&log->parent);
+      return NULL;
+    }
+
+  return &log->parent;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phodav-store.h"
+#include "phodav-utils.h"
+#include "phodav-path.h"
+
+/* the store keys, without trailing slash */
+static gchar *
+store_path (const gchar *path)
+{
+  gchar *p = g_strdup (path);
+
+  remove_trailing (p, '/');
+  return p;
+}
+
+void
+prop_store_free (PropStore *store)
+{
+  store->funcs->free (store);
+}
+
+gboolean
+prop_store_set_prop (PropStore *store, const gchar *path,
+                     const gchar *name, const gchar *value,
+                     GError **err)
+{
+  gchar *p = store_path (path);
+  gboolean success = store->funcs->set_prop (store, p, name, value, err);
+
+  g_free (p);
+  return success;
+}
+
+gchar *
+prop_store_get_prop (PropStore *store, const gchar *path, const gchar *name)
+{
+  gchar *p = store_path (path);
+  gchar *value = store->funcs->get_prop (store, p, name);
+
+  g_free (p);
+  return value;
+}
+
+void
+prop_store_foreach_prop (PropStore *store, const gchar *path,
+                         PropStoreFunc func, gpointer data)
+{
+  gchar *p = store_path (path);
+
+  store->funcs->foreach_prop (store, p, func, data);
+  g_free (p);
+}
+
+void
+prop_store_remove (PropStore *store, const gchar *path)
+{
+  gchar *p = store_path (path);
+
+  store->funcs->remove (store, p);
+  g_free (p);
+}
+
+void
+prop_store_move (PropStore *store, const gchar *path,
+                 const gchar *dest, gboolean copy)
+{
+  gchar *p = store_path (path);
+  gchar *d = store_path (dest);
+
+  store->funcs->move (store, p, d, copy);
+  g_free (p);
+  g_free (d);
+}
+
+/* the paths at or below @path with properties or locks, parents
+ * first */
+GList *
+prop_store_get_paths (PropStore *store, const gchar *path)
+{
+  gchar *p = store_path (path);
+  GList *paths = store->funcs->get_paths (store, p);
+
+  g_free (p);
+  return g_list_sort (paths, (GCompareFunc) g_strcmp0);
+}
+
+static gchar *
+owner_to_string (xmlNodePtr owner)
+{
+  xmlDocPtr doc;
+  xmlChar *mem = NULL;
+  int size;
+
+  if (!owner)
+    return NULL;
+
+  doc = xmlNewDoc (BAD_CAST "1.0");
+  xmlDocSetRootElement (doc, xmlCopyNode (owner, 1));
+  xmlReconciliateNs (doc, xmlDocGetRootElement (doc));
+  xmlDocDumpMemoryEnc (doc, &mem, &size, "utf-8");
+  xmlFreeDoc (doc);
+
+  return (gchar *) mem;
+}
+
+void
+prop_store_save_lock (PropStore *store, DAVLock *lock)
+{
+  StoredLock s = {
+    .path = lock->path->path,
+    .token = g_strndup (lock->token, sizeof (lock->token)),
+    .scope = lock->scope,
+    .type = lock->type,
+    .depth = lock->depth,
+    .owner = owner_to_string (lock->owner),
+  };
+
+  /* the lock timeout is monotonic time */
+  if (lock->timeout)
+    s.expires = g_get_real_time () / G_USEC_PER_SEC +
+      lock->timeout - g_get_monotonic_time () / G_USEC_PER_SEC;
+
+  store->funcs->save_lock (store, &s);
+
+  g_free (s.token);
+  xmlFree (s.owner);
+}
+
+void
+prop_store_remove_lock (PropStore *store, DAVLock *lock)
+{
+  gchar *token = g_strndup (lock->token, sizeof (lock->token));
+
+  store->funcs->remove_lock (store, token);
+  g_free (token);
+}
+
+void
+prop_store_foreach_lock (PropStore *store, LockStoreFunc func, gpointer data)
+{
+  store->funcs->foreach_lock (store, func, data);
+}
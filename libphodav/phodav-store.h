@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_STORE_H__
+#define __PHODAV_STORE_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+/* A store keeps the dead properties and the locks of resources by
+ * path, instead of the file system extended attributes. Paths are
+ * the unescaped request paths. Property names are the xattr names
+ * used otherwise, "xattr::ns#name". */
+
+typedef void (* PropStoreFunc) (const gchar *name, const gchar *value,
+                                gpointer data);
+
+typedef struct _StoredLock
+{
+  gchar            *path;
+  gchar            *token;
+  DAVLockScopeType  scope;
+  DAVLockType       type;
+  DepthType         depth;
+  gchar            *owner;   /* serialized owner element, or NULL */
+  gint64            expires; /* real time in seconds, or 0 */
+} StoredLock;
+
+typedef void (* LockStoreFunc) (const StoredLock *lock, gpointer data);
+
+typedef struct _PropStoreFuncs
+{
+  gboolean (* set_prop)     (PropStore *store, const gchar *path,
+                             const gchar *name, const gchar *value,
+                             GError **err);
+  gchar *  (* get_prop)     (PropStore *store, const gchar *path,
+                             const gchar *name);
+  void     (* foreach_prop) (PropStore *store, const gchar *path,
+                             PropStoreFunc func, gpointer data);
+  void     (* remove)       (PropStore *store, const gchar *path);
+  void     (* move)         (PropStore *store, const gchar *path,
+                             const gchar *dest, gboolean copy);
+  GList *  (* get_paths)    (PropStore *store, const gchar *path);
+
+  void     (* save_lock)    (PropStore *store, const StoredLock *lock);
+  void     (* remove_lock)  (PropStore *store, const gchar *token);
+  void     (* foreach_lock) (PropStore *store, LockStoreFunc func,
+                             gpointer data);
+
+  void     (* free)         (PropStore *store);
+} PropStoreFuncs;
+
+struct _PropStore
+{
+  const PropStoreFuncs *funcs;
+};
+
+PropStore *      prop_store_log_new              (GFile *file, GError **err);
+void             prop_store_free                 (PropStore *store);
+
+gboolean         prop_store_set_prop             (PropStore *store, const gchar *path,
+                                                  const gchar *name, const gchar *value,
+                                                  GError **err);
+gchar *          prop_store_get_prop             (PropStore *store, const gchar *path,
+                                                  const gchar *name);
+void             prop_store_foreach_prop         (PropStore *store, const gchar *path,
+                                                  PropStoreFunc func, gpointer data);
+void             prop_store_remove               (PropStore *store, const gchar *path);
+void             prop_store_move                 (PropStore *store, const gchar *path,
+                                                  const gchar *dest, gboolean copy);
+GList *          prop_store_get_paths            (PropStore *store, const gchar *path);
+
+void             prop_store_save_lock            (PropStore *store, DAVLock *lock);
+void             prop_store_remove_lock          (PropStore *store, DAVLock *lock);
+void             prop_store_foreach_lock         (PropStore *store, LockStoreFunc func,
+                                                  gpointer data);
+
+G_END_DECLS
+
+#endif /* __PHODAV_STORE_H__ */
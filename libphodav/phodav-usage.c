@@ -0,0 +1,643 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phodav-usage.h"
+
+/* The disk usage of every directory of the tree, so that the
+ * quota-used-bytes of a collection is answered without a walk.
+ *
+ * The tree is measured once by a worker, and then the parent of every
+ * file that phodav or a monitor reports as changed is measured again:
+ * only its direct children are listed, the new subdirectories are
+ * walked, and the difference is added to the ancestors. Only the
+ * worker changes the tree, the lookups take the mutex. Monitors are
+ * kept on the USAGE_MAX_MONITORS shallowest directories, and the whole
+ * tree is measured again when it is older than USAGE_REBUILD_INTERVAL
+ * at lookup, to catch the changes deeper than that.
+ *
+ * When asked to, the index also keeps a node for every file, with its
+ * size, modification time and name, so that searches can be answered
+ * from memory. */
+
+#define USAGE_ATTRIBUTES                        \
+  G_FILE_ATTRIBUTE_STANDARD_NAME ","            \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE ","            \
+  G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE ","   \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE ","            \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+#define USAGE_REBUILD_INTERVAL (10 * 60 * G_USEC_PER_SEC)
+#define USAGE_MAX_MONITORS 256
+
+typedef struct _UsageNode UsageNode;
+
+struct _UsageNode
+{
+  gchar      *name;
+  UsageNode  *parent;
+  GHashTable *children; /* name -> UsageNode, NULL for a file */
+  guint64     own;      /* the directory and its files without a node */
+  guint64     total;
+  guint64     size;
+  gint64      mtime;
+};
+
+struct _UsageIndex
+{
+  GFile        *root;
+  GMainContext *context;
+  GThreadPool  *pool;
+  GMutex        mutex;
+  UsageNode    *tree;
+  gboolean      files;      /* requested, for the next build */
+  gboolean      tree_files; /* the tree has the files */
+  gint64        built_at;
+  gboolean      building;
+  GHashTable   *pending;
+  GSource      *monitor_source;
+  GPtrArray    *monitors;
+};
+
+/* the job of a full measure, the others are relative paths to rescan */
+static gchar build_job[] = "build";
+
+static void
+usage_node_free (UsageNode *node)
+{
+  g_clear_pointer (&node->children, g_hash_table_unref);
+  g_free (node->name);
+  g_slice_free (UsageNode, node);
+}
+
+static UsageNode *
+usage_node_new (const gchar *name, gboolean dir)
+{
+  UsageNode *node = g_slice_new0 (UsageNode);
+
+  node->name = g_strdup (name);
+  if (dir)
+    node->children = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify) usage_node_free);
+
+  return node;
+}
+
+static void
+usage_node_set_info (UsageNode *node, GFileInfo *info)
+{
+  node->own = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+  node->total = node->own;
+  node->size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+  node->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+}
+
+static UsageNode *
+usage_node_new_for_info (GFileInfo *info)
+{
+  UsageNode *node = usage_node_new (g_file_info_get_name (info), FALSE);
+
+  usage_node_set_info (node, info);
+
+  return node;
+}
+
+/* replaces a child of the same name */
+static void
+usage_node_add (UsageNode *node, UsageNode *child)
+{
+  child->parent = node;
+  g_hash_table_replace (node->children, child->name, child);
+}
+
+static GFileInfo *
+usage_query (GFile *dir)
+{
+  return g_file_query_info (dir, USAGE_ATTRIBUTES,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+}
+
+/* measures @dir and everything below it */
+static UsageNode *
+usage_walk (GFile *dir, const gchar *name, gboolean files)
+{
+  UsageNode *node = usage_node_new (name, TRUE);
+  GFileEnumerator *e;
+  GFileInfo *info;
+
+  info = usage_query (dir);
+  if (info)
+    {
+      usage_node_set_info (node, info);
+      g_object_unref (info);
+    }
+
+  e = g_file_enumerate_children (dir, USAGE_ATTRIBUTES,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+  if (!e)
+    return node;
+
+  while ((info = g_file_enumerator_next_file (e, NULL, NULL)))
+    {
+      if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+        {
+          GFile *file = g_file_enumerator_get_child (e, info);
+          UsageNode *child = usage_walk (file, g_file_info_get_name (info), files);
+
+          usage_node_add (node, child);
+          node->total += child->total;
+          g_object_unref (file);
+        }
+      else if (files)
+        {
+          UsageNode *child = usage_node_new_for_info (info);
+
+          usage_node_add (node, child);
+          node->total += child->total;
+        }
+      else
+        {
+          guint64 size = g_file_info_get_attribute_uint64 (info,
+                                                           G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+
+          node->own += size;
+          node->total += size;
+        }
+      g_object_unref (info);
+    }
+
+  g_file_enumerator_close (e, NULL, NULL);
+  g_object_unref (e);
+
+  return node;
+}
+
+static UsageNode *
+usage_lookup (UsageIndex *index, const gchar *path)
+{
+  UsageNode *node = index->tree;
+  gchar **names = g_strsplit (path, "/", -1);
+  gint i;
+
+  for (i = 0; node && names[i]; i++)
+    if (*names[i])
+      node = node->children ? g_hash_table_lookup (node->children, names[i]) : NULL;
+
+  g_strfreev (names);
+  return node;
+}
+
+/* the path of @file relative to the root, "" for the root itself */
+static gchar *
+usage_relative_path (UsageIndex *index, GFile *file)
+{
+  if (g_file_equal (index->root, file))
+    return g_strdup ("");
+
+  return g_file_get_relative_path (index->root, file);
+}
+
+static GFile *
+usage_resolve (UsageIndex *index, const gchar *path)
+{
+  if (!*path)
+    return g_object_ref (index->root);
+
+  return g_file_resolve_relative_path (index->root, path);
+}
+
+static gchar *
+usage_node_path (UsageNode *node)
+{
+  GString *path = g_string_new (NULL);
+
+  for (; node->parent; node = node->parent)
+    {
+      g_string_prepend (path, node->name);
+      if (node->parent->parent)
+        g_string_prepend_c (path, '/');
+    }
+
+  return g_string_free (path, FALSE);
+}
+
+static void
+usage_rescan (UsageIndex *index, const gchar *path)
+{
+  GFile *dir = usage_resolve (index, path);
+  GHashTable *seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  GHashTable *added = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                             (GDestroyNotify) usage_node_free);
+  GFileEnumerator *e;
+  GFileInfo *info;
+  GHashTableIter iter;
+  UsageNode *node, *child;
+  guint64 own = 0, total, old;
+  gint64 mtime = 0;
+  gchar *name, *parent;
+
+  /* only this thread changes the tree, it is read without the lock */
+  node = usage_lookup (index, path);
+  if (!node || !node->children)
+    goto parent;
+
+  e = g_file_enumerate_children (dir, USAGE_ATTRIBUTES,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+  if (!e)
+    goto parent;
+
+  info = usage_query (dir);
+  if (info)
+    {
+      own = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+      mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      g_object_unref (info);
+    }
+
+  while ((info = g_file_enumerator_next_file (e, NULL, NULL)))
+    {
+      const gchar *n = g_file_info_get_name (info);
+
+      if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+        {
+          g_hash_table_add (seen, g_strdup (n));
+          child = g_hash_table_lookup (node->children, n);
+          if (!child || !child->children)
+            {
+              GFile *file = g_file_enumerator_get_child (e, info);
+
+              child = usage_walk (file, n, index->tree_files);
+              g_hash_table_insert (added, child->name, child);
+              g_object_unref (file);
+            }
+        }
+      else if (index->tree_files)
+        {
+          g_hash_table_add (seen, g_strdup (n));
+          child = usage_node_new_for_info (info);
+          g_hash_table_insert (added, child->name, child);
+        }
+      else
+        own += g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+      g_object_unref (info);
+    }
+  g_file_enumerator_close (e, NULL, NULL);
+  g_object_unref (e);
+
+  g_mutex_lock (&index->mutex);
+  g_hash_table_iter_init (&iter, node->children);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL))
+    if (!g_hash_table_contains (seen, name))
+      g_hash_table_iter_remove (&iter);
+
+  g_hash_table_iter_init (&iter, added);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+    {
+      g_hash_table_iter_steal (&iter);
+      usage_node_add (node, child);
+    }
+
+  total = own;
+  g_hash_table_iter_init (&iter, node->children);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+    total += child->total;
+
+  old = node->total;
+  node->own = own;
+  node->total = total;
+  node->mtime = mtime;
+  for (node = node->parent; node; node = node->parent)
+    node->total = node->total - old + total;
+  g_mutex_unlock (&index->mutex);
+  goto end;
+
+parent:
+  /* gone, or not known yet: the parent will tell */
+  if (*path)
+    {
+      parent = g_path_get_dirname (path);
+      usage_rescan (index, !g_strcmp0 (parent, ".") ? "" : parent);
+      g_free (parent);
+    }
+
+end:
+  g_hash_table_unref (added);
+  g_hash_table_unref (seen);
+  g_object_unref (dir);
+}
+
+static void
+usage_monitor_changed (GFileMonitor      *monitor,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event_type,
+                       gpointer           user_data)
+{
+  UsageIndex *index = user_data;
+
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_CREATED:
+      usage_index_changed (index, file);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* in the index context, where the monitors report */
+static gboolean
+usage_install_monitors (gpointer user_data)
+{
+  UsageIndex *index = user_data;
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+  GQueue queue = G_QUEUE_INIT;
+  GHashTableIter iter;
+  UsageNode *node, *child;
+  guint i;
+
+  g_mutex_lock (&index->mutex);
+  g_clear_pointer (&index->monitor_source, g_source_unref);
+  if (index->tree)
+    g_queue_push_tail (&queue, index->tree);
+
+  while (paths->len < USAGE_MAX_MONITORS && (node = g_queue_pop_head (&queue)))
+    {
+      g_ptr_array_add (paths, usage_node_path (node));
+      g_hash_table_iter_init (&iter, node->children);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+        if (child->children)
+          g_queue_push_tail (&queue, child);
+    }
+  g_queue_clear (&queue);
+  g_mutex_unlock (&index->mutex);
+
+  g_ptr_array_set_size (index->monitors, 0);
+  for (i = 0; i < paths->len; i++)
+    {
+      GFile *dir = usage_resolve (index, paths->pdata[i]);
+      GFileMonitor *monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+
+      if (monitor)
+        {
+          g_signal_connect (monitor, "changed", G_CALLBACK (usage_monitor_changed), index);
+          g_ptr_array_add (index->monitors, monitor);
+        }
+      g_object_unref (dir);
+    }
+
+  g_ptr_array_unref (paths);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+usage_build (UsageIndex *index)
+{
+  UsageNode *tree, *old;
+  gboolean files;
+
+  g_mutex_lock (&index->mutex);
+  files = index->files;
+  g_mutex_unlock (&index->mutex);
+
+  tree = usage_walk (index->root, "", files);
+
+  g_mutex_lock (&index->mutex);
+  old = index->tree;
+  index->tree = tree;
+  index->tree_files = files;
+  index->built_at = g_get_monotonic_time ();
+  index->building = FALSE;
+
+  if (!index->monitor_source)
+    {
+      index->monitor_source = g_idle_source_new ();
+      g_source_set_callback (index->monitor_source, usage_install_monitors, index, NULL);
+      g_source_attach (index->monitor_source, index->context);
+    }
+  g_mutex_unlock (&index->mutex);
+
+  g_clear_pointer (&old, usage_node_free);
+}
+
+static void
+usage_job (gpointer data, gpointer user_data)
+{
+  UsageIndex *index = user_data;
+
+  if (data == build_job)
+    {
+      usage_build (index);
+      return;
+    }
+
+  g_mutex_lock (&index->mutex);
+  g_hash_table_remove (index->pending, data);
+  g_mutex_unlock (&index->mutex);
+
+  usage_rescan (index, data);
+  g_free (data);
+}
+
+static void
+usage_job_free (gpointer data)
+{
+  if (data != build_job)
+    g_free (data);
+}
+
+UsageIndex *
+usage_index_new (GFile *root, GMainContext *context, gboolean files)
+{
+  UsageIndex *index = g_slice_new0 (UsageIndex);
+
+  index->root = g_object_ref (root);
+  index->files = files;
+  index->context = g_main_context_ref (context);
+  index->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  index->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  g_mutex_init (&index->mutex);
+
+  index->pool = g_thread_pool_new_full (usage_job, index, usage_job_free, 1, FALSE, NULL);
+  index->building = TRUE;
+  g_thread_pool_push (index->pool, build_job, NULL);
+
+  return index;
+}
+
+void
+usage_index_free (UsageIndex *index)
+{
+  g_thread_pool_free (index->pool, TRUE, TRUE);
+
+  if (index->monitor_source)
+    {
+      g_source_destroy (index->monitor_source);
+      g_source_unref (index->monitor_source);
+    }
+  g_ptr_array_unref (index->monitors);
+  g_clear_pointer (&index->tree, usage_node_free);
+  g_hash_table_unref (index->pending);
+  g_mutex_clear (&index->mutex);
+  g_main_context_unref (index->context);
+  g_object_unref (index->root);
+  g_slice_free (UsageIndex, index);
+}
+
+/* keep the files in the index too, from the next build on */
+void
+usage_index_set_files (UsageIndex *index, gboolean files)
+{
+  g_mutex_lock (&index->mutex);
+  if (index->files != files)
+    {
+      index->files = files;
+      if (!index->building)
+        {
+          index->building = TRUE;
+          g_thread_pool_push (index->pool, build_job, NULL);
+        }
+    }
+  g_mutex_unlock (&index->mutex);
+}
+
+/* with the mutex held */
+static void
+usage_check_age (UsageIndex *index)
+{
+  if (index->tree && !index->building &&
+      g_get_monotonic_time () - index->built_at > USAGE_REBUILD_INTERVAL)
+    {
+      index->building = TRUE;
+      g_thread_pool_push (index->pool, build_job, NULL);
+    }
+}
+
+/* FALSE when @dir is not a known directory, or not measured yet */
+gboolean
+usage_index_lookup (UsageIndex *index, GFile *dir, guint64 *usage)
+{
+  gchar *path = usage_relative_path (index, dir);
+  UsageNode *node = NULL;
+
+  if (!path)
+    return FALSE;
+
+  g_mutex_lock (&index->mutex);
+  usage_check_age (index);
+
+  node = index->tree ? usage_lookup (index, path) : NULL;
+  if (node && node->children)
+    *usage = node->total;
+  else
+    node = NULL;
+  g_mutex_unlock (&index->mutex);
+
+  g_free (path);
+  return node != NULL;
+}
+
+static gboolean
+usage_search_node (UsageNode *node, GString *path, gint depth,
+                   UsageSearchFunc func, gpointer data)
+{
+  UsageEntry entry = { path->str, node->name, node->children != NULL,
+                       node->size, node->mtime };
+  GHashTableIter iter;
+  UsageNode *child;
+  gsize len = path->len;
+
+  if (!func (&entry, data))
+    return FALSE;
+
+  if (!node->children || depth == 0)
+    return TRUE;
+
+  g_hash_table_iter_init (&iter, node->children);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &child))
+    {
+      if (len)
+        g_string_append_c (path, '/');
+      g_string_append (path, child->name);
+
+      if (!usage_search_node (child, path, depth > 0 ? depth - 1 : depth, func, data))
+        return FALSE;
+
+      g_string_truncate (path, len);
+    }
+
+  return TRUE;
+}
+
+/* Calls @func on @scope and its descendants up to @depth, -1 for all
+ * of them, with the mutex held, until it returns FALSE. The paths are
+ * relative to @scope. Returns FALSE when the files are not indexed,
+ * or @scope is unknown. */
+gboolean
+usage_index_search (UsageIndex *index, GFile *scope, gint depth,
+                    UsageSearchFunc func, gpointer data)
+{
+  gchar *path = usage_relative_path (index, scope);
+  UsageNode *node = NULL;
+  GString *s;
+
+  if (!path)
+    return FALSE;
+
+  g_mutex_lock (&index->mutex);
+  usage_check_age (index);
+
+  if (index->tree && index->tree_files)
+    node = usage_lookup (index, path);
+  if (node)
+    {
+      s = g_string_new (NULL);
+      usage_search_node (node, s, depth, func, data);
+      g_string_free (s, TRUE);
+    }
+  g_mutex_unlock (&index->mutex);
+
+  g_free (path);
+  return node != NULL;
+}
+
+/* @file was created, modified or removed */
+void
+usage_index_changed (UsageIndex *index, GFile *file)
+{
+  GFile *parent = g_file_get_parent (file);
+  gchar *path;
+
+  path = parent && !g_file_equal (index->root, file) ?
+    usage_relative_path (index, parent) : usage_relative_path (index, file);
+  g_clear_object (&parent);
+  if (!path)
+    return;
+
+  g_mutex_lock (&index->mutex);
+  if (!g_hash_table_contains (index->pending, path))
+    {
+      g_hash_table_add (index->pending, g_strdup (path));
+      g_thread_pool_push (index->pool, path, NULL);
+      path = NULL;
+    }
+  g_mutex_unlock (&index->mutex);
+
+  g_free (path);
+}
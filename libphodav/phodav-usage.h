@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PHODAV_USAGE_H__
+#define __PHODAV_USAGE_H__
+
+#include "phodav-priv.h"
+
+G_BEGIN_DECLS
+
+typedef struct _UsageEntry
+{
+  const gchar *path; /* relative to the search scope */
+  const gchar *name;
+  gboolean     dir;
+  guint64      size;
+  gint64       mtime;
+} UsageEntry;
+
+typedef gboolean (* UsageSearchFunc) (const UsageEntry *entry,
+                                      gpointer          data);
+
+UsageIndex *     usage_index_new                 (GFile *root, GMainContext *context,
+                                                  gboolean files);
+void             usage_index_free                (UsageIndex *index);
+void             usage_index_set_files           (UsageIndex *index, gboolean files);
+
+gboolean         usage_index_lookup              (UsageIndex *index, GFile *dir,
+                                                  guint64 *usage);
+void             usage_index_changed             (UsageIndex *index, GFile *file);
+gboolean         usage_index_search              (UsageIndex *index, GFile *scope,
+                                                  gint depth,
+                                                  UsageSearchFunc func,
+                                                  gpointer data);
+
+G_END_DECLS
+
+#endif /* __PHODAV_USAGE_H__ */
@@ -28,6 +28,82 @@ remove_trailing (gchar *str, gchar c)
   str[len] = '\0';
 }
 
+/* whether the unescaped @path has a . or .. segment, which would lead
+ * out of its parent once given to g_file_get_child() */
+gboolean
+path_has_dot_segment (const gchar *path)
+{
+  const gchar *seg = path;
+  gsize len;
+
+  while (*seg)
+    {
+      seg += strspn (seg, "/");
+      len = strcspn (seg, "/");
+      if ((len == 1 && seg[0] == '.') ||
+          (len == 2 && seg[0] == '.' && seg[1] == '.'))
+        return TRUE;
+      seg += len;
+    }
+
+  return FALSE;
+}
+
+#define PUT_TMP_RANDOM 8
+#define PUT_TMP_TAG 16
+
+static gchar *
+put_tmp_tag (const gchar *key, const gchar *name, gsize len, const gchar *random)
+{
+  GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, (const guchar *) key, strlen (key));
+  gchar *tag;
+
+  g_hmac_update (hmac, (const guchar *) name, len);
+  g_hmac_update (hmac, (const guchar *) random, PUT_TMP_RANDOM);
+  tag = g_strndup (g_hmac_get_string (hmac), PUT_TMP_TAG);
+  g_hmac_unref (hmac);
+
+  return tag;
+}
+
+gchar *
+put_tmp_name_new (const gchar *key, const gchar *name)
+{
+  gchar random[PUT_TMP_RANDOM + 1];
+  gchar *tag, *tmp;
+
+  g_snprintf (random, sizeof (random), "%08x", g_random_int ());
+  tag = put_tmp_tag (key, name, strlen (name), random);
+  tmp = g_strconcat (".", name, PUT_TMP_SUFFIX, random, tag, NULL);
+  g_free (tag);
+
+  return tmp;
+}
+
+/* whether @name is that of a put_tmp_name_new() file, made with @key */
+gboolean
+put_is_tmp_name (const gchar *key, const gchar *name)
+{
+  gsize len = strlen (name);
+  gsize suffix_len = strlen (PUT_TMP_SUFFIX);
+  const gchar *random;
+  gchar *tag;
+  gboolean tmp;
+
+  if (name[0] != '.' || len < 2 + suffix_len + PUT_TMP_RANDOM + PUT_TMP_TAG)
+    return FALSE;
+
+  random = name + len - PUT_TMP_RANDOM - PUT_TMP_TAG;
+  if (strncmp (random - suffix_len, PUT_TMP_SUFFIX, suffix_len))
+    return FALSE;
+
+  tag = put_tmp_tag (key, name + 1, random - suffix_len - (name + 1), random);
+  tmp = !strcmp (tag, random + PUT_TMP_RANDOM);
+  g_free (tag);
+
+  return tmp;
+}
+
 static xmlDocPtr
 parse_xml (const gchar  *data,
            const goffset len,
@@ -66,7 +142,7 @@ parse_xml (const gchar  *data,
       return NULL;
     }
 
-  if (g_strcmp0 ((char *) (*root)->name, name))
+  if (name && g_strcmp0 ((char *) (*root)->name, name))
     {
       g_debug ("Unexpected request");
       xmlFreeDoc (doc);
@@ -223,3 +299,280 @@ xml_node_get_xattr_name (xmlNodePtr node, const gchar *prefix)
   else
     return g_strdup_printf ("%s%s", prefix, name);
 }
+
+/* Calls @func for each child of @file until it returns FALSE. The
+ * children are read @batch_size at a time with the synchronous
+ * enumerator, in the calling thread, before being handed to @func:
+ * the directory is read back to back, and without a main loop. */
+gboolean
+phodav_enumerate_children (GFile *file, const gchar *attributes,
+                           GFileQueryInfoFlags flags, guint batch_size,
+                           EnumerateFunc func, gpointer data,
+                           GCancellable *cancellable, GError **err)
+{
+  GPtrArray *batch = g_ptr_array_new_with_free_func (g_object_unref);
+  GFileEnumerator *e;
+  GError *error = NULL;
+  gboolean more = TRUE, success = FALSE;
+  GFileInfo *info;
+  guint i;
+
+  e = g_file_enumerate_children (file, attributes, flags, cancellable, err);
+  if (!e)
+    goto end;
+
+  while (more && !error)
+    {
+      while (batch->len < MAX (batch_size, 1) &&
+             (info = g_file_enumerator_next_file (e, cancellable, &error)))
+        g_ptr_array_add (batch, info);
+
+      if (batch->len == 0)
+        break;
+
+      for (i = 0; i < batch->len && more; i++)
+        more = func (batch->pdata[i], data);
+
+      /* a batch not filled was the last */
+      more = more && batch->len == MAX (batch_size, 1);
+      g_ptr_array_set_size (batch, 0);
+    }
+
+  g_file_enumerator_close (e, cancellable, NULL);
+  g_object_unref (e);
+
+  success = !error;
+  if (error)
+    g_propagate_error (err, error);
+
+end:
+  g_ptr_array_unref (batch);
+  return success;
+}
+
+/* whether the entity-tag list @list contains the quoted @etag,
+ * ignoring the weak prefixes unless @strong */
+static gboolean
+etag_list_match (const gchar *list, const gchar *etag, gboolean strong)
+{
+  GSList *tags, *l;
+  gboolean match = FALSE;
+
+  tags = soup_header_parse_list (list);
+  for (l = tags; l != NULL && !match; l = l->next)
+    {
+      const gchar *tag = l->data;
+
+      if (g_str_has_prefix (tag, "W/"))
+        {
+          if (strong)
+            continue;
+          tag += 2;
+        }
+
+      match = !g_strcmp0 (tag, etag);
+    }
+
+  soup_header_free_list (tags);
+  return match;
+}
+
+/* compares the modification time in @info with the HTTP date @value:
+ * < 0 if older, 0 if the same second, > 0 if newer. Returns FALSE
+ * when either is missing or invalid, and the header is then ignored.
+ * With @past, a date later than now is invalid too (RFC 7232 3.3) */
+static gboolean
+compare_modified (GFileInfo *info, const gchar *value, gboolean past, gint *cmp)
+{
+  GDateTime *date, *mtime = NULL;
+  gboolean valid = FALSE;
+
+  date = soup_date_time_new_from_http_string (value);
+  if (!date)
+    goto end;
+
+  if (past && g_date_time_to_unix (date) > g_get_real_time () / G_USEC_PER_SEC)
+    goto end;
+
+  mtime = g_file_info_get_modification_date_time (info);
+  if (!mtime)
+    goto end;
+
+  *cmp = CLAMP (g_date_time_to_unix (mtime) - g_date_time_to_unix (date), -1, 1);
+  valid = TRUE;
+
+end:
+  g_clear_pointer (&date, g_date_time_unref);
+  g_clear_pointer (&mtime, g_date_time_unref);
+  return valid;
+}
+
+/* Evaluates the RFC 7232 preconditions of @msg against @info, the
+ * current state of the target, or NULL if it doesn't exist. It needs
+ * the etag::value and time::modified attributes. Returns
+ * SOUP_STATUS_OK if the method can go on, otherwise
+ * SOUP_STATUS_NOT_MODIFIED (GET/HEAD) or
+ * SOUP_STATUS_PRECONDITION_FAILED. If-Range is left to the method. */
+gint
+phodav_check_preconditions (SoupServerMessage *msg, GFileInfo *info)
+{
+  SoupMessageHeaders *headers = soup_server_message_get_request_headers (msg);
+  const gchar *method = soup_server_message_get_method (msg);
+  const gchar *if_match = soup_message_headers_get_list (headers, "If-Match");
+  const gchar *if_none_match = soup_message_headers_get_list (headers, "If-None-Match");
+  const gchar *value;
+  gboolean safe = method == SOUP_METHOD_GET || method == SOUP_METHOD_HEAD;
+  gchar *etag = NULL;
+  gint status = SOUP_STATUS_OK;
+  gint cmp;
+
+  if (info && g_file_info_get_etag (info))
+    etag = g_strdup_printf ("\"%s\"", g_file_info_get_etag (info));
+
+  /* 6.1-2: If-Match, or else If-Unmodified-Since */
+  if (if_match)
+    {
+      if (!info ||
+          (g_strcmp0 (if_match, "*") && (!etag || !etag_list_match (if_match, etag, TRUE))))
+        {
+          status = SOUP_STATUS_PRECONDITION_FAILED;
+          goto end;
+        }
+    }
+  else if (info &&
+           (value = soup_message_headers_get_one (headers, "If-Unmodified-Since")) &&
+           compare_modified (info, value, FALSE, &cmp) && cmp > 0)
+    {
+      status = SOUP_STATUS_PRECONDITION_FAILED;
+      goto end;
+    }
+
+  /* 6.3-4: If-None-Match, or else If-Modified-Since */
+  if (if_none_match)
+    {
+      if (info &&
+          (!g_strcmp0 (if_none_match, "*") || (etag && etag_list_match (if_none_match, etag, FALSE))))
+        status = safe ? SOUP_STATUS_NOT_MODIFIED : SOUP_STATUS_PRECONDITION_FAILED;
+    }
+  else if (safe && info &&
+           (value = soup_message_headers_get_one (headers, "If-Modified-Since")) &&
+           compare_modified (info, value, TRUE, &cmp) && cmp <= 0)
+    status = SOUP_STATUS_NOT_MODIFIED;
+
+end:
+  g_free (etag);
+  return status;
+}
+
+static gboolean
+encoding_in_list (GSList *list, const gchar *encoding)
+{
+  for (; list != NULL; list = list->next)
+    if (!g_ascii_strcasecmp (list->data, encoding) ||
+        (!g_strcmp0 (encoding, "gzip") && !g_ascii_strcasecmp (list->data, "x-gzip")))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* the preferred of the encodings we can produce that the client
+ * accepts, by q-value, or NULL. Those given a q-value of 0 are
+ * refused, even when * is accepted. */
+static const gchar *
+accepted_encoding (SoupServerMessage *msg)
+{
+  SoupMessageHeaders *headers = soup_server_message_get_request_headers (msg);
+  const gchar *header = soup_message_headers_get_list (headers, "Accept-Encoding");
+  const gchar *encoding = NULL;
+  GSList *list, *refused = NULL, *l;
+
+  if (!header)
+    return NULL;
+
+  /* sorted by q-value, without those of 0 */
+  list = soup_header_parse_quality_list (header, &refused);
+  for (l = list; l != NULL && !encoding; l = l->next)
+    {
+      if (!g_ascii_strcasecmp (l->data, "gzip") ||
+          !g_ascii_strcasecmp (l->data, "x-gzip"))
+        encoding = "gzip";
+      else if (!g_ascii_strcasecmp (l->data, "deflate"))
+        encoding = "deflate";
+      else if (!g_strcmp0 (l->data, "*"))
+        encoding = !encoding_in_list (refused, "gzip") ? "gzip" :
+          !encoding_in_list (refused, "deflate") ? "deflate" : NULL;
+    }
+  soup_header_free_list (list);
+  soup_header_free_list (refused);
+
+  return encoding;
+}
+
+/* to be set on every response that may be compressed, whether it is
+ * or not, so caches don't serve one encoding for the other */
+void
+response_add_vary (SoupServerMessage *msg)
+{
+  SoupMessageHeaders *headers = server_message_get_response_headers (msg);
+
+  soup_message_headers_append (headers, "Vary", "Accept-Encoding");
+}
+
+/* Returns a compressor for the response body of @msg if the client
+ * accepts one, and sets the Content-Encoding header accordingly. The
+ * caller sets Vary with response_add_vary(). */
+GConverter *
+response_compressor_new (SoupServerMessage *msg)
+{
+  SoupMessageHeaders *headers = server_message_get_response_headers (msg);
+  const gchar *encoding = accepted_encoding (msg);
+  GZlibCompressorFormat format;
+
+  if (!encoding)
+    return NULL;
+
+  format = !g_strcmp0 (encoding, "gzip") ?
+    G_ZLIB_COMPRESSOR_FORMAT_GZIP : G_ZLIB_COMPRESSOR_FORMAT_ZLIB;
+  soup_message_headers_replace (headers, "Content-Encoding", encoding);
+
+  return G_CONVERTER (g_zlib_compressor_new (format, COMPRESSOR_LEVEL));
+}
+
+/* compresses @len bytes of @data at the end of the response body of
+ * @msg, and the compressed stream is terminated when @last. On error,
+ * the headers are already sent: the connection is dropped, and FALSE
+ * is returned, so that nothing more is appended. */
+gboolean
+response_compressor_append (GConverter *compressor, SoupServerMessage *msg,
+                            const gchar *data, gsize len, gboolean last)
+{
+  GConverterFlags flags = last ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+  GConverterResult res;
+  GError *error = NULL;
+  gchar out[16 * 1024];
+  gsize read, written;
+
+  if (len == 0 && !last)
+    return TRUE;
+
+  do
+    {
+      res = g_converter_convert (compressor, data, len, out, sizeof (out),
+                                 flags, &read, &written, &error);
+      if (res == G_CONVERTER_ERROR)
+        {
+          g_warning ("compression failed: %s", error->message);
+          g_clear_error (&error);
+          server_message_abort (msg);
+          return FALSE;
+        }
+
+      if (written > 0)
+        server_message_append (msg, out, written);
+      data += read;
+      len -= read;
+    }
+  while (len > 0 || (last && res != G_CONVERTER_FINISHED));
+
+  return TRUE;
+}
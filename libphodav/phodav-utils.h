@@ -23,6 +23,14 @@
 G_BEGIN_DECLS
 
 void             remove_trailing                 (gchar *str, gchar c);
+gboolean         path_has_dot_segment            (const gchar *path);
+
+/* the name of the file a PUT is written to, before its rename: a
+ * random part, and a tag of it and @name keyed by the server, so that
+ * a user file can't take the look of one */
+#define PUT_TMP_SUFFIX ".phodav-"
+gchar *          put_tmp_name_new                (const gchar *key, const gchar *name);
+gboolean         put_is_tmp_name                 (const gchar *key, const gchar *name);
 
 DepthType        depth_from_string               (const gchar *depth);
 const gchar *    depth_to_string                 (DepthType depth);
@@ -44,6 +52,29 @@ gboolean         davdoc_parse                    (DavDoc *dd, SoupServerMessage
                                                   const gchar *name);
 void             davdoc_free                     (DavDoc *dd);
 
+#define ENUMERATE_BATCH_SIZE 64
+
+gboolean         phodav_enumerate_children       (GFile *file, const gchar *attributes,
+                                                  GFileQueryInfoFlags flags,
+                                                  guint batch_size,
+                                                  EnumerateFunc func, gpointer data,
+                                                  GCancellable *cancellable,
+                                                  GError **err);
+
+gint             phodav_check_preconditions      (SoupServerMessage *msg, GFileInfo *info);
+
+/* responses smaller than this are sent as they are */
+#define COMPRESSOR_MIN_SIZE (32 * 1024)
+/* the XML compresses well already at a low level, and faster */
+#define COMPRESSOR_LEVEL 3
+
+void             response_add_vary               (SoupServerMessage *msg);
+GConverter *     response_compressor_new         (SoupServerMessage *msg);
+gboolean         response_compressor_append      (GConverter *compressor,
+                                                  SoupServerMessage *msg,
+                                                  const gchar *data, gsize len,
+                                                  gboolean last);
+
 void             xml_node_to_string              (xmlNodePtr root, xmlChar **mem, int *size);
 gboolean         xml_node_is_element             (xmlNodePtr node);
 gboolean         xml_node_has_name               (xmlNodePtr node, const char *name);
@@ -67,7 +67,8 @@ struct _PhodavVirtualDir {
 
   gboolean          dummy;
   PhodavVirtualDir *parent;
-  GList            *children;
+  GHashTable       *children; /* basename -> GFile */
+  GPtrArray        *snapshot; /* the children, replaced on change */
   GFile            *real_root; /* only set for virtual root, otherwise NULL */
 
   /* TODO: we could store just the base name and build up the path when needed */
@@ -84,8 +85,8 @@ struct _PhodavVirtualDirEnumerator {
   GFileEnumerator      parent_instance;
   gchar               *attributes;
   GFileQueryInfoFlags  flags;
-  GList               *children;
-  GList               *current;
+  GPtrArray           *children;
+  guint                current;
   GFileEnumerator     *real_root_enumerator;
 };
 
@@ -99,15 +100,14 @@ phodav_virtual_dir_enumerator_next_file (GFileEnumerator *enumerator,
   PhodavVirtualDirEnumerator *self = PHODAV_VIRTUAL_DIR_ENUMERATOR (enumerator);
   GFile *file;
 
-  if (!self->current || !self->current->data)
+  if (!self->children || self->current >= self->children->len)
     {
       if (self->real_root_enumerator)
         return g_file_enumerator_next_file (self->real_root_enumerator, cancellable, error);
       return NULL;
     }
 
-  file = G_FILE (self->current->data);
-  self->current = self->current->next;
+  file = G_FILE (g_ptr_array_index (self->children, self->current++));
   return g_file_query_info (G_FILE (file), self->attributes, self->flags, cancellable, error);
 }
 
@@ -118,8 +118,7 @@ phodav_virtual_dir_enumerator_close (GFileEnumerator *enumerator,
 {
   PhodavVirtualDirEnumerator *self = PHODAV_VIRTUAL_DIR_ENUMERATOR (enumerator);
   g_clear_pointer (&self->attributes, g_free);
-  g_list_free_full (self->children, g_object_unref);
-  self->children = NULL;
+  g_clear_pointer (&self->children, g_ptr_array_unref);
   g_clear_object (&self->real_root_enumerator);
   return TRUE;
 }
@@ -273,8 +272,9 @@ phodav_virtual_dir_enumerate_children (GFile                *file,
   enumerator = g_object_new (PHODAV_TYPE_VIRTUAL_DIR_ENUMERATOR, "container", file, NULL);
   enumerator->attributes = g_strdup (attributes);
   enumerator->flags = flags;
-  enumerator->children = g_list_copy_deep (self->children, (GCopyFunc) g_object_ref, NULL);
-  enumerator->current = enumerator->children;
+  /* the snapshot is never modified, only replaced */
+  if (self->snapshot)
+    enumerator->children = g_ptr_array_ref (self->snapshot);
   if (self->real_root)
     {
       enumerator->real_root_enumerator =
@@ -293,24 +293,28 @@ static GFile *
 phodav_virtual_dir_find_direct_child (PhodavVirtualDir *parent,
                                       const gchar      *name)
 {
-  GFile *child;
-  GList *l;
-  gchar *base;
+  /* NULL once disposed */
+  if (!parent->children)
+    return NULL;
 
-  /* TODO: perhaps a hash table would be better? */
-  for (l = parent->children; l; l = l->next)
-    {
-      child = G_FILE (l->data);
-      base = g_file_get_basename (child);
-      if (!g_strcmp0 (name, base))
-        {
-          g_free (base);
-          return child;
-        }
-      g_free (base);
-    }
+  return g_hash_table_lookup (parent->children, name);
+}
 
-  return NULL;
+/* takes the @name, the enumerators keep the snapshot they started with */
+static void
+phodav_virtual_dir_add_child (PhodavVirtualDir *parent,
+                              gchar            *name,
+                              GFile            *child)
+{
+  GPtrArray *snapshot;
+
+  g_hash_table_insert (parent->children, name, g_object_ref (child));
+
+  snapshot = g_ptr_array_copy (parent->snapshot, (GCopyFunc) g_object_ref, NULL);
+  g_ptr_array_set_free_func (snapshot, g_object_unref);
+  g_ptr_array_add (snapshot, g_object_ref (child));
+  g_ptr_array_unref (parent->snapshot);
+  parent->snapshot = snapshot;
 }
 
 /* recursively searches for a child of @parent given the relative @path.
@@ -561,8 +565,8 @@ phodav_virtual_dir_dispose (GObject *object)
       self->parent = NULL;
     }
   self->dummy = TRUE;
-  g_list_free_full (self->children, g_object_unref);
-  self->children = NULL;
+  g_clear_pointer (&self->children, g_hash_table_unref);
+  g_clear_pointer (&self->snapshot, g_ptr_array_unref);
 
   G_OBJECT_CLASS (phodav_virtual_dir_parent_class)->dispose (object);
 }
@@ -586,6 +590,8 @@ phodav_virtual_dir_class_init (PhodavVirtualDirClass *klass)
 static void
 phodav_virtual_dir_init (PhodavVirtualDir *self)
 {
+  self->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  self->snapshot = g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 /**
@@ -730,7 +736,7 @@ phodav_virtual_dir_new_dir (PhodavVirtualDir  *root,
   file = g_object_new (PHODAV_TYPE_VIRTUAL_DIR, NULL);
   file->path = g_strdup (path);
   file->dummy = FALSE;
-  parent->children = g_list_prepend (parent->children, g_object_ref (file));
+  phodav_virtual_dir_add_child (parent, g_steal_pointer (&base), G_FILE (file));
   g_object_weak_ref (G_OBJECT (parent), parent_gone_cb, file);
   /* weak ref to parent allows us to remove all subdirectories by dropping the last ref to parent */
   file->parent = parent;
@@ -773,8 +779,7 @@ phodav_virtual_dir_attach_real_child (PhodavVirtualDir *parent,
       g_free (base);
       return FALSE;
     }
-  g_free (base);
 
-  parent->children = g_list_prepend (parent->children, g_object_ref (child));
+  phodav_virtual_dir_add_child (parent, base, child);
   return TRUE;
 }
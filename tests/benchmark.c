@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#ifdef G_OS_UNIX
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include "libphodav/phodav.h"
+
+/* Runs a PhodavServer in a thread of this process, against a
+ * generated tree, and drives it with a libsoup client from the main
+ * thread. Every workload prints one line of key=value pairs, so that
+ * the numbers can be compared from one release to the next. */
+
+static gint entries = 100000;
+static gint depth = 64;
+static gint file_size = 64;
+static gint iterations = 1000;
+
+static GOptionEntry entries_options[] = {
+  { "entries", 'n', 0, G_OPTION_ARG_INT, &entries,
+    "Number of entries of the flat directory", "N" },
+  { "depth", 'd', 0, G_OPTION_ARG_INT, &depth,
+    "Nesting of the deep directory", "N" },
+  { "file-size", 's', 0, G_OPTION_ARG_INT, &file_size,
+    "Size of the large file, in MiB", "MIB" },
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+    "Number of requests of the small workloads", "N" },
+  { NULL }
+};
+
+static SoupSession *session;
+static gchar *base_uri;
+
+typedef struct _Server {
+  GThread      *thread;
+  GMainContext *context;
+  GMainLoop    *loop;
+  GMutex        mutex;
+  GCond         cond;
+  gchar        *root;
+  guint         cache_size;
+  guint         port;
+  gboolean      ready;
+} Server;
+
+static gpointer
+server_thread (gpointer data)
+{
+  Server *s = data;
+  PhodavServer *dav;
+  GError *error = NULL;
+  GSList *uris;
+
+  g_main_context_push_thread_default (s->context);
+
+  dav = g_object_new (PHODAV_TYPE_SERVER,
+                      "root", s->root,
+                      "depth-infinity-limit", 100000,
+                      "info-cache-size", s->cache_size,
+                      NULL);
+  if (!soup_server_listen_local (phodav_server_get_soup_server (dav), 0, 0, &error))
+    g_error ("Failed to listen: %s", error->message);
+
+  uris = soup_server_get_uris (phodav_server_get_soup_server (dav));
+  g_mutex_lock (&s->mutex);
+  s->port = g_uri_get_port (uris->data);
+  s->ready = TRUE;
+  g_cond_signal (&s->cond);
+  g_mutex_unlock (&s->mutex);
+  g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+
+  g_main_loop_run (s->loop);
+
+  g_object_unref (dav);
+  g_main_context_pop_thread_default (s->context);
+
+  return NULL;
+}
+
+static void
+server_start (Server *s, const gchar *root, guint cache_size)
+{
+  s->context = g_main_context_new ();
+  s->loop = g_main_loop_new (s->context, FALSE);
+  s->root = g_strdup (root);
+  s->cache_size = cache_size;
+  s->ready = FALSE;
+  g_mutex_init (&s->mutex);
+  g_cond_init (&s->cond);
+
+  s->thread = g_thread_new ("phodav-bench-server", server_thread, s);
+
+  g_mutex_lock (&s->mutex);
+  while (!s->ready)
+    g_cond_wait (&s->cond, &s->mutex);
+  g_mutex_unlock (&s->mutex);
+}
+
+static void
+server_stop (Server *s)
+{
+  g_main_loop_quit (s->loop);
+  g_thread_join (s->thread);
+
+  g_main_loop_unref (s->loop);
+  g_main_context_unref (s->context);
+  g_mutex_clear (&s->mutex);
+  g_cond_clear (&s->cond);
+  g_free (s->root);
+}
+
+static void
+create_file (const gchar *path, gsize size)
+{
+  static gchar buffer[1024 * 1024];
+  GFile *file = g_file_new_for_path (path);
+  GFileOutputStream *out;
+  GError *error = NULL;
+
+  out = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  if (buffer[0] != 'x')
+    memset (buffer, 'x', sizeof (buffer));
+  while (size > 0)
+    {
+      gsize n = MIN (size, sizeof (buffer));
+
+      g_output_stream_write_all (G_OUTPUT_STREAM (out), buffer, n, NULL, NULL, &error);
+      g_assert_no_error (error);
+      size -= n;
+    }
+
+  g_output_stream_close (G_OUTPUT_STREAM (out), NULL, NULL);
+  g_object_unref (out);
+  g_object_unref (file);
+}
+
+static void
+create_tree (const gchar *root)
+{
+  gchar *path, *dir;
+  gint i;
+
+  path = g_build_filename (root, "flat", NULL);
+  g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+  for (i = 0; i < entries; i++)
+    {
+      gchar *name = g_strdup_printf ("%s/file-%06d", path, i);
+
+      create_file (name, 0);
+      g_free (name);
+    }
+  g_free (path);
+
+  dir = g_build_filename (root, "deep", NULL);
+  g_assert_cmpint (g_mkdir (dir, 0755), ==, 0);
+  for (i = 0; i < depth; i++)
+    {
+      path = g_strdup_printf ("%s/file", dir);
+      create_file (path, 4096);
+      g_free (path);
+
+      path = g_strdup_printf ("%s/%d", dir, i);
+      g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+      g_free (dir);
+      dir = path;
+    }
+  g_free (dir);
+
+  path = g_build_filename (root, "large", NULL);
+  create_file (path, (gsize) file_size * 1024 * 1024);
+  g_free (path);
+
+  path = g_build_filename (root, "small", NULL);
+  create_file (path, 4096);
+  g_free (path);
+}
+
+static void
+delete_recursive (GFile *file)
+{
+  GFileEnumerator *e;
+  GFileInfo *info;
+
+  e = g_file_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+  if (e)
+    {
+      while ((info = g_file_enumerator_next_file (e, NULL, NULL)))
+        {
+          GFile *child = g_file_get_child (file, g_file_info_get_name (info));
+
+          delete_recursive (child);
+          g_object_unref (child);
+          g_object_unref (info);
+        }
+      g_file_enumerator_close (e, NULL, NULL);
+      g_object_unref (e);
+    }
+
+  g_file_delete (file, NULL, NULL);
+}
+
+/* sends a request, and returns the status and the size of the
+ * response body */
+static guint
+request (const gchar *method, const gchar *path,
+         const gchar *header_name, const gchar *header_value,
+         GBytes *body, gsize *received, gchar **lock_token)
+{
+  static gchar buffer[64 * 1024];
+  gchar *uri = g_strconcat (base_uri, path, NULL);
+  SoupMessage *msg = soup_message_new (method, uri);
+  SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
+  GError *error = NULL;
+  GInputStream *in;
+  gssize n;
+  guint status;
+
+  if (header_name)
+    soup_message_headers_append (headers, header_name, header_value);
+  if (method == SOUP_METHOD_COPY)
+    {
+      gchar *dest = g_strconcat (uri, "-copy", NULL);
+
+      soup_message_headers_append (headers, "Destination", dest);
+      soup_message_headers_append (headers, "Overwrite", "T");
+      g_free (dest);
+    }
+  if (body)
+    soup_message_set_request_body_from_bytes (msg, "text/xml", body);
+
+  in = soup_session_send (session, msg, NULL, &error);
+  g_assert_no_error (error);
+
+  while ((n = g_input_stream_read (in, buffer, sizeof (buffer), NULL, &error)) > 0)
+    if (received)
+      *received += n;
+  g_assert_no_error (error);
+
+  status = soup_message_get_status (msg);
+  if (lock_token)
+    *lock_token = g_strdup (soup_message_headers_get_one (soup_message_get_response_headers (msg),
+                                                          "Lock-Token"));
+
+  g_object_unref (in);
+  g_object_unref (msg);
+  g_free (uri);
+
+  return status;
+}
+
+typedef struct _Sample {
+  gint64 start;
+  gsize  heap;
+  gsize  bytes;
+  gint   ops;
+} Sample;
+
+static gsize
+heap_in_use (void)
+{
+#ifdef HAVE_MALLINFO2
+  return mallinfo2 ().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static void
+sample_start (Sample *s)
+{
+  s->bytes = 0;
+  s->ops = 0;
+  s->heap = heap_in_use ();
+  s->start = g_get_monotonic_time ();
+}
+
+static void
+sample_report (Sample *s, const gchar *name)
+{
+  gdouble secs = MAX (g_get_monotonic_time () - s->start, 1) / (gdouble) G_USEC_PER_SEC;
+  gssize heap = heap_in_use () - s->heap;
+
+  g_print ("%-20s ops=%d time=%.3fs ops/s=%.1f MB/s=%.1f heap-delta=%" G_GSSIZE_FORMAT "K\n",
+           name, s->ops, secs, s->ops / secs, s->bytes / secs / 1e6, heap / 1024);
+}
+
+static const gchar lockinfo[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+  "<D:lockinfo xmlns:D=\"DAV:\">"
+  "<D:lockscope><D:exclusive/></D:lockscope>"
+  "<D:locktype><D:write/></D:locktype>"
+  "</D:lockinfo>";
+
+static void
+bench_propfind (const gchar *name, const gchar *path, const gchar *propfind_depth, gint n)
+{
+  Sample s;
+  gint i;
+
+  sample_start (&s);
+  for (i = 0; i < n; i++, s.ops++)
+    g_assert_cmpint (request (SOUP_METHOD_PROPFIND, path, "Depth", propfind_depth,
+                              NULL, &s.bytes, NULL), ==, SOUP_STATUS_MULTI_STATUS);
+  sample_report (&s, name);
+}
+
+static void
+bench_get (void)
+{
+  Sample s;
+  gint i, n = MAX (iterations / 100, 1);
+  gsize size = (gsize) file_size * 1024 * 1024;
+
+  sample_start (&s);
+  for (i = 0; i < n; i++, s.ops++)
+    g_assert_cmpint (request (SOUP_METHOD_GET, "large", NULL, NULL,
+                              NULL, &s.bytes, NULL), ==, SOUP_STATUS_OK);
+  sample_report (&s, "get-full");
+
+  sample_start (&s);
+  for (i = 0; i < iterations; i++, s.ops++)
+    {
+      guint64 offset = g_random_int_range (0, MAX (size / 4096, 1)) * (guint64) 4096;
+      gchar *range = g_strdup_printf ("bytes=%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+                                      offset, offset + 4095);
+
+      g_assert_cmpint (request (SOUP_METHOD_GET, "large", "Range", range,
+                                NULL, &s.bytes, NULL), ==, SOUP_STATUS_PARTIAL_CONTENT);
+      g_free (range);
+    }
+  sample_report (&s, "get-range");
+}
+
+static void
+bench_put (void)
+{
+  gchar *data = g_malloc (file_size * 1024 * 1024);
+  GBytes *small, *large;
+  Sample s;
+  gint i, n = MAX (iterations / 100, 1);
+
+  memset (data, 'y', file_size * 1024 * 1024);
+  small = g_bytes_new_static (data, 4096);
+  large = g_bytes_new_static (data, file_size * 1024 * 1024);
+
+  sample_start (&s);
+  for (i = 0; i < iterations; i++, s.ops++)
+    {
+      gchar *path = g_strdup_printf ("put-%d", i % 100);
+      guint status = request (SOUP_METHOD_PUT, path, NULL, NULL, small, NULL, NULL);
+
+      g_assert_true (status == SOUP_STATUS_CREATED || status == SOUP_STATUS_NO_CONTENT);
+      s.bytes += g_bytes_get_size (small);
+      g_free (path);
+    }
+  sample_report (&s, "put-small");
+
+  sample_start (&s);
+  for (i = 0; i < n; i++, s.ops++)
+    {
+      guint status = request (SOUP_METHOD_PUT, "put-large", NULL, NULL, large, NULL, NULL);
+
+      g_assert_true (status == SOUP_STATUS_CREATED || status == SOUP_STATUS_NO_CONTENT);
+      s.bytes += g_bytes_get_size (large);
+    }
+  sample_report (&s, "put-large");
+
+  g_bytes_unref (small);
+  g_bytes_unref (large);
+  g_free (data);
+}
+
+static void
+bench_copy_delete (void)
+{
+  Sample s;
+  gint i, n = MAX (iterations / 100, 1);
+
+  sample_start (&s);
+  for (i = 0; i < n; i++, s.ops += 2)
+    {
+      guint status = request (SOUP_METHOD_COPY, "deep", NULL, NULL, NULL, NULL, NULL);
+
+      g_assert_true (status == SOUP_STATUS_CREATED || status == SOUP_STATUS_NO_CONTENT);
+      g_assert_cmpint (request (SOUP_METHOD_DELETE, "deep-copy", NULL, NULL, NULL, NULL, NULL),
+                       ==, SOUP_STATUS_NO_CONTENT);
+    }
+  sample_report (&s, "copy-delete-deep");
+
+  sample_start (&s);
+  for (i = 0; i < iterations; i++, s.ops += 2)
+    {
+      guint status = request (SOUP_METHOD_COPY, "small", NULL, NULL, NULL, NULL, NULL);
+
+      g_assert_true (status == SOUP_STATUS_CREATED || status == SOUP_STATUS_NO_CONTENT);
+      g_assert_cmpint (request (SOUP_METHOD_DELETE, "small-copy", NULL, NULL, NULL, NULL, NULL),
+                       ==, SOUP_STATUS_NO_CONTENT);
+    }
+  sample_report (&s, "copy-delete-small");
+}
+
+static void
+bench_lock (void)
+{
+  GBytes *body = g_bytes_new_static (lockinfo, strlen (lockinfo));
+  Sample s;
+  gint i;
+
+  sample_start (&s);
+  for (i = 0; i < iterations; i++, s.ops += 2)
+    {
+      gchar *path = g_strdup_printf ("flat/file-%06d", i % MAX (entries, 1));
+      gchar *token = NULL;
+
+      g_assert_cmpint (request (SOUP_METHOD_LOCK, path, "Timeout", "Second-600",
+                                body, NULL, &token), ==, SOUP_STATUS_OK);
+      g_assert_nonnull (token);
+      g_assert_cmpint (request (SOUP_METHOD_UNLOCK, path, "Lock-Token", token,
+                                NULL, NULL, NULL), ==, SOUP_STATUS_NO_CONTENT);
+      g_free (token);
+      g_free (path);
+    }
+  sample_report (&s, "lock-unlock");
+
+  g_bytes_unref (body);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  Server server = { 0, };
+  GString *deepest;
+  gchar *root;
+  gint64 start;
+  GFile *file;
+  gint i;
+
+  context = g_option_context_new ("- phodav benchmark");
+  g_option_context_add_main_entries (context, entries_options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("Option parsing failed: %s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  root = g_dir_make_tmp ("phodav-bench-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  start = g_get_monotonic_time ();
+  create_tree (root);
+  g_print ("%-20s entries=%d depth=%d file-size=%dM time=%.3fs\n", "setup",
+           entries, depth, file_size,
+           (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+
+  server_start (&server, root, 0);
+  base_uri = g_strdup_printf ("http://127.0.0.1:%u/", server.port);
+  session = soup_session_new ();
+
+  deepest = g_string_new ("deep/");
+  for (i = 0; i < depth; i++)
+    g_string_append_printf (deepest, "%d/", i);
+
+  bench_propfind ("propfind-depth0", "flat/", "0", iterations);
+  bench_propfind ("propfind-depth1", "flat/", "1", 3);
+  bench_propfind ("propfind-deep", deepest->str, "1", iterations);
+  bench_propfind ("propfind-infinity", "deep/", "infinity", MAX (iterations / 10, 1));
+  bench_get ();
+  bench_put ();
+  bench_copy_delete ();
+  bench_lock ();
+  server_stop (&server);
+
+  /* the same listings with the info cache, once they are monitored */
+  server_start (&server, root, entries + depth + 1024);
+  g_free (base_uri);
+  base_uri = g_strdup_printf ("http://127.0.0.1:%u/", server.port);
+  bench_propfind ("propfind-depth0-c", "flat/", "0", iterations);
+  bench_propfind ("propfind-depth1-c", "flat/", "1", 5);
+  bench_propfind ("propfind-deep-c", deepest->str, "1", iterations);
+  g_string_free (deepest, TRUE);
+
+#ifdef G_OS_UNIX
+  {
+    struct rusage usage;
+
+    if (getrusage (RUSAGE_SELF, &usage) == 0)
+      g_print ("%-20s max=%ldK\n", "peak-rss", usage.ru_maxrss);
+  }
+#endif
+
+  g_object_unref (session);
+  server_stop (&server);
+
+  file = g_file_new_for_path (root);
+  delete_recursive (file);
+  g_object_unref (file);
+  g_free (base_uri);
+  g_free (root);
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "libphodav/phodav.h"
+#include "bin/htdigest.h"
+
+/* Tests of the htdigest users of chezdav, checked by a server on a
+ * real directory as chezdav sets it up. */
+
+#define REALM "test realm"
+
+static void
+test_htdigest_parse (void)
+{
+  gchar *digest = g_compute_checksum_for_string (G_CHECKSUM_MD5, "alice:" REALM ":secret", -1);
+  gchar *encoded = soup_auth_domain_digest_encode_password ("alice", REALM, "secret");
+  GHashTable *users;
+  gchar *contents;
+
+  /* what libsoup checks the response against */
+  g_assert_cmpstr (digest, ==, encoded);
+
+  contents = g_strdup_printf ("bob:" REALM ":0123\r\n"
+                              "\n"
+                              "alice:other realm:89ab\n"
+                              "alice:" REALM ":%s\n"
+                              "bob:" REALM ":4567\n"
+                              "dave:other realm:cdef\n"
+                              "carol\n", digest);
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "invalid htdigest line: carol");
+  users = htdigest_parse (contents, REALM);
+  g_test_assert_expected_messages ();
+
+  /* the first line of the realm wins, the other realms are skipped */
+  g_assert_cmpuint (g_hash_table_size (users), ==, 2);
+  g_assert_cmpstr (g_hash_table_lookup (users, "alice"), ==, digest);
+  g_assert_cmpstr (g_hash_table_lookup (users, "bob"), ==, "0123");
+  g_assert_null (g_hash_table_lookup (users, "carol"));
+  g_assert_null (g_hash_table_lookup (users, "dave"));
+
+  g_hash_table_unref (users);
+  g_free (contents);
+  g_free (encoded);
+  g_free (digest);
+}
+
+static gchar *
+digest_auth_callback (SoupAuthDomain *auth_domain, SoupServerMessage *msg,
+                      const char *username, gpointer data)
+{
+  GHashTable *users = data;
+
+  return g_strdup (g_hash_table_lookup (users, username));
+}
+
+static gboolean
+authenticate_cb (SoupMessage *msg, SoupAuth *auth, gboolean retrying,
+                 gpointer user_data)
+{
+  if (retrying)
+    return FALSE;
+
+  soup_auth_authenticate (auth, "alice", user_data);
+  return TRUE;
+}
+
+static void
+sent_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GBytes **body = user_data;
+
+  *body = soup_session_send_and_read_finish (SOUP_SESSION (source), result, NULL);
+  if (!*body)
+    *body = g_bytes_new (NULL, 0);
+}
+
+static guint
+get_status (SoupSession *session, const gchar *uri, const gchar *password)
+{
+  SoupMessage *msg = soup_message_new (SOUP_METHOD_PROPFIND, uri);
+  GBytes *body = NULL;
+  guint status;
+
+  soup_message_headers_append (soup_message_get_request_headers (msg), "Depth", "0");
+  if (password)
+    g_signal_connect (msg, "authenticate", G_CALLBACK (authenticate_cb), (gpointer) password);
+  soup_session_send_and_read_async (session, msg, G_PRIORITY_DEFAULT, NULL, sent_cb, &body);
+  while (!body)
+    g_main_context_iteration (NULL, TRUE);
+
+  status = soup_message_get_status (msg);
+  g_bytes_unref (body);
+  g_object_unref (msg);
+
+  return status;
+}
+
+/* a digest from the file lets the right password in, whatever the
+ * lines of the user in the other realms */
+static void
+test_htdigest_auth (void)
+{
+  gchar *root = g_dir_make_tmp ("phodav-htdigest-XXXXXX", NULL);
+  PhodavServer *dav = phodav_server_new (root);
+  SoupServer *server = phodav_server_get_soup_server (dav);
+  SoupSession *session = soup_session_new ();
+  gchar *digest = soup_auth_domain_digest_encode_password ("alice", REALM, "secret");
+  gchar *other = soup_auth_domain_digest_encode_password ("alice", "other realm", "other");
+  gchar *contents = g_strdup_printf ("alice:other realm:%s\n"
+                                     "alice:" REALM ":%s\n"
+                                     "alice:last realm:%s\n", other, digest, other);
+  GHashTable *users = htdigest_parse (contents, REALM);
+  SoupAuthDomain *auth;
+  GError *error = NULL;
+  GSList *uris;
+  gchar *uri;
+
+  auth = soup_auth_domain_digest_new ("realm", REALM, NULL);
+  soup_auth_domain_add_path (auth, "/");
+  soup_auth_domain_digest_set_auth_callback (auth, digest_auth_callback, users, NULL);
+  soup_server_add_auth_domain (server, auth);
+  g_object_unref (auth);
+
+  soup_server_listen_local (server, 0, 0, &error);
+  g_assert_no_error (error);
+  uris = soup_server_get_uris (server);
+  uri = g_uri_to_string (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+
+  g_assert_cmpuint (get_status (session, uri, NULL), ==, SOUP_STATUS_UNAUTHORIZED);
+  g_assert_cmpuint (get_status (session, uri, "wrong"), ==, SOUP_STATUS_UNAUTHORIZED);
+  g_assert_cmpuint (get_status (session, uri, "other"), ==, SOUP_STATUS_UNAUTHORIZED);
+  g_assert_cmpuint (get_status (session, uri, "secret"), ==, SOUP_STATUS_MULTI_STATUS);
+
+  g_free (uri);
+  g_object_unref (session);
+  g_object_unref (dav);
+  g_hash_table_unref (users);
+  g_free (contents);
+  g_free (other);
+  g_free (digest);
+  g_rmdir (root);
+  g_free (root);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/htdigest/parse", test_htdigest_parse);
+  g_test_add_func ("/htdigest/auth", test_htdigest_auth);
+
+  return g_test_run ();
+}
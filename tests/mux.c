@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#include "bin/buffer-pool.h"
+#include "bin/mux.h"
+#include "bin/mux-header.h"
+#include "bin/output-queue.h"
+
+/* Tests of the pieces spice-webdavd multiplexes its clients with,
+ * built from its sources. */
+
+#define N_FRAMES 4
+
+static const gchar *frames[N_FRAMES] = { "aaaa", "bbbb", "cccc", "dddd" };
+
+typedef struct _Pushed {
+  GMemoryOutputStream *output;
+  gsize                written[N_FRAMES];
+  gint                 done;
+} Pushed;
+
+static void
+pushed_cb (OutputQueue *q, gpointer user_data, GError *error)
+{
+  Pushed *p = user_data;
+
+  g_assert_no_error (error);
+  p->written[p->done++] = g_memory_output_stream_get_data_size (p->output);
+}
+
+/* what the stream held when each frame was done with, the first
+ * being written alone while the others are queued */
+static void
+assert_batches (gsize budget, const gsize *expected)
+{
+  GCancellable *cancel = g_cancellable_new ();
+  Pushed p = { NULL, };
+  OutputQueue *q;
+  gint i;
+
+  p.output = G_MEMORY_OUTPUT_STREAM (g_memory_output_stream_new_resizable ());
+  q = output_queue_new (G_OUTPUT_STREAM (p.output), cancel);
+  output_queue_set_budget (q, budget);
+
+  for (i = 0; i < N_FRAMES; i++)
+    output_queue_push (q, (const guint8 *) frames[i], strlen (frames[i]), pushed_cb, &p);
+  while (p.done < N_FRAMES)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (i = 0; i < N_FRAMES; i++)
+    g_assert_cmpuint (p.written[i], ==, expected[i]);
+  g_assert_cmpuint (g_memory_output_stream_get_data_size (p.output), ==, 16);
+  g_assert_true (memcmp (g_memory_output_stream_get_data (p.output),
+                         "aaaabbbbccccdddd", 16) == 0);
+
+  g_object_unref (q);
+  g_object_unref (p.output);
+  g_object_unref (cancel);
+}
+
+static void
+test_output_queue_coalesce (void)
+{
+  const gsize whole[N_FRAMES] = { 4, 16, 16, 16 };
+  const gsize pairs[N_FRAMES] = { 4, 12, 12, 16 };
+  const gsize single[N_FRAMES] = { 4, 8, 12, 16 };
+
+  assert_batches (OUTPUT_QUEUE_DEFAULT_BUDGET, whole);
+  assert_batches (8, pairs);
+  assert_batches (0, single);
+}
+
+static void
+failed_cb (OutputQueue *q, gpointer user_data, GError *error)
+{
+  gint *failed = user_data;
+
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+  (*failed)++;
+}
+
+/* the frames queued behind a failed write fail with it, so their
+ * buffers are given back */
+static void
+test_output_queue_error (void)
+{
+  GCancellable *cancel = g_cancellable_new ();
+  GOutputStream *output = g_memory_output_stream_new_resizable ();
+  OutputQueue *q = output_queue_new (output, cancel);
+  gint i, failed = 0;
+
+  g_output_stream_close (output, NULL, NULL);
+  for (i = 0; i < N_FRAMES; i++)
+    output_queue_push (q, (const guint8 *) frames[i], strlen (frames[i]), failed_cb, &failed);
+  while (failed < N_FRAMES)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_object_unref (q);
+  g_object_unref (output);
+  g_object_unref (cancel);
+}
+
+typedef struct _Waiter {
+  BufferPool *pool;
+  guint8     *buf;
+} Waiter;
+
+static void
+waiter_cb (gpointer user_data)
+{
+  Waiter *w = user_data;
+
+  w->buf = buffer_pool_get (w->pool);
+  g_assert_nonnull (w->buf);
+}
+
+/* bounded, and given back to the waiters in order */
+static void
+test_buffer_pool (void)
+{
+  BufferPool *pool = buffer_pool_new (64, 2);
+  Waiter first = { pool, NULL }, second = { pool, NULL };
+  guint8 *a, *b;
+
+  g_assert_cmpuint (buffer_pool_get_size (pool), ==, 64);
+  a = buffer_pool_get (pool);
+  b = buffer_pool_get (pool);
+  g_assert_nonnull (a);
+  g_assert_nonnull (b);
+  g_assert_null (buffer_pool_get (pool));
+
+  buffer_pool_wait (pool, waiter_cb, &first);
+  buffer_pool_wait (pool, waiter_cb, &second);
+  buffer_pool_put (pool, a);
+  g_assert_true (first.buf == a);
+  g_assert_null (second.buf);
+  buffer_pool_put (pool, b);
+  g_assert_true (second.buf == b);
+
+  /* reused, not allocated again */
+  buffer_pool_put (pool, first.buf);
+  g_assert_true (buffer_pool_get (pool) == a);
+  g_assert_null (buffer_pool_get (pool));
+
+  buffer_pool_put (pool, a);
+  buffer_pool_put (pool, b);
+  buffer_pool_free (pool);
+}
+
+/* version 1 in the native order, version 2 in little endian */
+static void
+test_mux_header (void)
+{
+  static const guint8 v2[MUX_V2_HEADER_SIZE] = {
+    0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+    0x00, 0x00, 0x04, 0x00,
+    MUX_FRAME_CREDIT, 0x00, 0x00, 0x00,
+  };
+  guint8 header[MUX_V2_HEADER_SIZE] = { 0, };
+  gint64 id = G_GINT64_CONSTANT (0x0102030405060708);
+  guint16 size16;
+  guint32 size;
+  guint8 type;
+
+  g_assert_cmpuint (mux_header_write (header, 1, id, MUX_FRAME_DATA, 1234), ==,
+                    MUX_V1_HEADER_SIZE);
+  g_assert_true (memcmp (header, &id, sizeof (id)) == 0);
+  memcpy (&size16, header + sizeof (id), sizeof (size16));
+  g_assert_cmpuint (size16, ==, 1234);
+
+  /* larger than a version 1 frame holds */
+  g_assert_cmpuint (mux_header_write (header, 2, id, MUX_FRAME_CREDIT, 256 * 1024), ==,
+                    MUX_V2_HEADER_SIZE);
+  g_assert_true (memcmp (header, v2, sizeof (v2)) == 0);
+
+  mux_header_read (v2, &id, &type, &size);
+  g_assert_cmpint (id, ==, G_GINT64_CONSTANT (0x0102030405060708));
+  g_assert_cmpuint (type, ==, MUX_FRAME_CREDIT);
+  g_assert_cmpuint (size, ==, 256 * 1024);
+
+  /* the control client, and a close */
+  mux_header_write (header, 2, -1, MUX_FRAME_CLOSE, 0);
+  mux_header_read (header, &id, &type, &size);
+  g_assert_cmpint (id, ==, -1);
+  g_assert_cmpuint (type, ==, MUX_FRAME_CLOSE);
+  g_assert_cmpuint (size, ==, 0);
+}
+
+#ifdef G_OS_UNIX
+/* the test plays the host, and the applications on the clients, in
+ * threads doing blocking I/O, while the mux runs in the main loop */
+
+#define CLIENT_EXTRA 4096
+
+typedef struct _Host {
+  gint   fd;
+  gint   app[2];
+  gint64 id[2];
+  gint   quit;
+} Host;
+
+static void
+write_full (gint fd, gconstpointer data, gsize size)
+{
+  const guint8 *p = data;
+
+  while (size > 0)
+    {
+      gssize n = write (fd, p, size);
+
+      g_assert_cmpint (n, >, 0);
+      p += n;
+      size -= n;
+    }
+}
+
+static void
+read_full (gint fd, gpointer data, gsize size)
+{
+  guint8 *p = data;
+
+  while (size > 0)
+    {
+      gssize n = read (fd, p, size);
+
+      g_assert_cmpint (n, >, 0);
+      p += n;
+      size -= n;
+    }
+}
+
+static void
+host_write_frame (Host *h, gint64 id, MuxFrameType type,
+                  gconstpointer data, guint32 size)
+{
+  guint8 header[MUX_V2_HEADER_SIZE];
+
+  write_full (h->fd, header, mux_header_write (header, 2, id, type, size));
+  write_full (h->fd, data, size);
+}
+
+static guint8 *
+host_read_frame (Host *h, gint64 *id, guint8 *type, guint32 *size)
+{
+  guint8 header[MUX_V2_HEADER_SIZE];
+  guint8 *data;
+
+  read_full (h->fd, header, sizeof (header));
+  mux_header_read (header, id, type, size);
+  data = g_malloc (*size + 1);
+  read_full (h->fd, data, *size);
+
+  return data;
+}
+
+/* whether the host has something to read within @ms */
+static gboolean
+host_readable (Host *h, gint ms)
+{
+  GPollFD pfd = { .fd = h->fd, .events = G_IO_IN };
+
+  return g_poll (&pfd, 1, ms) == 1;
+}
+
+static gpointer
+app_write_thread (gpointer data)
+{
+  Host *h = data;
+  gsize size = MUX_V2_WINDOW + CLIENT_EXTRA;
+  guint8 *buf = g_malloc (size);
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = i % 251;
+  write_full (h->app[0], buf, size);
+  g_free (buf);
+
+  return NULL;
+}
+
+/* the data of the first client, from @offset, up to @end */
+static void
+host_read_client (Host *h, gsize offset, gsize end)
+{
+  guint32 size;
+  gint64 id;
+  guint8 type, *data;
+  gsize i;
+
+  while (offset < end)
+    {
+      data = host_read_frame (h, &id, &type, &size);
+      g_assert_cmpuint (type, ==, MUX_FRAME_DATA);
+      g_assert_cmpint (id, !=, h->id[1]);
+      g_assert_cmpuint (size, >, 0);
+      h->id[0] = id;
+      for (i = 0; i < size; i++)
+        g_assert_cmpuint (data[i], ==, (offset + i) % 251);
+      offset += size;
+      g_free (data);
+    }
+
+  g_assert_cmpuint (offset, ==, end);
+}
+
+static gpointer
+host_thread (gpointer data)
+{
+  Host *h = data;
+  guint16 size16 = strlen (MUX_V2_HELLO);
+  gint64 id = MUX_CONTROL_ID;
+  GThread *writer;
+  guint32 size, credit;
+  guint8 type, *frame;
+  gchar text[16];
+
+  /* asked for in version 1, and answered the same */
+  write_full (h->fd, &id, sizeof (id));
+  write_full (h->fd, &size16, sizeof (size16));
+  write_full (h->fd, MUX_V2_HELLO, size16);
+  read_full (h->fd, &id, sizeof (id));
+  read_full (h->fd, &size16, sizeof (size16));
+  g_assert_cmpint (id, ==, MUX_CONTROL_ID);
+  g_assert_cmpuint (size16, ==, strlen (MUX_V2_HELLO));
+  read_full (h->fd, text, size16);
+  g_assert_true (memcmp (text, MUX_V2_HELLO, size16) == 0);
+
+  /* the clients coming after the switch are announced */
+  frame = host_read_frame (h, &h->id[1], &type, &size);
+  g_assert_cmpuint (type, ==, MUX_FRAME_OPEN);
+  g_assert_cmpuint (size, ==, 0);
+  g_free (frame);
+
+  /* a client sends no more than its window, until credited */
+  writer = g_thread_new ("app-write", app_write_thread, h);
+  host_read_client (h, 0, MUX_V2_WINDOW);
+  g_assert_false (host_readable (h, 200));
+  credit = GUINT32_TO_LE (CLIENT_EXTRA);
+  host_write_frame (h, h->id[0], MUX_FRAME_CREDIT, &credit, sizeof (credit));
+  host_read_client (h, MUX_V2_WINDOW, MUX_V2_WINDOW + CLIENT_EXTRA);
+  g_thread_join (writer);
+
+  /* what the host sends is credited back once delivered */
+  host_write_frame (h, h->id[1], MUX_FRAME_DATA, "hello", 5);
+  read_full (h->app[1], text, 5);
+  g_assert_true (memcmp (text, "hello", 5) == 0);
+  frame = host_read_frame (h, &id, &type, &size);
+  g_assert_cmpuint (type, ==, MUX_FRAME_CREDIT);
+  g_assert_cmpint (id, ==, h->id[1]);
+  g_assert_cmpuint (size, ==, sizeof (credit));
+  memcpy (&credit, frame, sizeof (credit));
+  g_assert_cmpuint (GUINT32_FROM_LE (credit), ==, 5);
+  g_free (frame);
+
+  /* and a close ends the client */
+  host_write_frame (h, h->id[1], MUX_FRAME_CLOSE, NULL, 0);
+  g_assert_cmpint (read (h->app[1], text, 1), ==, 0);
+
+  close (h->fd);
+  return NULL;
+}
+
+static Host *host;
+
+static void
+host_quit (gint code)
+{
+  g_atomic_int_set (&host->quit, 1);
+}
+
+static GSocketConnection *
+connection_new (gint fd)
+{
+  GError *error = NULL;
+  GSocket *socket = g_socket_new_from_fd (fd, &error);
+  GSocketConnection *connection;
+
+  g_assert_no_error (error);
+  connection = g_socket_connection_factory_create_connection (socket);
+  g_object_unref (socket);
+
+  return connection;
+}
+
+static GSocketConnection *
+client_new (gint *app)
+{
+  gint fds[2];
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+  *app = fds[0];
+
+  return connection_new (fds[1]);
+}
+
+/* the switch to version 2, and the windows in both directions */
+static void
+test_mux_v2 (void)
+{
+  GCancellable *cancel = g_cancellable_new ();
+  GSocketConnection *mux, *client;
+  Host h = { 0, };
+  GThread *thread;
+  gint fds[2];
+
+  host = &h;
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+  h.fd = fds[0];
+  mux = connection_new (fds[1]);
+
+  mux_init ();
+  mux_start (g_io_stream_get_input_stream (G_IO_STREAM (mux)),
+             g_io_stream_get_output_stream (G_IO_STREAM (mux)),
+             OUTPUT_QUEUE_DEFAULT_BUDGET, cancel, host_quit);
+
+  /* there at the switch */
+  client = client_new (&h.app[0]);
+  mux_add_client (client);
+  g_object_unref (client);
+
+  thread = g_thread_new ("host", host_thread, &h);
+  while (mux_get_version () == 1)
+    g_main_context_iteration (NULL, TRUE);
+
+  client = client_new (&h.app[1]);
+  mux_add_client (client);
+  g_object_unref (client);
+
+  /* the host going away ends the mux */
+  while (!g_atomic_int_get (&h.quit))
+    g_main_context_iteration (NULL, TRUE);
+  g_thread_join (thread);
+
+  mux_stop ();
+  mux_clear ();
+  close (h.app[0]);
+  close (h.app[1]);
+  g_object_unref (mux);
+  g_object_unref (cancel);
+}
+#endif
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/mux/output-queue/coalesce", test_output_queue_coalesce);
+  g_test_add_func ("/mux/output-queue/error", test_output_queue_error);
+  g_test_add_func ("/mux/buffer-pool", test_buffer_pool);
+  g_test_add_func ("/mux/header", test_mux_header);
+#ifdef G_OS_UNIX
+  g_test_add_func ("/mux/v2", test_mux_v2);
+#endif
+
+  return g_test_run ();
+}
@@ -0,0 +1,2054 @@
+/*
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "libphodav/phodav.h"
+
+/* Tests of a server on a real directory, run in this process: the
+ * requests are sent while iterating the context of the server. */
+
+static SoupSession *session;
+static gchar *root;
+
+typedef struct _Server {
+  PhodavServer *phodav;
+  gchar        *uri;
+} Server;
+
+static Server *
+server_new (const gchar *first_property, ...)
+{
+  Server *server = g_new0 (Server, 1);
+  GError *error = NULL;
+  GSList *uris;
+  va_list args;
+
+  va_start (args, first_property);
+  server->phodav = PHODAV_SERVER (g_object_new_valist (PHODAV_TYPE_SERVER,
+                                                       first_property, args));
+  va_end (args);
+
+  soup_server_listen_local (phodav_server_get_soup_server (server->phodav), 0, 0, &error);
+  g_assert_no_error (error);
+
+  uris = soup_server_get_uris (phodav_server_get_soup_server (server->phodav));
+  g_assert_nonnull (uris);
+  server->uri = g_uri_to_string (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+
+  return server;
+}
+
+static void
+server_free (Server *server)
+{
+  g_object_unref (server->phodav);
+  g_free (server->uri);
+  g_free (server);
+}
+
+static void
+sent_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GBytes **body = user_data;
+  GError *error = NULL;
+
+  *body = soup_session_send_and_read_finish (SOUP_SESSION (source), result, &error);
+  g_assert_no_error (error);
+}
+
+static SoupMessage *
+message_new (Server *server, const gchar *method, const gchar *path,
+             const gchar *body)
+{
+  gchar *uri = g_strconcat (server->uri, path + 1, NULL);
+  SoupMessage *msg = soup_message_new (method, uri);
+
+  g_free (uri);
+  if (body)
+    {
+      GBytes *bytes = g_bytes_new (body, strlen (body));
+
+      soup_message_set_request_body_from_bytes (msg, "application/xml", bytes);
+      g_bytes_unref (bytes);
+    }
+
+  return msg;
+}
+
+/* the body of the response to @msg */
+static gchar *
+send_message (SoupMessage *msg)
+{
+  GBytes *response = NULL;
+  gchar *text;
+
+  soup_session_send_and_read_async (session, msg, G_PRIORITY_DEFAULT, NULL,
+                                    sent_cb, &response);
+  while (!response)
+    g_main_context_iteration (NULL, TRUE);
+
+  text = g_strndup (g_bytes_get_data (response, NULL), g_bytes_get_size (response));
+  g_bytes_unref (response);
+
+  return text;
+}
+
+/* the body of the response to @method @path, and its status */
+static gchar *
+request (Server *server, const gchar *method, const gchar *path,
+         const gchar *header_name, const gchar *header_value,
+         const gchar *body, guint *status)
+{
+  SoupMessage *msg = message_new (server, method, path, body);
+  gchar *text;
+
+  if (header_name)
+    soup_message_headers_append (soup_message_get_request_headers (msg),
+                                 header_name, header_value);
+
+  text = send_message (msg);
+  *status = soup_message_get_status (msg);
+  g_object_unref (msg);
+
+  return text;
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  gboolean *done = user_data;
+
+  *done = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* for the file monitors to report */
+static void
+wait_a_bit (guint ms)
+{
+  gboolean done = FALSE;
+
+  g_timeout_add (ms, timeout_cb, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+write_file (const gchar *name, const gchar *contents)
+{
+  gchar *path = g_build_filename (root, name, NULL);
+  GError *error = NULL;
+
+  g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+  g_free (path);
+}
+
+/* Taken from virtual-dir-server.c */
+static void
+delete_file_recursive (GFile *file)
+{
+  GFileEnumerator *e;
+  e = g_file_enumerate_children (file, "standard::*", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 NULL, NULL);
+  if (e)
+    {
+      while (TRUE)
+        {
+          GFileInfo *info = g_file_enumerator_next_file (e, NULL, NULL);
+          if (!info)
+            break;
+          GFile *del = g_file_get_child (file, g_file_info_get_name (info));
+          if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+            delete_file_recursive (del);
+          else
+            g_file_delete (del, NULL, NULL);
+          g_object_unref (del);
+          g_object_unref (info);
+        }
+
+      g_file_enumerator_close (e, NULL, NULL);
+      g_clear_object (&e);
+    }
+
+  g_file_delete (file, NULL, NULL);
+}
+
+static gchar *
+sync_body (const gchar *token, const gchar *level)
+{
+  return g_strdup_printf ("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                          "<D:sync-collection xmlns:D=\"DAV:\">"
+                          "<D:sync-token>%s</D:sync-token>"
+                          "<D:sync-level>%s</D:sync-level>"
+                          "<D:prop><D:getetag/></D:prop>"
+                          "</D:sync-collection>", token, level);
+}
+
+/* the sync-token of a multistatus */
+static gchar *
+get_sync_token (const gchar *text)
+{
+  const gchar *start = strstr (text, "sync-token>");
+  const gchar *end;
+
+  g_assert_nonnull (start);
+  start += strlen ("sync-token>");
+  end = strchr (start, '<');
+  g_assert_nonnull (end);
+
+  return g_strndup (start, end - start);
+}
+
+static gchar *
+sync_collection (Server *server, const gchar *path, const gchar *token,
+                 const gchar *level, guint expected)
+{
+  gchar *body = sync_body (token ? token : "", level);
+  gchar *text;
+  guint status;
+
+  text = request (server, "REPORT", path, NULL, NULL, body, &status);
+  g_free (body);
+  g_assert_cmpuint (status, ==, expected);
+
+  return text;
+}
+
+#define PROPFIND_SYNC_TOKEN_BODY                                        \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\"><D:prop><D:sync-token/></D:prop></D:propfind>"
+
+static void
+test_sync_collection (void)
+{
+  Server *server = server_new ("root", root, "depth-infinity-limit", 100, NULL);
+  gchar *text, *token, *next, *dest;
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/sync", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (request (server, SOUP_METHOD_MKCOL, "/sync/sub", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("sync/sub/a.txt", "a");
+#ifdef G_OS_UNIX
+  /* a loop, listed but not walked */
+  {
+    gchar *link = g_build_filename (root, "sync", "loop", NULL);
+    g_assert_cmpint (symlink (".", link), ==, 0);
+    g_free (link);
+  }
+#endif
+
+  /* the initial listing, of the whole tree */
+  text = sync_collection (server, "/sync", NULL, "infinite", SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/sync/sub/a.txt"));
+  g_assert_null (strstr (text, "/sync/loop/sub"));
+  token = get_sync_token (text);
+  g_free (text);
+
+  /* nothing changed */
+  text = sync_collection (server, "/sync", token, "infinite", SOUP_STATUS_MULTI_STATUS);
+  g_assert_null (strstr (text, "/sync/sub"));
+  next = get_sync_token (text);
+  g_free (text);
+  g_free (token);
+  token = next;
+
+  /* a change behind phodav, in a subcollection */
+  write_file ("sync/sub/b.txt", "b");
+  wait_a_bit (500);
+  text = sync_collection (server, "/sync", token, "infinite", SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/sync/sub/b.txt"));
+  g_assert_null (strstr (text, "/sync/sub/a.txt"));
+  next = get_sync_token (text);
+  g_free (text);
+  g_free (token);
+  token = next;
+
+  /* the members of a copied collection */
+  dest = g_strconcat (server->uri, "sync/copy", NULL);
+  g_free (request (server, SOUP_METHOD_COPY, "/sync/sub", "Destination", dest,
+                   NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (dest);
+  text = sync_collection (server, "/sync", token, "infinite", SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/sync/copy/a.txt"));
+  g_assert_nonnull (strstr (text, "/sync/copy/b.txt"));
+  g_free (text);
+  g_free (token);
+
+  text = sync_collection (server, "/sync", NULL, "1", SOUP_STATUS_MULTI_STATUS);
+  token = get_sync_token (text);
+  g_free (text);
+  write_file ("sync/c.txt", "c");
+  wait_a_bit (500);
+  text = sync_collection (server, "/sync", token, "1", SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/sync/c.txt"));
+  g_free (text);
+  g_free (token);
+
+  text = sync_collection (server, "/sync", "urn:phodav:sync:0-0", "1", SOUP_STATUS_FORBIDDEN);
+  g_assert_nonnull (strstr (text, "valid-sync-token"));
+  g_free (text);
+
+  /* an initial listing past the limit */
+  text = request (server, "REPORT", "/sync", NULL, NULL,
+                  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                  "<D:sync-collection xmlns:D=\"DAV:\">"
+                  "<D:sync-token/><D:sync-level>1</D:sync-level>"
+                  "<D:limit><D:nresults>1</D:nresults></D:limit>"
+                  "<D:prop><D:getetag/></D:prop>"
+                  "</D:sync-collection>", &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_INSUFFICIENT_STORAGE);
+  g_assert_nonnull (strstr (text, "number-of-matches-within-limits"));
+  g_free (text);
+
+  /* the token of a PROPFIND, of a collection not synced before */
+  g_free (request (server, SOUP_METHOD_MKCOL, "/sync-prop", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  text = request (server, "PROPFIND", "/sync-prop", "Depth", "0",
+                  PROPFIND_SYNC_TOKEN_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  token = get_sync_token (text);
+  g_free (text);
+  write_file ("sync-prop/d.txt", "d");
+  wait_a_bit (500);
+  text = sync_collection (server, "/sync-prop", token, "1", SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/sync-prop/d.txt"));
+  g_free (text);
+  g_free (token);
+
+  server_free (server);
+
+  /* the infinite level needs a limit */
+  server = server_new ("root", root, NULL);
+  text = sync_collection (server, "/sync", NULL, "infinite", SOUP_STATUS_FORBIDDEN);
+  g_assert_nonnull (strstr (text, "sync-traversal-supported"));
+  g_free (text);
+  server_free (server);
+}
+
+#define PROPFIND_LENGTH_BODY                                            \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\"><D:prop><D:getcontentlength/></D:prop></D:propfind>"
+
+static guint64
+info_cache_hits (Server *server)
+{
+  GVariant *metrics = phodav_server_get_metrics (server->phodav);
+  guint64 hits;
+
+  g_assert_true (g_variant_lookup (metrics, "info-cache-hits", "t", &hits));
+  g_variant_unref (metrics);
+
+  return hits;
+}
+
+/* the body of a Depth: 1 PROPFIND of /cache, once it has @expected */
+static gchar *
+propfind_cache (Server *server, const gchar *expected)
+{
+  gchar *text = NULL;
+  guint status;
+  gint i;
+
+  for (i = 0; i < 50; i++)
+    {
+      g_free (text);
+      text = request (server, "PROPFIND", "/cache", "Depth", "1",
+                      PROPFIND_LENGTH_BODY, &status);
+      g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+      if (strstr (text, expected))
+        break;
+      wait_a_bit (100);
+    }
+  g_assert_nonnull (strstr (text, expected));
+
+  return text;
+}
+
+static void
+test_info_cache (void)
+{
+  Server *server = server_new ("root", root, "info-cache-size", 100, NULL);
+  guint64 hits;
+  gchar *text;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/cache", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("cache/a.txt", "a");
+  /* the files changed in the last second are not cached */
+  wait_a_bit (1100);
+
+  /* the first listing has the collection monitored, for the next one
+   * to be kept */
+  for (i = 0; i < 2; i++)
+    {
+      g_free (propfind_cache (server, "getcontentlength>1<"));
+      wait_a_bit (100);
+    }
+
+  /* the collection and its listing, from the cache */
+  hits = info_cache_hits (server);
+  g_free (propfind_cache (server, "getcontentlength>1<"));
+  g_assert_cmpuint (info_cache_hits (server), >=, hits + 2);
+
+  /* behind phodav, seen once the monitor reports it */
+  write_file ("cache/a.txt", "abc");
+  g_free (propfind_cache (server, "getcontentlength>3<"));
+  write_file ("cache/b.txt", "b");
+  text = propfind_cache (server, "/cache/b.txt");
+  g_assert_nonnull (strstr (text, "getcontentlength>3<"));
+  g_free (text);
+  text = request (server, "PROPFIND", "/cache/a.txt", "Depth", "0",
+                  PROPFIND_LENGTH_BODY, &status);
+  g_assert_nonnull (strstr (text, "getcontentlength>3<"));
+  g_free (text);
+
+  server_free (server);
+}
+
+#define LOCK_BODY                                                       \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:lockinfo xmlns:D=\"DAV:\">"                                     \
+  "<D:lockscope><D:exclusive/></D:lockscope>"                         \
+  "<D:locktype><D:write/></D:locktype>"                               \
+  "</D:lockinfo>"
+
+/* the token of a new exclusive lock on @path */
+static gchar *
+lock_path (Server *server, const gchar *path, const gchar *timeout)
+{
+  SoupMessage *msg = message_new (server, "LOCK", path, LOCK_BODY);
+  const gchar *header;
+  gchar *token;
+
+  soup_message_headers_append (soup_message_get_request_headers (msg),
+                               "Timeout", timeout);
+  g_free (send_message (msg));
+  g_assert_true (SOUP_STATUS_IS_SUCCESSFUL (soup_message_get_status (msg)));
+
+  header = soup_message_headers_get_one (soup_message_get_response_headers (msg),
+                                         "Lock-Token");
+  g_assert_nonnull (header);
+  g_assert_true (header[0] == '<' && header[strlen (header) - 1] == '>');
+  token = g_strndup (header + 1, strlen (header) - 2);
+  g_object_unref (msg);
+
+  return token;
+}
+
+static guint
+refresh_lock (Server *server, const gchar *path, const gchar *token,
+              const gchar *timeout)
+{
+  SoupMessage *msg = message_new (server, "LOCK", path, NULL);
+  SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
+  gchar *hif = g_strdup_printf ("(<%s>)", token);
+  guint status;
+
+  soup_message_headers_append (headers, "If", hif);
+  soup_message_headers_append (headers, "Timeout", timeout);
+  g_free (send_message (msg));
+  status = soup_message_get_status (msg);
+  g_object_unref (msg);
+  g_free (hif);
+
+  return status;
+}
+
+/* a PUT without the token is refused while @path is locked */
+static gboolean
+is_locked (Server *server, const gchar *path)
+{
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_PUT, path, NULL, NULL, "x", &status));
+  if (status == SOUP_STATUS_LOCKED)
+    return TRUE;
+
+  g_assert_true (SOUP_STATUS_IS_SUCCESSFUL (status));
+  return FALSE;
+}
+
+static void
+test_lock_expiry (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *token;
+
+  /* the timeouts count whole seconds, so a lock of n seconds lasts
+   * between n - 1 and n */
+  token = lock_path (server, "/lock-expiry.txt", "Second-2");
+  g_assert_true (is_locked (server, "/lock-expiry.txt"));
+  wait_a_bit (2500);
+  g_assert_false (is_locked (server, "/lock-expiry.txt"));
+  g_assert_cmpuint (refresh_lock (server, "/lock-expiry.txt", token, "Second-2"),
+                    !=, SOUP_STATUS_OK);
+  g_free (token);
+
+  /* a refresh moves the deadline */
+  token = lock_path (server, "/lock-refresh.txt", "Second-3");
+  wait_a_bit (1500);
+  g_assert_cmpuint (refresh_lock (server, "/lock-refresh.txt", token, "Second-3"),
+                    ==, SOUP_STATUS_OK);
+  wait_a_bit (1700);
+  g_assert_true (is_locked (server, "/lock-refresh.txt"));
+  wait_a_bit (1800);
+  g_assert_false (is_locked (server, "/lock-refresh.txt"));
+  g_free (token);
+
+  server_free (server);
+}
+
+#define PROPPATCH_COLOR_BODY                                            \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propertyupdate xmlns:D=\"DAV:\" xmlns:Z=\"urn:phodav:test\">"   \
+  "<D:set><D:prop><Z:%s>%s</Z:%s></D:prop></D:set>"                   \
+  "</D:propertyupdate>"
+
+#define PROPFIND_COLOR_BODY                                             \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\" xmlns:Z=\"urn:phodav:test\">"         \
+  "<D:prop><Z:%s/></D:prop></D:propfind>"
+
+static void
+set_prop (Server *server, const gchar *path, const gchar *name, const gchar *value)
+{
+  gchar *body = g_strdup_printf (PROPPATCH_COLOR_BODY, name, value, name);
+  guint status;
+
+  g_free (request (server, "PROPPATCH", path, NULL, NULL, body, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_free (body);
+}
+
+static void
+assert_prop (Server *server, const gchar *path, const gchar *name, const gchar *value)
+{
+  gchar *body = g_strdup_printf (PROPFIND_COLOR_BODY, name);
+  gchar *expected = g_strdup_printf (">%s<", value);
+  gchar *text;
+  guint status;
+
+  text = request (server, "PROPFIND", path, "Depth", "0", body, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, expected));
+  g_free (text);
+  g_free (expected);
+  g_free (body);
+}
+
+static goffset
+get_size (const gchar *path)
+{
+  GStatBuf buf;
+
+  g_assert_cmpint (g_stat (path, &buf), ==, 0);
+  return buf.st_size;
+}
+
+static void
+test_store_log (void)
+{
+  gchar *path = g_build_filename (root, "store.log", NULL);
+  GFile *store = g_file_new_for_path (path);
+  Server *server = server_new ("root", root, "store-file", store, NULL);
+  gchar *token, *value;
+  goffset size;
+  guint status;
+  FILE *f;
+  gint i;
+
+  write_file ("store.txt", "");
+  set_prop (server, "/store.txt", "color", "red");
+  token = lock_path (server, "/store-lock.txt", "Infinite");
+
+  /* replayed at the restart */
+  server_free (server);
+  server = server_new ("root", root, "store-file", store, NULL);
+  assert_prop (server, "/store.txt", "color", "red");
+  g_assert_true (is_locked (server, "/store-lock.txt"));
+
+  /* a torn record at the end, as if the server died writing it */
+  server_free (server);
+  f = g_fopen (path, "ab");
+  g_assert_nonnull (f);
+  g_assert_cmpint (fwrite ("\x40\0\0\0torn", 1, 8, f), ==, 8);
+  fclose (f);
+
+  /* the log is compacted when opened, so what follows isn't lost
+   * behind the torn record */
+  server = server_new ("root", root, "store-file", store, NULL);
+  assert_prop (server, "/store.txt", "color", "red");
+  set_prop (server, "/store.txt", "shape", "round");
+  server_free (server);
+  server = server_new ("root", root, "store-file", store, NULL);
+  assert_prop (server, "/store.txt", "color", "red");
+  assert_prop (server, "/store.txt", "shape", "round");
+  g_assert_true (is_locked (server, "/store-lock.txt"));
+
+  /* the overwritten values go away as the log grows */
+  size = get_size (path);
+  for (i = 0; i < 1100; i++)
+    {
+      value = g_strdup_printf ("v%04d", i);
+      set_prop (server, "/store.txt", "color", value);
+      g_free (value);
+    }
+  g_assert_cmpint (get_size (path), <, 100 * size);
+
+  server_free (server);
+  server = server_new ("root", root, "store-file", store, NULL);
+  assert_prop (server, "/store.txt", "color", "v1099");
+  assert_prop (server, "/store.txt", "shape", "round");
+
+  /* the restored lock can be released with its token */
+  value = g_strdup_printf ("<%s>", token);
+  g_free (request (server, "UNLOCK", "/store-lock.txt", "Lock-Token", value, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+  g_assert_false (is_locked (server, "/store-lock.txt"));
+  g_free (value);
+  g_free (token);
+
+  server_free (server);
+  g_object_unref (store);
+  g_free (path);
+}
+
+/* PROPPATCH queries the file once, for the If header too */
+static void
+test_proppatch_if (void)
+{
+  gchar *path = g_build_filename (root, "proppatch.log", NULL);
+  GFile *store = g_file_new_for_path (path);
+  Server *server = server_new ("root", root, "store-file", store, NULL);
+  gchar *body = g_strdup_printf (PROPPATCH_COLOR_BODY, "shade", "dark", "shade");
+  SoupMessage *msg;
+  gchar *text, *cond;
+  guint status;
+
+  write_file ("proppatch.txt", "p");
+  msg = message_new (server, SOUP_METHOD_HEAD, "/proppatch.txt", NULL);
+  g_free (send_message (msg));
+  cond = g_strdup_printf ("([%s])", soup_message_headers_get_one (
+                            soup_message_get_response_headers (msg), "ETag"));
+  g_object_unref (msg);
+
+  g_free (request (server, "PROPPATCH", "/proppatch.txt", "If", "([\"nope\"])",
+                   body, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_PRECONDITION_FAILED);
+  g_free (request (server, "PROPPATCH", "/proppatch.txt", "If", cond, body, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  assert_prop (server, "/proppatch.txt", "shade", "dark");
+
+  /* the store does not know about files */
+  text = request (server, "PROPPATCH", "/proppatch-none.txt", NULL, NULL, body, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "404"));
+  g_free (text);
+
+  g_free (cond);
+  g_free (body);
+  server_free (server);
+  g_object_unref (store);
+  g_free (path);
+}
+
+/* the members a partial DELETE removed leave nothing in the store
+ * for the files created again at their paths */
+static void
+test_store_partial_delete (void)
+{
+  gchar *path = g_build_filename (root, "purge.log", NULL);
+  gchar *keep = g_build_filename (root, "purge", "keep", NULL);
+  GFile *store = g_file_new_for_path (path);
+  Server *server = server_new ("root", root, "store-file", store, NULL);
+  gchar *body = g_strdup_printf (PROPFIND_COLOR_BODY, "color");
+  gchar *text;
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/purge", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (request (server, SOUP_METHOD_MKCOL, "/purge/keep", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("purge/a.txt", "a");
+  write_file ("purge/keep/b.txt", "b");
+  set_prop (server, "/purge/a.txt", "color", "red");
+  set_prop (server, "/purge/keep/b.txt", "color", "blue");
+
+  g_assert_cmpint (g_chmod (keep, 0555), ==, 0);
+  if (g_access (keep, W_OK) == 0)
+    {
+      g_test_skip ("the permissions do not apply");
+      goto end;
+    }
+
+  g_free (request (server, SOUP_METHOD_DELETE, "/purge", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_cmpint (g_chmod (keep, 0755), ==, 0);
+  assert_prop (server, "/purge/keep/b.txt", "color", "blue");
+
+  write_file ("purge/a.txt", "a");
+  server_free (server);
+  server = server_new ("root", root, "store-file", store, NULL);
+  text = request (server, "PROPFIND", "/purge/a.txt", "Depth", "0", body, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_null (strstr (text, ">red<"));
+  g_free (text);
+  assert_prop (server, "/purge/keep/b.txt", "color", "blue");
+
+end:
+  g_chmod (keep, 0755);
+  g_free (body);
+  server_free (server);
+  g_object_unref (store);
+  g_free (keep);
+  g_free (path);
+}
+
+#define SEARCH_LIKE_BODY                                                \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:searchrequest xmlns:D=\"DAV:\"><D:basicsearch>"                 \
+  "<D:select><D:prop><D:displayname/></D:prop></D:select>"            \
+  "<D:from><D:scope><D:href>/search</D:href>"                         \
+  "<D:depth>1</D:depth></D:scope></D:from>"                           \
+  "<D:where><D:like><D:prop><D:displayname/></D:prop>"                \
+  "<D:literal>%s</D:literal></D:like></D:where>"                      \
+  "</D:basicsearch></D:searchrequest>"
+
+static gchar *
+search_like (Server *server, const gchar *pattern)
+{
+  gchar *body = g_strdup_printf (SEARCH_LIKE_BODY, pattern);
+  gchar *text;
+  guint status;
+
+  text = request (server, "SEARCH", "/search", NULL, NULL, body, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_free (body);
+
+  return text;
+}
+
+static void
+test_search_like (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *name, *text;
+  GString *pattern;
+  gint64 start;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/search", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  name = g_strnfill (64, 'a');
+  write_file ("search/abc.txt", "");
+  text = g_build_filename ("search", name, NULL);
+  write_file (text, "");
+  g_free (text);
+
+  text = search_like (server, "A_c%");
+  g_assert_nonnull (strstr (text, "/search/abc.txt"));
+  g_assert_null (strstr (text, name));
+  g_free (text);
+
+  /* each % retried at every position would take forever */
+  pattern = g_string_new (NULL);
+  for (i = 0; i < 20; i++)
+    g_string_append (pattern, "%a");
+  g_string_append (pattern, "%b");
+  start = g_get_monotonic_time ();
+  text = search_like (server, pattern->str);
+  g_assert_cmpint (g_get_monotonic_time () - start, <, 5 * G_USEC_PER_SEC);
+  g_assert_null (strstr (text, name));
+  g_free (text);
+
+  g_string_free (pattern, TRUE);
+  g_free (name);
+  server_free (server);
+}
+
+#define SEARCH_QUOTA_BODY                                               \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:searchrequest xmlns:D=\"DAV:\"><D:basicsearch>"                 \
+  "<D:select><D:prop><D:quota-used-bytes/></D:prop></D:select>"       \
+  "<D:from><D:scope><D:href>/search-quota</D:href>"                   \
+  "<D:depth>1</D:depth></D:scope></D:from>"                           \
+  "<D:where><D:like><D:prop><D:displayname/></D:prop>"                \
+  "<D:literal>%</D:literal></D:like></D:where>"                       \
+  "</D:basicsearch></D:searchrequest>"
+
+/* the quota-used-bytes of the results needs the index the search
+ * goes through */
+static void
+test_search_quota (void)
+{
+  Server *server = server_new ("root", root, "search-index", TRUE, NULL);
+  gchar *text;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/search-quota", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (request (server, SOUP_METHOD_MKCOL, "/search-quota/dir", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("search-quota/dir/a.txt", "quota");
+
+  /* the first ones walk the scope, while the index is built */
+  for (i = 0; i < 10; i++)
+    {
+      text = request (server, "SEARCH", "/search-quota", NULL, NULL,
+                      SEARCH_QUOTA_BODY, &status);
+      g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+      g_assert_nonnull (strstr (text, "/search-quota/dir"));
+      g_assert_nonnull (strstr (text, "quota-used-bytes>"));
+      g_free (text);
+      wait_a_bit (100);
+    }
+
+  server_free (server);
+}
+
+#define assert_range(server, path, range, status, expected) G_STMT_START { \
+    guint _status;                                                      \
+    gchar *_text = request (server, SOUP_METHOD_GET, path, "Range", range, \
+                            NULL, &_status);                            \
+    g_assert_cmpuint (_status, ==, status);                             \
+    if (expected)                                                       \
+      g_assert_cmpstr (_text, ==, expected);                            \
+    g_free (_text);                                                     \
+  } G_STMT_END
+
+static void
+test_ranges (void)
+{
+  Server *server = server_new ("root", root, NULL);
+
+  write_file ("range.txt", "0123456789");
+  assert_range (server, "/range.txt", "bytes=2-4", SOUP_STATUS_PARTIAL_CONTENT, "234");
+  assert_range (server, "/range.txt", "bytes=5-", SOUP_STATUS_PARTIAL_CONTENT, "56789");
+  assert_range (server, "/range.txt", "bytes=-3", SOUP_STATUS_PARTIAL_CONTENT, "789");
+  assert_range (server, "/range.txt", "bytes=8-100", SOUP_STATUS_PARTIAL_CONTENT, "89");
+  assert_range (server, "/range.txt", "bytes=10-", SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL);
+  /* past what a goffset holds */
+  assert_range (server, "/range.txt", "bytes=9223372036854775808-",
+                SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL);
+  assert_range (server, "/range.txt", "bytes=18446744073709551615-18446744073709551615",
+                SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL);
+  assert_range (server, "/range.txt", "bytes=99999999999999999999-",
+                SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL);
+  /* ignored */
+  assert_range (server, "/range.txt", "bytes=4-2", SOUP_STATUS_OK, "0123456789");
+  assert_range (server, "/range.txt", "lines=1-2", SOUP_STATUS_OK, "0123456789");
+
+  server_free (server);
+}
+
+/* the Content-Encoding of a GET of @path, sent as it is */
+static gchar *
+get_encoding (Server *server, const gchar *path, const gchar *accept)
+{
+  SoupMessage *msg = message_new (server, SOUP_METHOD_GET, path, NULL);
+  gchar *encoding;
+
+  soup_message_disable_feature (msg, SOUP_TYPE_CONTENT_DECODER);
+  soup_message_headers_replace (soup_message_get_request_headers (msg),
+                                "Accept-Encoding", accept);
+  g_free (send_message (msg));
+  g_assert_cmpuint (soup_message_get_status (msg), ==, SOUP_STATUS_OK);
+  encoding = g_strdup (soup_message_headers_get_one (
+                         soup_message_get_response_headers (msg), "Content-Encoding"));
+  g_object_unref (msg);
+
+  return encoding;
+}
+
+#define assert_encoding(server, path, accept, expected) G_STMT_START {  \
+    gchar *_encoding = get_encoding (server, path, accept);             \
+    g_assert_cmpstr (_encoding, ==, expected);                          \
+    g_free (_encoding);                                                 \
+  } G_STMT_END
+
+static void
+test_compression (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *name;
+  guint status;
+  gint i;
+
+  /* a listing large enough to be compressed */
+  g_free (request (server, SOUP_METHOD_MKCOL, "/compress", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  for (i = 0; i < 500; i++)
+    {
+      name = g_strdup_printf ("compress/a-rather-long-file-name-%04d.txt", i);
+      write_file (name, "");
+      g_free (name);
+    }
+
+  assert_encoding (server, "/compress", "gzip", "gzip");
+  assert_encoding (server, "/compress", "deflate", "deflate");
+  assert_encoding (server, "/compress", "gzip;q=0.5, deflate", "deflate");
+  assert_encoding (server, "/compress", "gzip;q=0, *", "deflate");
+  assert_encoding (server, "/compress", "gzip;q=0, deflate;q=0, *", NULL);
+  assert_encoding (server, "/compress", "identity", NULL);
+
+  server_free (server);
+}
+
+/* a listing read over several batches, one of them partial */
+static void
+test_enumerate_batch (void)
+{
+  Server *server = server_new ("root", root, "enumerate-batch-size", 2, NULL);
+  gchar *text, *name;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/batch", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  for (i = 0; i < 5; i++)
+    {
+      name = g_strdup_printf ("batch/%d.txt", i);
+      write_file (name, "b");
+      g_free (name);
+    }
+
+  text = request (server, "PROPFIND", "/batch", "Depth", "1", NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  for (i = 0; i < 5; i++)
+    {
+      name = g_strdup_printf ("/batch/%d.txt<", i);
+      g_assert_nonnull (strstr (text, name));
+      g_free (name);
+    }
+  g_free (text);
+
+  g_free (request (server, SOUP_METHOD_DELETE, "/batch", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+
+  server_free (server);
+}
+
+static void
+test_put_tmp (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  PhodavPutDurability durability;
+  gchar *text;
+  guint status;
+
+  /* renamed over, without a sync */
+  g_object_get (server->phodav, "put-durability", &durability, NULL);
+  g_assert_cmpint (durability, ==, PHODAV_PUT_DURABILITY_ATOMIC);
+
+  /* only the names made by the server are hidden, not a user file
+   * that looks like an upload in progress */
+  g_free (request (server, SOUP_METHOD_MKCOL, "/put-tmp", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("put-tmp/.a.txt.phodav-0123abcd0123456789abcdef", "not partial");
+  write_file ("put-tmp/.b.txt", "hidden but listed");
+  text = request (server, "PROPFIND", "/put-tmp", "Depth", "1", NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "/put-tmp/.a.txt.phodav-0123abcd0123456789abcdef"));
+  g_assert_nonnull (strstr (text, "/put-tmp/.b.txt"));
+  g_free (text);
+
+  server_free (server);
+}
+
+#define N_CONCURRENT 8
+
+/* requests running in the pool at the same time */
+static void
+test_worker_threads (void)
+{
+  Server *server = server_new ("root", root, "worker-threads", 4, NULL);
+  SoupMessage *msgs[N_CONCURRENT];
+  GBytes *bodies[N_CONCURRENT] = { NULL, };
+  gchar *name, *text;
+  guint status;
+  gint i, j;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/workers", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  for (i = 0; i < N_CONCURRENT; i++)
+    {
+      name = g_strdup_printf ("workers/%d.txt", i);
+      write_file (name, "w");
+      g_free (name);
+    }
+
+  for (i = 0; i < N_CONCURRENT; i++)
+    {
+      msgs[i] = message_new (server, "PROPFIND", "/workers", NULL);
+      soup_message_headers_append (soup_message_get_request_headers (msgs[i]),
+                                   "Depth", "1");
+      soup_session_send_and_read_async (session, msgs[i], G_PRIORITY_DEFAULT, NULL,
+                                        sent_cb, &bodies[i]);
+    }
+
+  for (i = 0; i < N_CONCURRENT; i++)
+    {
+      while (!bodies[i])
+        g_main_context_iteration (NULL, TRUE);
+
+      g_assert_cmpuint (soup_message_get_status (msgs[i]), ==, SOUP_STATUS_MULTI_STATUS);
+      text = g_strndup (g_bytes_get_data (bodies[i], NULL), g_bytes_get_size (bodies[i]));
+      for (j = 0; j < N_CONCURRENT; j++)
+        {
+          name = g_strdup_printf ("/workers/%d.txt<", j);
+          g_assert_nonnull (strstr (text, name));
+          g_free (name);
+        }
+      g_free (text);
+      g_bytes_unref (bodies[i]);
+      g_object_unref (msgs[i]);
+    }
+
+  /* the methods not run in the pool are still served */
+  text = request (server, SOUP_METHOD_GET, "/workers/0.txt", NULL, NULL, NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  g_assert_cmpstr (text, ==, "w");
+  g_free (text);
+
+  g_free (request (server, SOUP_METHOD_DELETE, "/workers", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+  name = g_build_filename (root, "workers", NULL);
+  g_assert_false (g_file_test (name, G_FILE_TEST_EXISTS));
+  g_free (name);
+
+  server_free (server);
+}
+
+/* a body over many chunks, written as it comes */
+static void
+test_put_large (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *path = g_build_filename (root, "put-large.txt", NULL);
+  GError *error = NULL;
+  GString *body;
+  gchar *text;
+  gsize size;
+  guint status;
+  gint i;
+
+  body = g_string_new (NULL);
+  for (i = 0; i < 512 * 1024; i++)
+    g_string_append_printf (body, "%08d\n", i);
+
+  g_free (request (server, SOUP_METHOD_PUT, "/put-large.txt", NULL, NULL, body->str, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_file_get_contents (path, &text, &size, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (size, ==, body->len);
+  g_assert_true (memcmp (text, body->str, size) == 0);
+  g_free (text);
+
+  text = request (server, SOUP_METHOD_GET, "/put-large.txt", NULL, NULL, NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  g_assert_true (strcmp (text, body->str) == 0);
+  g_free (text);
+
+  g_string_free (body, TRUE);
+  g_free (path);
+  server_free (server);
+}
+
+/* locks apply to the members of a collection, by path component */
+static void
+test_lock_tree (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *token, *value;
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/locks", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (request (server, SOUP_METHOD_MKCOL, "/locks/a", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+
+  token = lock_path (server, "/locks/a", "Infinite");
+  g_assert_true (is_locked (server, "/locks/a/b.txt"));
+  g_assert_false (is_locked (server, "/locks/ab.txt"));
+  g_assert_false (is_locked (server, "/locks/b.txt"));
+
+  /* nor can the collection above go with it */
+  g_free (request (server, SOUP_METHOD_DELETE, "/locks", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_LOCKED);
+
+  value = g_strdup_printf ("<%s>", token);
+  g_free (request (server, "UNLOCK", "/locks/a", "Lock-Token", value, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+  g_assert_false (is_locked (server, "/locks/a/b.txt"));
+  g_free (request (server, SOUP_METHOD_DELETE, "/locks", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+
+  g_free (value);
+  g_free (token);
+  server_free (server);
+}
+
+static guint
+move_if (Server *server, const gchar *path, const gchar *dest, const gchar *hif)
+{
+  SoupMessage *msg = message_new (server, SOUP_METHOD_MOVE, path, NULL);
+  SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
+  gchar *uri = g_strconcat (server->uri, dest + 1, NULL);
+  guint status;
+
+  soup_message_headers_append (headers, "Destination", uri);
+  if (hif)
+    soup_message_headers_append (headers, "If", hif);
+  g_free (send_message (msg));
+  status = soup_message_get_status (msg);
+  g_object_unref (msg);
+  g_free (uri);
+
+  return status;
+}
+
+/* a collection moves with its locked members only given their token */
+static void
+test_move_locked (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *token, *hif;
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/move-locked", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("move-locked/a.txt", "a");
+
+  token = lock_path (server, "/move-locked/a.txt", "Infinite");
+  g_assert_cmpuint (move_if (server, "/move-locked", "/move-unlocked", NULL), ==,
+                    SOUP_STATUS_LOCKED);
+  /* the If header is checked before the locks below */
+  g_assert_cmpuint (move_if (server, "/move-locked", "/move-unlocked", "(<opaquelocktoken:nope>)"),
+                    ==, SOUP_STATUS_PRECONDITION_FAILED);
+
+  hif = g_strdup_printf ("</move-locked/a.txt> (<%s>)", token);
+  g_assert_cmpuint (move_if (server, "/move-locked", "/move-unlocked", hif), ==,
+                    SOUP_STATUS_CREATED);
+  g_assert_false (is_locked (server, "/move-unlocked/a.txt"));
+
+  g_free (hif);
+  g_free (token);
+  server_free (server);
+}
+
+static guint
+count_matches (const gchar *text, const gchar *needle)
+{
+  guint n = 0;
+
+  for (text = strstr (text, needle); text; text = strstr (text + 1, needle))
+    n++;
+
+  return n;
+}
+
+/* a multistatus sent over many chunks, whole, from the main context
+ * and from a worker */
+static void
+test_propfind_stream (void)
+{
+  gchar *dir = g_build_filename (root, "stream", NULL);
+  Server *server;
+  gchar *text, *name;
+  guint status;
+  gint i, threads;
+
+  g_assert_cmpint (g_mkdir (dir, 0755), ==, 0);
+  for (i = 0; i < 2000; i++)
+    {
+      name = g_strdup_printf ("stream/%04d.txt", i);
+      write_file (name, "s");
+      g_free (name);
+    }
+
+  for (threads = 0; threads <= 4; threads += 4)
+    {
+      server = server_new ("root", root, "worker-threads", threads, NULL);
+      text = request (server, "PROPFIND", "/stream", "Depth", "1",
+                      PROPFIND_LENGTH_BODY, &status);
+      g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+      g_assert_true (g_str_has_prefix (text, "<?xml"));
+      g_assert_true (g_str_has_suffix (text, "</D:multistatus>\n"));
+      g_assert_cmpuint (count_matches (text, "<D:response>"), ==, 2001);
+      g_assert_cmpuint (count_matches (text, "getcontentlength>1<"), ==, 2000);
+      g_assert_nonnull (strstr (text, "/stream/1999.txt<"));
+      g_free (text);
+      server_free (server);
+    }
+
+  g_free (dir);
+}
+
+#define PROPFIND_ETAG_BODY                                              \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\"><D:prop><D:getetag/></D:prop></D:propfind>"
+
+/* only the props asked for are answered, from what was queried */
+static void
+test_propfind_select (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  SoupMessage *msg;
+  gchar *text, *etag;
+  guint status;
+
+  write_file ("select.txt", "abc");
+
+  text = request (server, "PROPFIND", "/select.txt", "Depth", "0",
+                  PROPFIND_LENGTH_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "getcontentlength>3<"));
+  g_assert_null (strstr (text, "getlastmodified"));
+  g_assert_null (strstr (text, "getetag"));
+  g_assert_null (strstr (text, "resourcetype"));
+  g_free (text);
+
+  /* the same etag as a GET */
+  msg = message_new (server, SOUP_METHOD_HEAD, "/select.txt", NULL);
+  g_free (send_message (msg));
+  etag = g_strdup_printf ("getetag>%s<", soup_message_headers_get_one (
+                            soup_message_get_response_headers (msg), "ETag"));
+  g_object_unref (msg);
+  text = request (server, "PROPFIND", "/select.txt", "Depth", "0",
+                  PROPFIND_ETAG_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, etag));
+  g_assert_null (strstr (text, "getcontentlength"));
+  g_free (text);
+  g_free (etag);
+
+  /* everything, without a body */
+  text = request (server, "PROPFIND", "/select.txt", "Depth", "0", NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "getcontentlength>3<"));
+  g_assert_nonnull (strstr (text, "getlastmodified"));
+  g_assert_nonnull (strstr (text, "getetag"));
+  g_free (text);
+
+  server_free (server);
+}
+
+#define PROPFIND_SUPPORTEDLOCK_BODY                                     \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\" xmlns:Z=\"urn:phodav:test\">"         \
+  "<D:prop><D:supportedlock/><Z:none/></D:prop></D:propfind>"
+
+#define PROPFIND_PROPNAME_BODY                                          \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\"><D:propname/></D:propfind>"
+
+/* the constant parts of a response are copied as they are */
+static void
+test_propfind_fragments (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *text;
+  guint status;
+
+  write_file ("fragments.txt", "");
+
+  text = request (server, "PROPFIND", "/fragments.txt", "Depth", "0",
+                  PROPFIND_SUPPORTEDLOCK_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text,
+                            "<D:propstat><D:prop><D:supportedlock>"
+                            "<D:lockentry><D:lockscope><D:exclusive/></D:lockscope>"
+                            "<D:locktype><D:write/></D:locktype></D:lockentry>"
+                            "<D:lockentry><D:lockscope><D:shared/></D:lockscope>"
+                            "<D:locktype><D:write/></D:locktype></D:lockentry>"
+                            "</D:supportedlock></D:prop>"
+                            "<D:status>HTTP/1.1 200 OK</D:status></D:propstat>"));
+  g_assert_nonnull (strstr (text, "<D:status>HTTP/1.1 404 Not Found</D:status>"));
+  g_free (text);
+
+  /* only the name, then */
+  text = request (server, "PROPFIND", "/fragments.txt", "Depth", "0",
+                  PROPFIND_PROPNAME_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_nonnull (strstr (text, "<D:supportedlock/>"));
+  g_assert_null (strstr (text, "lockentry"));
+  g_free (text);
+
+  server_free (server);
+}
+
+/* the paths of the members, escaped or not, and more of them than
+ * the scratch space of a response holds */
+static void
+test_propfind_arena (void)
+{
+  gchar *path = g_build_filename (root, "arena.log", NULL);
+  GFile *store = g_file_new_for_path (path);
+  Server *server = server_new ("root", root, "store-file", store, NULL);
+  gchar *body = g_strdup_printf (PROPFIND_COLOR_BODY, "color");
+  gchar *text, *name, *longname;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/arena", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  longname = g_strnfill (200, 'n');
+  for (i = 0; i < 300; i++)
+    {
+      name = g_strdup_printf ("arena/%s-%03d", longname, i);
+      write_file (name, "");
+      g_free (name);
+    }
+  write_file ("arena/a&b.txt", "");
+  set_prop (server, "/arena/a&b.txt", "color", "red");
+
+  text = request (server, "PROPFIND", "/arena", "Depth", "1", body, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  g_assert_cmpuint (count_matches (text, "<D:response>"), ==, 302);
+  for (i = 0; i < 300; i++)
+    {
+      name = g_strdup_printf ("/arena/%s-%03d<", longname, i);
+      g_assert_nonnull (strstr (text, name));
+      g_free (name);
+    }
+  g_assert_nonnull (strstr (text, "/arena/a&amp;b.txt<"));
+  g_assert_cmpuint (count_matches (text, ">red<"), ==, 1);
+  g_free (text);
+
+  g_free (longname);
+  g_free (body);
+  server_free (server);
+  g_object_unref (store);
+  g_free (path);
+}
+
+/* a server in a thread and context of its own, as chezdav runs one
+ * per thread */
+typedef struct _Shard {
+  GMainContext *context;
+  GMainLoop    *loop;
+  PhodavServer *peer;
+  Server       *server;
+  GMutex        mutex;
+  GCond         cond;
+} Shard;
+
+static gpointer
+shard_run (gpointer data)
+{
+  Shard *shard = data;
+  Server *server;
+
+  g_main_context_push_thread_default (shard->context);
+  server = server_new ("root", root, "peer", shard->peer, NULL);
+
+  g_mutex_lock (&shard->mutex);
+  shard->server = server;
+  g_cond_signal (&shard->cond);
+  g_mutex_unlock (&shard->mutex);
+
+  g_main_loop_run (shard->loop);
+
+  server_free (server);
+  g_main_context_pop_thread_default (shard->context);
+
+  return NULL;
+}
+
+static gboolean
+shard_quit (gpointer data)
+{
+  Shard *shard = data;
+
+  g_main_loop_quit (shard->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* the locks and the counters are shared with the peer */
+static void
+test_peer (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  Shard shard = { NULL, };
+  GThread *thread;
+  GVariant *metrics, *methods;
+  gchar *token, *value;
+  guint status;
+
+  shard.context = g_main_context_new ();
+  shard.loop = g_main_loop_new (shard.context, FALSE);
+  shard.peer = server->phodav;
+  g_mutex_init (&shard.mutex);
+  g_cond_init (&shard.cond);
+  thread = g_thread_new ("shard", shard_run, &shard);
+  g_mutex_lock (&shard.mutex);
+  while (!shard.server)
+    g_cond_wait (&shard.cond, &shard.mutex);
+  g_mutex_unlock (&shard.mutex);
+
+  token = lock_path (server, "/peer.txt", "Infinite");
+  g_assert_true (is_locked (shard.server, "/peer.txt"));
+
+  value = g_strdup_printf ("<%s>", token);
+  g_free (request (shard.server, "UNLOCK", "/peer.txt", "Lock-Token", value, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+  g_assert_false (is_locked (server, "/peer.txt"));
+
+  /* the LOCK was served by the first one only */
+  metrics = phodav_server_get_metrics (shard.server->phodav);
+  methods = g_variant_lookup_value (metrics, "methods", G_VARIANT_TYPE ("a{sa{sv}}"));
+  g_assert_nonnull (methods);
+  g_assert_true (g_variant_lookup (methods, "LOCK", "@a{sv}", NULL));
+  g_assert_true (g_variant_lookup (methods, "UNLOCK", "@a{sv}", NULL));
+  g_variant_unref (methods);
+  g_variant_unref (metrics);
+
+  g_main_context_invoke (shard.context, shard_quit, &shard);
+  g_thread_join (thread);
+  g_main_loop_unref (shard.loop);
+  g_main_context_unref (shard.context);
+  g_mutex_clear (&shard.mutex);
+  g_cond_clear (&shard.cond);
+
+  g_free (value);
+  g_free (token);
+  server_free (server);
+}
+
+/* the responses of @method with @status, and the bytes sent for them */
+static guint64
+method_count (Server *server, const gchar *method, guint status, guint64 *bytes_out)
+{
+  GVariant *metrics = phodav_server_get_metrics (server->phodav);
+  GVariant *methods, *m, *statuses;
+  guint64 count = 0, n;
+  GVariantIter iter;
+  guint code;
+
+  methods = g_variant_lookup_value (metrics, "methods", G_VARIANT_TYPE ("a{sa{sv}}"));
+  g_assert_nonnull (methods);
+  m = g_variant_lookup_value (methods, method, G_VARIANT_TYPE ("a{sv}"));
+  g_assert_nonnull (m);
+  statuses = g_variant_lookup_value (m, "statuses", G_VARIANT_TYPE ("a{ut}"));
+  g_assert_nonnull (statuses);
+  g_variant_iter_init (&iter, statuses);
+  while (g_variant_iter_next (&iter, "{ut}", &code, &n))
+    if (code == status)
+      count = n;
+  if (bytes_out)
+    g_assert_true (g_variant_lookup (m, "bytes-out", "t", bytes_out));
+
+  g_variant_unref (statuses);
+  g_variant_unref (m);
+  g_variant_unref (methods);
+  g_variant_unref (metrics);
+
+  return count;
+}
+
+static void
+test_metrics (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  guint64 bytes;
+  guint status, other;
+
+  write_file ("metrics.txt", "0123456789");
+  g_free (request (server, SOUP_METHOD_GET, "/metrics.txt", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  g_free (request (server, SOUP_METHOD_GET, "/metrics.txt", NULL, NULL, NULL, &status));
+  g_free (request (server, SOUP_METHOD_GET, "/nowhere.txt", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NOT_FOUND);
+  g_free (request (server, "BREW", "/metrics.txt", NULL, NULL, NULL, &other));
+  g_free (request (server, "WHEN", "/metrics.txt", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, other);
+
+  /* counted once the responses are written */
+  wait_a_bit (100);
+  g_assert_cmpuint (method_count (server, "GET", SOUP_STATUS_OK, &bytes), ==, 2);
+  g_assert_cmpuint (bytes, >=, 20);
+  g_assert_cmpuint (method_count (server, "GET", SOUP_STATUS_NOT_FOUND, NULL), ==, 1);
+  g_assert_cmpuint (method_count (server, "other", other, NULL), ==, 2);
+
+  server_free (server);
+}
+
+/* the body of a GET of @path with @range, and whether the server
+ * closes the connection after it */
+static gchar *
+get_connection (Server *server, const gchar *path, const gchar *range,
+                guint expected, gboolean *closed)
+{
+  SoupMessage *msg = message_new (server, SOUP_METHOD_GET, path, NULL);
+  SoupMessageHeaders *headers;
+  gchar *text;
+
+  if (range)
+    soup_message_headers_append (soup_message_get_request_headers (msg), "Range", range);
+  text = send_message (msg);
+  g_assert_cmpuint (soup_message_get_status (msg), ==, expected);
+  headers = soup_message_get_response_headers (msg);
+  *closed = soup_message_headers_header_contains (headers, "Connection", "close");
+  g_object_unref (msg);
+
+  return text;
+}
+
+/* files that would be mapped are sent with sendfile() too, from the
+ * threshold on */
+static void
+test_get_sendfile (void)
+{
+  Server *server = server_new ("root", root, "sendfile-threshold",
+                               (guint64) 1024 * 1024, NULL);
+  Server *plain = server_new ("root", root, NULL);
+  GString *body = g_string_new (NULL);
+  guint64 bytes;
+  gboolean closed;
+  gchar *text;
+  gint i;
+
+  /* 3 MiB, over the threshold */
+  for (i = 0; i < 384 * 1024; i++)
+    g_string_append_printf (body, "%07d\n", i);
+  write_file ("sendfile.txt", body->str);
+
+  /* not used unless asked for */
+  text = get_connection (plain, "/sendfile.txt", NULL, SOUP_STATUS_OK, &closed);
+  g_assert_true (strcmp (text, body->str) == 0);
+  g_assert_false (closed);
+  g_free (text);
+
+  text = get_connection (server, "/sendfile.txt", NULL, SOUP_STATUS_OK, &closed);
+  g_assert_cmpuint (strlen (text), ==, body->len);
+  g_assert_true (strcmp (text, body->str) == 0);
+#ifdef HAVE_SENDFILE
+  g_assert_true (closed);
+#endif
+  g_free (text);
+
+  /* 2 MiB from the middle */
+  text = get_connection (server, "/sendfile.txt", "bytes=524288-2621439",
+                         SOUP_STATUS_PARTIAL_CONTENT, &closed);
+  g_assert_cmpuint (strlen (text), ==, 2 * 1024 * 1024);
+  g_assert_true (memcmp (text, body->str + 512 * 1024, 2 * 1024 * 1024) == 0);
+  g_free (text);
+
+  /* small ranges keep the connection */
+  text = get_connection (server, "/sendfile.txt", "bytes=8-15",
+                         SOUP_STATUS_PARTIAL_CONTENT, &closed);
+  g_assert_cmpstr (text, ==, "0000001\n");
+  g_assert_false (closed);
+  g_free (text);
+
+  /* what sendfile() sent is counted too */
+  wait_a_bit (100);
+  g_assert_cmpuint (method_count (server, "GET", SOUP_STATUS_OK, &bytes), ==, 1);
+  g_assert_cmpuint (bytes, >=, body->len + 2 * 1024 * 1024 + 8);
+
+  g_string_free (body, TRUE);
+  server_free (plain);
+  server_free (server);
+}
+
+/* an unreadable directory has no index page */
+static void
+test_get_listing (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *dir = g_build_filename (root, "listing", NULL);
+  gchar *text;
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/listing", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  g_free (request (server, SOUP_METHOD_MKCOL, "/listing/sub", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  write_file ("listing/a.txt", "a");
+
+  text = request (server, SOUP_METHOD_GET, "/listing", NULL, NULL, NULL, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  g_assert_nonnull (strstr (text, "<a href=\"a.txt\">"));
+  g_assert_nonnull (strstr (text, "<a href=\"sub/\">"));
+  g_free (text);
+
+  g_assert_cmpint (g_chmod (dir, 0), ==, 0);
+  if (g_access (dir, R_OK) == 0)
+    {
+      g_test_skip ("the permissions do not apply");
+      goto end;
+    }
+
+  g_test_expect_message ("phodav", G_LOG_LEVEL_WARNING, "error: *");
+  g_free (request (server, SOUP_METHOD_GET, "/listing", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_FORBIDDEN);
+  g_test_assert_expected_messages ();
+
+end:
+  g_chmod (dir, 0755);
+  g_free (dir);
+  server_free (server);
+}
+
+#define PROPFIND_QUOTA_USED_BODY                                        \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:propfind xmlns:D=\"DAV:\"><D:prop><D:quota-used-bytes/></D:prop></D:propfind>"
+
+static guint64
+get_quota_used (Server *server, const gchar *path)
+{
+  const gchar *value;
+  guint64 used;
+  gchar *text;
+  guint status;
+
+  text = request (server, "PROPFIND", path, "Depth", "0",
+                  PROPFIND_QUOTA_USED_BODY, &status);
+  g_assert_cmpuint (status, ==, SOUP_STATUS_MULTI_STATUS);
+  value = strstr (text, "quota-used-bytes>");
+  g_assert_nonnull (value);
+  used = g_ascii_strtoull (value + strlen ("quota-used-bytes>"), NULL, 10);
+  g_free (text);
+
+  return used;
+}
+
+/* the index catches up with the PUTs and the DELETEs */
+static void
+test_quota_used (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *body = g_strnfill (256 * 1024, 'q');
+  guint64 before, used = 0;
+  guint status;
+  gint i;
+
+  g_free (request (server, SOUP_METHOD_MKCOL, "/quota", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  before = get_quota_used (server, "/quota");
+
+  g_free (request (server, SOUP_METHOD_PUT, "/quota/a.txt", NULL, NULL, body, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+  for (i = 0; i < 50; i++)
+    {
+      used = get_quota_used (server, "/quota");
+      if (used >= before + 256 * 1024)
+        break;
+      wait_a_bit (100);
+    }
+  g_assert_cmpuint (used, >=, before + 256 * 1024);
+  g_assert_cmpuint (get_quota_used (server, "/"), >=, used);
+
+  g_free (request (server, SOUP_METHOD_DELETE, "/quota/a.txt", NULL, NULL, NULL, &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+  for (i = 0; i < 50; i++)
+    {
+      used = get_quota_used (server, "/quota");
+      if (used < before + 256 * 1024)
+        break;
+      wait_a_bit (100);
+    }
+  g_assert_cmpuint (used, <, before + 256 * 1024);
+
+  g_free (body);
+  server_free (server);
+}
+
+/* the responses of a Depth: infinity PROPFIND of @path, and whether
+ * some collections were left with a 507 */
+static guint
+propfind_infinity (Server *server, const gchar *path, guint expected,
+                   gboolean *truncated)
+{
+  guint status, n;
+  gchar *text;
+
+  text = request (server, "PROPFIND", path, "Depth", "infinity",
+                  PROPFIND_LENGTH_BODY, &status);
+  g_assert_cmpuint (status, ==, expected);
+  n = count_matches (text, "<D:response>");
+  if (truncated)
+    *truncated = strstr (text, "HTTP/1.1 507") != NULL;
+  g_free (text);
+
+  return n;
+}
+
+static void
+test_depth_infinity (void)
+{
+  const gchar *dirs[] = { "infinity", "infinity/a", "infinity/a/b", "infinity/c" };
+  Server *server;
+  gboolean truncated;
+  guint i, j, listed = 16;
+  gchar *path, *name;
+
+  for (i = 0; i < G_N_ELEMENTS (dirs); i++)
+    {
+      path = g_build_filename (root, dirs[i], NULL);
+      g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+      g_free (path);
+      for (j = 0; j < 3; j++)
+        {
+          name = g_strdup_printf ("%s/%u.txt", dirs[i], j);
+          write_file (name, "x");
+          g_free (name);
+        }
+    }
+#ifdef G_OS_UNIX
+  /* listed, but not walked into */
+  path = g_build_filename (root, "infinity", "link", NULL);
+  g_assert_cmpint (symlink ("a", path), ==, 0);
+  g_free (path);
+  listed++;
+#endif
+
+  /* refused by default */
+  server = server_new ("root", root, NULL);
+  propfind_infinity (server, "/infinity", SOUP_STATUS_FORBIDDEN, NULL);
+  server_free (server);
+
+  /* the 4 collections, their 12 files and the link */
+  server = server_new ("root", root, "depth-infinity-limit", 100, NULL);
+  g_assert_cmpuint (propfind_infinity (server, "/infinity", SOUP_STATUS_MULTI_STATUS,
+                                       &truncated), ==, listed);
+  g_assert_false (truncated);
+  server_free (server);
+
+  /* the client is told where to go on from */
+  server = server_new ("root", root, "depth-infinity-limit", 5,
+                       "worker-threads", 2, NULL);
+  g_assert_cmpuint (propfind_infinity (server, "/infinity", SOUP_STATUS_MULTI_STATUS,
+                                       &truncated), <, listed);
+  g_assert_true (truncated);
+  server_free (server);
+}
+
+#ifdef G_OS_UNIX
+static void
+assert_contents (const gchar *name, const gchar *expected)
+{
+  gchar *path = g_build_filename (root, name, NULL);
+  GError *error = NULL;
+  gchar *contents;
+
+  g_file_get_contents (path, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (contents, ==, expected);
+  g_free (contents);
+  g_free (path);
+}
+
+static void
+test_put_links (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *real = g_build_filename (root, "put-real.txt", NULL);
+  gchar *symlink_path = g_build_filename (root, "put-link.txt", NULL);
+  gchar *hard = g_build_filename (root, "put-hard.txt", NULL);
+  guint status;
+
+  write_file ("put-real.txt", "old");
+  g_assert_cmpint (symlink ("put-real.txt", symlink_path), ==, 0);
+
+  /* the link is kept, the file it leads to replaced */
+  g_free (request (server, SOUP_METHOD_PUT, "/put-link.txt", NULL, NULL, "new", &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  g_assert_true (g_file_test (symlink_path, G_FILE_TEST_IS_SYMLINK));
+  assert_contents ("put-real.txt", "new");
+
+  /* both names see the new content */
+  g_assert_cmpint (link (real, hard), ==, 0);
+  g_free (request (server, SOUP_METHOD_PUT, "/put-hard.txt", NULL, NULL, "newer", &status));
+  g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+  assert_contents ("put-real.txt", "newer");
+  assert_contents ("put-hard.txt", "newer");
+
+  g_free (real);
+  g_free (symlink_path);
+  g_free (hard);
+  server_free (server);
+}
+
+static guint
+copy (Server *server, const gchar *path, const gchar *dest)
+{
+  gchar *uri = g_strconcat (server->uri, dest + 1, NULL);
+  guint status;
+
+  g_free (request (server, SOUP_METHOD_COPY, path, "Destination", uri, NULL, &status));
+  g_free (uri);
+
+  return status;
+}
+
+static void
+test_copy_links (void)
+{
+  Server *server = server_new ("root", root, "worker-threads", 4, NULL);
+  gchar *dir = g_build_filename (root, "copy-src", NULL);
+  gchar *loop = g_build_filename (root, "copy-src", "loop", NULL);
+  gchar *dest_link = g_build_filename (root, "copy-dest.txt", NULL);
+  gchar *copied_loop = g_build_filename (root, "copy-dst", "loop", NULL);
+
+  /* the link in the way is replaced, not written through */
+  write_file ("copy-file.txt", "copied");
+  write_file ("copy-target.txt", "keep");
+  g_assert_cmpint (symlink ("copy-target.txt", dest_link), ==, 0);
+  g_assert_cmpuint (copy (server, "/copy-file.txt", "/copy-dest.txt"), ==,
+                    SOUP_STATUS_NO_CONTENT);
+  g_assert_false (g_file_test (dest_link, G_FILE_TEST_IS_SYMLINK));
+  assert_contents ("copy-dest.txt", "copied");
+  assert_contents ("copy-target.txt", "keep");
+
+  /* a link back to the collection is copied as a link */
+  g_assert_cmpint (g_mkdir (dir, 0755), ==, 0);
+  write_file ("copy-src/a.txt", "a");
+  g_assert_cmpint (symlink (".", loop), ==, 0);
+  g_assert_cmpuint (copy (server, "/copy-src", "/copy-dst"), ==,
+                    SOUP_STATUS_CREATED);
+  assert_contents ("copy-dst/a.txt", "a");
+  g_assert_true (g_file_test (copied_loop, G_FILE_TEST_IS_SYMLINK));
+
+  g_free (dir);
+  g_free (loop);
+  g_free (dest_link);
+  g_free (copied_loop);
+  server_free (server);
+}
+
+/* a tree removed by the request alone and on the threads, without
+ * following the link out of it */
+static void
+test_delete_tree (void)
+{
+  gchar *outside = g_build_filename (root, "delete-outside", NULL);
+  gchar *dir = g_build_filename (root, "delete", NULL);
+  gchar *link = g_build_filename (root, "delete", "out", NULL);
+  gchar *name, *sub;
+  Server *server;
+  guint status;
+  gint threads, i, j;
+
+  g_assert_cmpint (g_mkdir (outside, 0755), ==, 0);
+  write_file ("delete-outside/keep.txt", "keep");
+
+  for (threads = 0; threads <= 4; threads += 4)
+    {
+      g_assert_cmpint (g_mkdir (dir, 0755), ==, 0);
+      for (i = 0; i < 4; i++)
+        {
+          sub = g_strdup_printf ("%s/d%d/x/y", dir, i);
+          g_assert_cmpint (g_mkdir_with_parents (sub, 0755), ==, 0);
+          g_free (sub);
+          for (j = 0; j < 10; j++)
+            {
+              name = g_strdup_printf ("delete/d%d/f%d.txt", i, j);
+              write_file (name, "f");
+              g_free (name);
+            }
+          name = g_strdup_printf ("delete/d%d/x/y/z.txt", i);
+          write_file (name, "z");
+          g_free (name);
+        }
+      g_assert_cmpint (symlink (outside, link), ==, 0);
+
+      server = server_new ("root", root, "worker-threads", threads, NULL);
+      g_free (request (server, SOUP_METHOD_DELETE, "/delete", NULL, NULL, NULL, &status));
+      g_assert_cmpuint (status, ==, SOUP_STATUS_NO_CONTENT);
+      g_assert_false (g_file_test (dir, G_FILE_TEST_EXISTS));
+      assert_contents ("delete-outside/keep.txt", "keep");
+      server_free (server);
+    }
+
+  g_free (outside);
+  g_free (dir);
+  g_free (link);
+}
+
+static guint
+move (Server *server, const gchar *path, const gchar *dest, const gchar *overwrite)
+{
+  SoupMessage *msg = message_new (server, SOUP_METHOD_MOVE, path, NULL);
+  SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
+  gchar *uri = g_strconcat (server->uri, dest + 1, NULL);
+  guint status;
+
+  soup_message_headers_append (headers, "Destination", uri);
+  soup_message_headers_append (headers, "Overwrite", overwrite);
+  g_free (send_message (msg));
+  status = soup_message_get_status (msg);
+  g_object_unref (msg);
+  g_free (uri);
+
+  return status;
+}
+
+/* renamed, also over an existing collection, which goes away */
+static void
+test_move_rename (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *src = g_build_filename (root, "move-src", NULL);
+  gchar *dst = g_build_filename (root, "move-dst", NULL);
+  gchar *old = g_build_filename (root, "move-dst", "old.txt", NULL);
+
+  g_assert_cmpint (g_mkdir (src, 0755), ==, 0);
+  write_file ("move-src/a.txt", "a");
+  g_assert_cmpint (g_mkdir (dst, 0755), ==, 0);
+  write_file ("move-dst/old.txt", "old");
+
+  g_assert_cmpuint (move (server, "/move-src", "/move-dst", "F"), ==,
+                    SOUP_STATUS_PRECONDITION_FAILED);
+  assert_contents ("move-src/a.txt", "a");
+  assert_contents ("move-dst/old.txt", "old");
+
+  g_assert_cmpuint (move (server, "/move-src", "/move-dst", "T"), ==,
+                    SOUP_STATUS_NO_CONTENT);
+  g_assert_false (g_file_test (src, G_FILE_TEST_EXISTS));
+  g_assert_false (g_file_test (old, G_FILE_TEST_EXISTS));
+  assert_contents ("move-dst/a.txt", "a");
+
+  /* and a file, to a new name */
+  g_assert_cmpuint (move (server, "/move-dst/a.txt", "/move-a.txt", "T"), ==,
+                    SOUP_STATUS_CREATED);
+  assert_contents ("move-a.txt", "a");
+
+  g_free (src);
+  g_free (dst);
+  g_free (old);
+  server_free (server);
+}
+
+#ifdef HAVE_RENAMEAT2
+/* what the swapped out collection leaves behind is reported */
+static void
+test_move_rename_partial (void)
+{
+  Server *server = server_new ("root", root, NULL);
+  gchar *keep = g_build_filename (root, "move-over-dst", "keep", NULL);
+  gchar *left = g_build_filename (root, "move-over-src", "keep", "k.txt", NULL);
+  gchar *src = g_build_filename (root, "move-over-src", NULL);
+  gchar *swapped;
+
+  g_assert_cmpint (g_mkdir_with_parents (keep, 0755), ==, 0);
+  write_file ("move-over-dst/keep/k.txt", "k");
+  write_file ("move-over-dst/old.txt", "old");
+  g_assert_cmpint (g_mkdir (src, 0755), ==, 0);
+  write_file ("move-over-src/a.txt", "a");
+
+  g_assert_cmpint (g_chmod (keep, 0555), ==, 0);
+  if (g_access (keep, W_OK) == 0)
+    {
+      g_test_skip ("the permissions do not apply");
+      goto end;
+    }
+
+  g_assert_cmpuint (move (server, "/move-over-src", "/move-over-dst", "T"), ==,
+                    SOUP_STATUS_MULTI_STATUS);
+  assert_contents ("move-over-dst/a.txt", "a");
+  g_assert_true (g_file_test (left, G_FILE_TEST_EXISTS));
+
+end:
+  /* the swapped out collection is now at the source */
+  swapped = g_path_get_dirname (left);
+  g_chmod (swapped, 0755);
+  g_chmod (keep, 0755);
+  g_free (swapped);
+  g_free (keep);
+  g_free (left);
+  g_free (src);
+  server_free (server);
+}
+#endif
+#endif
+
+int
+main (int argc, char *argv[])
+{
+  GError *error = NULL;
+  GFile *dir;
+  gint res;
+
+  g_test_init (&argc, &argv, NULL);
+
+  root = g_dir_make_tmp ("phodav-server-XXXXXX", &error);
+  g_assert_no_error (error);
+  session = soup_session_new ();
+
+  g_test_add_func ("/server/sync-collection", test_sync_collection);
+  g_test_add_func ("/server/info-cache", test_info_cache);
+  g_test_add_func ("/server/lock-expiry", test_lock_expiry);
+  g_test_add_func ("/server/search-like", test_search_like);
+  g_test_add_func ("/server/search-quota", test_search_quota);
+  g_test_add_func ("/server/store-log", test_store_log);
+  g_test_add_func ("/server/store-partial-delete", test_store_partial_delete);
+  g_test_add_func ("/server/proppatch-if", test_proppatch_if);
+  g_test_add_func ("/server/ranges", test_ranges);
+  g_test_add_func ("/server/compression", test_compression);
+  g_test_add_func ("/server/enumerate-batch", test_enumerate_batch);
+  g_test_add_func ("/server/put-tmp", test_put_tmp);
+  g_test_add_func ("/server/worker-threads", test_worker_threads);
+  g_test_add_func ("/server/put-large", test_put_large);
+  g_test_add_func ("/server/lock-tree", test_lock_tree);
+  g_test_add_func ("/server/move-locked", test_move_locked);
+  g_test_add_func ("/server/propfind-stream", test_propfind_stream);
+  g_test_add_func ("/server/propfind-select", test_propfind_select);
+  g_test_add_func ("/server/propfind-fragments", test_propfind_fragments);
+  g_test_add_func ("/server/propfind-arena", test_propfind_arena);
+  g_test_add_func ("/server/peer", test_peer);
+  g_test_add_func ("/server/metrics", test_metrics);
+  g_test_add_func ("/server/get-sendfile", test_get_sendfile);
+  g_test_add_func ("/server/get-listing", test_get_listing);
+  g_test_add_func ("/server/quota-used", test_quota_used);
+  g_test_add_func ("/server/depth-infinity", test_depth_infinity);
+#ifdef G_OS_UNIX
+  g_test_add_func ("/server/put-links", test_put_links);
+  g_test_add_func ("/server/copy-links", test_copy_links);
+  g_test_add_func ("/server/delete-tree", test_delete_tree);
+  g_test_add_func ("/server/move-rename", test_move_rename);
+#ifdef HAVE_RENAMEAT2
+  g_test_add_func ("/server/move-rename-partial", test_move_rename_partial);
+#endif
+#endif
+
+  res = g_test_run ();
+
+  g_object_unref (session);
+  dir = g_file_new_for_path (root);
+  delete_file_recursive (dir);
+  g_object_unref (dir);
+  g_free (root);
+  return res;
+}
@@ -96,6 +96,10 @@ main (int argc, char *argv[])
   phodav_virtual_dir_root_set_real (root, "./phodav-virtual-root");
   PhodavVirtualDir *virtual_dir = phodav_virtual_dir_new_dir (root, "/virtual", NULL);
   phodav_virtual_dir_attach_real_child (virtual_dir, real_dir);
+  /* listed in this order, which is not the one of their names */
+  const gchar *children[] = { "/virtual/zeta", "/virtual/alpha", "/virtual/mid" };
+  for (guint i = 0; i < G_N_ELEMENTS (children); i++)
+    g_object_unref (phodav_virtual_dir_new_dir (root, children[i], NULL));
 
   PhodavServer *phodav = phodav_server_new_for_root_file (G_FILE(root));
 
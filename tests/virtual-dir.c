@@ -30,6 +30,9 @@ typedef struct _TestCase {
   const gchar *path;
   guint        status_code;
   const gchar *destination;
+  const gchar *header_name;
+  const gchar *header_value;
+  const gchar *body;
 } TestCase;
 
 static void
@@ -47,6 +50,10 @@ test_generic (gconstpointer data)
       g_free (dest_uri);
     }
 
+  if (test->header_name)
+    soup_message_headers_append (soup_message_get_request_headers (msg),
+                                 test->header_name, test->header_value);
+
   if (test->method == SOUP_METHOD_PUT)
     {
       GBytes *bytes;
@@ -55,6 +62,14 @@ test_generic (gconstpointer data)
       soup_message_set_request_body_from_bytes (msg, NULL, bytes);
       g_bytes_unref (bytes);
     }
+  else if (test->body)
+    {
+      GBytes *bytes;
+
+      bytes = g_bytes_new_static (test->body, strlen (test->body));
+      soup_message_set_request_body_from_bytes (msg, "application/xml", bytes);
+      g_bytes_unref (bytes);
+    }
 
   GError *error = NULL;
   GInputStream *in = soup_session_send (session, msg, NULL, &error);
@@ -66,6 +81,45 @@ test_generic (gconstpointer data)
   g_object_unref (msg);
 }
 
+/* the children of a virtual dir are listed in the order they were added */
+static void
+test_children_order (void)
+{
+  const gchar *children[] = { "/virtual/real", "/virtual/zeta",
+                              "/virtual/alpha", "/virtual/mid" };
+  gchar *uri = g_build_path ("/", SERVER_URI, "/virtual", NULL);
+  SoupMessage *msg = soup_message_new ("PROPFIND", uri);
+  GError *error = NULL;
+  const gchar *text, *pos;
+  GBytes *body;
+  guint i;
+
+  g_free (uri);
+  soup_message_headers_append (soup_message_get_request_headers (msg), "Depth", "1");
+  body = soup_session_send_and_read (session, msg, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (soup_message_get_status (msg), ==, SOUP_STATUS_MULTI_STATUS);
+
+  text = g_bytes_get_data (body, NULL);
+  pos = text;
+  for (i = 0; i < G_N_ELEMENTS (children); i++)
+    {
+      pos = g_strstr_len (pos, g_bytes_get_size (body) - (pos - text), children[i]);
+      g_assert_nonnull (pos);
+    }
+
+  g_bytes_unref (body);
+  g_object_unref (msg);
+}
+
+#define SEARCH_BODY(Href, Depth)                                        \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"                      \
+  "<D:searchrequest xmlns:D=\"DAV:\"><D:basicsearch>"                 \
+  "<D:select><D:prop><D:displayname/></D:prop></D:select>"              \
+  "<D:from><D:scope><D:href>" Href "</D:href>"                          \
+  "<D:depth>" Depth "</D:depth></D:scope></D:from>"                     \
+  "</D:basicsearch></D:searchrequest>"
+
 static gchar *
 replace_char_dup (const gchar *str, gchar old, gchar new)
 {
@@ -93,6 +147,14 @@ get_test_path (const TestCase *test)
       g_free (test_path);
       test_path = tmp;
     }
+  if (test->header_name)
+    {
+      gchar *value = replace_char_dup (test->header_value, '/', '\\');
+      gchar *tmp = g_strconcat (test_path, "[", test->header_name, ": ", value, "]", NULL);
+      g_free (value);
+      g_free (test_path);
+      test_path = tmp;
+    }
   return test_path;
 }
 
@@ -145,6 +207,16 @@ main (int argc, char *argv[])
     {SOUP_METHOD_GET, "/non-existent", SOUP_STATUS_NOT_FOUND},
     {SOUP_METHOD_GET, "/virtual/non-existent", SOUP_STATUS_NOT_FOUND},
     {SOUP_METHOD_GET, "/virtual/real", SOUP_STATUS_OK},
+    {SOUP_METHOD_GET, "/virtual/alpha", SOUP_STATUS_OK},
+    {SOUP_METHOD_GET, "/virtual/mid/non-existent", SOUP_STATUS_NOT_FOUND},
+    {SOUP_METHOD_GET, "/test.txt", SOUP_STATUS_PARTIAL_CONTENT, NULL, "Range", "bytes=0-3"},
+    {SOUP_METHOD_GET, "/test.txt", SOUP_STATUS_PARTIAL_CONTENT, NULL, "Range", "bytes=0-1,5-"},
+    {SOUP_METHOD_GET, "/test.txt", SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL,
+     "Range", "bytes=100-"},
+    /* a date in the future is invalid, and ignored */
+    {SOUP_METHOD_GET, "/test.txt", SOUP_STATUS_OK, NULL,
+     "If-Modified-Since", "Fri, 01 Jan 2100 00:00:00 GMT"},
+    {SOUP_METHOD_GET, "/test.txt", SOUP_STATUS_OK, NULL, "If-None-Match", "\"other\""},
 
     {SOUP_METHOD_MKCOL, "/A", SOUP_STATUS_CREATED},
     {SOUP_METHOD_MKCOL, "/virtual/B", SOUP_STATUS_FORBIDDEN},
@@ -158,6 +230,28 @@ main (int argc, char *argv[])
     {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_CREATED},
     {SOUP_METHOD_PUT, "/virtual/test-put.txt", SOUP_STATUS_INTERNAL_SERVER_ERROR},
     {SOUP_METHOD_PUT, "/virtual/real/test-put.txt", SOUP_STATUS_CREATED},
+    {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_NO_CONTENT, NULL,
+     "Content-Range", "bytes 4-22/*"},
+    {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE, NULL,
+     "Content-Range", "bytes 100-118/*"},
+    {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_BAD_REQUEST, NULL,
+     "Content-Range", "bytes 0-3/*"},
+    {SOUP_METHOD_PUT, "/non-existent.txt", SOUP_STATUS_NOT_FOUND, NULL,
+     "Content-Range", "bytes 0-18/*"},
+    {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_PRECONDITION_FAILED, NULL,
+     "If-None-Match", "*"},
+    {SOUP_METHOD_PUT, "/test-put.txt", SOUP_STATUS_PRECONDITION_FAILED, NULL,
+     "If-Match", "\"other\""},
+
+    {"SEARCH", "/virtual/real", SOUP_STATUS_MULTI_STATUS, NULL, NULL, NULL,
+     SEARCH_BODY ("/virtual/real", "1")},
+    /* the dot segments are only found once unescaped */
+    {"SEARCH", "/", SOUP_STATUS_BAD_REQUEST, NULL, NULL, NULL,
+     SEARCH_BODY ("/%2e%2e/%2e%2e/%2e%2e/etc", "1")},
+    {"SEARCH", "/virtual", SOUP_STATUS_BAD_REQUEST, NULL, NULL, NULL,
+     SEARCH_BODY ("/virtual/real/%2E%2E/%2e%2E/%2e%2e", "0")},
+    {"SEARCH", "/test.txt", SOUP_STATUS_FORBIDDEN, NULL, NULL, NULL,
+     SEARCH_BODY ("/", "infinity")},
 
     {SOUP_METHOD_DELETE, "/A", SOUP_STATUS_NO_CONTENT},
     {SOUP_METHOD_DELETE, "/virtual/real/B", SOUP_STATUS_NO_CONTENT},
@@ -171,6 +265,8 @@ main (int argc, char *argv[])
       g_free (test_path);
     }
 
+  g_test_add_func ("/PROPFIND/virtual[children order]", test_children_order);
+
   gint res = g_test_run ();
   g_object_unref (session);
   g_object_unref (server_subproc);